@@ -45,6 +45,12 @@ foreach ($Arch in ("x86", "x64", "arm64")) {
     & $MSBuild $SolutionFile /nologo /property:Configuration=Release /property:Platform=$Arch
 }
 
+# Check that the committed layout sources are generated from their descriptions.
+& "$PSScriptRoot\tools\kbdcompile-test\check.ps1" -NoBuild -NoPause
+if ($LASTEXITCODE -ne 0) {
+    Exit-Script "layout sources are not up to date with their descriptions"
+}
+
 # Build archive binaries.
 $Archive = "$PSScriptRoot\$ProjectName.zip"
 Write-Output "Archive: $Archive"
@@ -3,7 +3,7 @@
 [CmdletBinding(SupportsShouldProcess=$true)]
 param([switch]$NoPause = $false)
 
-$CleanupFiles = @("arm64", "x64", "x86", "Win32", "Debug", "Release", ".vs", "*.vcxproj.user", "*.aps", "*.zip", "*.log", "kbdtest.c", "*.tmp", "tmp")
+$CleanupFiles = @("arm64", "x64", "x86", "Win32", "Debug", "Release", ".vs", "*.vcxproj.user", "*.aps", "*.zip", "*.log", "kbdtest.c", "*.tmp", "tmp", "seeds", "corpus", "crash-*")
 
 Get-ChildItem $PSScriptRoot -Recurse -Include $CleanupFiles -Force | Remove-Item -Recurse -Force
 
@@ -0,0 +1,213 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Semantic fingerprint of a keyboard layout.
+//
+//----------------------------------------------------------------------------
+
+#include "fingerprint.h"
+#include "stats.h"
+
+// FNV-1a 64-bit parameters.
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME        0x00000100000001B3ULL
+
+
+//----------------------------------------------------------------------------
+// Build binary records: little-endian integers, length-prefixed strings.
+//----------------------------------------------------------------------------
+
+namespace {
+    class Record : public std::string
+    {
+    public:
+        Record& u8(uint32_t value)
+        {
+            push_back(char(value & 0xFF));
+            return *this;
+        }
+        Record& u16(uint32_t value)
+        {
+            return u8(value).u8(value >> 8);
+        }
+        Record& u32(uint32_t value)
+        {
+            return u16(value).u16(value >> 16);
+        }
+        Record& str(const wchar_t* s, size_t len)
+        {
+            u16(uint32_t(len));
+            for (size_t i = 0; i < len; ++i) {
+                u16(s[i]);
+            }
+            return *this;
+        }
+        Record& str(const wchar_t* s)
+        {
+            return str(s, s == nullptr ? 0 : std::wcslen(s));
+        }
+    };
+}
+
+
+//----------------------------------------------------------------------------
+// Constructor and accessors.
+//----------------------------------------------------------------------------
+
+LayoutFingerprint::LayoutFingerprint() :
+    _canonical(),
+    _hash(0)
+{
+}
+
+WString LayoutFingerprint::toString() const
+{
+    return Format(L"%016llX", _hash);
+}
+
+void LayoutFingerprint::addSection(char tag, Section& records)
+{
+    // The order of the records in the original tables is not significant.
+    std::sort(records.begin(), records.end());
+    Record header;
+    header.u8(uint8_t(tag)).u32(uint32_t(records.size()));
+    _canonical.append(header);
+    for (const auto& rec : records) {
+        Record size;
+        size.u16(uint32_t(rec.size()));
+        _canonical.append(size);
+        _canonical.append(rec);
+    }
+    records.clear();
+}
+
+
+//----------------------------------------------------------------------------
+// Compute the fingerprint of a keyboard layout.
+//----------------------------------------------------------------------------
+
+void LayoutFingerprint::build(const KBDTABLES& tables)
+{
+    Stats::Timer timer("fingerprint");
+
+    _canonical.clear();
+    Section section;
+
+    // General characteristics. The version in the high word of fLocaleFlags
+    // only defines which fields are present in the structure.
+    section.push_back(Record().u32(tables.dwType).u32(tables.dwSubType).u16(LOWORD(tables.fLocaleFlags)));
+    addSection('L', section);
+
+    // Modifiers: virtual keys to modifier bits. For each shift state, its column in VK_TO_WCHARS.
+    // The column numbers are not semantic, only the list of valid shift states is kept.
+    std::vector<size_t> columns;
+    const MODIFIERS* mods = tables.pCharModifiers;
+    if (mods != nullptr) {
+        for (const VK_TO_BIT* vb = mods->pVkToBit; vb != nullptr && vb->Vk != 0; ++vb) {
+            section.push_back(Record().u8(vb->Vk).u8(vb->ModBits));
+        }
+        addSection('M', section);
+        for (size_t bits = 0; bits <= mods->wMaxModBits; ++bits) {
+            columns.push_back(mods->ModNumber[bits]);
+        }
+    }
+
+    // Scan codes to virtual keys.
+    for (size_t sc = 0; tables.pusVSCtoVK != nullptr && sc < tables.bMaxVSCtoVK; ++sc) {
+        if ((tables.pusVSCtoVK[sc] & 0xFF) != VK__none_) {
+            section.push_back(Record().u8(0).u8(uint32_t(sc)).u16(tables.pusVSCtoVK[sc]));
+        }
+    }
+    for (const VSC_VK* p = tables.pVSCtoVK_E0; p != nullptr && p->Vsc != 0; ++p) {
+        section.push_back(Record().u8(0xE0).u8(p->Vsc).u16(p->Vk));
+    }
+    for (const VSC_VK* p = tables.pVSCtoVK_E1; p != nullptr && p->Vsc != 0; ++p) {
+        section.push_back(Record().u8(0xE1).u8(p->Vsc).u16(p->Vk));
+    }
+    addSection('S', section);
+
+    // Characters of virtual keys, per shift state. Only the first entry of a virtual key is used,
+    // as in the system. The entry after an SGCAPS key is its CapsLock row, whatever its virtual
+    // key. Otherwise, a VK__none_ entry after the key contains its dead characters. A flag tells
+    // if the record contains the CapsLock characters.
+    std::set<uint16_t> keys;
+    for (const VK_TO_WCHAR_TABLE* vtwt = tables.pVkToWcharTable; vtwt != nullptr && vtwt->pVkToWchars != nullptr; ++vtwt) {
+        const size_t count = vtwt->nModifications;
+        const size_t size = vtwt->cbSize;
+        const VK_TO_WCHARS10* vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(vtwt->pVkToWchars);
+        while (vtwc->VirtualKey != 0) {
+            const VK_TO_WCHARS10* next = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + size);
+            if (vtwc->VirtualKey != VK__none_ && keys.insert(vtwc->VirtualKey).second) {
+                const bool sgcaps = (vtwc->Attributes & SGCAPS) != 0 && next->VirtualKey != 0;
+                const VK_TO_WCHARS10* dead = !sgcaps && next->VirtualKey == VK__none_ ? next : nullptr;
+                Record rec;
+                rec.u8(vtwc->VirtualKey).u8(vtwc->Attributes).u8(sgcaps ? 1 : 0);
+                for (size_t bits = 0; bits < columns.size(); ++bits) {
+                    const size_t col = columns[bits];
+                    const wchar_t wc = col < count ? vtwc->wch[col] : WCH_NONE;
+                    if (wc != 0 && wc != WCH_NONE) {
+                        rec.u8(uint32_t(bits)).u16(wc);
+                        if (wc == WCH_DEAD) {
+                            rec.u16(dead != nullptr ? dead->wch[col] : 0);
+                        }
+                        if (sgcaps) {
+                            rec.u16(next->wch[col]);
+                        }
+                    }
+                }
+                section.push_back(rec);
+            }
+            vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + size);
+        }
+    }
+    addSection('K', section);
+
+    // Dead keys. Only the first entry of a combination is used, as in the system.
+    // With unique combinations, the order of the entries is not significant.
+    std::set<DWORD> combinations;
+    for (const DEADKEY* dk = tables.pDeadKey; dk != nullptr && dk->dwBoth != 0; ++dk) {
+        if (combinations.insert(dk->dwBoth).second) {
+            section.push_back(Record().u32(dk->dwBoth).u16(dk->wchComposed).u16(dk->uFlags));
+        }
+    }
+    addSection('D', section);
+
+    // Ligatures, for each shift state which uses the column.
+    const LIGATURE1* lig = tables.pLigature;
+    while (lig != nullptr && tables.cbLgEntry > 0 && lig->VirtualKey != 0) {
+        size_t len = 0;
+        while (len < size_t(tables.nLgMax) && lig->wch[len] != WCH_NONE) {
+            ++len;
+        }
+        for (size_t bits = 0; bits < columns.size(); ++bits) {
+            if (columns[bits] == lig->ModificationNumber) {
+                section.push_back(Record().u8(lig->VirtualKey).u8(uint32_t(bits)).str(lig->wch, len));
+            }
+        }
+        lig = reinterpret_cast<const LIGATURE1*>(reinterpret_cast<const char*>(lig) + tables.cbLgEntry);
+    }
+    addSection('G', section);
+
+    // Key names and dead key names.
+    for (const VSC_LPWSTR* names = tables.pKeyNames; names != nullptr && names->vsc != 0; ++names) {
+        section.push_back(Record().u8(0).u8(names->vsc).str(names->pwsz));
+    }
+    for (const VSC_LPWSTR* names = tables.pKeyNamesExt; names != nullptr && names->vsc != 0; ++names) {
+        section.push_back(Record().u8(0xE0).u8(names->vsc).str(names->pwsz));
+    }
+    addSection('N', section);
+    for (const DEADKEY_LPWSTR* names = tables.pKeyNamesDead; names != nullptr && *names != nullptr; ++names) {
+        section.push_back(Record().str(*names));
+    }
+    addSection('A', section);
+
+    // Hash the canonical description.
+    _hash = FNV_OFFSET_BASIS;
+    for (char c : _canonical) {
+        _hash = (_hash ^ uint8_t(c)) * FNV_PRIME;
+    }
+    Stats::Instance().count("fingerprint bytes", _canonical.size());
+}
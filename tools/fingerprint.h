@@ -0,0 +1,50 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Semantic fingerprint of a keyboard layout.
+//
+// The fingerprint is computed from a canonical description of the layout,
+// not from its binary image. Everything which depends on the compiler, the
+// CPU architecture or the order of the tables is ignored: addresses, table
+// order, entry sizes, column numbers of shift states. Two layouts with the
+// same scan codes, virtual keys, modifiers, characters per shift state,
+// dead keys, ligatures and key names have the same canonical description.
+//
+// The hash is a 64-bit FNV-1a of the canonical description. To avoid any
+// false match, layouts with the same hash can be compared using equal().
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "strutils.h"
+
+class LayoutFingerprint
+{
+public:
+    // Constructor.
+    LayoutFingerprint();
+
+    // Compute the fingerprint of a keyboard layout.
+    void build(const KBDTABLES&);
+
+    // Get the hash value and its hexadecimal representation.
+    uint64_t hash() const { return _hash; }
+    WString toString() const;
+
+    // Check if two fingerprints describe identical layouts.
+    bool equal(const LayoutFingerprint& other) const { return _hash == other._hash && _canonical == other._canonical; }
+
+    // Get the canonical description (binary data, for debug).
+    const std::string& canonical() const { return _canonical; }
+
+private:
+    std::string _canonical;
+    uint64_t    _hash;
+
+    // A section of the canonical description: sorted list of binary records.
+    typedef std::vector<std::string> Section;
+    void addSection(char tag, Section& records);
+};
@@ -0,0 +1,221 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Memory footprint of the tables of a keyboard layout.
+//
+//----------------------------------------------------------------------------
+
+#include "footprint.h"
+#include "stats.h"
+
+const WString LayoutFootprint::PADDING(L"Padding");
+const WString LayoutFootprint::UNREFERENCED(L"Unreferenced");
+
+// Virtual key of the typical keystroke.
+#define TYPICAL_VK 'A'
+
+
+//----------------------------------------------------------------------------
+// Constructor and accumulation.
+//----------------------------------------------------------------------------
+
+LayoutFootprint::LayoutFootprint() :
+    structures(),
+    types(),
+    total(0),
+    pages(0),
+    keystroke_pages(0),
+    strings(0),
+    duplicates(0),
+    duplicate_bytes(0)
+{
+}
+
+void LayoutFootprint::merge(const LayoutFootprint& other)
+{
+    for (const auto& it : other.types) {
+        types[it.first] += it.second;
+    }
+    total += other.total;
+    pages += other.pages;
+    keystroke_pages += other.keystroke_pages;
+    strings += other.strings;
+    duplicates += other.duplicates;
+    duplicate_bytes += other.duplicate_bytes;
+}
+
+void LayoutFootprint::add(const WString& type, const void* address, const void* end)
+{
+    structures.push_back(DataStructure(type, address, end));
+}
+
+void LayoutFootprint::addString(const wchar_t* str, std::set<WString>& values, std::set<const wchar_t*>& addresses)
+{
+    // The same string may be referenced twice, this is not a duplicate.
+    if (str != nullptr && addresses.insert(str).second) {
+        const size_t size = WStringSize(str);
+        structures.push_back(DataStructure(L"Strings", str, size));
+        strings++;
+        if (!values.insert(WString(str)).second) {
+            duplicates++;
+            duplicate_bytes += size;
+        }
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Analyze the tables of a keyboard layout.
+//----------------------------------------------------------------------------
+
+void LayoutFootprint::build(const KBDTABLES& tables, size_t page_size)
+{
+    Stats::Timer timer("footprint");
+
+    structures.clear();
+    types.clear();
+    total = pages = keystroke_pages = strings = duplicates = duplicate_bytes = 0;
+
+    if (page_size == 0) {
+        SYSTEM_INFO sysinfo;
+        GetSystemInfo(&sysinfo);
+        page_size = size_t(sysinfo.dwPageSize);
+    }
+
+    // Memory ranges which are read for a typical keystroke.
+    std::list<DataStructure> keystroke;
+    keystroke.push_back(DataStructure(L"", &tables, sizeof(tables)));
+
+    add(L"KBDTABLES", &tables, &tables + 1);
+
+    if (tables.pCharModifiers != nullptr) {
+        const MODIFIERS& mods(*tables.pCharModifiers);
+        add(L"MODIFIERS", &mods, &mods.ModNumber[0] + mods.wMaxModBits + 1);
+        keystroke.push_back(structures.back());
+        const VK_TO_BIT* vtb = mods.pVkToBit;
+        if (vtb != nullptr) {
+            while (vtb->Vk != 0) {
+                vtb++;
+            }
+            add(L"VK_TO_BIT", mods.pVkToBit, vtb + 1);
+            keystroke.push_back(structures.back());
+        }
+    }
+
+    // Scan code tables, only one entry is read per keystroke.
+    if (tables.pusVSCtoVK != nullptr) {
+        add(L"Scan codes", tables.pusVSCtoVK, tables.pusVSCtoVK + tables.bMaxVSCtoVK);
+        for (size_t sc = 0; sc < tables.bMaxVSCtoVK; ++sc) {
+            if ((tables.pusVSCtoVK[sc] & 0xFF) == TYPICAL_VK) {
+                keystroke.push_back(DataStructure(L"", tables.pusVSCtoVK + sc, sizeof(USHORT)));
+                break;
+            }
+        }
+    }
+    for (const VSC_VK* table : {tables.pVSCtoVK_E0, tables.pVSCtoVK_E1}) {
+        if (table != nullptr) {
+            const VSC_VK* p = table;
+            while (p->Vsc != 0) {
+                p++;
+            }
+            add(L"Scan codes", table, p + 1);
+            if (table == tables.pVSCtoVK_E0) {
+                keystroke.push_back(structures.back());
+            }
+        }
+    }
+
+    // Characters. For a keystroke, the tables are searched in sequence until the virtual key is found.
+    // The entry after the key is also read: dead characters or CapsLock row of SGCAPS keys.
+    if (tables.pVkToWcharTable != nullptr) {
+        bool found = false;
+        const VK_TO_WCHAR_TABLE* vtwt = tables.pVkToWcharTable;
+        for (; vtwt->pVkToWchars != nullptr; vtwt++) {
+            const size_t size = vtwt->cbSize;
+            const uint8_t* const start = reinterpret_cast<const uint8_t*>(vtwt->pVkToWchars);
+            const uint8_t* entry = start;
+            while (reinterpret_cast<const VK_TO_WCHARS1*>(entry)->VirtualKey != 0) {
+                if (!found && reinterpret_cast<const VK_TO_WCHARS1*>(entry)->VirtualKey == TYPICAL_VK) {
+                    found = true;
+                    keystroke.push_back(DataStructure(L"", start, entry + 2 * size));
+                    keystroke.push_back(DataStructure(L"", tables.pVkToWcharTable, vtwt + 1));
+                }
+                entry += size;
+            }
+            add(L"VK_TO_WCHARS", start, entry + size);
+            if (!found) {
+                keystroke.push_back(structures.back());
+            }
+        }
+        add(L"VK_TO_WCHAR_TABLE", tables.pVkToWcharTable, vtwt + 1);
+        if (!found) {
+            keystroke.push_back(structures.back());
+        }
+    }
+
+    if (tables.pDeadKey != nullptr) {
+        const DEADKEY* dk = tables.pDeadKey;
+        while (dk->dwBoth != 0) {
+            dk++;
+        }
+        add(L"DEADKEY", tables.pDeadKey, dk + 1);
+    }
+
+    if (tables.pLigature != nullptr && tables.cbLgEntry > 0) {
+        const uint8_t* lg = reinterpret_cast<const uint8_t*>(tables.pLigature);
+        while (reinterpret_cast<const LIGATURE1*>(lg)->VirtualKey != 0) {
+            lg += tables.cbLgEntry;
+        }
+        add(L"LIGATURE", tables.pLigature, lg + tables.cbLgEntry);
+    }
+
+    // Key names and their strings.
+    std::set<WString> values;
+    std::set<const wchar_t*> addresses;
+    for (const VSC_LPWSTR* table : {tables.pKeyNames, tables.pKeyNamesExt}) {
+        if (table != nullptr) {
+            const VSC_LPWSTR* p = table;
+            for (; p->vsc != 0; p++) {
+                addString(p->pwsz, values, addresses);
+            }
+            add(L"VSC_LPWSTR", table, p + 1);
+        }
+    }
+    if (tables.pKeyNamesDead != nullptr) {
+        const DEADKEY_LPWSTR* p = tables.pKeyNamesDead;
+        for (; *p != nullptr; p++) {
+            addString(*p, values, addresses);
+        }
+        add(L"DEADKEY_LPWSTR", tables.pKeyNamesDead, p + 1);
+    }
+
+    // Sort, merge and find the space between structures.
+    SortDataStructures(structures);
+    for (const auto& ds : structures) {
+        types[ds.name] += ds.size;
+    }
+
+    // Count the memory pages.
+    if (!structures.empty()) {
+        const uintptr_t first = uintptr_t(structures.front().address);
+        const uintptr_t last = uintptr_t(structures.back().end());
+        total = last - first;
+        std::set<uintptr_t> all_pages;
+        for (const auto& ds : structures) {
+            for (uintptr_t page = uintptr_t(ds.address) / page_size; ds.size > 0 && page <= (uintptr_t(ds.end()) - 1) / page_size; ++page) {
+                all_pages.insert(page);
+            }
+        }
+        pages = all_pages.size();
+    }
+    std::set<uintptr_t> read_pages;
+    for (const auto& ds : keystroke) {
+        for (uintptr_t page = uintptr_t(ds.address) / page_size; ds.size > 0 && page <= (uintptr_t(ds.end()) - 1) / page_size; ++page) {
+            read_pages.insert(page);
+        }
+    }
+    keystroke_pages = read_pages.size();
+}
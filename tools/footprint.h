@@ -0,0 +1,59 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Memory footprint of the tables of a keyboard layout.
+//
+// All data structures which are referenced from the KBDTABLES are listed
+// by type, as in the hexa dump of the generated source files. The space
+// between them is either padding (zeroes) or unreferenced data.
+//
+// The keystroke pages are the memory pages which the system reads to
+// translate a typical keystroke, the letter A: the main structure, the
+// scan code entry, the E0 scan code table (AltGr and the other extended
+// keys), the modifiers and the VK_TO_WCHARS tables up to the entry of the
+// virtual key, plus the following entry, which is read for dead keys and
+// SGCAPS. These pages are resident in each session where the layout is
+// used for typing.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "sourcegen.h"
+
+class LayoutFootprint
+{
+public:
+    // Constructor.
+    LayoutFootprint();
+
+    // Analyze the tables of a keyboard layout. When the page size is zero, use the system page size.
+    void build(const KBDTABLES& tables, size_t page_size = 0);
+
+    // Add the sizes of another instance. The list of structures is not merged.
+    // The pages are summed per layout: a page which is shared by several
+    // layouts is counted once per layout, the total is an upper bound.
+    void merge(const LayoutFootprint& other);
+
+    // Names of the special types of data.
+    static const WString PADDING;
+    static const WString UNREFERENCED;
+
+    std::list<DataStructure>  structures;       // Sorted data structures, named by type.
+    std::map<WString, size_t> types;            // Size in bytes per type.
+    size_t                    total;            // Bytes from start of first structure to end of last one.
+    size_t                    pages;            // Memory pages containing data structures.
+    size_t                    keystroke_pages;  // Memory pages which are read for a typical keystroke.
+    size_t                    strings;          // Number of strings (key names).
+    size_t                    duplicates;       // Number of strings which are identical to a previous one.
+    size_t                    duplicate_bytes;  // Size of the duplicated strings.
+
+private:
+    // Add a data structure, without padding at end.
+    void add(const WString& type, const void* address, const void* end);
+
+    // Add a string and check if it is duplicated.
+    void addString(const wchar_t* str, std::set<WString>& values, std::set<const wchar_t*>& addresses);
+};
@@ -16,7 +16,8 @@
 // Constructor.
 //----------------------------------------------------------------------------
 
-Grid::Grid(const WString& margin, const WString& spacing) :
+Grid::Grid(const WString& margin, const WString& spacing, std::pmr::memory_resource* upstream) :
+    _arena(ARENA_SIZE, upstream != nullptr ? upstream : std::pmr::get_default_resource()),
     _lines(),
     _margin(margin),
     _spacing(spacing)
@@ -25,15 +26,56 @@ Grid::Grid(const WString& margin, const WString& spacing) :
 
 
 //----------------------------------------------------------------------------
-// Add one column on last line.
+// Destroy all rows, then release the memory of the arena.
 //----------------------------------------------------------------------------
 
-void Grid::addColumn(const WString& text)
+void Grid::reset()
+{
+    _lines.clear();
+    _arena.release();
+}
+
+
+//----------------------------------------------------------------------------
+// Add one line or one column on last line.
+//----------------------------------------------------------------------------
+
+void Grid::addLine(const Line& line)
+{
+    Row& row(_lines.emplace_back(&_arena));
+    row.reserve(line.size());
+    for (const auto& text : line) {
+        row.emplace_back(text.data(), text.size());
+    }
+}
+
+void Grid::addColumn(const wchar_t* text, size_t size)
 {
     if (_lines.empty()) {
-        _lines.push_back(Line());
+        _lines.emplace_back(&_arena);
+    }
+    _lines.back().emplace_back(text, size);
+}
+
+
+//----------------------------------------------------------------------------
+// Remove leading and trailing spaces in a cell.
+//----------------------------------------------------------------------------
+
+namespace {
+    void TrimCell(std::pmr::wstring& cell)
+    {
+        size_t end = cell.size();
+        while (end > 0 && std::isspace(cell[end - 1])) {
+            end--;
+        }
+        size_t start = 0;
+        while (start < end && std::isspace(cell[start])) {
+            start++;
+        }
+        cell.erase(end);
+        cell.erase(0, start);
     }
-    _lines.back().push_back(text);
 }
 
 
@@ -44,12 +86,13 @@ void Grid::addColumn(const WString& text)
 void Grid::addUnderlines(const Line& first_colums, wchar_t underline)
 {
     if (!_lines.empty()) {
-        const Line& prev(_lines.back());
-        Line next(first_colums);
-        while (next.size() < prev.size()) {
-            next.push_back(WString(prev[next.size()].length(), underline));
+        const size_t prev_size = _lines.back().size();
+        addLine(first_colums);
+        const Row& prev(*std::prev(_lines.end(), 2));
+        Row& next(_lines.back());
+        while (next.size() < prev_size) {
+            next.emplace_back(prev[next.size()].length(), underline);
         }
-        _lines.push_back(next);
     }
 }
 
@@ -62,8 +105,8 @@ void Grid::removeEmptyLines(size_t header_columns_count, bool trim)
 {
     for (auto it = _lines.begin(); it != _lines.end(); ) {
         if (trim) {
-            for (WString& cell : *it) {
-                Trim(cell);
+            for (Cell& cell : *it) {
+                TrimCell(cell);
             }
         }
         bool remove = true;
@@ -92,8 +135,8 @@ void Grid::removeEmptyColumns(size_t header_lines_count, bool trim)
         bool remove = true;
         size_t line_index = 0;
         for (auto& line : _lines) {
-            for (WString& cell : line) {
-                Trim(cell);
+            for (Cell& cell : line) {
+                TrimCell(cell);
             }
             if (line_index++ >= header_lines_count && col < line.size() && remove) {
                 more_col = true;
@@ -106,7 +149,7 @@ void Grid::removeEmptyColumns(size_t header_lines_count, bool trim)
             for (auto& line : _lines) {
                 if (col < line.size()) {
                     // line.erase(line.begin() + col) does not compile with VS 17.5.5 ????
-                    Line::iterator it(line.begin());
+                    Row::iterator it(line.begin());
                     std::advance(it, col);
                     line.erase(it);
                 }
@@ -140,15 +183,20 @@ void Grid::print(std::ostream& out)
         }
     }
 
-    // Then print the grid.
+    // Then print the grid, one line at a time in the same buffer.
+    std::string line;
     for (const auto& row : _lines) {
-        out << _margin;
+        line.clear();
+        AppendUTF8(line, _margin.data(), _margin.size());
         for (size_t i = 0; i < row.size(); ++i) {
-            out << row[i];
+            AppendUTF8(line, row[i].data(), row[i].size());
             if (i < row.size() - 1) {
-                out << std::string(widths[i] - row[i].length(), ' ') << _spacing;
+                line.append(widths[i] - row[i].length(), ' ');
+                AppendUTF8(line, _spacing.data(), _spacing.size());
             }
         }
-        out << std::endl;
+        line.push_back('\n');
+        out.write(line.data(), line.size());
     }
+    out.flush();
 }
@@ -6,10 +6,15 @@
 //
 // Display a grid of row / columns.
 //
+// All cells are allocated in a monotonic arena which is freed when the grid
+// is destroyed. Large grids, such as the tables of a generated source file,
+// do not make one heap allocation per cell.
+//
 //----------------------------------------------------------------------------
 
 #pragma once
 #include "strutils.h"
+#include <memory_resource>
 
 class Grid
 {
@@ -17,17 +22,26 @@ public:
     // A line in the grid.
     typedef WStringVector Line;
 
-    // Constructor.
-    Grid(const WString& margin = L"", const WString& spacing = L" ");
+    // Constructor. The arena of cells is allocated from the specified
+    // memory resource, the default heap when null.
+    Grid(const WString& margin = L"", const WString& spacing = L" ", std::pmr::memory_resource* upstream = nullptr);
+
+    // Non copyable, the cells remain in the arena.
+    Grid(const Grid&) = delete;
+    Grid& operator=(const Grid&) = delete;
 
-    // Clear content.
-    void clear() { _lines.clear(); }
+    // Clear content and release the memory of the arena.
+    void clear() { reset(); }
 
     // Add one line.
-    void addLine(const Line& line) { _lines.push_back(line); }
+    void addLine(const Line& line);
+
+    // Add an empty line, the columns are added using addColumn().
+    void newLine() { _lines.emplace_back(&_arena); }
 
     // Add one column on last line.
-    void addColumn(const WString& text);
+    void addColumn(const WString& text) { addColumn(text.data(), text.size()); }
+    void addColumn(const wchar_t* text, size_t size);
 
     // Add underlines under previous line.
     void addUnderlines(const Line& first_colums = Line(), wchar_t underline = L'-');
@@ -46,7 +60,20 @@ public:
     void print(std::ostream& out);
 
 private:
-    std::list<Line> _lines;
-    WString         _margin;
-    WString         _spacing;
+    // Initial size of the arena.
+    static constexpr size_t ARENA_SIZE = 4096;
+
+    typedef std::pmr::wstring      Cell;
+    typedef std::pmr::vector<Cell> Row;
+
+    // The arena is declared before the rows: the rows, which are allocated in the
+    // arena, are destroyed first. The vector of rows is allocated on the heap, it
+    // never references the arena when it is empty.
+    std::pmr::monotonic_buffer_resource _arena;
+    std::vector<Row>                    _lines;
+    WString                             _margin;
+    WString                             _spacing;
+
+    // Destroy all rows, then release the memory of the arena.
+    void reset();
 };
@@ -0,0 +1,108 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Histogram of durations, in the style of HDR histograms.
+//
+//----------------------------------------------------------------------------
+
+#include "histogram.h"
+#include <bit>
+#include <cmath>
+
+
+//----------------------------------------------------------------------------
+// Constructor and reset.
+//----------------------------------------------------------------------------
+
+LatencyHistogram::LatencyHistogram() :
+    _buckets(),
+    _count(0),
+    _sum(0),
+    _min(0),
+    _max(0)
+{
+}
+
+void LatencyHistogram::clear()
+{
+    _buckets.fill(0);
+    _count = _sum = _min = _max = 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Mapping between values and buckets.
+//----------------------------------------------------------------------------
+
+size_t LatencyHistogram::Index(uint64_t value)
+{
+    // The first SUB_COUNT values have their own sub-bucket. Then, each power
+    // of 2 has SUB_HALF sub-buckets, with a precision of 2^shift.
+    if (value < SUB_COUNT) {
+        return size_t(value);
+    }
+    const size_t shift = size_t(std::bit_width(std::min(value, MAX_VALUE))) - SUB_BITS;
+    return shift * SUB_HALF + size_t(std::min(value, MAX_VALUE) >> shift);
+}
+
+uint64_t LatencyHistogram::HighestValue(size_t index)
+{
+    if (index < SUB_COUNT) {
+        return index;
+    }
+    const size_t shift = index / SUB_HALF - 1;
+    return ((uint64_t(index - shift * SUB_HALF) + 1) << shift) - 1;
+}
+
+
+//----------------------------------------------------------------------------
+// Record values.
+//----------------------------------------------------------------------------
+
+void LatencyHistogram::record(uint64_t nanoseconds)
+{
+    _buckets[Index(nanoseconds / 1000)]++;
+    _sum += nanoseconds;
+    _min = _count == 0 ? nanoseconds : std::min(_min, nanoseconds);
+    _max = std::max(_max, nanoseconds);
+    _count++;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    if (other._count > 0) {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            _buckets[i] += other._buckets[i];
+        }
+        _min = _count == 0 ? other._min : std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+        _sum += other._sum;
+        _count += other._count;
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Value at a given percentile.
+//----------------------------------------------------------------------------
+
+uint64_t LatencyHistogram::percentile(double percent) const
+{
+    if (_count == 0) {
+        return 0;
+    }
+    // Rank of the requested value, from 1 to _count.
+    const uint64_t rank = std::max<uint64_t>(1, std::min<uint64_t>(_count, uint64_t(std::ceil(percent * double(_count) / 100.0))));
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        total += _buckets[i];
+        if (total >= rank) {
+            // Report the highest equivalent value, within the recorded range.
+            return std::max(_min, std::min(_max, HighestValue(i) * 1000 + 999));
+        }
+    }
+    return _max;
+}
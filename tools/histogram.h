@@ -0,0 +1,63 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Histogram of durations, in the style of HDR histograms.
+//
+// Values are recorded in microseconds into logarithmic buckets, each of
+// them being split into 16 linear sub-buckets. The memory size is fixed and
+// the relative precision is 1/16, about 6% in the worst case, over the whole
+// range, from one microsecond to more than 19 hours. Larger values are clamped.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "platform.h"
+#include <array>
+
+class LatencyHistogram
+{
+public:
+    // Constructor.
+    LatencyHistogram();
+
+    // Reset all values.
+    void clear();
+
+    // Record one duration in nanoseconds.
+    void record(uint64_t nanoseconds);
+
+    // Add all values from another histogram.
+    void merge(const LatencyHistogram& other);
+
+    // Number of recorded values, min, max and mean values in nanoseconds.
+    uint64_t count() const { return _count; }
+    uint64_t min() const { return _count == 0 ? 0 : _min; }
+    uint64_t max() const { return _max; }
+    uint64_t mean() const { return _count == 0 ? 0 : _sum / _count; }
+
+    // Value at a given percentile (0 to 100), in nanoseconds.
+    uint64_t percentile(double percent) const;
+
+private:
+    static constexpr size_t   SUB_BITS = 5;                    // 32 sub-buckets in the first bucket.
+    static constexpr size_t   SUB_COUNT = size_t(1) << SUB_BITS;
+    static constexpr size_t   SUB_HALF = SUB_COUNT / 2;        // Sub-buckets in the next buckets.
+    static constexpr size_t   VALUE_BITS = 36;                 // Max value: 2^36 microseconds.
+    static constexpr size_t   BUCKET_COUNT = (VALUE_BITS - SUB_BITS + 2) * SUB_HALF;
+    static constexpr uint64_t MAX_VALUE = (uint64_t(1) << VALUE_BITS) - 1;
+
+    std::array<uint64_t, BUCKET_COUNT> _buckets;
+    uint64_t _count;
+    uint64_t _sum;
+    uint64_t _min;
+    uint64_t _max;
+
+    // Bucket index of a value in microseconds.
+    static size_t Index(uint64_t value);
+
+    // Highest value in microseconds which is recorded in a bucket.
+    static uint64_t HighestValue(size_t index);
+};
@@ -0,0 +1,252 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Sources of keyboard events.
+//
+//----------------------------------------------------------------------------
+
+#include "inputsource.h"
+#include "winutils.h"
+#include <thread>
+
+// Window class of all message input sources.
+#define INPUT_WINDOW_CLASS L"WKLInputSource"
+
+// Maximum sleep time while waiting for a replayed event, to check stop requests.
+#define REPLAY_MAX_SLEEP std::chrono::milliseconds(100)
+
+
+//----------------------------------------------------------------------------
+// Message input sources.
+//----------------------------------------------------------------------------
+
+static LRESULT CALLBACK InputWindowProc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
+{
+    if (msg == WM_DESTROY) {
+        // Window closed by user, terminate the message loop.
+        PostQuitMessage(0);
+        return 0;
+    }
+    return DefWindowProcW(hwnd, msg, wparam, lparam);
+}
+
+bool MessageInputSource::createWindow(bool visible)
+{
+    _thread = GetCurrentThreadId();
+
+    WNDCLASSW wclass;
+    Zero(&wclass, sizeof(wclass));
+    wclass.style = CS_HREDRAW | CS_VREDRAW | CS_OWNDC;
+    wclass.lpfnWndProc = InputWindowProc;
+    wclass.lpszClassName = INPUT_WINDOW_CLASS;
+    wclass.hCursor = LoadCursorA(0, IDC_ARROW);
+    if (RegisterClassW(&wclass) == 0 && GetLastError() != ERROR_CLASS_ALREADY_EXISTS) {
+        const DWORD err = GetLastError();
+        _err.error("RegisterClass: " + ErrorText(err));
+        return false;
+    }
+
+    if (visible) {
+        _window = CreateWindowExW(0, INPUT_WINDOW_CLASS, L"ScanCodes", WS_OVERLAPPEDWINDOW, 0, 0, 200, 200, 0, 0, 0, 0);
+    }
+    else {
+        _window = CreateWindowExW(0, INPUT_WINDOW_CLASS, L"", 0, 0, 0, 0, 0, HWND_MESSAGE, 0, 0, 0);
+    }
+    if (_window == nullptr) {
+        const DWORD err = GetLastError();
+        _err.error("CreateWindow: " + ErrorText(err));
+        return false;
+    }
+    if (visible) {
+        ShowWindow(_window, SW_SHOW);
+    }
+    return true;
+}
+
+bool MessageInputSource::read(KeyEvent& event)
+{
+    // Get all messages of the thread, to receive WM_QUIT.
+    MSG msg;
+    while (GetMessageW(&msg, nullptr, 0, 0) > 0) {
+        const bool is_key = decode(msg, event);
+        DispatchMessageW(&msg);
+        if (is_key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MessageInputSource::stop()
+{
+    if (_thread != 0) {
+        PostThreadMessageW(_thread, WM_QUIT, 0, 0);
+    }
+}
+
+void MessageInputSource::close()
+{
+    if (_window != nullptr) {
+        DestroyWindow(_window);
+        _window = nullptr;
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Keyboard messages in a small window.
+//----------------------------------------------------------------------------
+
+bool WindowInputSource::open()
+{
+    return createWindow(true);
+}
+
+bool WindowInputSource::decode(const MSG& msg, KeyEvent& event)
+{
+    if (msg.message != WM_KEYDOWN && msg.message != WM_KEYUP && msg.message != WM_SYSKEYDOWN && msg.message != WM_SYSKEYUP) {
+        return false;
+    }
+    Zero(&event, sizeof(event));
+    event.time = KeyEvent::Now();
+    event.scancode = uint16_t((msg.lParam >> 16) & 0xFF);
+    event.vk = uint16_t(msg.wParam);
+    if (msg.message == WM_KEYUP || msg.message == WM_SYSKEYUP) {
+        event.flags |= KeyEvent::KEY_UP;
+    }
+    if (msg.message == WM_SYSKEYDOWN || msg.message == WM_SYSKEYUP) {
+        event.flags |= KeyEvent::SYSKEY;
+    }
+    if ((msg.lParam & (1 << 24)) != 0) {
+        event.flags |= KeyEvent::EXTENDED;
+    }
+    if ((msg.lParam & (1 << 29)) != 0) {
+        event.flags |= KeyEvent::ALT;
+    }
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Raw input from all keyboard devices.
+//----------------------------------------------------------------------------
+
+bool RawInputSource::open()
+{
+    if (!createWindow(false)) {
+        return false;
+    }
+
+    // Generic desktop controls, keyboard. Receive input even in background.
+    RAWINPUTDEVICE rid;
+    Zero(&rid, sizeof(rid));
+    rid.usUsagePage = 0x01;
+    rid.usUsage = 0x06;
+    rid.dwFlags = RIDEV_INPUTSINK;
+    rid.hwndTarget = _window;
+    if (!RegisterRawInputDevices(&rid, 1, sizeof(rid))) {
+        const DWORD err = GetLastError();
+        _err.error("RegisterRawInputDevices: " + ErrorText(err));
+        MessageInputSource::close();
+        return false;
+    }
+    return true;
+}
+
+void RawInputSource::close()
+{
+    if (_window != nullptr) {
+        RAWINPUTDEVICE rid;
+        Zero(&rid, sizeof(rid));
+        rid.usUsagePage = 0x01;
+        rid.usUsage = 0x06;
+        rid.dwFlags = RIDEV_REMOVE;
+        RegisterRawInputDevices(&rid, 1, sizeof(rid));
+    }
+    MessageInputSource::close();
+}
+
+bool RawInputSource::decode(const MSG& msg, KeyEvent& event)
+{
+    if (msg.message != WM_INPUT) {
+        return false;
+    }
+    RAWINPUT input;
+    UINT size = sizeof(input);
+    if (GetRawInputData(reinterpret_cast<HRAWINPUT>(msg.lParam), RID_INPUT, &input, &size, sizeof(RAWINPUTHEADER)) == UINT(-1) ||
+        input.header.dwType != RIM_TYPEKEYBOARD ||
+        input.data.keyboard.MakeCode == KEYBOARD_OVERRUN_MAKE_CODE)
+    {
+        return false;
+    }
+    Zero(&event, sizeof(event));
+    event.time = KeyEvent::Now();
+    event.scancode = input.data.keyboard.MakeCode;
+    event.vk = input.data.keyboard.VKey;
+    if ((input.data.keyboard.Flags & RI_KEY_BREAK) != 0) {
+        event.flags |= KeyEvent::KEY_UP;
+    }
+    if ((input.data.keyboard.Flags & RI_KEY_E0) != 0) {
+        event.flags |= KeyEvent::EXTENDED;
+    }
+    if ((input.data.keyboard.Flags & RI_KEY_E1) != 0) {
+        event.flags |= KeyEvent::PREFIX_1;
+    }
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Replay of a binary key log file.
+//----------------------------------------------------------------------------
+
+ReplayInputSource::ReplayInputSource(Error& err, const WString& filename, bool realtime) :
+    InputSource(err),
+    _filename(filename),
+    _realtime(realtime),
+    _reader(err),
+    _stop(false),
+    _first_event(0),
+    _start(0)
+{
+}
+
+bool ReplayInputSource::open()
+{
+    _stop = false;
+    _start = 0;
+    return _reader.open(_filename);
+}
+
+bool ReplayInputSource::read(KeyEvent& event)
+{
+    if (_stop || !_reader.read(event)) {
+        return false;
+    }
+    if (_realtime) {
+        // Wait until the same delay as in the original capture has elapsed.
+        const uint64_t now = KeyEvent::Now();
+        if (_start == 0) {
+            _start = now;
+            _first_event = event.time;
+        }
+        const auto due = std::chrono::steady_clock::now() + std::chrono::nanoseconds(int64_t(_start + (event.time - _first_event)) - int64_t(now));
+        while (!_stop && std::chrono::steady_clock::now() < due) {
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(due - std::chrono::steady_clock::now(), REPLAY_MAX_SLEEP));
+        }
+    }
+    return !_stop;
+}
+
+void ReplayInputSource::stop()
+{
+    _stop = true;
+}
+
+void ReplayInputSource::close()
+{
+    _reader.close();
+}
@@ -0,0 +1,104 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Sources of keyboard events.
+//
+// The window and raw input sources must be opened, read and closed in the
+// same thread, which owns the receiving window. The method stop() can be
+// called from any thread.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "keylog.h"
+#include <atomic>
+
+// Abstract base class of all sources of keyboard events.
+class InputSource
+{
+public:
+    // Constructor. Specify where to report errors.
+    InputSource(Error& err) : _err(err) {}
+    virtual ~InputSource() {}
+
+    // Open the source. Return false on error.
+    virtual bool open() = 0;
+
+    // Wait for the next event. Return false at end of input, on error or after stop().
+    virtual bool read(KeyEvent& event) = 0;
+
+    // Request to stop reading. Can be called from any thread.
+    virtual void stop() = 0;
+
+    // Close the source.
+    virtual void close() {}
+
+protected:
+    Error& _err;
+};
+
+// Base class of input sources which receive window messages.
+class MessageInputSource : public InputSource
+{
+public:
+    MessageInputSource(Error& err) : InputSource(err), _window(nullptr), _thread(0) {}
+    virtual bool read(KeyEvent& event) override;
+    virtual void stop() override;
+    virtual void close() override;
+
+protected:
+    HWND  _window;
+    DWORD _thread;
+
+    // Create the receiving window, visible or message-only.
+    bool createWindow(bool visible);
+
+    // Decode a message into an event. Return false if this is not a keyboard event.
+    virtual bool decode(const MSG& msg, KeyEvent& event) = 0;
+};
+
+// Keyboard messages in a small window, which must have the focus.
+class WindowInputSource : public MessageInputSource
+{
+public:
+    WindowInputSource(Error& err) : MessageInputSource(err) {}
+    virtual bool open() override;
+
+protected:
+    virtual bool decode(const MSG& msg, KeyEvent& event) override;
+};
+
+// Raw input from all keyboard devices, even when the application is in background.
+class RawInputSource : public MessageInputSource
+{
+public:
+    RawInputSource(Error& err) : MessageInputSource(err) {}
+    virtual bool open() override;
+    virtual void close() override;
+
+protected:
+    virtual bool decode(const MSG& msg, KeyEvent& event) override;
+};
+
+// Replay of a binary key log file.
+class ReplayInputSource : public InputSource
+{
+public:
+    // Constructor. With realtime, the events are delivered with their original timing.
+    ReplayInputSource(Error& err, const WString& filename, bool realtime);
+    virtual bool open() override;
+    virtual bool read(KeyEvent& event) override;
+    virtual void stop() override;
+    virtual void close() override;
+
+private:
+    const WString     _filename;
+    const bool        _realtime;
+    KeyLogReader      _reader;
+    std::atomic<bool> _stop;
+    uint64_t          _first_event;  // Timestamp of first event in file.
+    uint64_t          _start;        // Replay start time.
+};
@@ -0,0 +1,286 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Inverse of a keyboard layout.
+//
+//----------------------------------------------------------------------------
+
+#include "inversekeymap.h"
+#include "winkeymap.h"
+#include "stats.h"
+#include "utf8.h"
+#include <bit>
+
+// All modifiers which are used in key sequences.
+#define ALL_MODS (KBDSHIFT | KBDCTRL | KBDALT)
+
+// Check UTF-16 surrogates.
+#define IS_HIGH_SURROGATE(c) ((c) >= 0xD800 && (c) < 0xDC00)
+#define IS_LOW_SURROGATE(c)  ((c) >= 0xDC00 && (c) < 0xE000)
+
+
+//----------------------------------------------------------------------------
+// Keystrokes.
+//----------------------------------------------------------------------------
+
+size_t Keystroke::cost() const
+{
+    return 1 + size_t(std::popcount(unsigned(mods & ALL_MODS)));
+}
+
+void Keystroke::format(std::string& out) const
+{
+    static const char hexa[] = "0123456789ABCDEF";
+    if ((mods & KBDSHIFT) != 0) {
+        out.append("S+");
+    }
+    if ((mods & KBDCTRL) != 0) {
+        out.append("C+");
+    }
+    if ((mods & KBDALT) != 0) {
+        out.append("A+");
+    }
+    if ((flags & PREFIX_0) != 0) {
+        out.append("E0_");
+    }
+    else if ((flags & PREFIX_1) != 0) {
+        out.append("E1_");
+    }
+    out.push_back(hexa[sc >> 4]);
+    out.push_back(hexa[sc & 0x0F]);
+}
+
+
+//----------------------------------------------------------------------------
+// Constructor and reset.
+//----------------------------------------------------------------------------
+
+InverseKeyMap::InverseKeyMap(Error& err) :
+    _err(err),
+    _index(),
+    _pages(),
+    _size(0)
+{
+    clear();
+}
+
+void InverseKeyMap::clear()
+{
+    // Page zero is always empty, it is used by all unreachable pages.
+    _index.assign(MAX_CODE_POINT >> 8, 0);
+    _pages.resize(1);
+    _pages[0].fill(KeySequence());
+    _size = 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Update the sequence of a code point if the new one is cheaper.
+//----------------------------------------------------------------------------
+
+void InverseKeyMap::update(char32_t cp, const Keystroke* keys, size_t count)
+{
+    if (cp >= MAX_CODE_POINT || count == 0 || count > 2) {
+        return;
+    }
+    size_t cost = 0;
+    for (size_t i = 0; i < count; ++i) {
+        cost += keys[i].cost();
+    }
+
+    // Allocate the page on first use.
+    if (_index[cp >> 8] == 0) {
+        _index[cp >> 8] = uint16_t(_pages.size());
+        _pages.emplace_back();
+    }
+    KeySequence& seq(_pages[_index[cp >> 8]][cp & 0xFF]);
+
+    if (seq.count == 0 || cost < seq.cost) {
+        if (seq.count == 0) {
+            _size++;
+        }
+        seq.count = uint8_t(count);
+        seq.cost = uint8_t(cost);
+        for (size_t i = 0; i < count; ++i) {
+            seq.keys[i] = keys[i];
+        }
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Build the inverse map of a keyboard layout.
+//----------------------------------------------------------------------------
+
+bool InverseKeyMap::build(const KBDTABLES* tables)
+{
+    Stats::Timer timer("inverse key map");
+
+    clear();
+    if (tables == nullptr || tables->pVkToWcharTable == nullptr) {
+        _err.error(L"no character table in keyboard layout");
+        return false;
+    }
+
+    // Use the same modifier numbers and scan codes as WinKeyMap.
+    WinKeyMap kmap(tables);
+    std::multimap<uint16_t, uint16_t> vk2sc;
+    kmap.buildScanCodeMap(vk2sc);
+
+    // Keystroke of each virtual key, preferably using a scan code without prefix.
+    std::map<uint16_t, Keystroke> vkeys;
+    for (const auto& it : vk2sc) {
+        Keystroke key;
+        key.sc = uint8_t(it.second & 0xFF);
+        key.flags = (it.second & WinKeyMap::SC_E0) != 0 ? Keystroke::PREFIX_0 : ((it.second & WinKeyMap::SC_E1) != 0 ? Keystroke::PREFIX_1 : 0);
+        key.mods = 0;
+        key.vk = uint8_t(it.first);
+        const auto current = vkeys.find(it.first);
+        if (current == vkeys.end() || (current->second.flags != 0 && key.flags == 0)) {
+            vkeys[it.first] = key;
+        }
+    }
+
+    // Cheapest dead key for each dead character.
+    std::map<wchar_t, Keystroke> dead_keys;
+
+    // Loop on all VK_TO_WCHARS tables. Each table has a different type, use the largest one.
+    for (const VK_TO_WCHAR_TABLE* tab = tables->pVkToWcharTable; tab->pVkToWchars != nullptr; tab++) {
+        const size_t count = tab->nModifications;
+        const size_t size = tab->cbSize;
+        const VK_TO_WCHARS10* vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(tab->pVkToWchars);
+        while (vtwc->VirtualKey != 0) {
+            // The entry after an SGCAPS key is its CapsLock row, whatever its virtual key.
+            // Otherwise, an entry with VK__none_ contains the dead characters of the previous one.
+            const VK_TO_WCHARS10* next = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + size);
+            const bool sgcaps = vtwc->VirtualKey != VK__none_ && (vtwc->Attributes & SGCAPS) != 0 && next->VirtualKey != 0;
+            const VK_TO_WCHARS10* const after = sgcaps ? next : vtwc;
+            if (sgcaps || next->VirtualKey != VK__none_) {
+                next = nullptr;
+            }
+            const auto key = vkeys.find(vtwc->VirtualKey);
+            if (vtwc->VirtualKey != VK__none_ && key != vkeys.end()) {
+                for (size_t i = 0; i < count; ++i) {
+                    const wchar_t wc = vtwc->wch[i];
+                    const size_t mods = kmap.modNumberToModMask(i);
+                    if (mods > ALL_MODS || wc == 0 || wc == WCH_NONE || wc == WCH_LGTR || IS_HIGH_SURROGATE(wc) || IS_LOW_SURROGATE(wc)) {
+                        continue;
+                    }
+                    Keystroke stroke(key->second);
+                    stroke.mods = uint8_t(mods);
+                    if (wc != WCH_DEAD) {
+                        update(wc, &stroke, 1);
+                    }
+                    else if (next != nullptr && next->wch[i] != 0 && next->wch[i] != WCH_NONE) {
+                        const auto dead = dead_keys.find(next->wch[i]);
+                        if (dead == dead_keys.end() || stroke.cost() < dead->second.cost()) {
+                            dead_keys[next->wch[i]] = stroke;
+                        }
+                    }
+                }
+            }
+            // Skip the CapsLock row of an SGCAPS key, not typed without CapsLock.
+            vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(after) + size);
+        }
+    }
+
+    // Ligatures which produce exactly one character, possibly outside the BMP.
+    const LIGATURE1* lig = tables->pLigature;
+    while (lig != nullptr && tables->cbLgEntry > 0 && lig->VirtualKey != 0) {
+        size_t len = 0;
+        while (len < size_t(tables->nLgMax) && lig->wch[len] != WCH_NONE) {
+            ++len;
+        }
+        char32_t cp = 0;
+        if (len == 1 && !IS_HIGH_SURROGATE(lig->wch[0]) && !IS_LOW_SURROGATE(lig->wch[0])) {
+            cp = lig->wch[0];
+        }
+        else if (len == 2 && IS_HIGH_SURROGATE(lig->wch[0]) && IS_LOW_SURROGATE(lig->wch[1])) {
+            cp = 0x10000 + ((char32_t(lig->wch[0]) - 0xD800) << 10) + (char32_t(lig->wch[1]) - 0xDC00);
+        }
+        const auto key = vkeys.find(lig->VirtualKey);
+        const size_t mods = kmap.modNumberToModMask(lig->ModificationNumber);
+        if (cp != 0 && key != vkeys.end() && mods <= ALL_MODS) {
+            Keystroke stroke(key->second);
+            stroke.mods = uint8_t(mods);
+            update(cp, &stroke, 1);
+        }
+        lig = reinterpret_cast<const LIGATURE1*>(reinterpret_cast<const char*>(lig) + tables->cbLgEntry);
+    }
+
+    // Dead key followed by a base key. Chained dead keys are not used. Collect all
+    // candidates first: the base keys must be direct keystrokes, not composed ones.
+    std::vector<std::pair<char32_t, std::array<Keystroke, 2>>> composed;
+    for (const DEADKEY* dk = tables->pDeadKey; dk != nullptr && dk->dwBoth != 0; ++dk) {
+        const auto dead = dead_keys.find(wchar_t(HIWORD(dk->dwBoth)));
+        const KeySequence* base = find(LOWORD(dk->dwBoth));
+        if ((dk->uFlags & DKF_DEAD) == 0 && dk->wchComposed != 0 && dead != dead_keys.end() && base != nullptr && base->count == 1) {
+            composed.push_back(std::make_pair(char32_t(dk->wchComposed), std::array<Keystroke, 2>({dead->second, base->keys[0]})));
+        }
+    }
+    for (const auto& it : composed) {
+        update(it.first, it.second.data(), it.second.size());
+    }
+
+    // Type newlines with the Enter key (carriage return without modifier), not Ctrl+Enter.
+    const KeySequence* cr = find(U'\r');
+    if (cr != nullptr && cr->count == 1 && cr->keys[0].mods == 0) {
+        const Keystroke enter(cr->keys[0]);
+        if (find(U'\n') != nullptr) {
+            _pages[_index[U'\n' >> 8]][U'\n' & 0xFF].count = 0;
+            _size--;
+        }
+        update(U'\n', &enter, 1);
+    }
+
+    Stats::Instance().allocate("inverse key map", _pages.size() * sizeof(Page) + _index.size() * sizeof(uint16_t));
+    Stats::Instance().count("reachable characters", _size);
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Translate UTF-8 text into keystrokes.
+//----------------------------------------------------------------------------
+
+size_t InverseKeyMap::translate(const char* text, size_t size, std::vector<Keystroke>& keys, uint64_t& unmapped, bool final) const
+{
+    const uint8_t* const start = reinterpret_cast<const uint8_t*>(text);
+    const uint8_t* const end = start + size;
+    const uint8_t* cur = start;
+
+    while (cur < end) {
+        char32_t cp = 0;
+        const UTF8Status status = DecodeUTF8(cur, end, cp);
+        if (status == UTF8_INVALID) {
+            unmapped++;
+            continue;
+        }
+        if (status == UTF8_TRUNCATED) {
+            // Truncated sequence, wait for the rest unless this is the end of text.
+            if (final) {
+                unmapped++;
+                cur = end;
+            }
+            break;
+        }
+
+        // Carriage returns are ignored, newlines are typed with Enter.
+        if (cp != U'\r') {
+            const KeySequence* seq = find(cp);
+            if (seq == nullptr) {
+                unmapped++;
+            }
+            else {
+                keys.push_back(seq->keys[0]);
+                if (seq->count > 1) {
+                    keys.push_back(seq->keys[1]);
+                }
+            }
+        }
+    }
+    return size_t(cur - start);
+}
@@ -0,0 +1,125 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Inverse of a keyboard layout: for each character which can be typed, the
+// cheapest sequence of keystrokes which produces it.
+//
+// The cost of a keystroke is one plus the number of modifiers (AltGr counts
+// as Ctrl+Alt). A character can be produced by one keystroke, including
+// single-character ligatures, or by a dead key followed by a base key.
+// Ligatures producing several characters are not used. Caps lock states
+// (SGCAPS) are ignored. A newline is typed using the Enter key and a
+// carriage return is ignored, to type text files with any end of lines.
+//
+// The table is indexed by code point in two levels, only the 256-character
+// pages which contain at least one reachable character are allocated.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "error.h"
+#include <array>
+
+// One keystroke: a scan code and modifiers.
+class Keystroke
+{
+public:
+    uint8_t sc;     // Scan code, without prefix.
+    uint8_t flags;  // Combination of the flags below.
+    uint8_t mods;   // Bitmask of KBDSHIFT, KBDCTRL, KBDALT.
+    uint8_t vk;     // Virtual key.
+
+    // Values for flags.
+    static constexpr uint8_t PREFIX_0 = 0x01;  // Scan code has E0 prefix.
+    static constexpr uint8_t PREFIX_1 = 0x02;  // Scan code has E1 prefix.
+
+    // Number of keys to press.
+    size_t cost() const;
+
+    // Format the keystroke as text, modifiers and scan code, for instance "S+A+E0_35".
+    // Append the text to a string.
+    void format(std::string& out) const;
+};
+
+static_assert(sizeof(Keystroke) == 4, "invalid Keystroke size");
+
+// A sequence of keystrokes which produces one character.
+class KeySequence
+{
+public:
+    Keystroke keys[2];  // Dead key and base key, or only one key.
+    uint8_t   count;    // Number of keystrokes, zero if the character is unreachable.
+    uint8_t   cost;     // Total cost of the keystrokes.
+};
+
+// Inverse of a keyboard layout.
+class InverseKeyMap
+{
+public:
+    // Constructor. Specify where to report errors.
+    InverseKeyMap(Error& err);
+
+    // Build the inverse map of a keyboard layout. Return false on error.
+    bool build(const KBDTABLES* tables);
+
+    // Clear the map.
+    void clear();
+
+    // Number of reachable characters.
+    size_t size() const { return _size; }
+
+    // Get the sequence for one code point. Return nullptr if the character is unreachable.
+    const KeySequence* find(char32_t cp) const
+    {
+        if (cp >= MAX_CODE_POINT) {
+            return nullptr;
+        }
+        const KeySequence* seq = &_pages[_index[cp >> 8]][cp & 0xFF];
+        return seq->count > 0 ? seq : nullptr;
+    }
+
+    // Translate UTF-8 text into keystrokes, appended to a vector. Unreachable characters
+    // and invalid UTF-8 bytes are skipped and counted in unmapped. When the text does not
+    // end with a complete UTF-8 sequence, the last bytes are not consumed, unless final is
+    // true. Return the number of consumed bytes.
+    size_t translate(const char* text, size_t size, std::vector<Keystroke>& keys, uint64_t& unmapped, bool final = true) const;
+
+    // Call a function for each reachable code point, in increasing order.
+    template <class FUNC>
+    void forEach(FUNC func) const;
+
+private:
+    static constexpr char32_t MAX_CODE_POINT = 0x110000;
+    typedef std::array<KeySequence, 256> Page;
+
+    Error&                _err;
+    std::vector<uint16_t> _index;  // Page index of each code point >> 8, zero is an empty page.
+    std::vector<Page>     _pages;  // Pages of key sequences.
+    size_t                _size;   // Number of reachable characters.
+
+    // Update the sequence of a code point if the new one is cheaper.
+    void update(char32_t cp, const Keystroke* keys, size_t count);
+};
+
+
+//----------------------------------------------------------------------------
+// Template definitions.
+//----------------------------------------------------------------------------
+
+template <class FUNC>
+void InverseKeyMap::forEach(FUNC func) const
+{
+    for (size_t page = 0; page < _index.size(); ++page) {
+        if (_index[page] != 0) {
+            for (size_t i = 0; i < 256; ++i) {
+                const KeySequence& seq(_pages[_index[page]][i]);
+                if (seq.count > 0) {
+                    func(char32_t((page << 8) | i), seq);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,429 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Generate a normalized JSON description of a keyboard layout.
+//
+//----------------------------------------------------------------------------
+
+#include "jsongen.h"
+#include "sourcegen.h"
+#include "winutils.h"
+#include "stats.h"
+
+
+//----------------------------------------------------------------------------
+// Constructor.
+//----------------------------------------------------------------------------
+
+JsonGenerator::JsonGenerator(std::ostream& out) :
+    input(),
+    ndjson(false),
+    _out(out),
+    _name(),
+    _first_section(true),
+    _array_section(false),
+    _first_record(true),
+    _first_field(true),
+    _modmask()
+{
+}
+
+
+//----------------------------------------------------------------------------
+// Structure of the output.
+//----------------------------------------------------------------------------
+
+void JsonGenerator::beginSection(const char* name, bool array)
+{
+    _array_section = array;
+    _first_record = true;
+    if (!ndjson) {
+        _out << (_first_section ? "\n" : ",\n") << "\"" << name << "\": " << (array ? "[" : "");
+        _first_section = false;
+    }
+}
+
+void JsonGenerator::endSection()
+{
+    if (!ndjson && _array_section) {
+        _out << (_first_record ? "]" : "\n]");
+    }
+}
+
+void JsonGenerator::beginRecord(const char* type)
+{
+    if (ndjson) {
+        _out << "{\"record\": \"" << type << "\", \"layout\": ";
+        writeString(_name);
+        _first_field = false;
+    }
+    else {
+        _out << (_array_section ? (_first_record ? "\n{" : ",\n{") : "{");
+        _first_field = true;
+    }
+    _first_record = false;
+}
+
+void JsonGenerator::endRecord()
+{
+    _out << (ndjson ? "}\n" : "}");
+}
+
+void JsonGenerator::field(const char* name)
+{
+    _out << (_first_field ? "\"" : ", \"") << name << "\": ";
+    _first_field = false;
+}
+
+
+//----------------------------------------------------------------------------
+// Write a JSON string. UTF-16 is directly encoded in UTF-8 in the output.
+// Lone surrogates are escaped since they cannot be encoded in UTF-8.
+//----------------------------------------------------------------------------
+
+void JsonGenerator::writeString(const wchar_t* str, size_t size)
+{
+    static const char hexdigits[] = "0123456789abcdef";
+    _out.put('"');
+    for (size_t i = 0; str != nullptr && i < size; ++i) {
+        uint32_t c = uint16_t(str[i]);
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < size && uint16_t(str[i + 1]) >= 0xDC00 && uint16_t(str[i + 1]) < 0xE000) {
+            // Surrogate pair.
+            c = 0x10000 + ((c - 0xD800) << 10) + (uint16_t(str[++i]) - 0xDC00);
+        }
+        if (c == '"' || c == '\\') {
+            _out.put('\\');
+            _out.put(char(c));
+        }
+        else if (c < 0x20) {
+            _out << "\\u00" << hexdigits[c >> 4] << hexdigits[c & 0x0F];
+        }
+        else if (c >= 0xD800 && c < 0xE000) {
+            _out << "\\u" << hexdigits[c >> 12] << hexdigits[(c >> 8) & 0x0F] << hexdigits[(c >> 4) & 0x0F] << hexdigits[c & 0x0F];
+        }
+        else if (c < 0x80) {
+            _out.put(char(c));
+        }
+        else if (c < 0x800) {
+            _out.put(char(0xC0 | (c >> 6)));
+            _out.put(char(0x80 | (c & 0x3F)));
+        }
+        else if (c < 0x10000) {
+            _out.put(char(0xE0 | (c >> 12)));
+            _out.put(char(0x80 | ((c >> 6) & 0x3F)));
+            _out.put(char(0x80 | (c & 0x3F)));
+        }
+        else {
+            _out.put(char(0xF0 | (c >> 18)));
+            _out.put(char(0x80 | ((c >> 12) & 0x3F)));
+            _out.put(char(0x80 | ((c >> 6) & 0x3F)));
+            _out.put(char(0x80 | (c & 0x3F)));
+        }
+    }
+    _out.put('"');
+}
+
+void JsonGenerator::writeString(const wchar_t* str)
+{
+    writeString(str, str == nullptr ? 0 : std::wcslen(str));
+}
+
+
+//---------------------------------------------------------------------------
+// Generate the description of the keyboard.
+//---------------------------------------------------------------------------
+
+void JsonGenerator::generate(const KBDTABLES& tables)
+{
+    Stats::Timer timer("json generation");
+
+    _name = input.empty() ? WString() : FileName(input);
+    _first_section = true;
+
+    // Column in VK_TO_WCHARS to shift state. Keep the lowest shift state for each column.
+    std::memset(_modmask, SHFT_INVALID, sizeof(_modmask));
+    const MODIFIERS* mods = tables.pCharModifiers;
+    for (size_t bits = 0; mods != nullptr && bits <= mods->wMaxModBits; ++bits) {
+        const size_t col = mods->ModNumber[bits];
+        if (col < sizeof(_modmask) && _modmask[col] == SHFT_INVALID) {
+            _modmask[col] = uint8_t(bits);
+        }
+    }
+
+    if (!ndjson) {
+        _out << "{";
+    }
+    genLayout(tables);
+    if (mods != nullptr) {
+        genModifiers(*mods);
+    }
+    genScanCodes(tables);
+    genKeys(tables.pVkToWcharTable);
+    genDeadKeys(tables.pDeadKey);
+    genLigatures(tables);
+    beginSection("key_names", true);
+    genKeyNames(tables.pKeyNames, false);
+    genKeyNames(tables.pKeyNamesExt, true);
+    endSection();
+    genDeadKeyNames(tables.pKeyNamesDead);
+    if (!ndjson) {
+        _out << "\n}" << std::endl;
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// General characteristics of the keyboard.
+//---------------------------------------------------------------------------
+
+void JsonGenerator::genLayout(const KBDTABLES& tables)
+{
+    beginSection("layout", false);
+    beginRecord("layout");
+    if (!ndjson) {
+        field("name");
+        writeString(_name);
+    }
+    field("type");
+    _out << tables.dwType;
+    field("subtype");
+    _out << tables.dwSubType;
+    field("version");
+    _out << HIWORD(tables.fLocaleFlags);
+    field("locale_flags");
+    _out << LOWORD(tables.fLocaleFlags);
+    field("max_scancode");
+    _out << int(tables.bMaxVSCtoVK);
+    endRecord();
+    endSection();
+}
+
+
+//---------------------------------------------------------------------------
+// Virtual keys to modifier bits, modifier bits to columns.
+//---------------------------------------------------------------------------
+
+void JsonGenerator::genModifiers(const MODIFIERS& mods)
+{
+    beginSection("modifiers", false);
+    beginRecord("modifiers");
+    field("vk_to_bits");
+    _out << "[";
+    for (const VK_TO_BIT* vb = mods.pVkToBit; vb != nullptr && vb->Vk != 0; ++vb) {
+        _out << (vb == mods.pVkToBit ? "" : ", ") << "{\"vk\": " << int(vb->Vk) << ", \"bits\": " << int(vb->ModBits) << "}";
+    }
+    _out << "]";
+    field("columns");
+    _out << "[";
+    for (size_t bits = 0; bits <= mods.wMaxModBits; ++bits) {
+        _out << (bits == 0 ? "" : ", ") << int(mods.ModNumber[bits]);
+    }
+    _out << "]";
+    endRecord();
+    endSection();
+}
+
+
+//---------------------------------------------------------------------------
+// Scan codes to virtual keys.
+//---------------------------------------------------------------------------
+
+void JsonGenerator::genScanCodes(const KBDTABLES& tables)
+{
+    const auto record = [this](int prefix, int sc, USHORT vk) {
+        beginRecord("scancode");
+        field("prefix");
+        _out << prefix;
+        field("sc");
+        _out << sc;
+        field("vk");
+        _out << int(vk & 0xFF);
+        const auto it = vk_symbols.find(vk & 0xFF);
+        if (it != vk_symbols.end()) {
+            field("vk_name");
+            writeString(it->second);
+        }
+        field("flags");
+        _out << int(vk & 0xFF00);
+        endRecord();
+    };
+
+    beginSection("scancodes", true);
+    for (int sc = 0; tables.pusVSCtoVK != nullptr && sc < tables.bMaxVSCtoVK; ++sc) {
+        if ((tables.pusVSCtoVK[sc] & 0xFF) != VK__none_) {
+            record(0, sc, tables.pusVSCtoVK[sc]);
+        }
+    }
+    for (const VSC_VK* p = tables.pVSCtoVK_E0; p != nullptr && p->Vsc != 0; ++p) {
+        record(0xE0, p->Vsc, p->Vk);
+    }
+    for (const VSC_VK* p = tables.pVSCtoVK_E1; p != nullptr && p->Vsc != 0; ++p) {
+        record(0xE1, p->Vsc, p->Vk);
+    }
+    endSection();
+}
+
+
+//---------------------------------------------------------------------------
+// Characters of virtual keys.
+//---------------------------------------------------------------------------
+
+void JsonGenerator::genKeys(const VK_TO_WCHAR_TABLE* vtwt)
+{
+    beginSection("keys", true);
+    for (; vtwt != nullptr && vtwt->pVkToWchars != nullptr; ++vtwt) {
+        const size_t count = vtwt->nModifications;
+        const size_t size = vtwt->cbSize;
+        const VK_TO_WCHARS10* vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(vtwt->pVkToWchars);
+        while (vtwc->VirtualKey != 0) {
+            // The entry after an SGCAPS key is its CapsLock row, whatever its virtual key.
+            // Otherwise, an entry with VK__none_ contains the dead characters of the previous one.
+            const VK_TO_WCHARS10* next = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + size);
+            const bool sgcaps = vtwc->VirtualKey != VK__none_ && (vtwc->Attributes & SGCAPS) != 0 && next->VirtualKey != 0;
+            if (!sgcaps && next->VirtualKey != VK__none_) {
+                next = nullptr;
+            }
+            if (vtwc->VirtualKey != VK__none_) {
+                beginRecord("key");
+                field("vk");
+                _out << int(vtwc->VirtualKey);
+                const auto it = vk_symbols.find(vtwc->VirtualKey);
+                if (it != vk_symbols.end()) {
+                    field("vk_name");
+                    writeString(it->second);
+                }
+                field("attributes");
+                _out << int(vtwc->Attributes);
+                field("chars");
+                genKeyChars(vtwc, sgcaps ? nullptr : next, count);
+                if (sgcaps) {
+                    field("caps_lock_chars");
+                    genKeyChars(next, nullptr, count);
+                }
+                endRecord();
+            }
+            // Skip the CapsLock row of an SGCAPS key, already in the key record.
+            vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(sgcaps ? next : vtwc) + size);
+        }
+    }
+    endSection();
+}
+
+void JsonGenerator::genKeyChars(const VK_TO_WCHARS10* vtwc, const VK_TO_WCHARS10* dead, size_t count)
+{
+    bool first = true;
+    _out << "[";
+    for (size_t i = 0; i < count; ++i) {
+        const wchar_t wc = vtwc->wch[i];
+        if (wc != 0 && wc != WCH_NONE) {
+            _out << (first ? "" : ", ") << "{\"shift_state\": " << int(i < sizeof(_modmask) ? _modmask[i] : SHFT_INVALID);
+            if (wc == WCH_DEAD) {
+                _out << ", \"dead\": ";
+                if (dead != nullptr) {
+                    writeChar(dead->wch[i]);
+                }
+                else {
+                    _out << "null";
+                }
+            }
+            else if (wc == WCH_LGTR) {
+                _out << ", \"ligature\": true";
+            }
+            else {
+                _out << ", \"char\": ";
+                writeChar(wc);
+            }
+            _out << "}";
+            first = false;
+        }
+    }
+    _out << "]";
+}
+
+
+//---------------------------------------------------------------------------
+// Dead keys.
+//---------------------------------------------------------------------------
+
+void JsonGenerator::genDeadKeys(const DEADKEY* dk)
+{
+    beginSection("dead_keys", true);
+    for (; dk != nullptr && dk->dwBoth != 0; ++dk) {
+        beginRecord("dead_key");
+        field("accent");
+        writeChar(wchar_t(HIWORD(dk->dwBoth)));
+        field("base");
+        writeChar(wchar_t(LOWORD(dk->dwBoth)));
+        field("composed");
+        writeChar(dk->wchComposed);
+        field("chained");
+        _out << ((dk->uFlags & DKF_DEAD) != 0 ? "true" : "false");
+        endRecord();
+    }
+    endSection();
+}
+
+
+//---------------------------------------------------------------------------
+// Ligatures, variable size entries.
+//---------------------------------------------------------------------------
+
+void JsonGenerator::genLigatures(const KBDTABLES& tables)
+{
+    beginSection("ligatures", true);
+    const LIGATURE1* lig = tables.pLigature;
+    while (lig != nullptr && tables.cbLgEntry > 0 && lig->VirtualKey != 0) {
+        size_t len = 0;
+        while (len < size_t(tables.nLgMax) && lig->wch[len] != WCH_NONE) {
+            ++len;
+        }
+        beginRecord("ligature");
+        field("vk");
+        _out << int(lig->VirtualKey);
+        field("shift_state");
+        _out << int(lig->ModificationNumber < sizeof(_modmask) ? _modmask[lig->ModificationNumber] : SHFT_INVALID);
+        field("chars");
+        writeString(lig->wch, len);
+        endRecord();
+        lig = reinterpret_cast<const LIGATURE1*>(reinterpret_cast<const char*>(lig) + tables.cbLgEntry);
+    }
+    endSection();
+}
+
+
+//---------------------------------------------------------------------------
+// Key names.
+//---------------------------------------------------------------------------
+
+void JsonGenerator::genKeyNames(const VSC_LPWSTR* names, bool extended)
+{
+    for (; names != nullptr && names->vsc != 0; ++names) {
+        beginRecord("key_name");
+        field("sc");
+        _out << int(names->vsc);
+        field("extended");
+        _out << (extended ? "true" : "false");
+        field("name");
+        writeString(names->pwsz);
+        endRecord();
+    }
+}
+
+void JsonGenerator::genDeadKeyNames(const DEADKEY_LPWSTR* names)
+{
+    beginSection("dead_key_names", true);
+    for (; names != nullptr && *names != nullptr; ++names) {
+        // The first character is the dead key, followed by its name.
+        const wchar_t* name = *names;
+        beginRecord("dead_key_name");
+        field("accent");
+        writeString(name, name[0] == 0 ? 0 : 1);
+        field("name");
+        writeString(name[0] == 0 ? name : name + 1);
+        endRecord();
+    }
+    endSection();
+}
@@ -0,0 +1,78 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Generate a normalized JSON description of a keyboard layout from its
+// KBDTABLES. The output is streamed while walking the tables.
+//
+// The description is made of records of the following types:
+// - layout: general characteristics of the keyboard.
+// - modifiers: virtual keys to modifier bits, modifier bits to columns.
+// - scancode: one scan code to virtual key translation.
+// - key: characters for one virtual key, one entry per shift state.
+// - dead_key: one dead key translation.
+// - ligature: one ligature, characters for one virtual key and shift state.
+// - key_name: name of one key, from its scan code.
+// - dead_key_name: name of one dead key.
+//
+// In JSON format, the output is one object with one array per record type
+// (the layout and modifiers are single objects). In NDJSON format, there is
+// one record per line with a "record" field containing the record type and
+// a "layout" field containing the layout name.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "strutils.h"
+
+class JsonGenerator
+{
+public:
+    // Constructor. Specify the output stream.
+    JsonGenerator(std::ostream& out);
+
+    // Generation options, to be set before generate().
+    WString input;   // Input file name, in the layout record.
+    bool    ndjson;  // Generate NDJSON (one record per line) instead of one JSON object.
+
+    // Generate the description of the keyboard.
+    void generate(const KBDTABLES&);
+
+private:
+    std::ostream& _out;
+    WString       _name;            // Layout name, in NDJSON records.
+    bool          _first_section;   // First section in JSON object.
+    bool          _array_section;   // Current JSON section is an array of records.
+    bool          _first_record;    // First record in a JSON section.
+    bool          _first_field;     // First field in a record.
+    uint8_t       _modmask[16];     // Column in VK_TO_WCHARS to shift state.
+
+    // Structure of the output.
+    void beginSection(const char* name, bool array);
+    void endSection();
+    void beginRecord(const char* type);
+    void endRecord();
+    void field(const char* name);
+
+    // Write JSON values.
+    void writeString(const wchar_t* str, size_t size);
+    void writeString(const wchar_t* str);
+    void writeString(const WString& str) { writeString(str.data(), str.size()); }
+    void writeChar(wchar_t c) { writeString(&c, 1); }
+
+    // Generate the various records.
+    void genLayout(const KBDTABLES&);
+    void genModifiers(const MODIFIERS&);
+    void genScanCodes(const KBDTABLES&);
+    void genKeys(const VK_TO_WCHAR_TABLE*);
+    void genDeadKeys(const DEADKEY*);
+    void genLigatures(const KBDTABLES&);
+    void genKeyNames(const VSC_LPWSTR*, bool extended);
+    void genDeadKeyNames(const DEADKEY_LPWSTR*);
+
+    // Write the list of characters of a key, from a VK_TO_WCHARS entry and
+    // the optional following entry which contains the dead characters.
+    void genKeyChars(const VK_TO_WCHARS10* vtwc, const VK_TO_WCHARS10* dead, size_t count);
+};
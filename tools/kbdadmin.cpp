@@ -14,6 +14,7 @@
 #include "strutils.h"
 #include "winutils.h"
 #include "grid.h"
+#include "stats.h"
 #include "kbdrc.h"
 
 // Configure the terminal console on init, restore on exit.
@@ -56,7 +57,8 @@ AdminOptions::AdminOptions(int argc, wchar_t* argv[]) :
         L"  -r  : remove all installed keyboard DLL's from this project\n"
         L"  -s  : search active keyboard layout DLL's in all processes\n"
         L"  -u  : display user setup\n"
-        L"  -v  : verbose messages"),
+        L"  -v  : verbose messages\n"
+        L"  --stats[=text|json] : display performance statistics on standard error"),
     output(),
     dll_install(),
     activate(),
@@ -237,6 +239,8 @@ void DisplayUserSetup(AdminOptions& opt)
 
 void SearchActiveKeyboards(AdminOptions& opt)
 {
+    Stats::Timer timer("process scan");
+
     // Enumerate keyboard layouts in registry.
     Registry reg(opt);
     WStringList all_lang_ids;
@@ -279,6 +283,7 @@ void SearchActiveKeyboards(AdminOptions& opt)
             error_count++;
             continue;
         }
+        Stats::Instance().count("processes scanned");
 
         // Enumerate all DLL's in this process.
         std::vector<HMODULE> mods(4096);
@@ -290,6 +295,7 @@ void SearchActiveKeyboards(AdminOptions& opt)
             continue;
         }
         mods.resize(retsize / sizeof(HMODULE));
+        Stats::Instance().count("modules scanned", mods.size());
 
         // Get the module names and display potential keyboards DLL's.
         for (auto hmod : mods) {
@@ -395,7 +401,13 @@ int wmain(int argc, wchar_t* argv[])
     // Need to be admin to install keyboards or explore all processes.
     if ((!opt.dll_install.empty() || opt.remove_wkl || opt.search_active) && !IsAdmin()) {
         opt.info("Restarting as admin...");
-        RestartAsAdmin(opt.args + L"-p", true);
+        WStringVector args(opt.args + L"-p");
+        if (Stats::Instance().enabled()) {
+            // Statistics are displayed by the process which does the job.
+            args.push_back(Stats::Instance().option());
+        }
+        RestartAsAdmin(args, true);
+        Stats::Instance().setFormat(Stats::NONE);
         opt.exit(EXIT_SUCCESS);
     }
 
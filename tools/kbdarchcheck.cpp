@@ -0,0 +1,262 @@
+//---------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Consistency check of the keyboard layout DLL's for all CPU architectures.
+//
+// The build script builds each layout for x86, x64 and arm64. The DLL's of
+// a layout must contain the same tables. Each DLL is mapped without the
+// system loader and its tables are copied in the structures of the current
+// process (PortableTables): the pointer widths and the relocations are
+// normalized, then the decoded tables are compared, structure by structure.
+// All layouts are checked in parallel.
+//
+//---------------------------------------------------------------------------
+
+#include "options.h"
+#include "strutils.h"
+#include "winutils.h"
+#include "grid.h"
+#include "peimage.h"
+#include "portabletables.h"
+#include "kbdcheck.h"
+#include "taskrunner.h"
+#include <chrono>
+#include <thread>
+
+// Configure the terminal console on init, restore on exit.
+ConsoleState state;
+
+// Supported architectures, as directory names in the output tree.
+static const std::vector<std::pair<WString, WORD>> architectures {
+    {L"x86",   IMAGE_FILE_MACHINE_I386},
+    {L"x64",   IMAGE_FILE_MACHINE_AMD64},
+    {L"arm64", IMAGE_FILE_MACHINE_ARM64},
+};
+
+
+//----------------------------------------------------------------------------
+// Command line options.
+//----------------------------------------------------------------------------
+
+class ArchCheckOptions : public Options
+{
+public:
+    // Constructor.
+    ArchCheckOptions(int argc, wchar_t* argv[]);
+
+    // Command line options.
+    WString       root;
+    WString       configuration;
+    WStringVector archs;
+    WString       output;
+    size_t        threads;
+
+    // Layout DLL file names, without directory, in lower case.
+    WStringVector layouts;
+
+    // Directory of the DLL's for one architecture.
+    WString directory(const WString& arch) const { return root + L"\\" + arch + L"\\" + configuration; }
+};
+
+ArchCheckOptions::ArchCheckOptions(int argc, wchar_t* argv[]) :
+    Options(argc, argv,
+        L"[options] [directory]\n"
+        L"\n"
+        L"  directory : Root of the output tree of the build, containing subdirectories\n"
+        L"  x86, x64 and arm64. The default is the root of the project.\n"
+        L"\n"
+        L"Options:\n"
+        L"\n"
+        L"  -a arch : architecture to check, x86, x64 or arm64, can be repeated, default: all\n"
+        L"  -c name : build configuration, default: Release\n"
+        L"  -h : display this help text\n"
+        L"  -o outfile : output file name, default is standard output\n"
+        L"  --threads count : number of threads, default is the number of processors\n"
+        L"  --stats[=text|json] : display performance statistics on standard error"),
+    root(),
+    configuration(L"Release"),
+    archs(),
+    output(),
+    threads(std::max<size_t>(1, std::thread::hardware_concurrency())),
+    layouts()
+{
+    // Parse arguments.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == L"--help" || args[i] == L"-h") {
+            usage();
+        }
+        else if (args[i] == L"-a" && i + 1 < args.size()) {
+            const WString arch(ToLower(args[++i]));
+            if (std::find_if(architectures.begin(), architectures.end(), [&arch](const auto& a) { return a.first == arch; }) == architectures.end()) {
+                fatal("invalid architecture '" + args[i] + "'");
+            }
+            archs.push_back(arch);
+        }
+        else if (args[i] == L"-c" && i + 1 < args.size()) {
+            configuration = args[++i];
+        }
+        else if (args[i] == L"-o" && i + 1 < args.size()) {
+            output = args[++i];
+        }
+        else if (args[i] == L"--threads" && i + 1 < args.size()) {
+            threads = size_t(ToInt64(args[++i]));
+            if (threads == 0 || threads > MAX_THREADS || !IsDecimal(args[i])) {
+                fatal("invalid thread count '" + args[i] + "'");
+            }
+        }
+        else if (!args[i].empty() && args[i][0] == L'-') {
+            fatal("invalid option '" + args[i] + "', try --help");
+        }
+        else if (root.empty()) {
+            root = args[i];
+        }
+        else {
+            fatal(L"more than one directory specified, try --help");
+        }
+    }
+
+    // Default: the executable is in x64\Release for instance, the output tree is at the root.
+    if (root.empty()) {
+        root = DirName(DirName(DirName(GetCurrentProgram())));
+    }
+    if (archs.empty()) {
+        for (const auto& arch : architectures) {
+            archs.push_back(arch.first);
+        }
+    }
+
+    // Layouts which exist in at least one architecture.
+    std::set<WString> names;
+    for (const auto& arch : archs) {
+        WStringList files;
+        if (IsDirectory(directory(arch)) && !SearchFiles(files, directory(arch), L"kbd*.dll")) {
+            fatal("error searching " + directory(arch));
+        }
+        for (const auto& file : files) {
+            names.insert(ToLower(file));
+        }
+    }
+    layouts.assign(names.begin(), names.end());
+    if (layouts.empty()) {
+        fatal("no keyboard layout DLL found in " + root);
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Check one architecture variant of a layout. Return the status to display.
+//----------------------------------------------------------------------------
+
+WString LoadVariant(const ArchCheckOptions& opt, const WString& layout, const WString& arch, PEImage& image, PortableTables& tables, Error& err)
+{
+    const WString filename(opt.directory(arch) + L"\\" + layout);
+    if (!FileExists(filename)) {
+        err.error(Format(L"%s: missing for %s", layout.c_str(), arch.c_str()));
+        return L"missing";
+    }
+    if (!image.load(filename)) {
+        return L"invalid";
+    }
+    const auto expected = std::find_if(architectures.begin(), architectures.end(), [&arch](const auto& a) { return a.first == arch; });
+    if (expected != architectures.end() && image.machine() != expected->second) {
+        err.error(Format(L"%s: %s image in %s directory", filename.c_str(), PEImage::MachineName(image.machine()).c_str(), arch.c_str()));
+        return L"wrong CPU";
+    }
+    if (tables.build(image) == nullptr || !CheckKbdTables(tables.tables(), tables.base(), tables.size(), err)) {
+        return L"invalid";
+    }
+    return L"ok";
+}
+
+
+//----------------------------------------------------------------------------
+// Result of one task: all architecture variants of one layout.
+//----------------------------------------------------------------------------
+
+class TaskResult
+{
+public:
+    WStringVector status {};  // Status per architecture.
+    bool          mismatch = false;
+};
+
+
+//---------------------------------------------------------------------------
+// Application entry point.
+//---------------------------------------------------------------------------
+
+int wmain(int argc, wchar_t* argv[])
+{
+    // Parse command line options.
+    ArchCheckOptions opt(argc, argv);
+
+    std::vector<TaskResult> results(opt.layouts.size());
+    const auto start = std::chrono::steady_clock::now();
+
+    TaskRunner runner(opt);
+    runner.threads = opt.threads;
+    const bool success = runner.run(results.size(),
+        [&opt, &results](size_t index, TaskError& err) {
+            const WString& layout(opt.layouts[index]);
+            TaskResult& res(results[index]);
+            res.status.assign(opt.archs.size(), WString());
+
+            // The first valid variant is the reference, the others are compared with it.
+            // The tables are copied, the image is reused for the next variant.
+            PEImage image(err);
+            std::vector<PortableTables> tables;
+            tables.reserve(opt.archs.size());
+            size_t ref = opt.archs.size();
+            for (size_t i = 0; i < opt.archs.size(); ++i) {
+                tables.emplace_back(err);
+                res.status[i] = LoadVariant(opt, layout, opt.archs[i], image, tables[i], err);
+                image.clear();
+                if (res.status[i] != L"ok") {
+                    res.mismatch = true;
+                }
+                else if (ref == opt.archs.size()) {
+                    ref = i;
+                }
+                else {
+                    WString difference;
+                    if (!tables[i].compare(tables[ref], difference)) {
+                        err.error(Format(L"%s: %s differs from %s, %s", layout.c_str(), opt.archs[i].c_str(), opt.archs[ref].c_str(), difference.c_str()));
+                        res.status[i] = L"differs";
+                        res.mismatch = true;
+                    }
+                }
+            }
+            return !res.mismatch;
+        });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Summary per layout.
+    Grid grid;
+    Grid::Line header{L"Layout"};
+    header.insert(header.end(), opt.archs.begin(), opt.archs.end());
+    grid.addLine(header);
+    grid.addUnderlines();
+    size_t mismatches = 0;
+    for (size_t index = 0; index < results.size(); ++index) {
+        Grid::Line line{FileBaseName(opt.layouts[index])};
+        line.insert(line.end(), results[index].status.begin(), results[index].status.end());
+        grid.addLine(line);
+        if (results[index].mismatch) {
+            mismatches++;
+        }
+    }
+
+    opt.setOutput(opt.output);
+    grid.setSpacing(2);
+    grid.print(opt.out());
+    opt.out() << std::endl
+              << Format(L"%llu layouts, %llu mismatches, %.2f s", uint64_t(results.size()), uint64_t(mismatches), seconds)
+              << std::endl;
+    if (!success) {
+        runner.summary(L"layouts");
+    }
+    opt.exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+}
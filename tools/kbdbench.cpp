@@ -0,0 +1,775 @@
+//---------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Microbenchmarks of libtools primitives.
+//
+// The fixtures are built from real keyboard layouts: the layout descriptions
+// in the keyboards directory of the project or layout DLL's. One operation
+// of a benchmark is one pass over all layouts of the fixture.
+//
+// Each benchmark is calibrated so that one sample lasts a minimum time, then
+// several samples are measured. The median time per operation and the
+// interquartile range are reported. The heap allocations are counted by
+// replacing the global operator new.
+//
+// The results can be saved as a JSON baseline and compared with a previous
+// baseline. A benchmark regresses when its median is slower than the
+// threshold and the interquartile ranges do not overlap (noise is not
+// reported), or when it makes more allocations per operation.
+//
+//---------------------------------------------------------------------------
+
+#include "options.h"
+#include "strutils.h"
+#include "winutils.h"
+#include "grid.h"
+#include "winkeymap.h"
+#include "sourcegen.h"
+#include "layoutdesc.h"
+#include "kbdloader.h"
+#include "kbdfrapple/kbdfrapple_model.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+// Configure the terminal console on init, restore on exit.
+ConsoleState state;
+
+// Default parameters of the measurement.
+#define DEFAULT_SAMPLES     25
+#define DEFAULT_SAMPLE_MS   5
+#define DEFAULT_THRESHOLD   10
+#define MAX_SAMPLES         10000
+#define MAX_SAMPLE_MS       10000
+
+
+//----------------------------------------------------------------------------
+// Count all heap allocations of the process.
+//----------------------------------------------------------------------------
+
+namespace {
+    std::atomic<uint64_t> alloc_count(0);
+    std::atomic<uint64_t> alloc_bytes(0);
+}
+
+void* operator new(size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+
+//----------------------------------------------------------------------------
+// Command line options.
+//----------------------------------------------------------------------------
+
+class BenchOptions : public Options
+{
+public:
+    // Constructor.
+    BenchOptions(int argc, wchar_t* argv[]);
+
+    // Command line options.
+    WStringVector inputs;
+    WString       output;
+    WString       baseline;
+    WString       compare;
+    WString       filter;
+    size_t        samples;
+    size_t        sample_ms;
+    size_t        threshold;
+
+private:
+    // Add the layout descriptions of a directory and its kbd* subdirectories.
+    void addDirectory(const WString& dir, bool subdirs);
+};
+
+BenchOptions::BenchOptions(int argc, wchar_t* argv[]) :
+    Options(argc, argv,
+        L"[options] [layout ...]\n"
+        L"\n"
+        L"  layout : Either a layout description file (.kbl), the file name of a keyboard\n"
+        L"  layout DLL, the name of a keyboard layout, for instance \"fr\" for\n"
+        L"  C:\\Windows\\System32\\kbdfr.dll, or a directory, meaning all kbd*.kbl files in\n"
+        L"  that directory and its kbd* subdirectories. The default is the keyboards\n"
+        L"  directory of the project.\n"
+        L"\n"
+        L"Options:\n"
+        L"\n"
+        L"  -b file : save the results as a JSON baseline\n"
+        L"  -c file : compare with a JSON baseline, exit with an error on regression\n"
+        L"  -f string : run only the benchmarks containing that string\n"
+        L"  -h : display this help text\n"
+        L"  -n count : number of samples per benchmark, 5 to " + Format(L"%d", MAX_SAMPLES) + L", default: " + Format(L"%d", DEFAULT_SAMPLES) + L"\n"
+        L"  -o outfile : output file name, default is standard output\n"
+        L"  -r percent : regression threshold on median times, default: " + Format(L"%d", DEFAULT_THRESHOLD) + L"\n"
+        L"  -t ms : minimum duration of one sample in milliseconds, 1 to " + Format(L"%d", MAX_SAMPLE_MS) + L", default: " + Format(L"%d", DEFAULT_SAMPLE_MS)),
+    inputs(),
+    output(),
+    baseline(),
+    compare(),
+    filter(),
+    samples(DEFAULT_SAMPLES),
+    sample_ms(DEFAULT_SAMPLE_MS),
+    threshold(DEFAULT_THRESHOLD)
+{
+    // Parse arguments.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == L"--help" || args[i] == L"-h") {
+            usage();
+        }
+        else if (args[i] == L"-b" && i + 1 < args.size()) {
+            baseline = args[++i];
+        }
+        else if (args[i] == L"-c" && i + 1 < args.size()) {
+            compare = args[++i];
+        }
+        else if (args[i] == L"-f" && i + 1 < args.size()) {
+            filter = args[++i];
+        }
+        else if (args[i] == L"-n" && i + 1 < args.size()) {
+            samples = size_t(ToInt64(args[++i]));
+            if (samples < 5 || samples > MAX_SAMPLES || !IsDecimal(args[i])) {
+                fatal("invalid sample count '" + args[i] + "', at least 5 samples are required");
+            }
+        }
+        else if (args[i] == L"-o" && i + 1 < args.size()) {
+            output = args[++i];
+        }
+        else if (args[i] == L"-r" && i + 1 < args.size()) {
+            threshold = size_t(ToInt64(args[++i]));
+            if (!IsDecimal(args[i])) {
+                fatal("invalid threshold '" + args[i] + "'");
+            }
+        }
+        else if (args[i] == L"-t" && i + 1 < args.size()) {
+            sample_ms = size_t(ToInt64(args[++i]));
+            if (sample_ms == 0 || sample_ms > MAX_SAMPLE_MS || !IsDecimal(args[i])) {
+                fatal("invalid sample duration '" + args[i] + "'");
+            }
+        }
+        else if (!args[i].empty() && args[i][0] == L'-') {
+            fatal("invalid option '" + args[i] + "', try --help");
+        }
+        else if (IsDirectory(args[i])) {
+            addDirectory(args[i], true);
+        }
+        else if (EndsWith(ToLower(args[i]), LayoutDescription::FILE_EXTENSION)) {
+            inputs.push_back(args[i]);
+        }
+        else {
+            inputs.push_back(KeyboardLoader::FileName(args[i]));
+        }
+    }
+
+    // Default: the executable is in x64\Release for instance, the keyboards are at the root.
+    if (inputs.empty()) {
+        addDirectory(DirName(DirName(DirName(GetCurrentProgram()))) + L"\\keyboards", true);
+    }
+    if (inputs.empty()) {
+        fatal(L"no keyboard layout found, try --help");
+    }
+}
+
+void BenchOptions::addDirectory(const WString& dir, bool subdirs)
+{
+    WStringList files;
+    if (!SearchFiles(files, dir, L"kbd*" + LayoutDescription::FILE_EXTENSION)) {
+        fatal("error searching " + dir);
+    }
+    for (const auto& file : files) {
+        inputs.push_back(dir + L"\\" + file);
+    }
+    if (subdirs) {
+        files.clear();
+        SearchFiles(files, dir, L"kbd*");
+        for (const auto& file : files) {
+            if (IsDirectory(dir + L"\\" + file)) {
+                addDirectory(dir + L"\\" + file, false);
+            }
+        }
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// An output stream which discards everything, to measure formatting only.
+//----------------------------------------------------------------------------
+
+class NullBuffer : public std::streambuf
+{
+protected:
+    virtual int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+    virtual std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+// Same, counting the lines, without allocation.
+class LineCounter : public std::streambuf
+{
+public:
+    uint64_t lines = 0;
+protected:
+    virtual int_type overflow(int_type c) override { lines += uint64_t(c == '\n'); return traits_type::not_eof(c); }
+    virtual std::streamsize xsputn(const char* s, std::streamsize n) override { lines += uint64_t(std::count(s, s + n, '\n')); return n; }
+};
+
+
+//----------------------------------------------------------------------------
+// Fixtures: data which are derived from the real layouts, built once.
+//----------------------------------------------------------------------------
+
+class Fixture
+{
+public:
+    // Constructor.
+    Fixture(Error& err) : _err(err) {}
+
+    // Load all layouts. Invalid layouts are reported and skipped.
+    bool load(const WStringVector& inputs);
+
+    // Data per layout.
+    class Layout
+    {
+    public:
+        Layout(Error& err) : desc(err), tables(nullptr), chars(), utf8(), hexa(), lines() {}
+        LayoutDescription   desc;    // Layout description, owner of the tables.
+        const KBDTABLES*    tables;  // Keyboard tables.
+        WString             chars;   // All characters of the keys.
+        std::string         utf8;    // Same in UTF-8.
+        WStringVector       hexa;    // Scan codes and virtual keys in hexadecimal.
+        std::vector<Grid::Line> lines;  // Character table, one line per scan code, one column per modifier.
+    };
+
+    std::list<Layout> layouts;
+    std::vector<uint8_t> zeroes;  // Zeroed memory area.
+
+private:
+    Error& _err;
+};
+
+bool Fixture::load(const WStringVector& inputs)
+{
+    KeyboardLoader loader(_err);
+    loader.portable = true;
+    for (const auto& input : inputs) {
+        layouts.emplace_back(_err);
+        Layout& lay(layouts.back());
+        bool ok = false;
+        if (EndsWith(ToLower(input), LayoutDescription::FILE_EXTENSION)) {
+            ok = lay.desc.load(input);
+        }
+        else {
+            const KBDTABLES* tables = loader.load(input);
+            if (tables != nullptr) {
+                lay.desc.build(*tables);
+                ok = true;
+            }
+            loader.unload();
+        }
+        if (!ok) {
+            layouts.pop_back();
+            continue;
+        }
+        lay.tables = &lay.desc.tables();
+
+        // Characters in a grid, as in the character table of kbdreverse.
+        WinKeyMap map(lay.tables);
+        std::map<std::pair<uint8_t, uint8_t>, Grid::Line> rows;
+        for (const KeyChar& kc : map.characters()) {
+            Grid::Line& line(rows[std::make_pair(kc.prefix, kc.sc)]);
+            if (line.empty()) {
+                line.resize(9);
+                line[0] = Format(L"%s%02X", kc.prefix == 0 ? L"" : (kc.prefix == 0xE0 ? L"E0:" : L"E1:"), kc.sc);
+            }
+            if (kc.modifier < 8) {
+                line[kc.modifier + 1] = WString(1, kc.wc);
+            }
+            lay.chars.push_back(kc.wc);
+            lay.hexa.push_back(Format(L"0x%02X", kc.sc));
+            lay.hexa.push_back(Format(L"%02X", kc.vk));
+        }
+        for (auto& it : rows) {
+            lay.lines.push_back(std::move(it.second));
+        }
+        lay.utf8 = ToUTF8(lay.chars);
+    }
+    zeroes.resize(4096);
+    return !layouts.empty();
+}
+
+
+//----------------------------------------------------------------------------
+// Result of one benchmark.
+//----------------------------------------------------------------------------
+
+class Result
+{
+public:
+    std::string name;
+    uint64_t    iterations = 0;  // Operations per sample.
+    uint64_t    samples = 0;
+    double      median = 0;      // Times in nanoseconds per operation.
+    double      q1 = 0;
+    double      q3 = 0;
+    double      min = 0;
+    double      mean = 0;
+    double      allocs = 0;      // Heap allocations per operation.
+    double      bytes = 0;       // Allocated bytes per operation.
+};
+
+// Quantile of sorted values, with linear interpolation.
+double Quantile(const std::vector<double>& sorted, double q)
+{
+    const double pos = q * double(sorted.size() - 1);
+    const size_t index = size_t(pos);
+    return index + 1 < sorted.size() ? sorted[index] + (pos - double(index)) * (sorted[index + 1] - sorted[index]) : sorted[index];
+}
+
+
+//----------------------------------------------------------------------------
+// Run one benchmark. The operation returns a value to defeat the optimizer.
+//----------------------------------------------------------------------------
+
+volatile uint64_t sink = 0;
+
+Result Run(const BenchOptions& opt, const std::string& name, const std::function<uint64_t()>& operation)
+{
+    typedef std::chrono::steady_clock Clock;
+    const auto run_batch = [&operation](uint64_t count) {
+        uint64_t value = 0;
+        const Clock::time_point start = Clock::now();
+        for (uint64_t i = 0; i < count; ++i) {
+            value += operation();
+        }
+        const Clock::duration duration = Clock::now() - start;
+        sink = sink + value;
+        return std::chrono::duration<double, std::nano>(duration).count();
+    };
+
+    Result res;
+    res.name = name;
+    res.samples = opt.samples;
+
+    // Calibration, also a warm-up: double the iterations until a sample is long enough.
+    const double min_ns = double(opt.sample_ms) * 1e6;
+    res.iterations = 1;
+    while (run_batch(res.iterations) < min_ns && res.iterations < (uint64_t(1) << 40)) {
+        res.iterations *= 2;
+    }
+
+    // Allocations are deterministic, one operation is enough.
+    const uint64_t count0 = alloc_count.load();
+    const uint64_t bytes0 = alloc_bytes.load();
+    sink = sink + operation();
+    res.allocs = double(alloc_count.load() - count0);
+    res.bytes = double(alloc_bytes.load() - bytes0);
+
+    // Timed samples.
+    std::vector<double> times;
+    times.reserve(opt.samples);
+    for (size_t i = 0; i < opt.samples; ++i) {
+        times.push_back(run_batch(res.iterations) / double(res.iterations));
+    }
+    std::sort(times.begin(), times.end());
+    res.median = Quantile(times, 0.5);
+    res.q1 = Quantile(times, 0.25);
+    res.q3 = Quantile(times, 0.75);
+    res.min = times.front();
+    double sum = 0;
+    for (double t : times) {
+        sum += t;
+    }
+    res.mean = sum / double(times.size());
+    return res;
+}
+
+
+//----------------------------------------------------------------------------
+// Heap allocations of SourceGenerator::generate() for each layout, with the
+// number of generated lines. Allocations are deterministic, they are counted
+// on one generation, after a first one which initializes the static data.
+//----------------------------------------------------------------------------
+
+void AddGeneratorAllocations(Grid& grid, const Fixture& fix)
+{
+    grid.addLine({L"Layout", L"Lines", L"Allocs", L"Bytes", L"Allocs/line"});
+    grid.addUnderlines();
+    for (const auto& lay : fix.layouts) {
+        LineCounter counter;
+        std::ostream output(&counter);
+        for (int pass = 0; pass < 2; ++pass) {
+            counter.lines = 0;
+            const uint64_t count0 = alloc_count.load();
+            const uint64_t bytes0 = alloc_bytes.load();
+            SourceGenerator gen(output);
+            gen.input = lay.desc.name;
+            gen.generate(*lay.tables);
+            const uint64_t count = alloc_count.load() - count0;
+            const uint64_t bytes = alloc_bytes.load() - bytes0;
+            if (pass == 1) {
+                grid.addLine({
+                    lay.desc.name,
+                    Format(L"%llu", counter.lines),
+                    Format(L"%llu", count),
+                    Format(L"%llu", bytes),
+                    Format(L"%.2f", counter.lines == 0 ? 0.0 : double(count) / double(counter.lines))
+                });
+            }
+        }
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// JSON baselines.
+//----------------------------------------------------------------------------
+
+void SaveBaseline(BenchOptions& opt, const std::vector<Result>& results)
+{
+    std::ofstream file(opt.baseline);
+    if (!file) {
+        opt.fatal("cannot create " + opt.baseline);
+    }
+    file << "{" << std::endl << "  \"benchmarks\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r(results[i]);
+        file << "    {\"name\": \"" << r.name << "\""
+             << ", \"iterations\": " << r.iterations
+             << ", \"samples\": " << r.samples
+             << ", \"median_ns\": " << r.median
+             << ", \"q1_ns\": " << r.q1
+             << ", \"q3_ns\": " << r.q3
+             << ", \"min_ns\": " << r.min
+             << ", \"mean_ns\": " << r.mean
+             << ", \"allocs\": " << r.allocs
+             << ", \"bytes\": " << r.bytes << "}"
+             << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    file << "  ]" << std::endl << "}" << std::endl;
+}
+
+// Read a baseline which was written by SaveBaseline(): an array of flat objects.
+bool LoadBaseline(BenchOptions& opt, std::map<std::string, Result>& results)
+{
+    std::ifstream file(opt.compare);
+    if (!file) {
+        opt.error("cannot open " + opt.compare);
+        return false;
+    }
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // Skip the outer object, each inner object is one result.
+    size_t pos = text.find('[');
+    while (pos != std::string::npos && (pos = text.find('{', pos)) != std::string::npos) {
+        Result res;
+        const size_t end = text.find('}', pos);
+        if (end == std::string::npos) {
+            break;
+        }
+        const std::string obj(text.substr(pos + 1, end - pos - 1));
+        pos = end + 1;
+        for (size_t p = obj.find('"'); p != std::string::npos; p = obj.find('"', p)) {
+            const size_t kend = obj.find('"', p + 1);
+            const size_t colon = kend == std::string::npos ? kend : obj.find(':', kend);
+            if (colon == std::string::npos) {
+                break;
+            }
+            const std::string key(obj.substr(p + 1, kend - p - 1));
+            size_t vstart = obj.find_first_not_of(" \t\r\n", colon + 1);
+            if (vstart == std::string::npos) {
+                break;
+            }
+            if (obj[vstart] == '"') {
+                const size_t vend = obj.find('"', vstart + 1);
+                if (key == "name" && vend != std::string::npos) {
+                    res.name = obj.substr(vstart + 1, vend - vstart - 1);
+                }
+                p = vend == std::string::npos ? vend : vend + 1;
+            }
+            else {
+                const double value = std::strtod(obj.c_str() + vstart, nullptr);
+                if (key == "iterations") { res.iterations = uint64_t(value); }
+                else if (key == "samples") { res.samples = uint64_t(value); }
+                else if (key == "median_ns") { res.median = value; }
+                else if (key == "q1_ns") { res.q1 = value; }
+                else if (key == "q3_ns") { res.q3 = value; }
+                else if (key == "min_ns") { res.min = value; }
+                else if (key == "mean_ns") { res.mean = value; }
+                else if (key == "allocs") { res.allocs = value; }
+                else if (key == "bytes") { res.bytes = value; }
+                p = obj.find_first_of(",", vstart);
+            }
+        }
+        if (!res.name.empty()) {
+            results[res.name] = res;
+        }
+    }
+    if (results.empty()) {
+        opt.error("no benchmark in " + opt.compare);
+        return false;
+    }
+    return true;
+}
+
+
+//---------------------------------------------------------------------------
+// Application entry point.
+//---------------------------------------------------------------------------
+
+int wmain(int argc, wchar_t* argv[])
+{
+    // Parse command line options.
+    BenchOptions opt(argc, argv);
+
+    // Build the fixtures.
+    Fixture fix(opt);
+    if (!fix.load(opt.inputs)) {
+        opt.fatal(L"no valid keyboard layout");
+    }
+
+    NullBuffer null_buffer;
+    std::ostream null_output(&null_buffer);
+
+    // All benchmarks, one operation is one pass over all layouts.
+    std::vector<std::pair<std::string, std::function<uint64_t()>>> benchmarks {
+        {"Format", [&fix]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                for (size_t i = 0; i < lay.chars.size(); ++i) {
+                    n += Format(L"%s: %d 0x%04X", lay.desc.name.c_str(), int(i), lay.chars[i]).size();
+                }
+            }
+            return n;
+        }},
+        {"ToUTF8", [&fix]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                n += ToUTF8(lay.chars).size();
+            }
+            return n;
+        }},
+        {"ToUTF16", [&fix]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                n += ToUTF16(lay.utf8).size();
+            }
+            return n;
+        }},
+        {"FromHexa", [&fix]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                for (const auto& s : lay.hexa) {
+                    uint32_t value = 0;
+                    n += FromHexa(value, s) ? value : 0;
+                }
+            }
+            return n;
+        }},
+        {"PrintHexa", [&fix, &null_output]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                PrintHexa(null_output, lay.tables->pusVSCtoVK, lay.tables->bMaxVSCtoVK * sizeof(USHORT), L"  ", true);
+                n += lay.tables->bMaxVSCtoVK;
+            }
+            return n;
+        }},
+        {"IsZero", [&fix]() {
+            uint64_t n = 0;
+            for (size_t i = 0; i < fix.layouts.size(); ++i) {
+                n += IsZero(fix.zeroes.data(), fix.zeroes.size());
+            }
+            return n;
+        }},
+        {"Grid::addLine", [&fix]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                Grid grid;
+                for (const auto& line : lay.lines) {
+                    grid.addLine(line);
+                }
+                n += lay.lines.size();
+            }
+            return n;
+        }},
+        {"Grid::removeEmptyColumns", [&fix]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                Grid grid;
+                for (const auto& line : lay.lines) {
+                    grid.addLine(line);
+                }
+                grid.removeEmptyColumns(0, true);
+                n += lay.lines.size();
+            }
+            return n;
+        }},
+        {"Grid::print", [&fix, &null_output]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                Grid grid;
+                for (const auto& line : lay.lines) {
+                    grid.addLine(line);
+                }
+                grid.print(null_output);
+                n += lay.lines.size();
+            }
+            return n;
+        }},
+        {"WinKeyMap::buildKeyMap", [&fix]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                WinKeyMap map(lay.tables);
+                WinKeyVector keys;
+                map.buildKeyMap(keys);
+                n += keys.size();
+            }
+            return n;
+        }},
+        {"WinKeyMap::characters", [&fix]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                WinKeyMap map(lay.tables);
+                for (const KeyChar& kc : map.characters()) {
+                    n += kc.wc;
+                }
+            }
+            return n;
+        }},
+        {"SymbolTable::vk", [&fix]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                for (const auto& key : lay.desc.keys) {
+                    n += vk_symbols.find(Value(key.vk)) != vk_symbols.end();
+                }
+            }
+            return n;
+        }},
+        {"KbdModel::find", [&fix]() {
+            // Compile-time model of kbdfrapple, validated when this file is compiled.
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                for (wchar_t c : lay.chars) {
+                    n += kbd_model.find(c) != nullptr;
+                }
+            }
+            return n;
+        }},
+        {"SymbolTable::wchar", [&fix]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                for (wchar_t c : lay.chars) {
+                    n += wchar_symbols.find(Value(c)) != wchar_symbols.end();
+                }
+            }
+            return n;
+        }},
+        {"SourceGenerator::generate", [&fix, &null_output]() {
+            uint64_t n = 0;
+            for (const auto& lay : fix.layouts) {
+                SourceGenerator gen(null_output);
+                gen.input = lay.desc.name;
+                gen.generate(*lay.tables);
+                n += lay.desc.keys.size();
+            }
+            return n;
+        }},
+    };
+
+    // Run the selected benchmarks.
+    const std::string filter(ToUTF8(opt.filter));
+    std::vector<Result> results;
+    for (const auto& bench : benchmarks) {
+        if (filter.empty() || bench.first.find(filter) != std::string::npos) {
+            opt.verbose("running " + bench.first);
+            results.push_back(Run(opt, bench.first, bench.second));
+        }
+    }
+    if (!opt.baseline.empty()) {
+        SaveBaseline(opt, results);
+    }
+
+    // Load the baseline to compare with.
+    std::map<std::string, Result> base;
+    const bool compare = !opt.compare.empty();
+    if (compare && !LoadBaseline(opt, base)) {
+        opt.exit(EXIT_FAILURE);
+    }
+
+    // Display the results.
+    Grid grid;
+    Grid::Line headers({L"Benchmark", L"Median(ns)", L"Q1(ns)", L"Q3(ns)", L"Min(ns)", L"Allocs", L"Bytes"});
+    if (compare) {
+        headers.insert(headers.end(), {L"Base(ns)", L"Change", L"Status"});
+    }
+    grid.addLine(headers);
+    grid.addUnderlines();
+    size_t regressions = 0;
+    for (const auto& r : results) {
+        Grid::Line line({
+            ToUTF16(r.name),
+            Format(L"%.1f", r.median),
+            Format(L"%.1f", r.q1),
+            Format(L"%.1f", r.q3),
+            Format(L"%.1f", r.min),
+            Format(L"%.1f", r.allocs),
+            Format(L"%.1f", r.bytes)
+        });
+        if (compare) {
+            const auto it = base.find(r.name);
+            if (it == base.end()) {
+                line.insert(line.end(), {L"", L"", L"new"});
+            }
+            else {
+                const Result& b(it->second);
+                const double change = b.median > 0 ? 100.0 * (r.median - b.median) / b.median : 0.0;
+                const bool slower = change > double(opt.threshold) && r.q1 > b.q3;
+                const bool faster = change < -double(opt.threshold) && r.q3 < b.q1;
+                const bool more_allocs = r.allocs > b.allocs;
+                regressions += slower || more_allocs;
+                line.insert(line.end(), {
+                    Format(L"%.1f", b.median),
+                    Format(L"%+.1f%%", change),
+                    slower || more_allocs ? L"REGRESSION" : (faster ? L"improved" : L"ok")
+                });
+            }
+        }
+        grid.addLine(line);
+    }
+
+    opt.setOutput(opt.output);
+    grid.setSpacing(2);
+    grid.print(opt.out());
+    opt.out() << std::endl << Format(L"%llu layouts, %llu samples per benchmark", uint64_t(fix.layouts.size()), uint64_t(opt.samples)) << std::endl;
+
+    // Allocations of the source generator per layout, when it is benchmarked.
+    if (std::string("SourceGenerator::generate").find(filter) != std::string::npos) {
+        Grid allocs;
+        AddGeneratorAllocations(allocs, fix);
+        allocs.setSpacing(2);
+        opt.out() << std::endl;
+        allocs.print(opt.out());
+    }
+    if (regressions > 0) {
+        opt.error(Format(L"%llu regressions from %s", uint64_t(regressions), opt.compare.c_str()));
+        opt.exit(EXIT_FAILURE);
+    }
+    opt.exit(EXIT_SUCCESS);
+}
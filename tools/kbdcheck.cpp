@@ -0,0 +1,220 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Validation of untrusted keyboard tables.
+//
+//----------------------------------------------------------------------------
+
+#include "kbdcheck.h"
+#include "stats.h"
+
+
+//----------------------------------------------------------------------------
+// A class to check keyboard tables in a memory range.
+//----------------------------------------------------------------------------
+
+class KbdChecker
+{
+public:
+    // Upper bounds of the modifier fields.
+    static constexpr WORD MAX_MOD_BITS = 0xFF;
+    static constexpr BYTE MAX_MODIFICATIONS = BYTE((0xFF - offsetof(VK_TO_WCHARS1, wch)) / sizeof(WCHAR));
+
+    // Constructor.
+    KbdChecker(const void* base, size_t size, Error& err);
+
+    // Check complete tables.
+    bool check(const KBDTABLES* tables);
+
+private:
+    const uint8_t* _base;
+    const uint8_t* _end;
+    Error&         _err;
+
+    // Check if an address range is entirely inside the memory range.
+    bool inRange(const void* addr, size_t size) const;
+
+    // Report an error in a named structure and return false.
+    bool fail(const WString& name, const WString& message);
+
+    // Check a nul-terminated string. A null pointer is valid.
+    bool checkString(const wchar_t* str, const WString& name);
+
+    // Check an array of variable-size entries, up to the last one.
+    // IS_LAST is a predicate on one entry. CHECK_ENTRY is called on each entry before the last one.
+    template <typename T, class IS_LAST, class CHECK_ENTRY>
+    bool checkArray(const T* first, size_t entry_size, const WString& name, IS_LAST is_last, CHECK_ENTRY check_entry);
+
+    // Same as checkArray with fixed-size entries and no specific check per entry.
+    template <typename T, class IS_LAST>
+    bool checkArray(const T* first, const WString& name, IS_LAST is_last)
+    {
+        return checkArray(first, sizeof(T), name, is_last, [](const T*, size_t) { return true; });
+    }
+};
+
+//----------------------------------------------------------------------------
+
+KbdChecker::KbdChecker(const void* base, size_t size, Error& err) :
+    _base(reinterpret_cast<const uint8_t*>(base)),
+    _end(reinterpret_cast<const uint8_t*>(base) + size),
+    _err(err)
+{
+}
+
+bool KbdChecker::inRange(const void* addr, size_t size) const
+{
+    const uint8_t* const p = reinterpret_cast<const uint8_t*>(addr);
+    return p >= _base && p < _end && size <= size_t(_end - p);
+}
+
+bool KbdChecker::fail(const WString& name, const WString& message)
+{
+    _err.error(L"invalid keyboard tables, " + name + L": " + message);
+    return false;
+}
+
+bool KbdChecker::checkString(const wchar_t* str, const WString& name)
+{
+    for (const wchar_t* p = str; p != nullptr; ++p) {
+        if (!inRange(p, sizeof(wchar_t))) {
+            return fail(name, L"string out of range");
+        }
+        if (*p == 0) {
+            break;
+        }
+    }
+    return true;
+}
+
+template <typename T, class IS_LAST, class CHECK_ENTRY>
+bool KbdChecker::checkArray(const T* first, size_t entry_size, const WString& name, IS_LAST is_last, CHECK_ENTRY check_entry)
+{
+    if (entry_size == 0) {
+        return fail(name, L"null entry size");
+    }
+    for (size_t i = 0; ; ++i) {
+        const T* entry = reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(first) + i * entry_size);
+        if (!inRange(entry, entry_size)) {
+            return fail(name, Format(L"entry #%d out of range", int(i)));
+        }
+        if (is_last(entry)) {
+            return true;
+        }
+        if (!check_entry(entry, i)) {
+            return false;
+        }
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Check complete tables.
+//----------------------------------------------------------------------------
+
+bool KbdChecker::check(const KBDTABLES* tables)
+{
+    if (tables == nullptr || !inRange(tables, sizeof(KBDTABLES))) {
+        return fail(L"kbd_tables", L"out of range");
+    }
+
+    // Modifiers and associated virtual keys.
+    const MODIFIERS* mods = tables->pCharModifiers;
+    if (mods != nullptr) {
+        if (!inRange(mods, offsetof(MODIFIERS, ModNumber)) || !inRange(mods->ModNumber, size_t(mods->wMaxModBits) + 1)) {
+            return fail(L"char_modifiers", L"out of range");
+        }
+        // Modifier bits are a BYTE in VK_TO_BIT, a larger combination is never reached.
+        if (mods->wMaxModBits > MAX_MOD_BITS) {
+            return fail(L"char_modifiers", Format(L"max modifier bits %d too large", int(mods->wMaxModBits)));
+        }
+        if (mods->pVkToBit != nullptr && !checkArray(mods->pVkToBit, L"vk_to_bits", [](const VK_TO_BIT* e) { return e->Vk == 0; })) {
+            return false;
+        }
+    }
+
+    // Virtual keys to characters, one sub-table per number of shift states.
+    if (tables->pVkToWcharTable != nullptr) {
+        const bool ok = checkArray(tables->pVkToWcharTable, sizeof(VK_TO_WCHAR_TABLE), L"vk_to_wchar",
+            [](const VK_TO_WCHAR_TABLE* e) { return e->pVkToWchars == nullptr; },
+            [this](const VK_TO_WCHAR_TABLE* e, size_t index) {
+                const WString name(Format(L"vk_to_wchar%d (#%d)", e->nModifications, int(index)));
+                // All columns must be inside a row of cbSize bytes.
+                if (e->nModifications == 0 || e->nModifications > MAX_MODIFICATIONS) {
+                    return fail(name, Format(L"invalid number of modifications %d", e->nModifications));
+                }
+                if (e->cbSize < offsetof(VK_TO_WCHARS1, wch) + e->nModifications * sizeof(WCHAR)) {
+                    return fail(name, Format(L"entry size %d too short", e->cbSize));
+                }
+                return checkArray(e->pVkToWchars, e->cbSize, name, [](const VK_TO_WCHARS1* v) { return v->VirtualKey == 0; }, [](const VK_TO_WCHARS1*, size_t) { return true; });
+            });
+        if (!ok) {
+            return false;
+        }
+    }
+
+    // Dead keys and their names.
+    if (tables->pDeadKey != nullptr && !checkArray(tables->pDeadKey, L"dead_keys", [](const DEADKEY* e) { return e->dwBoth == 0; })) {
+        return false;
+    }
+    if (tables->pKeyNamesDead != nullptr) {
+        const bool ok = checkArray(tables->pKeyNamesDead, sizeof(DEADKEY_LPWSTR), L"key_names_dead",
+            [](const DEADKEY_LPWSTR* e) { return *e == nullptr; },
+            [this](const DEADKEY_LPWSTR* e, size_t) { return checkString(*e, L"key_names_dead"); });
+        if (!ok) {
+            return false;
+        }
+    }
+
+    // Scan codes to key names.
+    const auto last_vsc = [](const VSC_LPWSTR* e) { return e->vsc == 0; };
+    const auto check_vsc = [this](const VSC_LPWSTR* e, size_t) { return checkString(e->pwsz, L"key_names"); };
+    if (tables->pKeyNames != nullptr && !checkArray(tables->pKeyNames, sizeof(VSC_LPWSTR), L"key_names", last_vsc, check_vsc)) {
+        return false;
+    }
+    if (tables->pKeyNamesExt != nullptr && !checkArray(tables->pKeyNamesExt, sizeof(VSC_LPWSTR), L"key_names_ext", last_vsc, check_vsc)) {
+        return false;
+    }
+
+    // Scan codes to virtual keys.
+    if (tables->pusVSCtoVK != nullptr && !inRange(tables->pusVSCtoVK, tables->bMaxVSCtoVK * sizeof(USHORT))) {
+        return fail(L"scancode_to_vk", L"out of range");
+    }
+    const auto last_vsc_vk = [](const VSC_VK* e) { return e->Vsc == 0; };
+    if (tables->pVSCtoVK_E0 != nullptr && !checkArray(tables->pVSCtoVK_E0, L"scancode_to_vk_e0", last_vsc_vk)) {
+        return false;
+    }
+    if (tables->pVSCtoVK_E1 != nullptr && !checkArray(tables->pVSCtoVK_E1, L"scancode_to_vk_e1", last_vsc_vk)) {
+        return false;
+    }
+
+    // Ligatures, variable-size entries.
+    if (tables->pLigature != nullptr) {
+        if (tables->cbLgEntry < offsetof(LIGATURE1, wch) + tables->nLgMax * sizeof(WCHAR)) {
+            return fail(L"ligatures", Format(L"entry size %d too short", tables->cbLgEntry));
+        }
+        const bool ok = checkArray(tables->pLigature, tables->cbLgEntry, L"ligatures",
+            [](const LIGATURE1* e) { return e->VirtualKey == 0; },
+            [](const LIGATURE1*, size_t) { return true; });
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Check that all data structures in a KBDTABLES are in a memory range.
+//----------------------------------------------------------------------------
+
+bool CheckKbdTables(const KBDTABLES* tables, const void* base, size_t size, Error& err)
+{
+    Stats::Timer timer("table check");
+    KbdChecker checker(base, size, err);
+    return checker.check(tables);
+}
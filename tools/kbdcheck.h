@@ -0,0 +1,19 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Validation of untrusted keyboard tables.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "error.h"
+
+// Check that all data structures which are referenced from a KBDTABLES are
+// entirely contained in a memory range (typically the image of the DLL).
+// All pointers, variable-size entries and zero terminators are checked.
+// After a successful check, the tables can be walked without bounds checking.
+// Report the first inconsistency and return false if the tables are invalid.
+bool CheckKbdTables(const KBDTABLES* tables, const void* base, size_t size, Error& err);
@@ -0,0 +1,129 @@
+﻿# Check that the committed sources of the keyboard layouts are up to date.
+#
+# All layout descriptions (.kbl) in the "keyboards" directory are compiled
+# using kbdcompile in a work directory. The generated C source file and
+# strings.h of each layout must be identical to the committed ones. The
+# committed source files are first copied in the work directory, so that
+# kbdcompile keeps their header comment lines, as it does in place.
+#
+# The committed source files are also the golden output of the source
+# generator from compiled tables: the layout DLL's of the current
+# architecture, when they are built, are reversed using kbdreverse and
+# the generated source files must be identical to the committed ones.
+# The compile-time model header (kbdreverse -M) of each of these DLL's is
+# also generated in the work directory. The models are not committed, the
+# projects which use them generate them during the build.
+#
+# The exit code is non-zero when a layout cannot be compiled or when a
+# generated file differs from the committed one.
+
+[CmdletBinding(SupportsShouldProcess=$true)]
+param(
+    [switch]$NoBuild = $false,
+    [switch]$NoPause = $false
+)
+
+# A function to exit this script.
+function Exit-Script([string]$Message = "", [int]$Status = 0)
+{
+    if ($Message -ne "") {
+        Write-Host "ERROR: $Message"
+        $Status = 1
+    }
+    if (-not $NoPause) {
+        pause
+    }
+    exit $Status
+}
+
+$RootDir = (Resolve-Path "$PSScriptRoot\..\..").Path
+$ProjectSolutionFile = "$RootDir\winkbdlayouts.sln"
+$KeyboardsDir = "$RootDir\keyboards"
+$WorkDir = "$PSScriptRoot\work"
+
+# Current architecture.
+$OSArch = (Get-WmiObject Win32_OperatingSystem).OSArchitecture
+$Arch = if ($OSArch -like "*arm*") {"arm64"} elseif ($OSArch -like "*64*") {"x64"} else {"x86"}
+
+# Find MSBuild
+if (-not $NoBuild) {
+    Write-Output "Searching MSBuild..."
+    $MSRoots = @("C:\Program Files*\MSBuild", "C:\Program Files*\Microsoft Visual Studio")
+    $MSBuild = Get-ChildItem $MSRoots -Recurse -Include MSBuild.exe -ErrorAction Ignore | ForEach-Object { $_.FullName} | Select-Object -First 1
+    if ($MSBuild -eq $null) {
+        Exit-Script "MSBuild not found"
+    }
+    Write-Output "MSBuild: $MSBuild"
+    & $MSBuild $ProjectSolutionFile /nologo /property:Configuration=Release /property:Platform=$Arch "/target:kbdcompile;kbdreverse"
+}
+$Compile = "$RootDir\$Arch\Release\kbdcompile.exe"
+$Reverse = "$RootDir\$Arch\Release\kbdreverse.exe"
+if (-not (Test-Path $Compile)) {
+    Exit-Script "$Compile not found"
+}
+
+# Copy the committed source files in the work directory.
+Remove-Item $WorkDir -Recurse -Force -ErrorAction SilentlyContinue
+[void](New-Item -ItemType Directory -Force $WorkDir)
+$Layouts = Get-ChildItem "$KeyboardsDir\*\*.kbl" | ForEach-Object { $_.BaseName }
+foreach ($Name in $Layouts) {
+    [void](New-Item -ItemType Directory -Force "$WorkDir\$Name")
+    Copy-Item "$KeyboardsDir\$Name\$Name.c" "$WorkDir\$Name\$Name.c" -ErrorAction SilentlyContinue
+    Copy-Item "$KeyboardsDir\$Name\$Name.c" "$WorkDir\$Name\reversed.c" -ErrorAction SilentlyContinue
+}
+
+# Compile all descriptions, without binary models and project files.
+& $Compile -n -p -d $WorkDir $KeyboardsDir
+if ($LASTEXITCODE -ne 0) {
+    Exit-Script "kbdcompile failed"
+}
+
+# Reverse the layout DLL's, keeping the header comment lines of the copies.
+$Failed = 0
+$Reversed = @{}
+if (Test-Path $Reverse) {
+    foreach ($Name in $Layouts) {
+        $Dll = "$RootDir\$Arch\Release\$Name.dll"
+        if (Test-Path $Dll) {
+            & $Reverse -p -u "$WorkDir\$Name\reversed.c" $Dll
+            if ($LASTEXITCODE -eq 0) {
+                $Reversed[$Name] = $true
+            }
+            else {
+                Write-Output "$($Name): kbdreverse failed on $Dll"
+                $Failed++
+            }
+            & $Reverse -p -M -o "$WorkDir\$Name\$($Name)_model.h" $Dll
+            if ($LASTEXITCODE -ne 0) {
+                Write-Output "$($Name): kbdreverse -M failed on $Dll"
+                $Failed++
+            }
+        }
+    }
+}
+Write-Output "$($Reversed.Count) layout DLL's reversed for $Arch"
+
+# Compare the generated files with the committed ones.
+foreach ($Name in $Layouts) {
+    $Files = @(@("$Name.c", "$Name.c"), @("strings.h", "strings.h"))
+    if ($Reversed.ContainsKey($Name)) {
+        $Files += ,@("$Name.c", "reversed.c")
+    }
+    foreach ($Pair in $Files) {
+        $File = $Pair[1]
+        $Text1 = Get-Content "$KeyboardsDir\$Name\$($Pair[0])" -ErrorAction SilentlyContinue
+        $Text2 = Get-Content "$WorkDir\$Name\$File" -ErrorAction SilentlyContinue
+        for ($i = 0; $i -lt [Math]::Max($Text1.Count, $Text2.Count); $i++) {
+            if ($Text1[$i] -ne $Text2[$i]) {
+                Write-Output "$Name\$($File): differ at line $($i + 1)"
+                Write-Output "  < $($Text1[$i])"
+                Write-Output "  > $($Text2[$i])"
+                $Failed++
+                break
+            }
+        }
+    }
+}
+Write-Output "$($Layouts.Count) layouts, $Failed errors or files which differ"
+Write-Output "Work files in $WorkDir"
+Exit-Script -Status $(if ($Failed -eq 0) {0} else {1})
@@ -0,0 +1,259 @@
+//---------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Utility to compile layout descriptions and MSKLC source files into keyboard
+// layout projects.
+//
+//---------------------------------------------------------------------------
+
+#include "options.h"
+#include "strutils.h"
+#include "winutils.h"
+#include "grid.h"
+#include "layoutdesc.h"
+#include "klcreader.h"
+#include "layoutproject.h"
+#include "fingerprint.h"
+#include "stats.h"
+#include "taskrunner.h"
+#include <thread>
+
+// Configure the terminal console on init, restore on exit.
+ConsoleState state;
+
+
+//----------------------------------------------------------------------------
+// Command line options.
+//----------------------------------------------------------------------------
+
+class CompileOptions : public Options
+{
+public:
+    // Constructor.
+    CompileOptions(int argc, wchar_t* argv[]);
+
+    // Command line options.
+    WStringVector inputs;
+    WString       directory;
+    bool          check_only;
+    bool          model;
+    bool          project;
+    bool          description;
+    size_t        threads;
+
+    // Add all layout descriptions or MSKLC files in a directory and its subdirectories.
+    void addDirectory(const WString& dir);
+    void addFiles(const WString& dir);
+};
+
+CompileOptions::CompileOptions(int argc, wchar_t* argv[]) :
+    Options(argc, argv,
+        L"[options] description-file-or-directory ...\n"
+        L"\n"
+        L"  description-file-or-directory : Either a layout description file (.kbl),\n"
+        L"  an MSKLC source file (.klc) or a directory, meaning all .kbl and .klc files\n"
+        L"  in that directory and its immediate subdirectories, for instance the\n"
+        L"  \"keyboards\" directory. The project of an MSKLC file is generated in a\n"
+        L"  subdirectory with the layout name, next to the MSKLC file.\n"
+        L"\n"
+        L"Options:\n"
+        L"\n"
+        L"  -c : check the descriptions only, do not generate any file\n"
+        L"  -d directory : output directory, the files of each layout are generated\n"
+        L"     in a subdirectory with the layout name, default: same directory as\n"
+        L"     the description\n"
+        L"  -h : display this help text\n"
+        L"  -k : also generate the layout description (.kbl) of MSKLC files\n"
+        L"  -n : do not generate the binary models (.kbm)\n"
+        L"  -p : do not generate the project files (.vcxproj) when they are missing\n"
+        L"  -t count : number of threads, default is the number of processors\n"
+        L"  -v : verbose mode, display the fingerprint of each layout\n"
+        L"  --stats[=text|json] : display performance statistics on standard error"),
+    inputs(),
+    directory(),
+    check_only(false),
+    model(true),
+    project(true),
+    description(false),
+    threads(std::max<size_t>(1, std::thread::hardware_concurrency()))
+{
+    // Parse arguments.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == L"--help" || args[i] == L"-h") {
+            usage();
+        }
+        else if (args[i] == L"-c") {
+            check_only = true;
+        }
+        else if (args[i] == L"-d" && i + 1 < args.size()) {
+            directory = args[++i];
+        }
+        else if (args[i] == L"-k") {
+            description = true;
+        }
+        else if (args[i] == L"-n") {
+            model = false;
+        }
+        else if (args[i] == L"-p") {
+            project = false;
+        }
+        else if (args[i] == L"-t" && i + 1 < args.size()) {
+            threads = size_t(ToInt64(args[++i]));
+            if (threads == 0 || threads > MAX_THREADS || !IsDecimal(args[i])) {
+                fatal("invalid thread count '" + args[i] + "'");
+            }
+        }
+        else if (args[i] == L"-v") {
+            setVerbose(true);
+        }
+        else if (!args[i].empty() && args[i][0] == L'-') {
+            fatal("invalid option '" + args[i] + "', try --help");
+        }
+        else if (IsDirectory(args[i])) {
+            addDirectory(args[i]);
+        }
+        else {
+            inputs.push_back(args[i]);
+        }
+    }
+    if (inputs.empty()) {
+        fatal(L"no layout description specified, try --help");
+    }
+}
+
+void CompileOptions::addDirectory(const WString& dir)
+{
+    addFiles(dir);
+    WStringList subdirs;
+    if (!SearchFiles(subdirs, dir, L"*")) {
+        fatal("error searching " + dir);
+    }
+    for (const auto& sub : subdirs) {
+        const WString path(dir + L"\\" + sub);
+        if (IsDirectory(path)) {
+            addFiles(path);
+        }
+    }
+}
+
+void CompileOptions::addFiles(const WString& dir)
+{
+    for (const auto& ext : {LayoutDescription::FILE_EXTENSION, KlcReader::FILE_EXTENSION}) {
+        WStringList files;
+        if (!SearchFiles(files, dir, L"*" + ext)) {
+            fatal("error searching " + dir);
+        }
+        for (const auto& file : files) {
+            inputs.push_back(dir + L"\\" + file);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Compile one layout description. Return false on error.
+// The line of the layout in the verbose grid is returned in 'line'.
+//---------------------------------------------------------------------------
+
+bool Compile(const CompileOptions& opt, Error& err, WStringVector& line, const WString& input)
+{
+    LayoutDescription desc(err);
+    const bool klc = EndsWith(ToLower(input), KlcReader::FILE_EXTENSION);
+    if (klc) {
+        KlcReader reader(err);
+        if (!reader.load(desc, input)) {
+            return false;
+        }
+    }
+    else if (!desc.load(input)) {
+        return false;
+    }
+    const KBDTABLES& tables(desc.tables());
+
+    LayoutFingerprint fp;
+    fp.build(tables);
+    line = {desc.name, fp.toString(), input};
+
+    if (!opt.check_only) {
+        Stats::Timer timer("project generation");
+        LayoutProject project(err);
+        if (!opt.directory.empty()) {
+            project.directory = opt.directory + L"\\" + desc.name;
+        }
+        else if (klc) {
+            project.directory = DirName(input) + L"\\" + desc.name;
+        }
+        else {
+            project.directory = DirName(input);
+        }
+        project.name = desc.name;
+        project.text = desc.text;
+        project.lang = desc.lang;
+        project.input = FileName(input);
+        project.model = opt.model;
+        project.project = opt.project;
+        if (desc.text.empty() || desc.lang.empty()) {
+            err.warning("no text or lang in " + input + ", strings.h not generated");
+            project.strings = false;
+        }
+        if (!project.generate(tables)) {
+            return false;
+        }
+        if (klc && opt.description) {
+            const WString filename(project.directory + L"\\" + desc.name + LayoutDescription::FILE_EXTENSION);
+            std::ofstream file(filename);
+            file << UTF8_BOM;
+            desc.write(file);
+            file.close();
+            if (!file) {
+                err.error("error writing " + filename);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+//---------------------------------------------------------------------------
+// Application entry point.
+//---------------------------------------------------------------------------
+
+int wmain(int argc, wchar_t* argv[])
+{
+    // Parse command line options.
+    CompileOptions opt(argc, argv);
+
+    Grid grid;
+    grid.addLine({L"Layout", L"Fingerprint", L"Description"});
+    grid.addUnderlines();
+
+    // Compile all descriptions in parallel, continue on error. Messages and
+    // grid lines are reported in input order.
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<WStringVector> lines(opt.inputs.size());
+    TaskRunner runner(opt);
+    runner.threads = opt.threads;
+    runner.run(opt.inputs.size(),
+        [&opt, &lines](size_t index, TaskError& err) {
+            return Compile(opt, err, lines[index], opt.inputs[index]);
+        },
+        [&grid, &lines](size_t index, bool) {
+            if (!lines[index].empty()) {
+                grid.addLine(lines[index]);
+            }
+        });
+    const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    Stats::Instance().count("layouts", opt.inputs.size());
+
+    if (opt.verbose()) {
+        grid.setSpacing(2);
+        grid.print(std::cout);
+    }
+    runner.summary(L"layouts");
+    opt.verbose(Format(L"%.3f ms", double(duration.count()) / 1000.0));
+    opt.exit(runner.failed() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
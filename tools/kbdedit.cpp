@@ -0,0 +1,71 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Modifiable copy of keyboard tables.
+//
+//----------------------------------------------------------------------------
+
+#include "kbdedit.h"
+#include "stats.h"
+
+
+//----------------------------------------------------------------------------
+// Constructor.
+//----------------------------------------------------------------------------
+
+KbdTablesEditor::KbdTablesEditor(const KBDTABLES& original) :
+    _tables(original),
+    _vtwt(),
+    _entries()
+{
+    size_t allocated = 0;
+    for (const VK_TO_WCHAR_TABLE* tab = original.pVkToWcharTable; tab != nullptr; tab++) {
+        _vtwt.push_back(*tab);
+        if (tab->pVkToWchars == nullptr) {
+            break;
+        }
+        // Copy all entries, including the final null one.
+        const uint8_t* const start = reinterpret_cast<const uint8_t*>(tab->pVkToWchars);
+        const uint8_t* end = start;
+        while (reinterpret_cast<const VK_TO_WCHARS1*>(end)->VirtualKey != 0) {
+            end += tab->cbSize;
+        }
+        end += tab->cbSize;
+        _entries.emplace_back(start, end);
+        allocated += _entries.back().size();
+    }
+
+    // Point to the copies. The vectors are no longer resized.
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        _vtwt[i].pVkToWchars = reinterpret_cast<PVK_TO_WCHARS1>(_entries[i].data());
+    }
+    _tables.pVkToWcharTable = _vtwt.empty() ? nullptr : _vtwt.data();
+    Stats::Instance().allocate("tables copy", allocated + _vtwt.size() * sizeof(VK_TO_WCHAR_TABLE));
+}
+
+
+//----------------------------------------------------------------------------
+// Get the first VK_TO_WCHARS entry of a virtual key.
+//----------------------------------------------------------------------------
+
+VK_TO_WCHARS10* KbdTablesEditor::entry(uint16_t vk, size_t& columns)
+{
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        const size_t size = _vtwt[i].cbSize;
+        for (size_t off = 0; off + size <= _entries[i].size(); off += size) {
+            VK_TO_WCHARS10* e = reinterpret_cast<VK_TO_WCHARS10*>(_entries[i].data() + off);
+            if (e->VirtualKey == 0) {
+                break;
+            }
+            if (e->VirtualKey == vk) {
+                columns = _vtwt[i].nModifications;
+                return e;
+            }
+        }
+    }
+    columns = 0;
+    return nullptr;
+}
@@ -0,0 +1,39 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Modifiable copy of keyboard tables.
+//
+// Only the VK_TO_WCHARS tables are copied and can be modified. All other
+// structures are shared with the original tables, which must remain loaded
+// while the copy is used.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "platform.h"
+
+class KbdTablesEditor
+{
+public:
+    // Constructor. Copy the original tables.
+    KbdTablesEditor(const KBDTABLES& original);
+
+    // Get the modified tables.
+    const KBDTABLES& tables() const { return _tables; }
+
+    // Get the first VK_TO_WCHARS entry of a virtual key. Return nullptr if not found.
+    // The entry has the largest type, only the first columns() characters are valid.
+    VK_TO_WCHARS10* entry(uint16_t vk, size_t& columns);
+
+private:
+    KBDTABLES                         _tables;
+    std::vector<VK_TO_WCHAR_TABLE>    _vtwt;     // Copy of the array of VK_TO_WCHARS tables.
+    std::vector<std::vector<uint8_t>> _entries;  // Copy of each VK_TO_WCHARS table.
+
+    // Inaccessible operations, the tables point to internal data.
+    KbdTablesEditor(const KbdTablesEditor&) = delete;
+    KbdTablesEditor& operator=(const KbdTablesEditor&) = delete;
+};
@@ -0,0 +1,298 @@
+//---------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Utility to compare the typing effort of text corpora on keyboard layouts.
+//
+//---------------------------------------------------------------------------
+
+#include "options.h"
+#include "strutils.h"
+#include "winutils.h"
+#include "grid.h"
+#include "kbdloader.h"
+#include "kbdmap.h"
+#include "mappedfile.h"
+#include "typingeffort.h"
+#include "utf8.h"
+#include "stats.h"
+#include <thread>
+#include <atomic>
+
+// Configure the terminal console on init, restore on exit.
+ConsoleState state;
+
+// Size of text chunks which are processed by one thread at a time.
+// The decoded text of a chunk should remain in the cache of the processor.
+#define CHUNK_SIZE (256 * 1024)
+
+
+//----------------------------------------------------------------------------
+// Command line options.
+//----------------------------------------------------------------------------
+
+class EffortOptions : public Options
+{
+public:
+    // Constructor.
+    EffortOptions(int argc, wchar_t* argv[]);
+
+    // Command line options.
+    WStringVector inputs;
+    WStringVector corpora;
+    WString       map_template;
+    WString       output;
+    size_t        threads;
+    bool          portable;
+};
+
+EffortOptions::EffortOptions(int argc, wchar_t* argv[]) :
+    Options(argc, argv,
+        L"[options] kbd-name-file-or-directory ...\n"
+        L"\n"
+        L"  kbd-name-file-or-directory : Either the file name of a keyboard layout DLL,\n"
+        L"  the name of a keyboard layout, for instance \"fr\" for C:\\Windows\\System32\\kbdfr.dll,\n"
+        L"  or a directory, meaning all kbd*.dll files in that directory.\n"
+        L"\n"
+        L"Options:\n"
+        L"\n"
+        L"  -c file : UTF-8 text corpus to analyze, can be specified several times\n"
+        L"  -g infile : keyboard map template for finger and row metrics, for instance images\\pc.txt\n"
+        L"  -h : display this help text\n"
+        L"  -o outfile : output file name, default is standard output\n"
+        L"  -p : portable loading, map the DLL without executing it (allows DLL's for other CPU's)\n"
+        L"  -t count : number of threads, default is the number of processors\n"
+        L"  --stats[=text|json] : display performance statistics on standard error"),
+    inputs(),
+    corpora(),
+    map_template(),
+    output(),
+    threads(std::max<size_t>(1, std::thread::hardware_concurrency())),
+    portable(false)
+{
+    // Parse arguments.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == L"--help" || args[i] == L"-h") {
+            usage();
+        }
+        else if (args[i] == L"-p") {
+            portable = true;
+        }
+        else if (args[i] == L"-c" && i + 1 < args.size()) {
+            corpora.push_back(args[++i]);
+        }
+        else if (args[i] == L"-g" && i + 1 < args.size()) {
+            map_template = args[++i];
+        }
+        else if (args[i] == L"-o" && i + 1 < args.size()) {
+            output = args[++i];
+        }
+        else if (args[i] == L"-t" && i + 1 < args.size()) {
+            threads = size_t(ToInt64(args[++i]));
+            if (threads == 0 || threads > MAX_THREADS || !IsDecimal(args[i])) {
+                fatal("invalid thread count '" + args[i] + "'");
+            }
+        }
+        else if (!args[i].empty() && args[i][0] == L'-') {
+            fatal("invalid option '" + args[i] + "', try --help");
+        }
+        else if (IsDirectory(args[i])) {
+            WStringList files;
+            if (!SearchFiles(files, args[i], L"kbd*.dll")) {
+                fatal("error searching " + args[i]);
+            }
+            for (const auto& file : files) {
+                inputs.push_back(args[i] + L"\\" + file);
+            }
+        }
+        else {
+            inputs.push_back(KeyboardLoader::FileName(args[i]));
+        }
+    }
+    if (inputs.empty()) {
+        fatal(L"no keyboard layout specified, try --help");
+    }
+    if (corpora.empty()) {
+        fatal(L"no text corpus specified, try --help");
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Description of one layout to analyze.
+//---------------------------------------------------------------------------
+
+class Layout
+{
+public:
+    Layout(Error& err, const WString& name) : name(name), imap(err), effort() {}
+    WString       name;
+    InverseKeyMap imap;
+    TypingEffort  effort;
+};
+
+typedef std::vector<std::unique_ptr<Layout>> LayoutVector;
+
+
+//---------------------------------------------------------------------------
+// Thread processing chunks of text, until all chunks are processed.
+// Each chunk is decoded once and analyzed on all layouts.
+//---------------------------------------------------------------------------
+
+void AnalyzeChunks(const std::vector<TextChunk>& chunks, std::atomic<size_t>& next, const LayoutVector& layouts, const KeyGeometry& geometry, std::vector<TypingEffort>& efforts, uint64_t& invalid)
+{
+    std::vector<EffortAnalyzer> analyzers;
+    for (const auto& layout : layouts) {
+        analyzers.emplace_back(layout->imap, geometry);
+    }
+    efforts.resize(layouts.size());
+    invalid = 0;
+
+    std::vector<char32_t> text(CHUNK_SIZE);
+    for (size_t index = next++; index < chunks.size(); index = next++) {
+        const uint8_t* cur = reinterpret_cast<const uint8_t*>(chunks[index].data);
+        const uint8_t* const end = cur + chunks[index].size;
+        size_t count = 0;
+        while (cur < end) {
+            const UTF8Status status = DecodeUTF8(cur, end, text[count]);
+            if (status == UTF8_OK) {
+                count++;
+            }
+            else if (status == UTF8_INVALID) {
+                invalid++;
+            }
+            else {
+                invalid++;
+                break;
+            }
+        }
+        for (size_t i = 0; i < analyzers.size(); ++i) {
+            analyzers[i].analyze(text.data(), count, efforts[i]);
+        }
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Format a ratio as a percentage.
+//---------------------------------------------------------------------------
+
+WString Percent(uint64_t value, uint64_t total)
+{
+    return total == 0 ? L"-" : Format(L"%.2f", 100.0 * double(value) / double(total));
+}
+
+WString Ratio(uint64_t value, uint64_t total)
+{
+    return total == 0 ? L"-" : Format(L"%.3f", double(value) / double(total));
+}
+
+
+//---------------------------------------------------------------------------
+// Application entry point.
+//---------------------------------------------------------------------------
+
+int wmain(int argc, wchar_t* argv[])
+{
+    // Parse command line options.
+    EffortOptions opt(argc, argv);
+
+    // Load the keyboard geometry.
+    KeyGeometry geometry;
+    if (!opt.map_template.empty()) {
+        KeyboardMap kbdmap(opt);
+        if (!kbdmap.load(opt.map_template) && kbdmap.lines().empty()) {
+            opt.fatal("error loading keyboard map template " + opt.map_template);
+        }
+        if (!geometry.build(kbdmap)) {
+            opt.fatal("no home row in keyboard map template " + opt.map_template);
+        }
+    }
+
+    // Build the inverse key maps of all layouts. Invalid layouts are skipped.
+    LayoutVector layouts;
+    KeyboardLoader loader(opt);
+    loader.portable = opt.portable;
+    for (const auto& input : opt.inputs) {
+        const KBDTABLES* tables = loader.load(input);
+        if (tables != nullptr) {
+            layouts.push_back(std::make_unique<Layout>(opt, FileBaseName(input)));
+            if (!layouts.back()->imap.build(tables)) {
+                layouts.pop_back();
+            }
+        }
+        loader.unload();
+    }
+    if (layouts.empty()) {
+        opt.fatal(L"no valid keyboard layout");
+    }
+
+    // Map all corpora in memory and split them in chunks.
+    std::vector<std::unique_ptr<MappedFile>> files;
+    std::vector<TextChunk> chunks;
+    for (const auto& name : opt.corpora) {
+        files.push_back(std::make_unique<MappedFile>(opt));
+        if (!files.back()->open(name)) {
+            opt.exit(EXIT_FAILURE);
+        }
+        SplitUTF8(chunks, files.back()->data(), files.back()->size(), CHUNK_SIZE);
+    }
+    Stats::Instance().count("text chunks", chunks.size());
+
+    // Analyze all chunks in parallel.
+    const size_t thread_count = std::min(opt.threads, std::max<size_t>(1, chunks.size()));
+    std::vector<std::vector<TypingEffort>> efforts(thread_count);
+    std::vector<uint64_t> invalid(thread_count, 0);
+    {
+        Stats::Timer timer("corpus analysis");
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_count; ++i) {
+            threads.emplace_back(AnalyzeChunks, std::cref(chunks), std::ref(next), std::cref(layouts), std::cref(geometry), std::ref(efforts[i]), std::ref(invalid[i]));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // Merge the results of all threads.
+    uint64_t invalid_bytes = 0;
+    for (size_t ti = 0; ti < thread_count; ++ti) {
+        invalid_bytes += invalid[ti];
+        for (size_t li = 0; li < layouts.size() && li < efforts[ti].size(); ++li) {
+            layouts[li]->effort.merge(efforts[ti][li]);
+        }
+    }
+    if (invalid_bytes > 0) {
+        opt.warning(Format(L"%llu invalid UTF-8 bytes in corpus", invalid_bytes));
+    }
+
+    // Display the metrics of all layouts.
+    Grid grid;
+    grid.addLine({L"Layout", L"Chars", L"Unreachable", L"Keys/char", L"Mods/char", L"Shift%", L"AltGr%", L"Dead%", L"Home%", L"SameFinger%", L"RowJump%", L"Alternate%"});
+    grid.addUnderlines();
+    for (const auto& layout : layouts) {
+        const TypingEffort& e(layout->effort);
+        const bool geo = geometry.isValid();
+        grid.addLine({
+            layout->name,
+            Format(L"%llu", e.characters),
+            Format(L"%llu", e.unreachable),
+            Ratio(e.keystrokes, e.characters - e.unreachable),
+            Ratio(e.modifiers, e.characters - e.unreachable),
+            Percent(e.shifted, e.keystrokes),
+            Percent(e.altgr, e.keystrokes),
+            Percent(e.dead_keys, e.characters - e.unreachable),
+            geo ? Percent(e.home_row, e.keystrokes) : L"-",
+            geo ? Percent(e.same_finger, e.bigrams) : L"-",
+            geo ? Percent(e.row_jumps, e.bigrams) : L"-",
+            geo ? Percent(e.alternations, e.bigrams) : L"-"
+        });
+    }
+    opt.setOutput(opt.output);
+    grid.setSpacing(2);
+    grid.print(opt.out());
+    opt.exit(EXIT_SUCCESS);
+}
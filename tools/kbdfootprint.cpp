@@ -0,0 +1,192 @@
+//---------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Utility to analyze the memory footprint of keyboard layout DLL's.
+//
+//---------------------------------------------------------------------------
+
+#include "options.h"
+#include "strutils.h"
+#include "winutils.h"
+#include "grid.h"
+#include "kbdloader.h"
+#include "footprint.h"
+#include "peimage.h"
+#include "stats.h"
+
+// Configure the terminal console on init, restore on exit.
+ConsoleState state;
+
+
+//----------------------------------------------------------------------------
+// Command line options.
+//----------------------------------------------------------------------------
+
+class FootprintOptions : public Options
+{
+public:
+    // Constructor.
+    FootprintOptions(int argc, wchar_t* argv[]);
+
+    // Command line options.
+    WStringVector inputs;
+    WString       output;
+    size_t        page_size;
+    bool          portable;
+};
+
+FootprintOptions::FootprintOptions(int argc, wchar_t* argv[]) :
+    Options(argc, argv,
+        L"[options] kbd-name-file-or-directory ...\n"
+        L"\n"
+        L"  kbd-name-file-or-directory : Either the file name of a keyboard layout DLL,\n"
+        L"  the name of a keyboard layout, for instance \"fr\" for C:\\Windows\\System32\\kbdfr.dll,\n"
+        L"  or a directory, meaning all kbd*.dll files in that directory.\n"
+        L"\n"
+        L"Options:\n"
+        L"\n"
+        L"  -h : display this help text\n"
+        L"  -o outfile : output file name, default is standard output\n"
+        L"  -p : portable loading, map the DLL without executing it (allows DLL's for other CPU's)\n"
+        L"  -s size : memory page size in bytes, default is the system page size\n"
+        L"  --stats[=text|json] : display performance statistics on standard error"),
+    inputs(),
+    output(),
+    page_size(0),
+    portable(false)
+{
+    // Parse arguments.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == L"--help" || args[i] == L"-h") {
+            usage();
+        }
+        else if (args[i] == L"-p") {
+            portable = true;
+        }
+        else if (args[i] == L"-o" && i + 1 < args.size()) {
+            output = args[++i];
+        }
+        else if (args[i] == L"-s" && i + 1 < args.size()) {
+            page_size = size_t(ToInt64(args[++i]));
+            if (page_size == 0 || (page_size & (page_size - 1)) != 0 || !IsDecimal(args[i])) {
+                fatal("invalid page size '" + args[i] + "'");
+            }
+        }
+        else if (!args[i].empty() && args[i][0] == L'-') {
+            fatal("invalid option '" + args[i] + "', try --help");
+        }
+        else if (IsDirectory(args[i])) {
+            WStringList files;
+            if (!SearchFiles(files, args[i], L"kbd*.dll")) {
+                fatal("error searching " + args[i]);
+            }
+            for (const auto& file : files) {
+                inputs.push_back(args[i] + L"\\" + file);
+            }
+        }
+        else {
+            inputs.push_back(KeyboardLoader::FileName(args[i]));
+        }
+    }
+    if (inputs.empty()) {
+        fatal(L"no keyboard layout specified, try --help");
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Add a line in the grid of layouts.
+//---------------------------------------------------------------------------
+
+void AddLayoutLine(Grid& grid, const WString& name, const LayoutFootprint& fp, size_t file_size, size_t writable_pages)
+{
+    const auto type_size = [&fp](const WString& type) {
+        const auto it = fp.types.find(type);
+        return Format(L"%llu", uint64_t(it == fp.types.end() ? 0 : it->second));
+    };
+    grid.addLine({
+        name,
+        Format(L"%llu", uint64_t(file_size)),
+        Format(L"%llu", uint64_t(writable_pages)),
+        Format(L"%llu", uint64_t(fp.total)),
+        Format(L"%llu", uint64_t(fp.pages)),
+        Format(L"%llu", uint64_t(fp.keystroke_pages)),
+        type_size(LayoutFootprint::PADDING),
+        type_size(LayoutFootprint::UNREFERENCED),
+        type_size(L"Strings"),
+        Format(L"%llu", uint64_t(fp.duplicates)),
+        Format(L"%llu", uint64_t(fp.duplicate_bytes))
+    });
+}
+
+
+//---------------------------------------------------------------------------
+// Application entry point.
+//---------------------------------------------------------------------------
+
+int wmain(int argc, wchar_t* argv[])
+{
+    // Parse command line options.
+    FootprintOptions opt(argc, argv);
+
+    Grid layouts;
+    layouts.addLine({L"Layout", L"File", L"Writable", L"Bytes", L"Pages", L"Keystroke", L"Padding", L"Unreferenced", L"Strings", L"Duplicates", L"Dup.bytes"});
+    layouts.addUnderlines();
+
+    // Analyze all layouts. Invalid layouts are skipped.
+    // The DLL file is also mapped without the system loader, to get its sections.
+    LayoutFootprint all;
+    size_t all_file_size = 0;
+    size_t all_writable_pages = 0;
+    size_t count = 0;
+    KeyboardLoader loader(opt);
+    loader.portable = opt.portable;
+    PEImage image(opt);
+    for (const auto& input : opt.inputs) {
+        const KBDTABLES* tables = loader.load(input);
+        if (tables != nullptr && image.load(input)) {
+            LayoutFootprint fp;
+            fp.build(*tables, opt.page_size);
+            AddLayoutLine(layouts, FileName(input), fp, image.fileSize(), image.writablePages());
+            all.merge(fp);
+            all_file_size += image.fileSize();
+            all_writable_pages += image.writablePages();
+            count++;
+        }
+        image.clear();
+        loader.unload();
+    }
+    if (count == 0) {
+        opt.fatal(L"no valid keyboard layout");
+    }
+    if (count > 1) {
+        layouts.addUnderlines();
+        AddLayoutLine(layouts, Format(L"Total (%llu)", uint64_t(count)), all, all_file_size, all_writable_pages);
+    }
+
+    // Bytes per type of data, all layouts, largest first.
+    std::vector<std::pair<size_t, WString>> types;
+    size_t total_bytes = 0;
+    for (const auto& it : all.types) {
+        types.push_back(std::make_pair(it.second, it.first));
+        total_bytes += it.second;
+    }
+    std::sort(types.rbegin(), types.rend());
+    Grid grid;
+    grid.addLine({L"Type", L"Bytes", L"%"});
+    grid.addUnderlines();
+    for (const auto& it : types) {
+        grid.addLine({it.second, Format(L"%llu", uint64_t(it.first)), Format(L"%.1f", total_bytes == 0 ? 0.0 : 100.0 * double(it.first) / double(total_bytes))});
+    }
+
+    opt.setOutput(opt.output);
+    layouts.setSpacing(2);
+    layouts.print(opt.out());
+    opt.out() << std::endl;
+    grid.setSpacing(2);
+    grid.print(opt.out());
+    opt.exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,72 @@
+﻿# Build and run the libFuzzer target for the analysis of keyboard layout DLL's.
+#
+# The seed corpus is made of the keyboard layouts of this project, for all
+# architectures, to cover the code of the three KbdLayerDescriptor() decoders.
+# libFuzzer with MSVC is only available on x64. Inputs which trigger a crash
+# are saved as crash-* files in this directory.
+
+[CmdletBinding(SupportsShouldProcess=$true)]
+param(
+    [int]$Seconds = 600,
+    [int]$Jobs = 0,
+    [switch]$NoBuild = $false,
+    [switch]$NoPause = $false
+)
+
+# A function to exit this script.
+function Exit-Script([string]$Message = "")
+{
+    if ($Message -ne "") {
+        Write-Host "ERROR: $Message"
+    }
+    if (-not $NoPause) {
+        pause
+    }
+    exit
+}
+
+$RootDir = (Resolve-Path "$PSScriptRoot\..\..").Path
+$ProjectSolutionFile = "$RootDir\winkbdlayouts.sln"
+$SeedDir = "$PSScriptRoot\seeds"
+$CorpusDir = "$PSScriptRoot\corpus"
+$Fuzzer = "$RootDir\x64\Release\kbdfuzz.exe"
+if ($Jobs -le 0) {
+    $Jobs = [Environment]::ProcessorCount
+}
+
+# Find MSBuild
+Write-Output "Searching MSBuild..."
+$MSRoots = @("C:\Program Files*\MSBuild", "C:\Program Files*\Microsoft Visual Studio")
+$MSBuild = Get-ChildItem $MSRoots -Recurse -Include MSBuild.exe -ErrorAction Ignore | ForEach-Object { $_.FullName} | Select-Object -First 1
+if ($MSBuild -eq $null) {
+    Exit-Script "MSBuild not found"
+}
+Write-Output "MSBuild: $MSBuild"
+
+# Build the keyboard layouts for all architectures, the fuzzer is built with x64.
+if (-not $NoBuild) {
+    foreach ($Arch in ("x86", "x64", "arm64")) {
+        & $MSBuild $ProjectSolutionFile /nologo /property:Configuration=Release /property:Platform=$Arch
+    }
+}
+if (-not (Test-Path $Fuzzer)) {
+    Exit-Script "$Fuzzer not found"
+}
+
+# Build the seed corpus.
+Remove-Item $SeedDir -Recurse -Force -ErrorAction SilentlyContinue
+[void](New-Item -ItemType Directory -Force $SeedDir)
+[void](New-Item -ItemType Directory -Force $CorpusDir)
+foreach ($Arch in ("x86", "x64", "arm64")) {
+    Get-ChildItem "$RootDir\$Arch\Release\kbd*.dll" -ErrorAction Ignore | ForEach-Object {
+        Copy-Item $_.FullName "$SeedDir\$Arch-$($_.Name)"
+    }
+}
+Write-Output "Seed corpus: $((Get-ChildItem $SeedDir).Count) files"
+
+# Run the fuzzer. New interesting inputs are accumulated in the corpus directory.
+Push-Location $PSScriptRoot
+& $Fuzzer $CorpusDir $SeedDir -max_total_time=$Seconds -jobs=$Jobs -workers=$Jobs -print_final_stats=1
+Pop-Location
+
+Exit-Script
@@ -0,0 +1,72 @@
+//---------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// libFuzzer target for the analysis of untrusted keyboard layout DLL's.
+// Cover PE parsing, validation of keyboard tables, table walking, source
+// and JSON generation, as done by kbdreverse, and the inverse key map
+// built by kbdtype.
+//
+//---------------------------------------------------------------------------
+
+#include "peimage.h"
+#include "kbdcheck.h"
+#include "sourcegen.h"
+#include "jsongen.h"
+#include "winkeymap.h"
+#include "inversekeymap.h"
+
+// Keyboard layout DLL's are a few tens of kilobytes. Larger images are
+// rejected to avoid spending fuzzing time in memory allocation.
+#define FUZZ_MAX_IMAGE_SIZE (1024 * 1024)
+
+// Errors are expected with random input, they are not displayed.
+static Error silent;
+
+// Generated source files are discarded.
+static std::ostream null_output(nullptr);
+
+
+//---------------------------------------------------------------------------
+// Fuzzer entry point, one input is the content of one DLL file.
+//---------------------------------------------------------------------------
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    PEImage image(silent);
+    image.setMaxImageSize(FUZZ_MAX_IMAGE_SIZE);
+    if (!image.load(data, size, L"input")) {
+        return 0;
+    }
+
+    // Same sequence as kbdreverse: no table walk before validation.
+    const KBDTABLES* tables = image.kbdTables();
+    if (tables == nullptr || !CheckKbdTables(tables, image.base(), image.size(), silent)) {
+        return 0;
+    }
+
+    WinKeyMap kmap(tables);
+    WinKeyVector keys;
+    kmap.buildKeyMap(keys);
+    for (const KeyChar& kc : kmap.characters()) {
+        (void)kc;
+    }
+
+    SourceGenerator gen(null_output);
+    gen.hexa_dump = true;
+    gen.generate(*tables);
+
+    JsonGenerator json(null_output);
+    json.generate(*tables);
+
+    InverseKeyMap imap(silent);
+    if (imap.build(tables)) {
+        static const char text[] = "Fuzz \xC3\xA9\xC3\xA0\xE2\x82\xAC\r\n";
+        std::vector<Keystroke> strokes;
+        uint64_t unmapped = 0;
+        imap.translate(text, sizeof(text) - 1, strokes, unmapped);
+    }
+    return 0;
+}
@@ -11,6 +11,7 @@
 #include "kbdinstall.h"
 #include "registry.h"
 #include "winutils.h"
+#include "stats.h"
 #include "kbdrc.h"
 
 
@@ -104,7 +105,12 @@ uint32_t InstallKeyboardLayout(Error& err, const WString& dll, uint16_t base_lan
     }
 
     // Copy DLL file first.
-    if (CopyFileW(dll.c_str(), filepath.c_str(), false)) {
+    bool copied = false;
+    {
+        Stats::Timer timer("file copy");
+        copied = CopyFileW(dll.c_str(), filepath.c_str(), false);
+    }
+    if (copied) {
         err.verbose(L"copied " + filepath);
     }
     else {
@@ -118,6 +124,7 @@ uint32_t InstallKeyboardLayout(Error& err, const WString& dll, uint16_t base_lan
         // Copy it into a temporary directory and move it on reboot.
         err.info(dll + L" currently in use, will be installed on reboot");
         const WString temppath(GetSystemTemp() + L"\\" + filename);
+        Stats::Timer timer("file copy");
         if (!CopyFileW(dll.c_str(), temppath.c_str(), false)) {
             err.error(L"error copying " + dll + " in temp directory: " + ErrorText(errcode));
             return 0;
@@ -146,6 +153,9 @@ uint32_t InstallKeyboardLayout(Error& err, const WString& dll, uint16_t base_lan
 
 bool UninstallKeyboardLayout(Error& err, const WString& dll)
 {
+    Stats::Timer timer("layout uninstall");
+    Stats::Instance().count("layouts uninstalled");
+
     // Reference DLL name to search in the registry.
     const WString filename(ToLower(FileName(dll)));
     const WString filepath(GetSystem32() + L"\\" + filename);
@@ -168,6 +178,7 @@ bool UninstallKeyboardLayout(Error& err, const WString& dll)
 
     // Delete the DLL file.
     if (success) {
+        Stats::Timer timer("file delete");
         success = DeleteFileW(filepath.c_str());
         if (success) {
             err.verbose(L"deleted " + filepath);
@@ -189,6 +200,9 @@ bool UninstallKeyboardLayout(Error& err, const WString& dll)
 
 uint32_t WKLInstallKeyboardLayout(Error& err, const WString& dll)
 {
+    Stats::Timer timer("layout install");
+    Stats::Instance().count("layouts installed");
+
     // Get all expected resource strings from a WKL DLL.
     HMODULE hmod = LoadLibraryExW(dll.c_str(), nullptr, LOAD_LIBRARY_AS_DATAFILE);
     if (hmod == nullptr) {
@@ -0,0 +1,113 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Load the tables of a keyboard layout DLL.
+//
+//----------------------------------------------------------------------------
+
+#include "kbdloader.h"
+#include "kbdcheck.h"
+#include "winutils.h"
+#include "stats.h"
+
+
+//----------------------------------------------------------------------------
+// Constructor and destructor.
+//----------------------------------------------------------------------------
+
+KeyboardLoader::KeyboardLoader(Error& err) :
+    portable(false),
+    _err(err),
+    _image(err),
+    _dll(nullptr)
+{
+}
+
+KeyboardLoader::~KeyboardLoader()
+{
+    unload();
+}
+
+void KeyboardLoader::unload()
+{
+    if (_dll != nullptr) {
+        FreeLibrary(_dll);
+        _dll = nullptr;
+    }
+    _image.clear();
+}
+
+
+//----------------------------------------------------------------------------
+// Get the file name of a keyboard layout DLL.
+//----------------------------------------------------------------------------
+
+WString KeyboardLoader::FileName(const WString& name)
+{
+    // No separator, must be a keyboard name, not a DLL file name.
+    return name.find_first_of(L":\\/.") == WString::npos ? GetSystem32() + L"\\kbd" + name + L".dll" : name;
+}
+
+
+//----------------------------------------------------------------------------
+// Load the keyboard tables from a DLL file.
+//----------------------------------------------------------------------------
+
+const KBDTABLES* KeyboardLoader::load(const WString& filename)
+{
+    unload();
+    const KBDTABLES* tables = nullptr;
+    Stats::Instance().count("layouts");
+
+    if (portable) {
+        // Map the DLL in private memory and locate the tables without executing code.
+        if (!_image.load(filename) || (tables = _image.kbdTables()) == nullptr) {
+            _err.error("cannot load keyboard tables from " + filename);
+            return nullptr;
+        }
+    }
+    else {
+        // Load the DLL in our virtual memory space.
+        Stats::Timer timer("dll load");
+        _dll = LoadLibraryW(filename.c_str());
+        if (_dll == nullptr) {
+            const DWORD err = GetLastError();
+            _err.error(filename + ": " + ErrorText(err));
+            return nullptr;
+        }
+
+        // Get the DLL entry point.
+        FARPROC proc_addr = GetProcAddress(_dll, KBD_DLL_ENTRY_NAME);
+        if (proc_addr == nullptr) {
+            const DWORD err = GetLastError();
+            _err.error("cannot find " KBD_DLL_ENTRY_NAME " in " + filename + ": " + ErrorText(err));
+            return nullptr;
+        }
+
+        // Call the entry point to get the keyboard tables.
+        // The entry point profile is: PKBDTABLES KbdLayerDescriptor()
+        tables = reinterpret_cast<PKBDTABLES(*)()>(proc_addr)();
+        if (tables == nullptr) {
+            _err.error(KBD_DLL_ENTRY_NAME "() returned null in " + filename);
+            return nullptr;
+        }
+    }
+
+    // The DLL is untrusted, all data structures must be inside its image before walking them.
+    const uint8_t* image_base = _image.base();
+    size_t image_size = _image.size();
+    MODULEINFO info;
+    if (_dll != nullptr && GetModuleInformation(GetCurrentProcess(), _dll, &info, sizeof(info))) {
+        image_base = reinterpret_cast<const uint8_t*>(info.lpBaseOfDll);
+        image_size = info.SizeOfImage;
+    }
+    if (!CheckKbdTables(tables, image_base, image_size, _err)) {
+        Stats::Instance().count("invalid layouts");
+        _err.error("invalid keyboard layout DLL " + filename);
+        return nullptr;
+    }
+    return tables;
+}
@@ -0,0 +1,48 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Load the tables of a keyboard layout DLL, either using the system loader
+// or in portable mode, without executing the DLL. In both cases, the tables
+// are validated before being returned.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "peimage.h"
+
+class KeyboardLoader
+{
+public:
+    // Constructor. Specify where to report errors.
+    KeyboardLoader(Error& err);
+    ~KeyboardLoader();
+
+    // Portable mode: map the DLL without executing it.
+    bool portable;
+
+    // Get the file name of a keyboard layout DLL from a keyboard name ("fr" for kbdfr.dll)
+    // or a DLL file name. A name without any path separator or dot is a keyboard name.
+    static WString FileName(const WString& name);
+
+    // Load the keyboard tables from a DLL file. The previous DLL, if any, is unloaded.
+    // Return nullptr on error. The tables remain valid until the DLL is unloaded.
+    const KBDTABLES* load(const WString& filename);
+
+    // Unload the current DLL.
+    void unload();
+
+    // Handle of the DLL when loaded by the system loader, null in portable mode.
+    HMODULE module() const { return _dll; }
+
+private:
+    Error&  _err;
+    PEImage _image;
+    HMODULE _dll;
+
+    // Inaccessible operations.
+    KeyboardLoader(const KeyboardLoader&) = delete;
+    KeyboardLoader& operator=(const KeyboardLoader&) = delete;
+};
@@ -0,0 +1,334 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Keyboard map, a template text file describing the geometry of a keyboard.
+//
+//----------------------------------------------------------------------------
+
+#include "kbdmap.h"
+#include "stats.h"
+
+// Size of a template character in SVG output (pixels).
+#define SVG_CHAR_WIDTH  10
+#define SVG_LINE_HEIGHT 16
+
+
+//----------------------------------------------------------------------------
+// Constructor and cleanup.
+//----------------------------------------------------------------------------
+
+KeyboardMap::KeyboardMap(Error& err) :
+    _err(err),
+    _lines(),
+    _width(0)
+{
+}
+
+void KeyboardMap::clear()
+{
+    _lines.clear();
+    _width = 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Get an output format from its name.
+//----------------------------------------------------------------------------
+
+bool KeyboardMap::FormatFromName(OutputFormat& format, const WString& name)
+{
+    const WString lname(ToLower(name));
+    if (lname == L"text" || lname == L"txt") {
+        format = MAP_TEXT;
+    }
+    else if (lname == L"html" || lname == L"htm") {
+        format = MAP_HTML;
+    }
+    else if (lname == L"svg") {
+        format = MAP_SVG;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Load and compile a template file.
+//----------------------------------------------------------------------------
+
+bool KeyboardMap::load(const WString& filename)
+{
+    Stats::Timer timer("map template");
+    clear();
+
+    std::ifstream in(filename);
+    if (!in) {
+        _err.error("error opening file " + filename);
+        return false;
+    }
+
+    // A cell is a sequence of spaces and hexa digits, starting with a scan code.
+    static const wchar_t* const cellchars = L" 0123456789abcdefABCDEF";
+    static const wchar_t* const hexachars = cellchars + 1;
+
+    bool success = true;
+    std::string mapline;
+    while (std::getline(in, mapline)) {
+        _lines.emplace_back();
+        Line& line(_lines.back());
+        line.text = ToUTF16(mapline);
+        _width = std::max(_width, line.text.size());
+
+        const WString& text(line.text);
+        size_t start = 0;
+        size_t end = 0;
+        while ((start = text.find_first_of(hexachars, end)) != WString::npos) {
+            // Locate start of cell, including leading spaces.
+            while (start > end && text[start - 1] == L' ') {
+                --start;
+            }
+            // Locate end of cell.
+            end = text.find_first_not_of(cellchars, start);
+            if (end == WString::npos) {
+                end = text.size();
+            }
+            // Locate hexa scan code inside cell.
+            const size_t hex = text.find_first_of(hexachars, start);
+            size_t scancode = 0;
+            if (hex + 2 >= end || !FromHexa(scancode, text.substr(hex, 2))) {
+                // Invalid cell, the rest of the line is kept as raw text.
+                _err.error(Format(L"invalid cell \"%s\" in %s, line %d, col %d", text.substr(start, end - start).c_str(), filename.c_str(), int(_lines.size()), int(start + 1)));
+                success = false;
+                break;
+            }
+            line.cells.push_back(Cell{_lines.size() - 1, start, end - start, uint16_t(scancode), text[hex + 2] == L'e'});
+        }
+    }
+    return success;
+}
+
+
+//----------------------------------------------------------------------------
+// Get the virtual key of a cell in a layout, nullptr if unused.
+//----------------------------------------------------------------------------
+
+const VirtualKey* KeyboardMap::CellKey(const Cell& cell, const WinKeyVector& keys)
+{
+    if (cell.scancode >= keys.size() || keys[cell.scancode].sc == 0) {
+        return nullptr;
+    }
+    const VirtualKey& vk(cell.extended ? keys[cell.scancode].evk : keys[cell.scancode].vk);
+    return vk.vk != 0 ? &vk : nullptr;
+}
+
+
+//----------------------------------------------------------------------------
+// Escape a string for HTML or SVG text.
+//----------------------------------------------------------------------------
+
+static WString XmlEscape(const WString& str)
+{
+    WString res;
+    res.reserve(str.size());
+    for (wchar_t c : str) {
+        switch (c) {
+            case L'&': res.append(L"&amp;"); break;
+            case L'<': res.append(L"&lt;"); break;
+            case L'>': res.append(L"&gt;"); break;
+            case L'"': res.append(L"&quot;"); break;
+            default: res.push_back(c); break;
+        }
+    }
+    return res;
+}
+
+
+//----------------------------------------------------------------------------
+// Render a list of layouts, in one single document.
+//----------------------------------------------------------------------------
+
+void KeyboardMap::render(std::ostream& out, OutputFormat format, const std::vector<Layout>& layouts) const
+{
+    Stats::Timer timer("map rendering");
+    Stats::Instance().count("rendered layouts", layouts.size());
+
+    switch (format) {
+        case MAP_HTML:
+            renderHTML(out, layouts);
+            break;
+        case MAP_SVG:
+            renderSVG(out, layouts);
+            break;
+        case MAP_TEXT:
+        default:
+            renderText(out, layouts);
+            break;
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Build the two text lines for one template line in one layout.
+// The first line contains the shifted characters, the second one the
+// base characters. AltGr characters are on the right side of the cell.
+//----------------------------------------------------------------------------
+
+void KeyboardMap::renderTextLine(WString& line1, WString& line2, const Line& line, const WinKeyVector& keys) const
+{
+    line1.clear();
+    line2.clear();
+    line1.reserve(line.text.size());
+    line2.reserve(line.text.size());
+
+    size_t end = 0;
+    for (const auto& cell : line.cells) {
+        // Copy raw characters before cell.
+        line1.append(line.text, end, cell.column - end);
+        line2.append(line.text, end, cell.column - end);
+        end = cell.column + cell.width;
+
+        // Format chars.
+        const VirtualKey* vk = CellKey(cell, keys);
+        const size_t left = cell.width == 2 ? 0 : (cell.width - 3) / 2;
+        const size_t right = cell.width == 2 ? 0 : cell.width - left - 3;
+        line1.append(left, L' ');
+        line2.append(left, L' ');
+        line1.push_back(vk != nullptr ? Printable(vk->wc[KBDSHIFT]) : L' ');
+        line2.push_back(vk != nullptr ? Printable(vk->wc[KBDBASE]) : L' ');
+        if (cell.width != 2) {
+            line1.push_back(L' ');
+            line2.push_back(L' ');
+        }
+        line1.push_back(vk != nullptr ? Printable(vk->wc[KBDSHIFT | KBDCTRL | KBDALT]) : L' ');
+        line2.push_back(vk != nullptr ? Printable(vk->wc[KBDCTRL | KBDALT]) : L' ');
+        line1.append(right, L' ');
+        line2.append(right, L' ');
+    }
+
+    // Append end of template line.
+    line1.append(line.text, end);
+    line2.append(line.text, end);
+}
+
+
+//----------------------------------------------------------------------------
+// Text output.
+//----------------------------------------------------------------------------
+
+void KeyboardMap::renderText(std::ostream& out, const std::vector<Layout>& layouts) const
+{
+    WString line1, line2;
+    out << UTF8_BOM;
+    for (size_t i = 0; i < layouts.size(); ++i) {
+        if (layouts.size() > 1) {
+            out << (i > 0 ? "\n" : "") << layouts[i].title << std::endl << std::endl;
+        }
+        for (const auto& line : _lines) {
+            if (line.cells.empty()) {
+                out << line.text << std::endl;
+            }
+            else {
+                renderTextLine(line1, line2, line, layouts[i].keys);
+                out << line1 << std::endl << line2 << std::endl;
+            }
+        }
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// HTML output.
+//----------------------------------------------------------------------------
+
+void KeyboardMap::renderHTML(std::ostream& out, const std::vector<Layout>& layouts) const
+{
+    out << "<!DOCTYPE html>" << std::endl
+        << "<html>" << std::endl
+        << "<head>" << std::endl
+        << "<meta charset=\"utf-8\">" << std::endl
+        << "<title>" << XmlEscape(layouts.size() == 1 ? layouts[0].title : L"Keyboard layouts") << "</title>" << std::endl
+        << "<style>pre {font-family: Consolas, monospace;}</style>" << std::endl
+        << "</head>" << std::endl
+        << "<body>" << std::endl;
+
+    WString line1, line2;
+    for (const auto& layout : layouts) {
+        if (layouts.size() > 1) {
+            out << "<h2>" << XmlEscape(layout.title) << "</h2>" << std::endl;
+        }
+        out << "<pre>" << std::endl;
+        for (const auto& line : _lines) {
+            if (line.cells.empty()) {
+                out << XmlEscape(line.text) << std::endl;
+            }
+            else {
+                renderTextLine(line1, line2, line, layout.keys);
+                out << XmlEscape(line1) << std::endl << XmlEscape(line2) << std::endl;
+            }
+        }
+        out << "</pre>" << std::endl;
+    }
+
+    out << "</body>" << std::endl
+        << "</html>" << std::endl;
+}
+
+
+//----------------------------------------------------------------------------
+// SVG output. One rectangle per cell, from the middle of the border line
+// above the cell to the middle of the border line below the cell.
+//----------------------------------------------------------------------------
+
+void KeyboardMap::renderSVG(std::ostream& out, const std::vector<Layout>& layouts) const
+{
+    const int cw = SVG_CHAR_WIDTH;
+    const int lh = SVG_LINE_HEIGHT;
+    const int title_height = layouts.size() > 1 ? 2 * lh : 0;
+    const int layout_height = title_height + int(_lines.size() + 1) * lh;
+
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << std::endl
+        << Format(L"<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\"", int(_width + 1) * cw, int(layouts.size()) * layout_height)
+        << " font-family=\"Consolas, monospace\" font-size=\"13\">" << std::endl;
+
+    int y0 = 0;
+    for (const auto& layout : layouts) {
+        if (layouts.size() > 1) {
+            out << Format(L"<text x=\"%d\" y=\"%d\" font-weight=\"bold\">", cw, y0 + lh) << XmlEscape(layout.title) << "</text>" << std::endl;
+        }
+        const int top = y0 + title_height;
+        for (const auto& line : _lines) {
+            for (const auto& cell : line.cells) {
+                const int x = std::max(0, int(cell.column) * cw - cw / 2);
+                const int y = top + int(cell.line) * lh - lh / 2;
+                const int w = int(cell.width + 1) * cw;
+                out << Format(L"<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" fill=\"none\" stroke=\"black\"/>", x, std::max(top, y), w, 2 * lh) << std::endl;
+
+                // Four characters per cell: shift and base on the left, AltGr on the right.
+                const VirtualKey* vk = CellKey(cell, layout.keys);
+                if (vk != nullptr) {
+                    const struct { size_t mods; int dx; int dy; const wchar_t* anchor; } chars[] {
+                        {KBDSHIFT, cw / 2, lh - 3, L"start"},
+                        {KBDBASE, cw / 2, 2 * lh - 4, L"start"},
+                        {KBDSHIFT | KBDCTRL | KBDALT, w - cw / 2, lh - 3, L"end"},
+                        {KBDCTRL | KBDALT, w - cw / 2, 2 * lh - 4, L"end"},
+                    };
+                    for (const auto& ch : chars) {
+                        const wchar_t c = Printable(vk->wc[ch.mods]);
+                        if (c != L' ') {
+                            out << Format(L"<text x=\"%d\" y=\"%d\" text-anchor=\"%s\">", x + ch.dx, std::max(top, y) + ch.dy, ch.anchor)
+                                << XmlEscape(WString(1, c)) << "</text>" << std::endl;
+                        }
+                    }
+                }
+            }
+        }
+        y0 += layout_height;
+    }
+
+    out << "</svg>" << std::endl;
+}
@@ -0,0 +1,87 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Keyboard map, a template text file describing the geometry of a keyboard.
+//
+// The template is an ASCII drawing of the keyboard. Each key is a cell
+// containing its hexadecimal scan code, followed by 'e' for extended keys.
+// The template is compiled once and can be rendered for many layouts.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "error.h"
+#include "winkeymap.h"
+
+class KeyboardMap
+{
+public:
+    // Constructor. Specify where to report errors.
+    KeyboardMap(Error&);
+
+    // Output formats.
+    enum OutputFormat {MAP_TEXT, MAP_HTML, MAP_SVG};
+
+    // Get an output format from its name ("text", "html", "svg"). Return false if invalid.
+    static bool FormatFromName(OutputFormat& format, const WString& name);
+
+    // One cell in the template, containing a scan code.
+    class Cell
+    {
+    public:
+        size_t   line;      // Line index in template.
+        size_t   column;    // Column of first character in cell.
+        size_t   width;     // Number of characters in cell.
+        uint16_t scancode;  // Scan code, without extended flag.
+        bool     extended;  // Extended key.
+    };
+
+    // One line in the template.
+    class Line
+    {
+    public:
+        WString           text;   // Original text from the template.
+        std::vector<Cell> cells;  // Cells in the line, in increasing column order.
+    };
+
+    // One keyboard layout to render.
+    class Layout
+    {
+    public:
+        WString      title;  // Title of the layout, typically the DLL name.
+        WinKeyVector keys;   // Keys, indexed by scan code.
+    };
+
+    // Load and compile a template file. Return false on error.
+    bool load(const WString& filename);
+
+    // Clear content.
+    void clear();
+
+    // Access the compiled template.
+    const std::vector<Line>& lines() const { return _lines; }
+    size_t width() const { return _width; }
+
+    // Render a list of layouts, in one single document.
+    // The titles are displayed only when there are more than one layout.
+    void render(std::ostream& out, OutputFormat format, const std::vector<Layout>& layouts) const;
+
+private:
+    Error&            _err;
+    std::vector<Line> _lines;
+    size_t            _width;   // Max line width.
+
+    // Get the virtual key of a cell in a layout, nullptr if unused.
+    static const VirtualKey* CellKey(const Cell&, const WinKeyVector&);
+
+    // Renderers for each format.
+    void renderText(std::ostream& out, const std::vector<Layout>& layouts) const;
+    void renderHTML(std::ostream& out, const std::vector<Layout>& layouts) const;
+    void renderSVG(std::ostream& out, const std::vector<Layout>& layouts) const;
+
+    // Build the two text lines for one template line in one layout.
+    void renderTextLine(WString& line1, WString& line2, const Line& line, const WinKeyVector& keys) const;
+};
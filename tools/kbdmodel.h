@@ -0,0 +1,359 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Compile-time model of a keyboard layout, header-only.
+//
+// The model is built from the same table initializers as the C source file
+// of a layout, declared constexpr in a C++ header (see kbdreverse -M).
+// The tables are validated during the compilation: terminators, ranges of
+// modification numbers, width of VK_TO_WCHARS rows, dead keys. Any error is
+// a compilation error which points to the failed check in this file.
+//
+// The derived lookup tables, virtual key to scan code and character to key,
+// are also computed during the compilation. There is no setup at run time.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "platform.h"
+#include <array>
+#include <type_traits>
+
+// Equivalent of MODIFIERS with a fixed number of modification numbers.
+// MODIFIERS ends with a flexible array which cannot be initialized in C++.
+template <size_t N>
+class KbdModifiers
+{
+public:
+    const VK_TO_BIT* pVkToBit;
+    WORD             wMaxModBits;
+    BYTE             ModNumber[N];
+};
+
+// One character in the reverse index of a model.
+class KbdModelChar
+{
+public:
+    wchar_t wc;         // Unicode character.
+    uint8_t vk;         // Virtual key which produces the character.
+    uint8_t modifiers;  // Bitmask of KBDSHIFT, KBDCTRL, KBDALT, etc.
+    bool    dead;       // The character is a dead key.
+};
+
+// Compile-time model of a keyboard layout with CHARS characters.
+// Use the macro KBD_MODEL() to build it.
+template <size_t CHARS>
+class KbdModel
+{
+public:
+    // Scan code of each virtual key, zero if there is none. The scan codes
+    // with a prefix are ored with 0xE000 or 0xE100, as in MapVirtualKey().
+    std::array<uint16_t, 256> vk_to_sc;
+
+    // All characters, sorted by character, then modifiers, then virtual key.
+    // When a virtual key appears several times, the first one is used, as Windows does.
+    std::array<KbdModelChar, CHARS> chars;
+
+    // Get the scan code of a virtual key, zero if there is none.
+    constexpr uint16_t scanCode(uint8_t vk) const { return vk_to_sc[vk]; }
+
+    // Find the key which produces a character with the fewest modifiers, nullptr if there is none.
+    constexpr const KbdModelChar* find(wchar_t wc) const
+    {
+        const auto it = std::lower_bound(chars.begin(), chars.end(), wc, [](const KbdModelChar& c, wchar_t w) { return c.wc < w; });
+        return it != chars.end() && it->wc == wc ? &*it : nullptr;
+    }
+};
+
+// Build a model from the constexpr tables of a layout. The tables which do not
+// exist are specified as nullptr. All VK_TO_WCHARS tables are specified last,
+// in the same order as in the VK_TO_WCHAR_TABLE.
+#define KBD_MODEL(name, scancode_to_vk, scancode_to_vk_e0, scancode_to_vk_e1, char_modifiers, dead_keys, ...) \
+    constexpr auto name = KbdMakeModel<KbdCountChars(char_modifiers, __VA_ARGS__)>( \
+        scancode_to_vk, scancode_to_vk_e0, scancode_to_vk_e1, char_modifiers, dead_keys, __VA_ARGS__)
+
+
+//----------------------------------------------------------------------------
+// Implementation of the checks. The function KbdModelError() is deliberately
+// not constexpr: calling it during a constant evaluation is a compilation
+// error and the compiler reports the line with the error message.
+//----------------------------------------------------------------------------
+
+inline void KbdModelError(const char* message)
+{
+    (void)message;
+}
+
+// Set of dead characters which are found during the checks.
+class KbdDeadChars
+{
+public:
+    wchar_t chars[256];
+    size_t  count;
+
+    constexpr bool contains(wchar_t wc) const
+    {
+        for (size_t i = 0; i < count; ++i) {
+            if (chars[i] == wc) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    constexpr void add(wchar_t wc)
+    {
+        if (!contains(wc)) {
+            if (count >= std::size(chars)) {
+                KbdModelError("too many dead keys");
+            }
+            else {
+                chars[count++] = wc;
+            }
+        }
+    }
+};
+
+// Number of modification numbers in a VK_TO_WCHARS row type.
+template <typename ROW>
+constexpr size_t KbdRowWidth = std::extent_v<decltype(ROW::wch)>;
+
+// Check the table of scan codes without prefix.
+template <size_t N>
+consteval void KbdCheckScanToVk(const USHORT (&table)[N])
+{
+    if (N > 0xFF) {
+        KbdModelError("too many scan codes, bMaxVSCtoVK is a BYTE");
+    }
+}
+
+inline consteval void KbdCheckScanToVk(std::nullptr_t) {}
+
+// Check a table of scan codes with prefix.
+template <size_t N>
+consteval void KbdCheckVscToVk(const VSC_VK (&table)[N])
+{
+    for (size_t i = 0; i + 1 < N; ++i) {
+        if (table[i].Vsc == 0) {
+            KbdModelError("VSC_VK: zero scan code before the end of the table");
+        }
+    }
+    if (table[N - 1].Vsc != 0 || table[N - 1].Vk != 0) {
+        KbdModelError("VSC_VK: missing {0, 0} terminator");
+    }
+}
+
+inline consteval void KbdCheckVscToVk(std::nullptr_t) {}
+
+// Check the modifiers. Return the number of modification numbers which are used.
+template <size_t N>
+consteval size_t KbdCheckModifiers(const KbdModifiers<N>& mods)
+{
+    if (N != size_t(mods.wMaxModBits) + 1) {
+        KbdModelError("MODIFIERS: size of ModNumber is not wMaxModBits + 1");
+    }
+    if (mods.pVkToBit == nullptr) {
+        KbdModelError("MODIFIERS: no VK_TO_BIT table");
+    }
+    else {
+        const VK_TO_BIT* vtb = mods.pVkToBit;
+        for (; vtb->Vk != 0; ++vtb) {
+            if (vtb->ModBits == 0 || vtb->ModBits > mods.wMaxModBits) {
+                KbdModelError("VK_TO_BIT: modifier bits above wMaxModBits");
+            }
+        }
+        if (vtb->ModBits != 0) {
+            KbdModelError("VK_TO_BIT: missing {0, 0} terminator");
+        }
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < N; ++i) {
+        if (mods.ModNumber[i] != SHFT_INVALID) {
+            count = std::max(count, size_t(mods.ModNumber[i]) + 1);
+        }
+    }
+    return count;
+}
+
+// Check a VK_TO_WCHARS table. The dead characters are accumulated in 'dead'.
+template <typename ROW, size_t N>
+consteval void KbdCheckVkToWchars(const ROW (&table)[N], size_t mod_count, KbdDeadChars& dead)
+{
+    constexpr size_t width = KbdRowWidth<ROW>;
+    if (width > mod_count) {
+        KbdModelError("VK_TO_WCHARS: more columns than modification numbers");
+    }
+    for (size_t i = 0; i + 1 < N; ++i) {
+        const ROW& row(table[i]);
+        if (row.VirtualKey == 0) {
+            KbdModelError("VK_TO_WCHARS: zero virtual key before the end of the table");
+        }
+        bool row_dead = false;
+        for (size_t c = 0; c < width; ++c) {
+            if (row.wch[c] == WCH_DEAD) {
+                row_dead = true;
+                if (row.VirtualKey == VK__none_) {
+                    KbdModelError("VK_TO_WCHARS: WCH_DEAD in a dead key row");
+                }
+                else if (i + 2 >= N || table[i + 1].VirtualKey != VK__none_) {
+                    KbdModelError("VK_TO_WCHARS: WCH_DEAD not followed by a VK__none_ row");
+                }
+                else if (table[i + 1].wch[c] == 0 || table[i + 1].wch[c] >= WCH_NONE) {
+                    KbdModelError("VK_TO_WCHARS: no character for a WCH_DEAD entry");
+                }
+                else {
+                    dead.add(table[i + 1].wch[c]);
+                }
+            }
+        }
+        if (row.VirtualKey == VK__none_ && (i == 0 || table[i - 1].VirtualKey == VK__none_)) {
+            KbdModelError("VK_TO_WCHARS: VK__none_ row does not follow a key");
+        }
+        // The row after an SGCAPS key is its CapsLock row, whatever its virtual key.
+        if (row.VirtualKey != VK__none_ && !row_dead && (row.Attributes & SGCAPS) == 0 && i + 1 < N && table[i + 1].VirtualKey == VK__none_) {
+            KbdModelError("VK_TO_WCHARS: VK__none_ row after a key without WCH_DEAD or SGCAPS");
+        }
+    }
+    if (table[N - 1].VirtualKey != 0 || table[N - 1].Attributes != 0) {
+        KbdModelError("VK_TO_WCHARS: missing zero terminator");
+    }
+}
+
+// Check the dead keys against the dead characters of the VK_TO_WCHARS tables.
+template <size_t N>
+consteval void KbdCheckDeadKeys(const DEADKEY (&table)[N], KbdDeadChars& dead)
+{
+    // Chained dead keys: a composed character which is itself a dead key.
+    for (size_t i = 0; i + 1 < N; ++i) {
+        if ((table[i].uFlags & DKF_DEAD) != 0) {
+            dead.add(table[i].wchComposed);
+        }
+    }
+    for (size_t i = 0; i + 1 < N; ++i) {
+        if (table[i].dwBoth == 0) {
+            KbdModelError("DEADKEY: zero entry before the end of the table");
+        }
+        else if (!dead.contains(wchar_t(HIWORD(table[i].dwBoth)))) {
+            KbdModelError("DEADKEY: accent which is not produced by any dead key");
+        }
+    }
+    if (table[N - 1].dwBoth != 0 || table[N - 1].wchComposed != 0) {
+        KbdModelError("DEADKEY: missing zero terminator");
+    }
+}
+
+inline consteval void KbdCheckDeadKeys(std::nullptr_t, KbdDeadChars& dead)
+{
+    if (dead.count > 0) {
+        KbdModelError("DEADKEY: WCH_DEAD entries without dead key table");
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Implementation of the derived tables.
+//----------------------------------------------------------------------------
+
+// Call f(wc, vk, modifiers, dead) for all characters of a VK_TO_WCHARS table.
+// The virtual keys in 'seen' are already defined in a previous table.
+template <size_t M, typename F, typename ROW, size_t N>
+constexpr void KbdForEachChar(const KbdModifiers<M>& mods, const F& f, bool (&seen)[256], const ROW (&table)[N])
+{
+    for (size_t i = 0; i + 1 < N; ++i) {
+        const ROW& row(table[i]);
+        if (row.VirtualKey == VK__none_ || seen[row.VirtualKey]) {
+            continue;
+        }
+        seen[row.VirtualKey] = true;
+        for (size_t c = 0; c < KbdRowWidth<ROW>; ++c) {
+            wchar_t wc = row.wch[c];
+            const bool dead = wc == WCH_DEAD;
+            if (dead) {
+                wc = table[i + 1].wch[c];
+            }
+            if (wc == 0 || wc == WCH_NONE || wc == WCH_DEAD || wc == WCH_LGTR) {
+                continue;
+            }
+            // The modifiers are the smallest bitmask with this modification number.
+            for (size_t bits = 0; bits < M; ++bits) {
+                if (mods.ModNumber[bits] == c) {
+                    f(wc, row.VirtualKey, uint8_t(bits), dead);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// Number of characters in a model.
+template <size_t M, typename... TABLES>
+consteval size_t KbdCountChars(const KbdModifiers<M>& mods, const TABLES&... tables)
+{
+    size_t count = 0;
+    bool seen[256] {};
+    (KbdForEachChar(mods, [&count](wchar_t, uint8_t, uint8_t, bool) { count++; }, seen, tables), ...);
+    return count;
+}
+
+// Add the scan codes of a table in the virtual key to scan code table.
+template <size_t N>
+constexpr void KbdAddScanCodes(std::array<uint16_t, 256>& vk_to_sc, const USHORT (&table)[N])
+{
+    for (size_t sc = 1; sc < N; ++sc) {
+        const uint8_t vk = uint8_t(table[sc]);
+        if (vk != 0 && vk != VK__none_ && vk_to_sc[vk] == 0) {
+            vk_to_sc[vk] = uint16_t(sc);
+        }
+    }
+}
+
+template <size_t N>
+constexpr void KbdAddScanCodes(std::array<uint16_t, 256>& vk_to_sc, const VSC_VK (&table)[N], uint16_t prefix)
+{
+    for (size_t i = 0; i + 1 < N; ++i) {
+        const uint8_t vk = uint8_t(table[i].Vk);
+        if (vk != 0 && vk != VK__none_ && vk_to_sc[vk] == 0) {
+            vk_to_sc[vk] = prefix | table[i].Vsc;
+        }
+    }
+}
+
+inline constexpr void KbdAddScanCodes(std::array<uint16_t, 256>&, std::nullptr_t) {}
+inline constexpr void KbdAddScanCodes(std::array<uint16_t, 256>&, std::nullptr_t, uint16_t) {}
+
+// Validate all tables and build the model.
+template <size_t CHARS, typename SC, typename E0, typename E1, size_t M, typename DEAD, typename... TABLES>
+consteval KbdModel<CHARS> KbdMakeModel(const SC& sc, const E0& e0, const E1& e1, const KbdModifiers<M>& mods, const DEAD& dead_keys, const TABLES&... tables)
+{
+    // Validation.
+    KbdCheckScanToVk(sc);
+    KbdCheckVscToVk(e0);
+    KbdCheckVscToVk(e1);
+    const size_t mod_count = KbdCheckModifiers(mods);
+    if (mod_count > std::max({KbdRowWidth<std::remove_extent_t<TABLES>>...})) {
+        KbdModelError("MODIFIERS: ModNumber out of range of all VK_TO_WCHARS tables");
+    }
+    KbdDeadChars dead {};
+    (KbdCheckVkToWchars(tables, mod_count, dead), ...);
+    KbdCheckDeadKeys(dead_keys, dead);
+
+    // Derived tables.
+    KbdModel<CHARS> model {};
+    KbdAddScanCodes(model.vk_to_sc, sc);
+    KbdAddScanCodes(model.vk_to_sc, e0, 0xE000);
+    KbdAddScanCodes(model.vk_to_sc, e1, 0xE100);
+
+    size_t count = 0;
+    bool seen[256] {};
+    const auto add = [&model, &count](wchar_t wc, uint8_t vk, uint8_t modifiers, bool dead) {
+        model.chars[count++] = {wc, vk, modifiers, dead};
+    };
+    (KbdForEachChar(mods, add, seen, tables), ...);
+    std::sort(model.chars.begin(), model.chars.end(), [](const KbdModelChar& a, const KbdModelChar& b) {
+        return a.wc != b.wc ? a.wc < b.wc : (a.modifiers != b.modifiers ? a.modifiers < b.modifiers : a.vk < b.vk);
+    });
+    return model;
+}
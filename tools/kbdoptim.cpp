@@ -0,0 +1,395 @@
+//---------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Utility to optimize a keyboard layout for text corpora.
+//
+//---------------------------------------------------------------------------
+
+#include "options.h"
+#include "strutils.h"
+#include "winutils.h"
+#include "grid.h"
+#include "kbdloader.h"
+#include "kbdmap.h"
+#include "kbdedit.h"
+#include "fileversion.h"
+#include "mappedfile.h"
+#include "layoutoptim.h"
+#include "layoutproject.h"
+#include "sourcegen.h"
+#include "utf8.h"
+#include "stats.h"
+#include <thread>
+#include <atomic>
+#include <random>
+
+// Configure the terminal console on init, restore on exit.
+ConsoleState state;
+
+// Size of text chunks which are processed by one thread at a time.
+#define CHUNK_SIZE (256 * 1024)
+
+
+//----------------------------------------------------------------------------
+// Command line options.
+//----------------------------------------------------------------------------
+
+class OptimOptions : public Options
+{
+public:
+    // Constructor.
+    OptimOptions(int argc, wchar_t* argv[]);
+
+    // Command line options.
+    WString       input;
+    WStringVector corpora;
+    WString       map_template;
+    WString       name;
+    WString       directory;
+    WString       lang;
+    WString       text;
+    uint64_t      iterations;
+    size_t        chains;
+    uint64_t      seed;
+    bool          portable;
+};
+
+OptimOptions::OptimOptions(int argc, wchar_t* argv[]) :
+    Options(argc, argv,
+        L"[options] kbd-name-or-file\n"
+        L"\n"
+        L"  kbd-name-or-file : Either the file name of a keyboard layout DLL or the name\n"
+        L"  of a keyboard layout, for instance \"fr\" for C:\\Windows\\System32\\kbdfr.dll.\n"
+        L"\n"
+        L"Options:\n"
+        L"\n"
+        L"  -c file : UTF-8 text corpus to optimize for, can be specified several times\n"
+        L"  -d directory : directory where the project directory is created, default: current\n"
+        L"  -g infile : keyboard map template for fingers and rows, for instance images\\pc.txt (required)\n"
+        L"  -h : display this help text\n"
+        L"  -i count : number of iterations per chain, default: 1000000\n"
+        L"  -j count : number of independent chains, default is the number of processors\n"
+        L"  -l hexa : base language of the generated layout, default: same as input\n"
+        L"  -n name : name of the generated project, default: input name followed by \"opt\"\n"
+        L"  -p : portable loading, map the DLL without executing it (allows DLL's for other CPU's)\n"
+        L"  -s value : random seed, default: random\n"
+        L"  -t text : description of the generated layout, default: from input\n"
+        L"  --stats[=text|json] : display performance statistics on standard error"),
+    input(),
+    corpora(),
+    map_template(),
+    name(),
+    directory(L"."),
+    lang(),
+    text(),
+    iterations(1000000),
+    chains(std::max<size_t>(1, std::thread::hardware_concurrency())),
+    seed(std::random_device()()),
+    portable(false)
+{
+    // Parse arguments.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == L"--help" || args[i] == L"-h") {
+            usage();
+        }
+        else if (args[i] == L"-p") {
+            portable = true;
+        }
+        else if (args[i] == L"-c" && i + 1 < args.size()) {
+            corpora.push_back(args[++i]);
+        }
+        else if (args[i] == L"-d" && i + 1 < args.size()) {
+            directory = args[++i];
+        }
+        else if (args[i] == L"-g" && i + 1 < args.size()) {
+            map_template = args[++i];
+        }
+        else if (args[i] == L"-i" && i + 1 < args.size()) {
+            iterations = uint64_t(ToInt64(args[++i]));
+            if (iterations == 0 || !IsDecimal(args[i])) {
+                fatal("invalid iteration count '" + args[i] + "'");
+            }
+        }
+        else if (args[i] == L"-j" && i + 1 < args.size()) {
+            chains = size_t(ToInt(args[++i]));
+            if (chains == 0 || !IsDecimal(args[i])) {
+                fatal("invalid chain count '" + args[i] + "'");
+            }
+        }
+        else if (args[i] == L"-l" && i + 1 < args.size()) {
+            lang = ToLower(args[++i]);
+            if (lang.size() != 4 || lang.find_first_not_of(L"0123456789abcdef") != WString::npos) {
+                fatal("invalid language '" + args[i] + "', must be 4 hexadecimal digits");
+            }
+        }
+        else if (args[i] == L"-n" && i + 1 < args.size()) {
+            name = args[++i];
+        }
+        else if (args[i] == L"-s" && i + 1 < args.size()) {
+            seed = uint64_t(ToInt64(args[++i]));
+            if (!IsDecimal(args[i])) {
+                fatal("invalid seed '" + args[i] + "'");
+            }
+        }
+        else if (args[i] == L"-t" && i + 1 < args.size()) {
+            text = args[++i];
+        }
+        else if (!args[i].empty() && args[i][0] == L'-') {
+            fatal("invalid option '" + args[i] + "', try --help");
+        }
+        else if (input.empty()) {
+            input = KeyboardLoader::FileName(args[i]);
+        }
+        else {
+            fatal(L"more than one input specified, try --help");
+        }
+    }
+    if (input.empty()) {
+        fatal(L"no keyboard layout specified, try --help");
+    }
+    if (corpora.empty()) {
+        fatal(L"no text corpus specified, try --help");
+    }
+    if (map_template.empty()) {
+        fatal(L"no keyboard map template specified, try --help");
+    }
+    if (name.empty()) {
+        name = FileBaseName(input) + L"opt";
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Thread counting symbols in chunks of text, until all chunks are processed.
+//---------------------------------------------------------------------------
+
+void CountChunks(const std::vector<TextChunk>& chunks, std::atomic<size_t>& next, const LayoutModel& model, CorpusStats& stats, uint64_t& invalid)
+{
+    stats = CorpusStats(model.symbolCount());
+    invalid = 0;
+
+    std::vector<char32_t> text(CHUNK_SIZE);
+    for (size_t index = next++; index < chunks.size(); index = next++) {
+        const uint8_t* cur = reinterpret_cast<const uint8_t*>(chunks[index].data);
+        const uint8_t* const end = cur + chunks[index].size;
+        size_t count = 0;
+        while (cur < end) {
+            const UTF8Status status = DecodeUTF8(cur, end, text[count]);
+            if (status == UTF8_OK) {
+                count++;
+            }
+            else if (status == UTF8_INVALID) {
+                invalid++;
+            }
+            else {
+                invalid++;
+                break;
+            }
+        }
+        stats.count(text.data(), count, model);
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Thread running annealing chains, until all chains are completed.
+//---------------------------------------------------------------------------
+
+class ChainResult
+{
+public:
+    ChainResult() : cost(0.0), placement() {}
+    double                cost;
+    std::vector<uint16_t> placement;
+};
+
+void RunChains(std::atomic<size_t>& next, const OptimOptions& opt, const LayoutModel& model, const CorpusStats& stats, std::vector<ChainResult>& results)
+{
+    LayoutAnnealer annealer(model, stats);
+    for (size_t index = next++; index < results.size(); index = next++) {
+        results[index].cost = annealer.run(opt.iterations, opt.seed + index);
+        results[index].placement = annealer.best();
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Generate the keyboard project files.
+//---------------------------------------------------------------------------
+
+// Generate the project of the optimized layout, exit on error.
+void GenerateProject(OptimOptions& opt, const KBDTABLES& tables, HMODULE hmod)
+{
+    // Description and base language, from the input when not specified.
+    FileVersionInfo info(opt);
+    if (opt.lang.empty() || opt.text.empty()) {
+        if (hmod != nullptr ? !info.load(hmod) : !info.load(opt.input)) {
+            opt.fatal("Error loading version information from " + opt.input);
+        }
+    }
+    const WString lang(opt.lang.empty() ? ToLower(info.BaseLanguage) : opt.lang);
+    if (lang.empty()) {
+        opt.fatal("unknown base language for " + opt.input + ", use option -l");
+    }
+    WString text(opt.text);
+    if (text.empty()) {
+        text = (info.LayoutText.empty() ? info.FileDescription : info.LayoutText) + L" (optimized)";
+    }
+
+    // Generate the project in a subdirectory.
+    LayoutProject project(opt);
+    project.directory = opt.directory + L"\\" + opt.name;
+    project.name = opt.name;
+    project.text = text;
+    project.lang = lang;
+    project.input = opt.input;
+    if (!project.generate(tables)) {
+        opt.fatal("error generating " + project.directory);
+    }
+
+    opt.info("generated " + project.directory + ", add " + opt.name + ".vcxproj to the solution to build it");
+}
+
+
+//---------------------------------------------------------------------------
+// Application entry point.
+//---------------------------------------------------------------------------
+
+int wmain(int argc, wchar_t* argv[])
+{
+    // Parse command line options.
+    OptimOptions opt(argc, argv);
+
+    // Load the keyboard geometry.
+    KeyGeometry geometry;
+    KeyboardMap kbdmap(opt);
+    if (!kbdmap.load(opt.map_template) && kbdmap.lines().empty()) {
+        opt.fatal("error loading keyboard map template " + opt.map_template);
+    }
+    if (!geometry.build(kbdmap)) {
+        opt.fatal("no home row in keyboard map template " + opt.map_template);
+    }
+
+    // Load the keyboard layout and build its model.
+    KeyboardLoader loader(opt);
+    loader.portable = opt.portable;
+    const KBDTABLES* tables = loader.load(opt.input);
+    if (tables == nullptr) {
+        opt.exit(EXIT_FAILURE);
+    }
+    InverseKeyMap imap(opt);
+    LayoutModel model(opt);
+    if (!imap.build(tables) || !model.build(tables, imap, geometry)) {
+        opt.exit(EXIT_FAILURE);
+    }
+
+    // Map all corpora in memory and split them in chunks.
+    std::vector<std::unique_ptr<MappedFile>> files;
+    std::vector<TextChunk> chunks;
+    for (const auto& name : opt.corpora) {
+        files.push_back(std::make_unique<MappedFile>(opt));
+        if (!files.back()->open(name)) {
+            opt.exit(EXIT_FAILURE);
+        }
+        SplitUTF8(chunks, files.back()->data(), files.back()->size(), CHUNK_SIZE);
+    }
+    Stats::Instance().count("text chunks", chunks.size());
+
+    // Count symbols and pairs of symbols in all chunks in parallel.
+    const size_t thread_count = std::min(std::max<size_t>(1, std::thread::hardware_concurrency()), std::max<size_t>(1, chunks.size()));
+    std::vector<CorpusStats> counts(thread_count);
+    std::vector<uint64_t> invalid(thread_count, 0);
+    {
+        Stats::Timer timer("corpus analysis");
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_count; ++i) {
+            threads.emplace_back(CountChunks, std::cref(chunks), std::ref(next), std::cref(model), std::ref(counts[i]), std::ref(invalid[i]));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    CorpusStats corpus(model.symbolCount());
+    uint64_t invalid_bytes = 0;
+    for (size_t i = 0; i < thread_count; ++i) {
+        corpus.merge(counts[i]);
+        invalid_bytes += invalid[i];
+    }
+    counts.clear();
+    corpus.finalize();
+    if (invalid_bytes > 0) {
+        opt.warning(Format(L"%llu invalid UTF-8 bytes in corpus", invalid_bytes));
+    }
+    if (corpus.unreachable > 0) {
+        opt.warning(Format(L"%llu characters cannot be typed on %s", corpus.unreachable, FileName(opt.input).c_str()));
+    }
+    if (corpus.total == 0) {
+        opt.fatal(L"no character to type in corpus");
+    }
+
+    // Run all annealing chains in parallel, keep the best one.
+    std::vector<ChainResult> results(opt.chains);
+    {
+        Stats::Timer timer("annealing");
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        const size_t count = std::min(opt.chains, std::max<size_t>(1, std::thread::hardware_concurrency()));
+        for (size_t i = 0; i < count; ++i) {
+            threads.emplace_back(RunChains, std::ref(next), std::cref(opt), std::cref(model), std::cref(corpus), std::ref(results));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    size_t best = 0;
+    for (size_t i = 1; i < results.size(); ++i) {
+        if (results[i].cost < results[best].cost) {
+            best = i;
+        }
+    }
+    const std::vector<uint16_t>& placement(results[best].placement);
+    std::vector<uint16_t> original(placement.size());
+    for (size_t i = 0; i < original.size(); ++i) {
+        original[i] = uint16_t(i);
+    }
+    const double initial_cost = LayoutAnnealer(model, corpus).cost(original);
+
+    // Display the result.
+    Grid grid;
+    grid.addLine({L"Characters", L"From", L"To"});
+    grid.addUnderlines();
+    const auto& units(model.units());
+    const auto key_name = [](uint16_t vk) {
+        const auto it = vk_symbols.find(vk);
+        return it != vk_symbols.end() ? it->second : Format(L"%02X", vk);
+    };
+    const auto char_text = [](wchar_t c) {
+        return c == 0 || c == WCH_NONE ? WString(L"-") : WString(1, c);
+    };
+    for (size_t u = 0; u < placement.size(); ++u) {
+        if (placement[u] != u && !units[u].empty) {
+            grid.addLine({
+                char_text(units[u].chars[0]) + L" " + char_text(units[u].chars[1]),
+                key_name(units[u].vk) + (units[u].pair != 0 ? L" (AltGr)" : L""),
+                key_name(units[placement[u]].vk) + (units[placement[u]].pair != 0 ? L" (AltGr)" : L"")
+            });
+        }
+    }
+    grid.setSpacing(2);
+    grid.print(std::cout);
+    std::cout << std::endl
+              << "Chains: " << opt.chains << ", iterations: " << opt.iterations << ", seed: " << opt.seed << std::endl
+              << "Cost per keystroke: initial " << Format(L"%.4f", initial_cost)
+              << ", optimized " << Format(L"%.4f", results[best].cost)
+              << Format(L" (%.2f%%)", initial_cost == 0.0 ? 0.0 : 100.0 * (results[best].cost - initial_cost) / initial_cost) << std::endl;
+
+    // Apply the best placement to a copy of the tables and generate the project.
+    KbdTablesEditor editor(*tables);
+    model.apply(placement, editor);
+    GenerateProject(opt, editor.tables(), loader.module());
+    opt.exit(EXIT_SUCCESS);
+}
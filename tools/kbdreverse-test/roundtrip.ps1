@@ -0,0 +1,189 @@
+﻿# Round-trip test of the reverse tool on all keyboard layouts.
+#
+# For each keyboard layout DLL: generate a C source file using kbdreverse,
+# build a new DLL from this source file, reverse the new DLL and check that
+# the two generated source files are identical, meaning that the KBDTABLES
+# structures in the two DLL's are structurally identical. The two DLL's must
+# also have the same semantic fingerprint.
+#
+# DLL's are mapped using the portable loader of kbdreverse (option -p).
+# Rebuilt DLL's can therefore target another architecture than the current
+# system, provided that pointers have the same size (x64 vs. arm64).
+#
+# Limitation: the rebuild step requires MSBuild. It takes minutes, not
+# seconds, for all layouts of the system. The command "kbdreverse --roundtrip"
+# performs the same check through layout descriptions, without building or
+# loading any DLL, and compares the tables structurally (PortableTables).
+
+[CmdletBinding(SupportsShouldProcess=$true)]
+param(
+    [string[]]$Layouts = @(),
+    [string]$Arch = "",
+    [int]$Jobs = 0,
+    [switch]$NoBuild = $false,
+    [switch]$NoPause = $false
+)
+
+# A function to exit this script.
+function Exit-Script([string]$Message = "")
+{
+    if ($Message -ne "") {
+        Write-Host "ERROR: $Message"
+    }
+    if (-not $NoPause) {
+        pause
+    }
+    exit
+}
+
+$RootDir = (Resolve-Path "$PSScriptRoot\..\..").Path
+$ProjectSolutionFile = "$RootDir\winkbdlayouts.sln"
+$WorkDir = "$PSScriptRoot\roundtrip"
+
+# Current architecture.
+$OSArch = (Get-WmiObject Win32_OperatingSystem).OSArchitecture
+$HostArch = if ($OSArch -like "*arm*") {"arm64"} elseif ($OSArch -like "*64*") {"x64"} else {"x86"}
+if ($Arch -eq "") {
+    $Arch = $HostArch
+}
+$Platform = if ($Arch -eq "x86") {"Win32"} else {$Arch}
+if ($Jobs -le 0) {
+    $Jobs = [Environment]::ProcessorCount
+}
+
+# Find MSBuild
+Write-Output "Searching MSBuild..."
+$MSRoots = @("C:\Program Files*\MSBuild", "C:\Program Files*\Microsoft Visual Studio")
+$MSBuild = Get-ChildItem $MSRoots -Recurse -Include MSBuild.exe -ErrorAction Ignore | ForEach-Object { $_.FullName} | Select-Object -First 1
+if ($MSBuild -eq $null) {
+    Exit-Script "MSBuild not found"
+}
+Write-Output "MSBuild: $MSBuild"
+
+# Build the reverse tool for the current architecture.
+if (-not $NoBuild) {
+    & $MSBuild $ProjectSolutionFile /nologo /property:Configuration=Release /property:Platform=$HostArch /target:kbdreverse
+}
+$Reverse = "$RootDir\$HostArch\Release\kbdreverse.exe"
+if (-not (Test-Path $Reverse)) {
+    Exit-Script "$Reverse not found"
+}
+
+# List of keyboard layout DLL's, default to all system layouts.
+if ($Layouts.Count -eq 0) {
+    $Layouts = Get-ChildItem "$env:SystemRoot\System32\kbd*.dll" | ForEach-Object { $_.FullName }
+}
+else {
+    $Layouts = $Layouts | ForEach-Object { if ($_ -match '[:\\/.]') {(Resolve-Path $_).Path} else {"$env:SystemRoot\System32\kbd$_.dll"} }
+}
+Remove-Item $WorkDir -Recurse -Force -ErrorAction SilentlyContinue
+[void](New-Item -ItemType Directory -Force $WorkDir)
+Write-Output "Testing $($Layouts.Count) layouts for $Arch, $Jobs parallel jobs"
+
+# Processing of one layout, in a separate runspace.
+$TestLayout = {
+    param($Dll, $WorkDir, $Reverse, $MSBuild, $RootDir, $TestDir, $Arch, $Platform)
+
+    $Timer = [System.Diagnostics.Stopwatch]::StartNew()
+    $Name = [System.IO.Path]::GetFileNameWithoutExtension($Dll).ToLower()
+    if (-not $Name.StartsWith("kbd")) {
+        $Name = "kbd$Name"
+    }
+    $Dir = "$WorkDir\$Name"
+    $Source1 = "$Dir\$Name.c"
+    $Source2 = "$Dir\reversed.c"
+    $Result = [PSCustomObject]@{Layout = $Name; Status = "OK"; Seconds = 0.0; Message = ""}
+
+    [void](New-Item -ItemType Directory -Force $Dir)
+    Copy-Item "$TestDir\strings.h" "$Dir\strings.h"
+    @(
+        '<?xml version="1.0" encoding="utf-8"?>'
+        '<Project DefaultTargets="Build" xmlns="http://schemas.microsoft.com/developer/msbuild/2003">'
+        '  <PropertyGroup Label="Globals">'
+        "    <ProjectGuid>{$([guid]::NewGuid())}</ProjectGuid>"
+        '  </PropertyGroup>'
+        '  <ImportGroup Label="PropertySheets">'
+        '    <Import Project="$(RootDir)msbuild.props"/>'
+        '  </ImportGroup>'
+        '</Project>'
+    ) | Out-File "$Dir\$Name.vcxproj" -Encoding utf8
+
+    # Step 1: reverse the original DLL.
+    & $Reverse -p $Dll -o $Source1 2>&1 | Out-File "$Dir\reverse1.log" -Encoding utf8
+    if ($LASTEXITCODE -ne 0) {
+        $Result.Status = "REVERSE"
+        $Result.Message = (Get-Content "$Dir\reverse1.log" -Raw)
+    }
+
+    # Step 2: build a new DLL from the generated source.
+    if ($Result.Status -eq "OK") {
+        & $MSBuild "$Dir\$Name.vcxproj" /nologo /verbosity:quiet /property:Configuration=Release /property:Platform=$Platform "/property:SolutionDir=$Dir\\" "/property:RootDir=$RootDir\\" 2>&1 | Out-File "$Dir\build.log" -Encoding utf8
+        $NewDll = "$Dir\$Arch\Release\$Name.dll"
+        if (-not (Test-Path $NewDll)) {
+            $Result.Status = "BUILD"
+            $Result.Message = (Get-Content "$Dir\build.log" | Select-String "error" | Select-Object -First 3) -join "`n"
+        }
+    }
+
+    # Step 3: reverse the new DLL.
+    if ($Result.Status -eq "OK") {
+        & $Reverse -p $NewDll -o $Source2 2>&1 | Out-File "$Dir\reverse2.log" -Encoding utf8
+        if ($LASTEXITCODE -ne 0) {
+            $Result.Status = "REVERSE2"
+            $Result.Message = (Get-Content "$Dir\reverse2.log" -Raw)
+        }
+    }
+
+    # Step 4: both generated sources must be identical.
+    if ($Result.Status -eq "OK") {
+        $Text1 = Get-Content $Source1
+        $Text2 = Get-Content $Source2
+        for ($i = 0; $i -lt [Math]::Max($Text1.Count, $Text2.Count); $i++) {
+            if ($Text1[$i] -ne $Text2[$i]) {
+                $Result.Status = "DIFFER"
+                $Result.Message = "line $($i + 1):`n  < $($Text1[$i])`n  > $($Text2[$i])"
+                break
+            }
+        }
+    }
+
+    # Step 5: both DLL's must have the same semantic fingerprint.
+    if ($Result.Status -eq "OK") {
+        $Prints = & $Reverse -p --fingerprint $Dll $NewDll 2>&1
+        if ($LASTEXITCODE -ne 0 -or -not ($Prints -match "^2 layouts, 1 distinct")) {
+            $Result.Status = "FINGERPRINT"
+            $Result.Message = $Prints -join "`n"
+        }
+    }
+
+    $Result.Seconds = [Math]::Round($Timer.Elapsed.TotalSeconds, 2)
+    return $Result
+}
+
+# Run all layouts in a pool of runspaces.
+$Timer = [System.Diagnostics.Stopwatch]::StartNew()
+$Pool = [RunspaceFactory]::CreateRunspacePool(1, $Jobs)
+$Pool.Open()
+$Tasks = foreach ($Dll in $Layouts) {
+    $PS = [PowerShell]::Create()
+    $PS.RunspacePool = $Pool
+    [void]$PS.AddScript($TestLayout).AddArgument($Dll).AddArgument($WorkDir).AddArgument($Reverse).AddArgument($MSBuild).AddArgument($RootDir).AddArgument($PSScriptRoot).AddArgument($Arch).AddArgument($Platform)
+    [PSCustomObject]@{PowerShell = $PS; Handle = $PS.BeginInvoke()}
+}
+$Results = foreach ($Task in $Tasks) {
+    $Task.PowerShell.EndInvoke($Task.Handle)
+    $Task.PowerShell.Dispose()
+}
+$Pool.Close()
+
+# Final report.
+$Results | Sort-Object Seconds -Descending | Format-Table Layout, Status, Seconds -AutoSize | Out-String | Write-Output
+$Failed = @($Results | Where-Object Status -ne "OK")
+foreach ($Res in $Failed) {
+    Write-Output "$($Res.Layout): $($Res.Status)"
+    Write-Output $Res.Message
+}
+Write-Output "$($Results.Count) layouts, $($Failed.Count) failed, total time: $([Math]::Round($Timer.Elapsed.TotalSeconds, 2)) seconds"
+Write-Output "Work files in $WorkDir"
+
+Exit-Script
@@ -0,0 +1,584 @@
+//---------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Local server which keeps compiled keyboard layouts in memory and answers
+// translation, inverse lookup, reverse and diff requests on a named pipe.
+// The protocol is described in serverprotocol.h. The same executable is
+// also a client, to send one request from the command line.
+//
+//---------------------------------------------------------------------------
+
+#include "options.h"
+#include "strutils.h"
+#include "winutils.h"
+#include "layoutcache.h"
+#include "serverprotocol.h"
+#include "sourcegen.h"
+#include "jsongen.h"
+#include "stats.h"
+#include "utf8.h"
+#include <atomic>
+#include <thread>
+
+// Configure the terminal console on init, restore on exit.
+ConsoleState state;
+
+// Size of the pipe buffers.
+#define PIPE_BUFFER_SIZE (64 * 1024)
+
+// Maximum number of compiled layouts in the cache.
+#define MAX_CACHE_SIZE 1024
+
+// Append a code point as "U+XXXX" to a string.
+void AppendCodePoint(std::string& out, char32_t cp)
+{
+    static const char hexa[] = "0123456789ABCDEF";
+    out.append("U+");
+    for (int shift = cp > 0xFFFF ? 20 : 12; shift >= 0; shift -= 4) {
+        out.push_back(hexa[(cp >> shift) & 0x0F]);
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Command line options.
+//----------------------------------------------------------------------------
+
+class ServerOptions : public Options
+{
+public:
+    // Constructor.
+    ServerOptions(int argc, wchar_t* argv[]);
+
+    // Command line options.
+    WString       pipe;
+    size_t        cache_size;
+    size_t        threads;
+    bool          portable;
+    bool          client;
+    WStringVector request;
+};
+
+ServerOptions::ServerOptions(int argc, wchar_t* argv[]) :
+    Options(argc, argv,
+        L"[options] [-q request [arguments]]\n"
+        L"\n"
+        L"  Without -q, run the server: keep compiled keyboard layouts in memory and\n"
+        L"  answer requests from local clients on a named pipe, until interrupted.\n"
+        L"  Keyboard layouts are specified as in kbdreverse: a keyboard name such as\n"
+        L"  \"fr\" for C:\\Windows\\System32\\kbdfr.dll, or a DLL file name.\n"
+        L"\n"
+        L"Options:\n"
+        L"\n"
+        L"  -c count : maximum number of compiled layouts in memory, 1 to " + Format(L"%d", MAX_CACHE_SIZE) + L", default: 32\n"
+        L"  -h : display this help text\n"
+        L"  -n name : pipe name, default: " + ServerMessage::DEFAULT_PIPE + L"\n"
+        L"  -p : portable loading, map the DLL without executing it (allows DLL's for other CPU's)\n"
+        L"  -q : client mode, send one request to a running server and display the response:\n"
+        L"       -q translate layout text-file : keystrokes to type a UTF-8 text file\n"
+        L"       -q inverse layout \"text\" : keystrokes of each character in the text\n"
+        L"       -q reverse layout [c|json] : C source file or JSON description\n"
+        L"       -q diff layout1 layout2 : characters which are typed differently\n"
+        L"       -q status : statistics of the server\n"
+        L"  -t count : number of server threads, that is to say simultaneous clients,\n"
+        L"     default is the number of processors\n"
+        L"  -v : verbose mode, log each request\n"
+        L"  --stats[=text|json] : display performance statistics on standard error"),
+    pipe(ServerMessage::DEFAULT_PIPE),
+    cache_size(32),
+    threads(std::max<size_t>(1, std::thread::hardware_concurrency())),
+    portable(false),
+    client(false),
+    request()
+{
+    // Parse arguments.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (client) {
+            request.push_back(args[i]);
+        }
+        else if (args[i] == L"--help" || args[i] == L"-h") {
+            usage();
+        }
+        else if (args[i] == L"-c" && i + 1 < args.size()) {
+            cache_size = size_t(ToInt64(args[++i]));
+            if (cache_size == 0 || cache_size > MAX_CACHE_SIZE || !IsDecimal(args[i])) {
+                fatal("invalid cache size '" + args[i] + "'");
+            }
+        }
+        else if (args[i] == L"-n" && i + 1 < args.size()) {
+            pipe = args[++i];
+        }
+        else if (args[i] == L"-p") {
+            portable = true;
+        }
+        else if (args[i] == L"-q") {
+            client = true;
+        }
+        else if (args[i] == L"-t" && i + 1 < args.size()) {
+            threads = size_t(ToInt64(args[++i]));
+            if (threads == 0 || threads > MAX_THREADS || !IsDecimal(args[i])) {
+                fatal("invalid thread count '" + args[i] + "'");
+            }
+        }
+        else if (args[i] == L"-v") {
+            setVerbose(true);
+        }
+        else {
+            fatal("invalid option '" + args[i] + "', try --help");
+        }
+    }
+    if (client && request.empty()) {
+        fatal(L"no request specified after -q, try --help");
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// The server.
+//----------------------------------------------------------------------------
+
+class Server
+{
+public:
+    // Constructor.
+    Server(ServerOptions& opt);
+
+    // Run the server threads, never return.
+    [[noreturn]] void run();
+
+private:
+    ServerOptions&        _opt;
+    LayoutCache           _cache;
+    std::mutex            _log_mutex;
+    std::atomic<uint64_t> _requests;
+    std::atomic<uint64_t> _failures;
+    std::atomic<uint64_t> _connections;
+
+    // Server thread: accept and serve clients, one at a time.
+    void worker();
+
+    // Serve all requests from one client.
+    void serve(HANDLE pipe);
+
+    // Execute one request, build the response. Return false on error, with the reason in err.
+    bool execute(const ServerMessage& request, ServerMessage& reply, const Error& err);
+    bool translate(const ServerMessage& request, ServerMessage& reply, const Error& err);
+    bool inverse(const ServerMessage& request, ServerMessage& reply, const Error& err);
+    bool reverse(const ServerMessage& request, ServerMessage& reply, const Error& err);
+    bool diff(const ServerMessage& request, ServerMessage& reply, const Error& err);
+    bool status(const ServerMessage& request, ServerMessage& reply, const Error& err);
+
+    // Get the layout which is specified at the given position in the request.
+    std::shared_ptr<const CompiledLayout> layout(const ServerMessage& request, size_t& pos, const Error& err);
+};
+
+Server::Server(ServerOptions& opt) :
+    _opt(opt),
+    _cache(opt.cache_size),
+    _log_mutex(),
+    _requests(0),
+    _failures(0),
+    _connections(0)
+{
+    _cache.portable = opt.portable;
+}
+
+
+//----------------------------------------------------------------------------
+// Run the server threads.
+//----------------------------------------------------------------------------
+
+[[noreturn]] void Server::run()
+{
+    _opt.verbose(Format(L"listening on %s with %d threads", _opt.pipe.c_str(), int(_opt.threads)));
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < _opt.threads; ++i) {
+        pool.emplace_back(&Server::worker, this);
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    _opt.exit(EXIT_FAILURE);
+}
+
+void Server::worker()
+{
+    for (;;) {
+        // Each server thread owns one instance of the pipe.
+        HANDLE pipe = CreateNamedPipeW(_opt.pipe.c_str(),
+                                       PIPE_ACCESS_DUPLEX,
+                                       PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                       PIPE_UNLIMITED_INSTANCES,
+                                       PIPE_BUFFER_SIZE,
+                                       PIPE_BUFFER_SIZE,
+                                       0,
+                                       nullptr);
+        if (pipe == INVALID_HANDLE_VALUE) {
+            const DWORD err = GetLastError();
+            _opt.fatal(_opt.pipe + L": " + ErrorText(err));
+        }
+        if (ConnectNamedPipe(pipe, nullptr) || GetLastError() == ERROR_PIPE_CONNECTED) {
+            _connections++;
+            serve(pipe);
+            DisconnectNamedPipe(pipe);
+        }
+        CloseHandle(pipe);
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Serve all requests from one client.
+//----------------------------------------------------------------------------
+
+void Server::serve(HANDLE pipe)
+{
+    // Reused for all requests of the connection.
+    ServerMessage request;
+    ServerMessage reply;
+    std::ostringstream messages;
+    Error err(L"", &messages);
+    DWORD error = 0;
+
+    while (request.read(pipe, error)) {
+        const auto start = std::chrono::steady_clock::now();
+        _requests++;
+        messages.str(std::string());
+        reply.reset(request.type, request.id);
+        if (!execute(request, reply, err)) {
+            _failures++;
+            reply.reset(request.type, request.id, ServerMessage::REPLY_ERROR);
+            const std::string text(messages.str());
+            reply.putBytes(text.data(), text.size());
+        }
+        if (!reply.write(pipe, error)) {
+            break;
+        }
+        if (_opt.verbose()) {
+            const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            std::lock_guard<std::mutex> lock(_log_mutex);
+            _opt.verbose(Format(L"request %u, type %d, status %d, %llu bytes, %llu us", request.id, request.type, reply.status, uint64_t(reply.payloadSize()), uint64_t(duration.count())));
+        }
+    }
+    if (error != ERROR_BROKEN_PIPE && error != ERROR_NO_DATA) {
+        std::lock_guard<std::mutex> lock(_log_mutex);
+        _opt.error(L"client error: " + ErrorText(error));
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Execute one request.
+//----------------------------------------------------------------------------
+
+bool Server::execute(const ServerMessage& request, ServerMessage& reply, const Error& err)
+{
+    Stats::Timer timer("requests");
+    switch (request.type) {
+        case ServerMessage::REQ_TRANSLATE:
+            return translate(request, reply, err);
+        case ServerMessage::REQ_INVERSE:
+            return inverse(request, reply, err);
+        case ServerMessage::REQ_REVERSE:
+            return reverse(request, reply, err);
+        case ServerMessage::REQ_DIFF:
+            return diff(request, reply, err);
+        case ServerMessage::REQ_STATUS:
+            return status(request, reply, err);
+        default:
+            err.error(Format(L"invalid request type %d", request.type));
+            return false;
+    }
+}
+
+std::shared_ptr<const CompiledLayout> Server::layout(const ServerMessage& request, size_t& pos, const Error& err)
+{
+    std::string name;
+    if (!request.getString(pos, name)) {
+        err.error(L"truncated request, missing layout name");
+        return nullptr;
+    }
+    return _cache.get(ToUTF16(name), err);
+}
+
+bool Server::translate(const ServerMessage& request, ServerMessage& reply, const Error& err)
+{
+    size_t pos = 0;
+    const auto kbd = layout(request, pos, err);
+    if (kbd == nullptr) {
+        return false;
+    }
+    // The keystrokes are appended to a thread-local vector, reused between requests.
+    thread_local std::vector<Keystroke> keys;
+    uint64_t unmapped = 0;
+    keys.clear();
+    kbd->inverse().translate(request.payload() + pos, request.payloadSize() - pos, keys, unmapped);
+    reply.putUInt32(uint32_t(unmapped));
+    reply.putBytes(keys.data(), keys.size() * sizeof(Keystroke));
+    return true;
+}
+
+bool Server::inverse(const ServerMessage& request, ServerMessage& reply, const Error& err)
+{
+    size_t pos = 0;
+    const auto kbd = layout(request, pos, err);
+    if (kbd == nullptr) {
+        return false;
+    }
+    uint32_t cp = 0;
+    while (request.getUInt32(pos, cp)) {
+        const KeySequence* seq = kbd->inverse().find(cp);
+        if (seq == nullptr) {
+            reply.putUInt8(0);
+            reply.putUInt8(0);
+        }
+        else {
+            reply.putUInt8(seq->count);
+            reply.putUInt8(seq->cost);
+            reply.putBytes(seq->keys, seq->count * sizeof(Keystroke));
+        }
+    }
+    return true;
+}
+
+bool Server::reverse(const ServerMessage& request, ServerMessage& reply, const Error& err)
+{
+    size_t pos = 0;
+    uint8_t format = ServerMessage::FORMAT_SOURCE;
+    const auto kbd = layout(request, pos, err);
+    if (kbd == nullptr) {
+        return false;
+    }
+    request.getUInt8(pos, format);
+
+    std::ostringstream out;
+    if (format == ServerMessage::FORMAT_SOURCE) {
+        SourceGenerator gen(out);
+        gen.input = kbd->filename();
+        gen.generate(*kbd->tables());
+    }
+    else if (format == ServerMessage::FORMAT_JSON) {
+        JsonGenerator gen(out);
+        gen.input = kbd->filename();
+        gen.generate(*kbd->tables());
+    }
+    else {
+        err.error(Format(L"invalid reverse format %d", format));
+        return false;
+    }
+    const std::string text(out.str());
+    reply.putBytes(text.data(), text.size());
+    return true;
+}
+
+bool Server::diff(const ServerMessage& request, ServerMessage& reply, const Error& err)
+{
+    size_t pos = 0;
+    const auto kbd1 = layout(request, pos, err);
+    const auto kbd2 = kbd1 == nullptr ? nullptr : layout(request, pos, err);
+    if (kbd2 == nullptr) {
+        return false;
+    }
+    const InverseKeyMap& inv1(kbd1->inverse());
+    const InverseKeyMap& inv2(kbd2->inverse());
+    reply.putUInt8(kbd1->fingerprint().equal(kbd2->fingerprint()) ? 1 : 0);
+
+    // Format one line: code point, keystrokes in each layout.
+    std::string line;
+    const auto format = [&line](const KeySequence* seq) {
+        line.push_back(' ');
+        if (seq == nullptr) {
+            line.push_back('-');
+        }
+        for (size_t i = 0; seq != nullptr && i < seq->count; ++i) {
+            if (i > 0) {
+                line.push_back(',');
+            }
+            seq->keys[i].format(line);
+        }
+    };
+    const auto add = [&line, &format, &reply](char32_t cp, const KeySequence* seq1, const KeySequence* seq2) {
+        line.clear();
+        AppendCodePoint(line, cp);
+        format(seq1);
+        format(seq2);
+        line.push_back('\n');
+        reply.putBytes(line.data(), line.size());
+    };
+    const auto same = [](const KeySequence& seq1, const KeySequence& seq2) {
+        return seq1.count == seq2.count && std::memcmp(seq1.keys, seq2.keys, seq1.count * sizeof(Keystroke)) == 0;
+    };
+
+    // Characters in the first layout, then characters in the second one only.
+    inv1.forEach([&](char32_t cp, const KeySequence& seq1) {
+        const KeySequence* seq2 = inv2.find(cp);
+        if (seq2 == nullptr || !same(seq1, *seq2)) {
+            add(cp, &seq1, seq2);
+        }
+    });
+    inv2.forEach([&](char32_t cp, const KeySequence& seq2) {
+        if (inv1.find(cp) == nullptr) {
+            add(cp, nullptr, &seq2);
+        }
+    });
+    return true;
+}
+
+bool Server::status(const ServerMessage& request, ServerMessage& reply, const Error& err)
+{
+    const std::string text(ToUTF8(Format(L"requests: %llu\nfailed requests: %llu\nconnections: %llu\nthreads: %llu\n"
+                                         L"cached layouts: %llu/%llu\ncache hits: %llu\ncache misses: %llu\n",
+                                         uint64_t(_requests), uint64_t(_failures), uint64_t(_connections), uint64_t(_opt.threads),
+                                         uint64_t(_cache.size()), uint64_t(_opt.cache_size), _cache.hits(), _cache.misses())));
+    reply.putBytes(text.data(), text.size());
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Client mode: send one request and display the response.
+//----------------------------------------------------------------------------
+
+[[noreturn]] void Client(ServerOptions& opt)
+{
+    const WStringVector& req(opt.request);
+    const WString& command(req[0]);
+    ServerMessage msg;
+    std::vector<char32_t> code_points;
+
+    if (command == L"translate" && req.size() == 3) {
+        std::ifstream file(req[2], std::ios::binary);
+        if (!file) {
+            opt.fatal(L"cannot open " + req[2]);
+        }
+        const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        msg.reset(ServerMessage::REQ_TRANSLATE, 1);
+        msg.putString(ToUTF8(req[1]));
+        msg.putBytes(text.data(), text.size());
+    }
+    else if (command == L"inverse" && req.size() == 3) {
+        msg.reset(ServerMessage::REQ_INVERSE, 1);
+        msg.putString(ToUTF8(req[1]));
+        const std::string text(ToUTF8(req[2]));
+        const uint8_t* cur = reinterpret_cast<const uint8_t*>(text.data());
+        const uint8_t* end = cur + text.size();
+        char32_t cp = 0;
+        while (cur < end) {
+            if (DecodeUTF8(cur, end, cp) != UTF8_OK) {
+                break;
+            }
+            code_points.push_back(cp);
+            msg.putUInt32(uint32_t(cp));
+        }
+    }
+    else if (command == L"reverse" && (req.size() == 2 || req.size() == 3)) {
+        msg.reset(ServerMessage::REQ_REVERSE, 1);
+        msg.putString(ToUTF8(req[1]));
+        msg.putUInt8(req.size() == 3 && req[2] == L"json" ? ServerMessage::FORMAT_JSON : ServerMessage::FORMAT_SOURCE);
+    }
+    else if (command == L"diff" && req.size() == 3) {
+        msg.reset(ServerMessage::REQ_DIFF, 1);
+        msg.putString(ToUTF8(req[1]));
+        msg.putString(ToUTF8(req[2]));
+    }
+    else if (command == L"status" && req.size() == 1) {
+        msg.reset(ServerMessage::REQ_STATUS, 1);
+    }
+    else {
+        opt.fatal(L"invalid request '" + command + L"', try --help");
+    }
+
+    // Connect to the server, wait if all instances of the pipe are busy.
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    for (;;) {
+        pipe = CreateFileW(opt.pipe.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (pipe != INVALID_HANDLE_VALUE) {
+            break;
+        }
+        const DWORD err = GetLastError();
+        if (err != ERROR_PIPE_BUSY || !WaitNamedPipeW(opt.pipe.c_str(), 5000)) {
+            opt.fatal(opt.pipe + L": " + ErrorText(err));
+        }
+    }
+
+    const uint16_t type = msg.type;
+    DWORD error = 0;
+    if (!msg.write(pipe, error) || !msg.read(pipe, error)) {
+        opt.fatal(opt.pipe + L": " + ErrorText(error));
+    }
+    CloseHandle(pipe);
+
+    if (msg.status != ServerMessage::REPLY_OK) {
+        opt.out().write(msg.payload(), std::streamsize(msg.payloadSize()));
+        opt.exit(EXIT_FAILURE);
+    }
+
+    // Display the response.
+    std::string text;
+    size_t pos = 0;
+    if (type == ServerMessage::REQ_TRANSLATE) {
+        uint32_t unmapped = 0;
+        msg.getUInt32(pos, unmapped);
+        for (; pos + sizeof(Keystroke) <= msg.payloadSize(); pos += sizeof(Keystroke)) {
+            Keystroke k;
+            std::memcpy(&k, msg.payload() + pos, sizeof(k));
+            k.format(text);
+            text.push_back(k.vk == VK_RETURN && k.mods == 0 ? '\n' : ' ');
+        }
+        opt.out() << text << std::endl;
+        if (unmapped > 0) {
+            opt.warning(Format(L"%u characters cannot be typed with this layout", unmapped));
+        }
+    }
+    else if (type == ServerMessage::REQ_INVERSE) {
+        uint8_t count = 0, cost = 0;
+        for (const char32_t cp : code_points) {
+            if (!msg.getUInt8(pos, count) || !msg.getUInt8(pos, cost) || pos + count * sizeof(Keystroke) > msg.payloadSize()) {
+                break;
+            }
+            text.clear();
+            AppendCodePoint(text, cp);
+            text.push_back(' ');
+            text.push_back(char('0' + cost % 10));
+            for (size_t i = 0; i < count; ++i, pos += sizeof(Keystroke)) {
+                Keystroke k;
+                std::memcpy(&k, msg.payload() + pos, sizeof(k));
+                text.push_back(' ');
+                k.format(text);
+            }
+            opt.out() << text << (count == 0 ? " unreachable" : "") << std::endl;
+        }
+    }
+    else if (type == ServerMessage::REQ_DIFF) {
+        uint8_t identical = 0;
+        msg.getUInt8(pos, identical);
+        opt.out() << (identical ? "identical layouts" : "different layouts") << std::endl;
+        opt.out().write(msg.payload() + pos, std::streamsize(msg.payloadSize() - pos));
+    }
+    else {
+        opt.out().write(msg.payload(), std::streamsize(msg.payloadSize()));
+    }
+    opt.exit(EXIT_SUCCESS);
+}
+
+
+//---------------------------------------------------------------------------
+// Application entry point.
+//---------------------------------------------------------------------------
+
+int wmain(int argc, wchar_t* argv[])
+{
+    // Parse command line options.
+    ServerOptions opt(argc, argv);
+
+    if (opt.client) {
+        Client(opt);
+    }
+    else {
+        Server server(opt);
+        server.run();
+    }
+}
@@ -0,0 +1,242 @@
+//---------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Utility to translate text into the keystrokes which type it on a given
+// keyboard layout. Used to generate synthetic typing workloads.
+//
+//---------------------------------------------------------------------------
+
+#include "options.h"
+#include "strutils.h"
+#include "winutils.h"
+#include "grid.h"
+#include "kbdloader.h"
+#include "inversekeymap.h"
+#include "stats.h"
+#include "unicode.h"
+
+// Configure the terminal console on init, restore on exit.
+ConsoleState state;
+
+// Size of text chunks which are read and translated at a time.
+#define CHUNK_SIZE (1024 * 1024)
+
+
+//----------------------------------------------------------------------------
+// Command line options.
+//----------------------------------------------------------------------------
+
+class TypeOptions : public Options
+{
+public:
+    // Constructor.
+    TypeOptions(int argc, wchar_t* argv[]);
+
+    // Command line options.
+    WString       input;
+    WStringVector texts;
+    WString       output;
+    bool          binary;
+    bool          list;
+    bool          portable;
+};
+
+TypeOptions::TypeOptions(int argc, wchar_t* argv[]) :
+    Options(argc, argv,
+        L"[options] kbd-name-or-file [text-file ...]\n"
+        L"\n"
+        L"  kbd-name-or-file : Either the file name of a keyboard layout DLL or the\n"
+        L"  name of a keyboard layout, for instance \"fr\" for C:\\Windows\\System32\\kbdfr.dll\n"
+        L"  text-file : UTF-8 text files to translate into keystrokes.\n"
+        L"\n"
+        L"  By default, each keystroke is displayed as its modifiers (S+ for Shift,\n"
+        L"  C+ for Ctrl, A+ for Alt) and its scan code in hexadecimal, with an E0_ or\n"
+        L"  E1_ prefix when necessary. A new line is output after each Enter key.\n"
+        L"\n"
+        L"Options:\n"
+        L"\n"
+        L"  -b : binary output, 4 bytes per keystroke: scan code, prefix flags (1 for E0,\n"
+        L"       2 for E1), modifiers (1 for Shift, 2 for Ctrl, 4 for Alt), virtual key\n"
+        L"  -h : display this help text\n"
+        L"  -l : list all characters which can be typed, with their keystrokes\n"
+        L"  -o outfile : output file name, default is standard output\n"
+        L"  -p : portable loading, map the DLL without executing it (allows DLL's for other CPU's)\n"
+        L"  --stats[=text|json] : display performance statistics on standard error"),
+    input(),
+    texts(),
+    output(),
+    binary(false),
+    list(false),
+    portable(false)
+{
+    // Parse arguments.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == L"--help" || args[i] == L"-h") {
+            usage();
+        }
+        else if (args[i] == L"-b") {
+            binary = true;
+        }
+        else if (args[i] == L"-l") {
+            list = true;
+        }
+        else if (args[i] == L"-p") {
+            portable = true;
+        }
+        else if (args[i] == L"-o" && i + 1 < args.size()) {
+            output = args[++i];
+        }
+        else if (!args[i].empty() && args[i][0] == L'-') {
+            fatal("invalid option '" + args[i] + "', try --help");
+        }
+        else if (input.empty()) {
+            input = args[i];
+        }
+        else {
+            texts.push_back(args[i]);
+        }
+    }
+    if (input.empty()) {
+        fatal(L"no keyboard layout specified, try --help");
+    }
+    if (!list && texts.empty()) {
+        fatal(L"no text file specified, try --help");
+    }
+    if (binary && output.empty()) {
+        fatal(L"binary output requires an output file");
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// List all characters which can be typed.
+//---------------------------------------------------------------------------
+
+void ListCharacters(TypeOptions& opt, const InverseKeyMap& imap)
+{
+    Grid grid;
+    grid.addLine({L"Code point", L"Char", L"Cost", L"Keystrokes"});
+    grid.addUnderlines();
+
+    imap.forEach([&grid](char32_t cp, const KeySequence& seq) {
+        WString text;
+        if (cp >= 0x10000) {
+            text.push_back(wchar_t(0xD800 + ((cp - 0x10000) >> 10)));
+            text.push_back(wchar_t(0xDC00 + ((cp - 0x10000) & 0x3FF)));
+        }
+        else if (cp >= L' ' && cp != UC_DEL) {
+            text.push_back(wchar_t(cp));
+        }
+        std::string keys;
+        for (size_t i = 0; i < seq.count; ++i) {
+            if (i > 0) {
+                keys.push_back(' ');
+            }
+            seq.keys[i].format(keys);
+        }
+        grid.addLine({Format(L"U+%04X", uint32_t(cp)), text, Format(L"%d", seq.cost), ToUTF16(keys)});
+    });
+
+    grid.setSpacing(2);
+    opt.out() << UTF8_BOM;
+    grid.print(opt.out());
+}
+
+
+//---------------------------------------------------------------------------
+// Translate one text file. Return false on error.
+//---------------------------------------------------------------------------
+
+bool TranslateFile(TypeOptions& opt, const InverseKeyMap& imap, const WString& filename, uint64_t& unmapped)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        opt.error("cannot open " + filename);
+        return false;
+    }
+
+    // The buffer keeps the end of an incomplete UTF-8 sequence between chunks.
+    std::vector<char> buffer(CHUNK_SIZE);
+    std::vector<Keystroke> keys;
+    std::string text;
+    size_t pending = 0;
+    keys.reserve(CHUNK_SIZE);
+    Stats::Instance().allocate("text buffer", buffer.size());
+
+    for (;;) {
+        file.read(buffer.data() + pending, std::streamsize(buffer.size() - pending));
+        const size_t size = pending + size_t(file.gcount());
+        const bool final = !file;
+
+        Stats::Timer timer("text translation");
+        Stats::Instance().count("text bytes", size - pending);
+        keys.clear();
+        const size_t done = imap.translate(buffer.data(), size, keys, unmapped, final);
+        pending = size - done;
+        std::memmove(buffer.data(), buffer.data() + done, pending);
+        Stats::Instance().count("keystrokes", keys.size());
+
+        if (opt.binary) {
+            opt.out().write(reinterpret_cast<const char*>(keys.data()), std::streamsize(keys.size() * sizeof(Keystroke)));
+        }
+        else {
+            text.clear();
+            for (const auto& k : keys) {
+                k.format(text);
+                // Carriage return without modifier, new line after Enter.
+                text.push_back(k.vk == VK_RETURN && k.mods == 0 ? '\n' : ' ');
+            }
+            opt.out().write(text.data(), std::streamsize(text.size()));
+        }
+        if (final) {
+            break;
+        }
+    }
+    if (file.bad()) {
+        opt.error("error reading " + filename);
+        return false;
+    }
+    return true;
+}
+
+
+//---------------------------------------------------------------------------
+// Application entry point.
+//---------------------------------------------------------------------------
+
+int wmain(int argc, wchar_t* argv[])
+{
+    // Parse command line options.
+    TypeOptions opt(argc, argv);
+
+    // Load the keyboard tables and build the inverse map.
+    KeyboardLoader loader(opt);
+    loader.portable = opt.portable;
+    InverseKeyMap imap(opt);
+    const KBDTABLES* tables = loader.load(KeyboardLoader::FileName(opt.input));
+    if (tables == nullptr || !imap.build(tables)) {
+        opt.exit(EXIT_FAILURE);
+    }
+
+    // Open the output file when specified.
+    opt.setOutput(opt.output, opt.binary);
+
+    if (opt.list) {
+        ListCharacters(opt, imap);
+        opt.exit(EXIT_SUCCESS);
+    }
+
+    bool success = true;
+    uint64_t unmapped = 0;
+    for (const auto& name : opt.texts) {
+        success = TranslateFile(opt, imap, name, unmapped) && success;
+    }
+    Stats::Instance().count("unmapped characters", unmapped);
+    if (unmapped > 0) {
+        opt.warning(Format(L"%llu characters cannot be typed with this layout", unmapped));
+    }
+    opt.exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+}
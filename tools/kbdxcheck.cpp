@@ -0,0 +1,521 @@
+//---------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Differential tester of the key translation engine.
+//
+// Random keystroke sequences are translated by KeyTranslator, the fast
+// engine, and by ReferenceTranslator, which follows the tables literally.
+// The produced characters and the keyboard states must be identical after
+// each keystroke. The sequences favor the interesting keys of each layout:
+// modifiers, locks, dead keys and ligatures. A failing sequence is
+// shrunk to a minimal reproduction before being reported.
+//
+//---------------------------------------------------------------------------
+
+#include "options.h"
+#include "strutils.h"
+#include "winutils.h"
+#include "grid.h"
+#include "winkeymap.h"
+#include "layoutdesc.h"
+#include "kbdloader.h"
+#include "keytranslator.h"
+#include "keyreference.h"
+#include "taskrunner.h"
+#include <chrono>
+#include <random>
+#include <thread>
+
+// Configure the terminal console on init, restore on exit.
+ConsoleState state;
+
+// Default parameters of the test.
+#define DEFAULT_SEQUENCES  100000
+#define DEFAULT_LENGTH     40
+#define MAX_LENGTH         100000
+
+
+//----------------------------------------------------------------------------
+// Command line options.
+//----------------------------------------------------------------------------
+
+class CheckOptions : public Options
+{
+public:
+    // Constructor.
+    CheckOptions(int argc, wchar_t* argv[]);
+
+    // Command line options.
+    WStringVector inputs;
+    WString       output;
+    size_t        sequences;
+    size_t        length;
+    size_t        threads;
+    uint64_t      seed;
+    bool          portable;
+
+private:
+    // Add the layout descriptions of a directory and its kbd* subdirectories.
+    void addDirectory(const WString& dir, bool subdirs);
+};
+
+CheckOptions::CheckOptions(int argc, wchar_t* argv[]) :
+    Options(argc, argv,
+        L"[options] [layout ...]\n"
+        L"\n"
+        L"  layout : Either a layout description file (.kbl), the file name of a keyboard\n"
+        L"  layout DLL, the name of a keyboard layout, for instance \"fr\" for\n"
+        L"  C:\\Windows\\System32\\kbdfr.dll, or a directory, meaning all kbd*.kbl files in\n"
+        L"  that directory and its kbd* subdirectories. The default is the keyboards\n"
+        L"  directory of the project.\n"
+        L"\n"
+        L"Options:\n"
+        L"\n"
+        L"  -h : display this help text\n"
+        L"  -l count : number of keystrokes per sequence, 1 to " + Format(L"%d", MAX_LENGTH) + L", default: " + Format(L"%d", DEFAULT_LENGTH) + L"\n"
+        L"  -n count : number of sequences per layout, default: " + Format(L"%d", DEFAULT_SEQUENCES) + L"\n"
+        L"  -o outfile : output file name, default is standard output\n"
+        L"  -p : portable loading, map the DLL without executing it (allows DLL's for other CPU's)\n"
+        L"  -s value : random seed, default: random\n"
+        L"  --threads count : number of threads, default is the number of processors\n"
+        L"  --stats[=text|json] : display performance statistics on standard error"),
+    inputs(),
+    output(),
+    sequences(DEFAULT_SEQUENCES),
+    length(DEFAULT_LENGTH),
+    threads(std::max<size_t>(1, std::thread::hardware_concurrency())),
+    seed(std::random_device()()),
+    portable(false)
+{
+    // Parse arguments.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == L"--help" || args[i] == L"-h") {
+            usage();
+        }
+        else if (args[i] == L"-l" && i + 1 < args.size()) {
+            length = size_t(ToInt64(args[++i]));
+            if (length == 0 || length > MAX_LENGTH || !IsDecimal(args[i])) {
+                fatal("invalid sequence length '" + args[i] + "'");
+            }
+        }
+        else if (args[i] == L"-n" && i + 1 < args.size()) {
+            sequences = size_t(ToInt64(args[++i]));
+            if (sequences == 0 || !IsDecimal(args[i])) {
+                fatal("invalid sequence count '" + args[i] + "'");
+            }
+        }
+        else if (args[i] == L"-o" && i + 1 < args.size()) {
+            output = args[++i];
+        }
+        else if (args[i] == L"-p") {
+            portable = true;
+        }
+        else if (args[i] == L"-s" && i + 1 < args.size()) {
+            seed = uint64_t(ToInt64(args[++i]));
+            if (!IsDecimal(args[i])) {
+                fatal("invalid seed '" + args[i] + "'");
+            }
+        }
+        else if (args[i] == L"--threads" && i + 1 < args.size()) {
+            threads = size_t(ToInt64(args[++i]));
+            if (threads == 0 || threads > MAX_THREADS || !IsDecimal(args[i])) {
+                fatal("invalid thread count '" + args[i] + "'");
+            }
+        }
+        else if (!args[i].empty() && args[i][0] == L'-') {
+            fatal("invalid option '" + args[i] + "', try --help");
+        }
+        else if (IsDirectory(args[i])) {
+            addDirectory(args[i], true);
+        }
+        else if (EndsWith(ToLower(args[i]), LayoutDescription::FILE_EXTENSION)) {
+            inputs.push_back(args[i]);
+        }
+        else {
+            inputs.push_back(KeyboardLoader::FileName(args[i]));
+        }
+    }
+
+    // Default: the executable is in x64\Release for instance, the keyboards are at the root.
+    if (inputs.empty()) {
+        addDirectory(DirName(DirName(DirName(GetCurrentProgram()))) + L"\\keyboards", true);
+    }
+    if (inputs.empty()) {
+        fatal(L"no keyboard layout found, try --help");
+    }
+}
+
+void CheckOptions::addDirectory(const WString& dir, bool subdirs)
+{
+    WStringList files;
+    if (!SearchFiles(files, dir, L"kbd*" + LayoutDescription::FILE_EXTENSION)) {
+        fatal("error searching " + dir);
+    }
+    for (const auto& file : files) {
+        inputs.push_back(dir + L"\\" + file);
+    }
+    if (subdirs) {
+        files.clear();
+        SearchFiles(files, dir, L"kbd*");
+        for (const auto& file : files) {
+            if (IsDirectory(dir + L"\\" + file)) {
+                addDirectory(dir + L"\\" + file, false);
+            }
+        }
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// A keystroke in a test sequence.
+//----------------------------------------------------------------------------
+
+class KeyEvent
+{
+public:
+    uint8_t prefix;   // 0, 0xE0 or 0xE1.
+    uint8_t sc;       // Scan code, without prefix.
+    bool    pressed;  // Press or release.
+
+    // Encode as set 1 scan code bytes. The E1 prefix covers two bytes. Return the size.
+    size_t encode(uint8_t* bytes) const;
+
+    // Format as text, for instance "E0:38+" or "1E-".
+    WString toString() const;
+};
+
+typedef std::vector<KeyEvent> KeySequenceVector;
+
+size_t KeyEvent::encode(uint8_t* bytes) const
+{
+    const uint8_t release = pressed ? 0 : 0x80;
+    size_t size = 0;
+    if (prefix != 0) {
+        bytes[size++] = prefix;
+    }
+    bytes[size++] = uint8_t(sc | release);
+    if (prefix == 0xE1) {
+        bytes[size++] = uint8_t(0x45 | release);
+    }
+    return size;
+}
+
+WString KeyEvent::toString() const
+{
+    return Format(L"%s%02X%c", prefix == 0 ? L"" : (prefix == 0xE0 ? L"E0:" : L"E1:"), sc, pressed ? L'+' : L'-');
+}
+
+
+//----------------------------------------------------------------------------
+// Generator of random keystroke sequences for one layout.
+//----------------------------------------------------------------------------
+
+class SequenceGenerator
+{
+public:
+    // Constructor. Collect the interesting keys of the layout.
+    SequenceGenerator(const KBDTABLES* tables, const ReferenceTranslator& ref);
+
+    // Generate a random sequence.
+    void generate(KeySequenceVector& seq, size_t length, std::mt19937_64& rng) const;
+
+private:
+    KeySequenceVector _modifiers;  // Keys with modifier bits.
+    KeySequenceVector _locks;      // CapsLock and Kana lock keys.
+    KeySequenceVector _chars;      // Keys with characters.
+    KeySequenceVector _deads;      // Keys with dead keys in some shift state.
+    KeySequenceVector _ligatures;  // Keys with ligatures in some shift state.
+
+    // Pick one key in a list, use a random scan code if the list is empty.
+    static KeyEvent Pick(const KeySequenceVector& keys, std::mt19937_64& rng);
+};
+
+SequenceGenerator::SequenceGenerator(const KBDTABLES* tables, const ReferenceTranslator& ref)
+{
+    // Virtual keys with ligatures.
+    std::set<uint8_t> lig_vks;
+    for (const LIGATURE1* lig = tables->pLigature; lig != nullptr && tables->cbLgEntry > 0 && lig->VirtualKey != 0;
+         lig = reinterpret_cast<const LIGATURE1*>(reinterpret_cast<const char*>(lig) + tables->cbLgEntry))
+    {
+        lig_vks.insert(lig->VirtualKey);
+    }
+
+    // Virtual keys with dead keys and characters.
+    std::set<std::pair<uint8_t, uint8_t>> dead_keys;
+    std::set<std::pair<uint8_t, uint8_t>> char_keys;
+    WinKeyMap map(tables);
+    for (const KeyChar& kc : map.characters()) {
+        (kc.dead ? dead_keys : char_keys).insert(std::make_pair(kc.prefix, kc.sc));
+    }
+
+    // Classify all scan codes. Scan codes 60 and 61 would be seen as prefixes when released.
+    for (const uint8_t prefix : {uint8_t(0), uint8_t(0xE0), uint8_t(0xE1)}) {
+        for (uint8_t sc = 1; sc < 0x80; ++sc) {
+            const uint8_t vk = uint8_t(ref.virtualKey(prefix, sc) & 0xFF);
+            const KeyEvent key {prefix, sc, true};
+            if (vk == 0 || vk == VK__none_ || sc == 0x60 || sc == 0x61) {
+                continue;
+            }
+            if (ref.modifierBits(vk) != 0) {
+                _modifiers.push_back(key);
+            }
+            if (ref.isLock(vk)) {
+                _locks.push_back(key);
+            }
+            if (lig_vks.count(vk) > 0) {
+                _ligatures.push_back(key);
+            }
+            if (dead_keys.count(std::make_pair(prefix, sc)) > 0) {
+                _deads.push_back(key);
+            }
+            if (char_keys.count(std::make_pair(prefix, sc)) > 0) {
+                _chars.push_back(key);
+            }
+        }
+    }
+}
+
+KeyEvent SequenceGenerator::Pick(const KeySequenceVector& keys, std::mt19937_64& rng)
+{
+    if (keys.empty()) {
+        const uint8_t prefixes[] = {0, 0, 0, 0xE0, 0xE1};
+        uint8_t sc = uint8_t(1 + rng() % 0x7F);
+        if (sc == 0x60 || sc == 0x61) {
+            sc = 0x1E;
+        }
+        return KeyEvent {prefixes[rng() % 5], sc, true};
+    }
+    return keys[rng() % keys.size()];
+}
+
+void SequenceGenerator::generate(KeySequenceVector& seq, size_t length, std::mt19937_64& rng) const
+{
+    static const KeySequenceVector none;
+    std::set<std::pair<uint8_t, uint8_t>> pressed;
+    seq.clear();
+    while (seq.size() < length) {
+        const unsigned int choice = unsigned(rng() % 100);
+        KeyEvent key;
+        if (choice < 30) {
+            // Modifiers and locks are pressed and released.
+            key = Pick(choice < 25 || _locks.empty() ? _modifiers : _locks, rng);
+            key.pressed = pressed.insert(std::make_pair(key.prefix, key.sc)).second;
+            if (!key.pressed) {
+                pressed.erase(std::make_pair(key.prefix, key.sc));
+            }
+        }
+        else {
+            key = Pick(choice < 45 ? _deads : (choice < 52 ? _ligatures : (choice < 92 ? _chars : none)), rng);
+            key.pressed = rng() % 8 != 0;
+        }
+        seq.push_back(key);
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Run a sequence through both engines. Return the index of the first
+// different keystroke, or the sequence size if identical.
+//----------------------------------------------------------------------------
+
+class Checker
+{
+public:
+    // Constructor.
+    Checker(const KeyTranslator& fast, const ReferenceTranslator& ref) : _fast(fast), _ref(ref), _expected(), _actual() {}
+
+    // Run a sequence.
+    size_t run(const KeySequenceVector& seq);
+
+    // Description of the last difference.
+    WString difference;
+
+private:
+    const KeyTranslator&       _fast;
+    const ReferenceTranslator& _ref;
+    WString                    _expected;
+    WString                    _actual;
+};
+
+size_t Checker::run(const KeySequenceVector& seq)
+{
+    KeyTranslator::State fstate;
+    ReferenceTranslator::State rstate;
+    uint8_t bytes[4];
+    wchar_t out[64];
+
+    for (size_t i = 0; i < seq.size(); ++i) {
+        const KeyEvent& key(seq[i]);
+
+        // The fast engine receives the scan code bytes, as from a keyboard.
+        size_t written = 0;
+        const size_t size = key.encode(bytes);
+        const size_t consumed = _fast.translate(fstate, bytes, size, out, sizeof(out) / sizeof(out[0]), written);
+        _actual.assign(out, written);
+
+        _expected.clear();
+        _ref.keystroke(rstate, key.prefix, key.sc, key.pressed, _expected);
+
+        if (consumed != size || _actual != _expected || fstate.capslock != rstate.capslock || fstate.kanalock != rstate.kanalock ||
+            fstate.grpsel != rstate.grpsel || fstate.modifiers != rstate.modifiers || fstate.dead != rstate.dead)
+        {
+            difference = Format(L"expected \"%s\" caps=%d kana=%d grpsel=%d mods=0x%02X dead=0x%04X, got \"%s\" caps=%d kana=%d grpsel=%d mods=0x%02X dead=0x%04X",
+                                WStringLiteral(_expected).c_str(), int(rstate.capslock), int(rstate.kanalock), int(rstate.grpsel), rstate.modifiers, rstate.dead,
+                                WStringLiteral(_actual).c_str(), int(fstate.capslock), int(fstate.kanalock), int(fstate.grpsel), fstate.modifiers, fstate.dead);
+            return i;
+        }
+    }
+    return seq.size();
+}
+
+
+//----------------------------------------------------------------------------
+// Shrink a failing sequence: remove chunks of keystrokes, then single
+// keystrokes, as long as the sequence still fails.
+//----------------------------------------------------------------------------
+
+void Shrink(Checker& checker, KeySequenceVector& seq)
+{
+    // Keystrokes after the first difference are useless.
+    seq.resize(checker.run(seq) + 1);
+
+    KeySequenceVector candidate;
+    for (size_t chunk = std::max<size_t>(1, seq.size() / 2); chunk > 0; ) {
+        bool removed = false;
+        for (size_t start = 0; start < seq.size(); ) {
+            candidate.assign(seq.begin(), seq.begin() + start);
+            candidate.insert(candidate.end(), seq.begin() + std::min(start + chunk, seq.size()), seq.end());
+            const size_t index = candidate.empty() ? 0 : checker.run(candidate);
+            if (index < candidate.size()) {
+                candidate.resize(index + 1);
+                seq.swap(candidate);
+                removed = true;
+            }
+            else {
+                start += chunk;
+            }
+        }
+        if (!removed) {
+            chunk /= 2;
+        }
+    }
+
+    // Recompute the difference of the final sequence.
+    checker.run(seq);
+}
+
+
+//----------------------------------------------------------------------------
+// Result of one task: one part of the sequences of one layout.
+//----------------------------------------------------------------------------
+
+class TaskResult
+{
+public:
+    uint64_t sequences = 0;
+    uint64_t keystrokes = 0;
+    uint64_t failures = 0;
+};
+
+
+//---------------------------------------------------------------------------
+// Application entry point.
+//---------------------------------------------------------------------------
+
+int wmain(int argc, wchar_t* argv[])
+{
+    // Parse command line options.
+    CheckOptions opt(argc, argv);
+
+    // Each layout is split in as many parts as threads, to use all cores
+    // with few layouts. Each sequence has its own seed, for reproduction.
+    const size_t parts = opt.threads;
+    std::vector<TaskResult> results(opt.inputs.size() * parts);
+    const auto start = std::chrono::steady_clock::now();
+
+    TaskRunner runner(opt);
+    runner.threads = opt.threads;
+    const bool success = runner.run(results.size(),
+        [&opt, &results, parts](size_t index, TaskError& err) {
+            const size_t layout = index / parts;
+            const size_t part = index % parts;
+            const WString& input(opt.inputs[layout]);
+
+            // Each task loads its own copy of the layout.
+            KeyboardLoader loader(err);
+            LayoutDescription desc(err);
+            const KBDTABLES* tables = nullptr;
+            loader.portable = opt.portable;
+            if (EndsWith(ToLower(input), LayoutDescription::FILE_EXTENSION)) {
+                tables = desc.load(input) ? &desc.tables() : nullptr;
+            }
+            else {
+                tables = loader.load(input);
+            }
+            KeyTranslator fast(err);
+            if (tables == nullptr || !fast.build(tables)) {
+                return false;
+            }
+            const ReferenceTranslator ref(tables);
+            const SequenceGenerator gen(tables, ref);
+            Checker checker(fast, ref);
+
+            TaskResult& res(results[index]);
+            KeySequenceVector seq;
+            seq.reserve(opt.length);
+            for (size_t n = part; n < opt.sequences; n += parts) {
+                const uint64_t seq_seed = opt.seed ^ (uint64_t(layout) << 40) ^ n;
+                std::mt19937_64 rng(seq_seed);
+                gen.generate(seq, opt.length, rng);
+                res.sequences++;
+                res.keystrokes += seq.size();
+                // Only the first failure of a task is shrunk and reported.
+                if (checker.run(seq) < seq.size() && ++res.failures == 1) {
+                    Shrink(checker, seq);
+                    WString keys;
+                    for (const auto& key : seq) {
+                        keys += L" " + key.toString();
+                    }
+                    err.error(Format(L"%s, sequence %llu, seed %llu, %llu keystrokes:%s\n  %s",
+                                     FileName(input).c_str(), uint64_t(n), opt.seed, uint64_t(seq.size()), keys.c_str(), checker.difference.c_str()));
+                }
+            }
+            return res.failures == 0;
+        });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Summary per layout.
+    Grid grid;
+    grid.addLine({L"Layout", L"Sequences", L"Keystrokes", L"Failures"});
+    grid.addUnderlines();
+    TaskResult total;
+    for (size_t layout = 0; layout < opt.inputs.size(); ++layout) {
+        TaskResult sum;
+        for (size_t part = 0; part < parts; ++part) {
+            const TaskResult& res(results[layout * parts + part]);
+            sum.sequences += res.sequences;
+            sum.keystrokes += res.keystrokes;
+            sum.failures += res.failures;
+        }
+        grid.addLine({FileName(opt.inputs[layout]), Format(L"%llu", sum.sequences), Format(L"%llu", sum.keystrokes), Format(L"%llu", sum.failures)});
+        total.sequences += sum.sequences;
+        total.keystrokes += sum.keystrokes;
+        total.failures += sum.failures;
+    }
+    grid.addUnderlines();
+    grid.addLine({L"Total", Format(L"%llu", total.sequences), Format(L"%llu", total.keystrokes), Format(L"%llu", total.failures)});
+
+    opt.setOutput(opt.output);
+    grid.setSpacing(2);
+    grid.print(opt.out());
+    opt.out() << std::endl
+              << Format(L"Seed: %llu, %.2f s, %.0f keystrokes/s", opt.seed, seconds, seconds > 0 ? double(total.keystrokes) / seconds : 0.0)
+              << std::endl;
+    if (!success) {
+        runner.summary(L"tasks");
+    }
+    opt.exit(success ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,143 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Keyboard events and binary key logs.
+//
+//----------------------------------------------------------------------------
+
+#include "keylog.h"
+#include <chrono>
+
+// Key log file header.
+#define KEYLOG_MAGIC   "WKLKEYS"
+#define KEYLOG_VERSION 1
+
+class KeyLogHeader
+{
+public:
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+static_assert(sizeof(KeyLogHeader) == 16, "invalid KeyLogHeader size");
+
+
+//----------------------------------------------------------------------------
+// Current time in nanoseconds.
+//----------------------------------------------------------------------------
+
+uint64_t KeyEvent::Now()
+{
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+
+//----------------------------------------------------------------------------
+// Write a key log file.
+//----------------------------------------------------------------------------
+
+bool KeyLogWriter::open(const WString& filename)
+{
+    _file.close();
+    _filename = filename;
+    _file.open(filename, std::ios::binary);
+    if (!_file) {
+        _err.error("cannot create " + filename);
+        return false;
+    }
+
+    KeyLogHeader header;
+    Zero(&header, sizeof(header));
+    std::memcpy(header.magic, KEYLOG_MAGIC, sizeof(KEYLOG_MAGIC));
+    header.version = KEYLOG_VERSION;
+    header.record_size = uint32_t(sizeof(KeyEvent));
+    if (!_file.write(reinterpret_cast<const char*>(&header), sizeof(header))) {
+        _err.error("error writing " + filename);
+        return false;
+    }
+    return true;
+}
+
+bool KeyLogWriter::write(const KeyEvent& event)
+{
+    if (!_file.write(reinterpret_cast<const char*>(&event), sizeof(event))) {
+        _err.error("error writing " + _filename);
+        return false;
+    }
+    return true;
+}
+
+bool KeyLogWriter::close()
+{
+    if (_file.is_open()) {
+        _file.close();
+        if (!_file) {
+            _err.error("error writing " + _filename);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Read a key log file.
+//----------------------------------------------------------------------------
+
+bool KeyLogReader::open(const WString& filename)
+{
+    _file.close();
+    _filename = filename;
+    _file.open(filename, std::ios::binary);
+    if (!_file) {
+        _err.error("cannot open " + filename);
+        return false;
+    }
+
+    KeyLogHeader header;
+    if (!_file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, KEYLOG_MAGIC, sizeof(KEYLOG_MAGIC)) != 0 ||
+        header.version != KEYLOG_VERSION ||
+        header.record_size != sizeof(KeyEvent))
+    {
+        _err.error(filename + " is not a valid key log file");
+        _file.close();
+        return false;
+    }
+    return true;
+}
+
+bool KeyLogReader::read(KeyEvent& event)
+{
+    if (!_file.read(reinterpret_cast<char*>(&event), sizeof(event))) {
+        if (!_file.eof() || _file.gcount() != 0) {
+            _err.error(_filename + " is truncated");
+        }
+        return false;
+    }
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Load a complete key log file in memory.
+//----------------------------------------------------------------------------
+
+bool LoadKeyLog(Error& err, const WString& filename, std::vector<KeyEvent>& events)
+{
+    events.clear();
+    KeyLogReader reader(err);
+    if (!reader.open(filename)) {
+        return false;
+    }
+    KeyEvent event;
+    while (reader.read(event)) {
+        events.push_back(event);
+    }
+    reader.close();
+    return true;
+}
@@ -0,0 +1,89 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Keyboard events and binary key logs.
+//
+// A key log file starts with a 16-byte header: the magic string "WKLKEYS"
+// followed by a nul byte, the format version and the size of one record,
+// both as 32-bit little-endian integers. The header is followed by fixed-
+// size records, one per KeyEvent, in their in-memory (little-endian) format.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "error.h"
+
+// One keyboard event, as stored in binary key logs.
+class KeyEvent
+{
+public:
+    uint64_t time;         // Timestamp in nanoseconds, from an arbitrary origin.
+    uint16_t scancode;     // Scan code, without E0 or E1 prefix.
+    uint16_t vk;           // Virtual key, zero if unknown.
+    uint8_t  flags;        // Combination of the flags below.
+    uint8_t  reserved[3];  // Unused, zero.
+
+    // Values for flags.
+    static constexpr uint8_t KEY_UP   = 0x01;  // Key is released.
+    static constexpr uint8_t EXTENDED = 0x02;  // Scan code has E0 prefix.
+    static constexpr uint8_t PREFIX_1 = 0x04;  // Scan code has E1 prefix.
+    static constexpr uint8_t ALT      = 0x08;  // Alt key is down (window messages only).
+    static constexpr uint8_t SYSKEY   = 0x10;  // System key message (window messages only).
+
+    // Current time in nanoseconds, high-resolution monotonic clock.
+    static uint64_t Now();
+};
+
+static_assert(sizeof(KeyEvent) == 16, "invalid KeyEvent size");
+
+// Write a key log file.
+class KeyLogWriter
+{
+public:
+    // Constructor. Specify where to report errors.
+    KeyLogWriter(Error& err) : _err(err), _file(), _filename() {}
+
+    // Create a key log file. Return false on error.
+    bool open(const WString& filename);
+    bool isOpen() const { return _file.is_open(); }
+
+    // Write one event. Return false on error.
+    bool write(const KeyEvent& event);
+
+    // Close the file. Return false on error.
+    bool close();
+
+private:
+    Error&        _err;
+    std::ofstream _file;
+    WString       _filename;
+};
+
+// Read a key log file.
+class KeyLogReader
+{
+public:
+    // Constructor. Specify where to report errors.
+    KeyLogReader(Error& err) : _err(err), _file(), _filename() {}
+
+    // Open a key log file and check its header. Return false on error.
+    bool open(const WString& filename);
+    bool isOpen() const { return _file.is_open(); }
+
+    // Read one event. Return false at end of file or on error.
+    bool read(KeyEvent& event);
+
+    // Close the file.
+    void close() { _file.close(); }
+
+private:
+    Error&        _err;
+    std::ifstream _file;
+    WString       _filename;
+};
+
+// Load a complete key log file in memory. Return false on error.
+bool LoadKeyLog(Error& err, const WString& filename, std::vector<KeyEvent>& events);
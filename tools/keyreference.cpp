@@ -0,0 +1,324 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Reference interpreter of the tables of a keyboard layout.
+//
+//----------------------------------------------------------------------------
+
+#include "keyreference.h"
+
+
+//----------------------------------------------------------------------------
+// Constructors.
+//----------------------------------------------------------------------------
+
+ReferenceTranslator::ReferenceTranslator(const KBDTABLES* tables) :
+    _tables(tables)
+{
+}
+
+ReferenceTranslator::State::State() :
+    capslock(false),
+    kanalock(false),
+    grpsel(false),
+    modifiers(0),
+    dead(0),
+    tap(0),
+    pressed()
+{
+}
+
+void ReferenceTranslator::State::reset()
+{
+    capslock = false;
+    kanalock = false;
+    grpsel = false;
+    modifiers = 0;
+    dead = 0;
+    tap = 0;
+    pressed.clear();
+}
+
+
+//----------------------------------------------------------------------------
+// Get the virtual key of a scan code.
+//----------------------------------------------------------------------------
+
+uint16_t ReferenceTranslator::virtualKey(uint8_t prefix, uint8_t sc) const
+{
+    if (sc >= 128) {
+        return 0;
+    }
+    if (prefix == 0) {
+        if (_tables->pusVSCtoVK == nullptr || sc >= _tables->bMaxVSCtoVK || (_tables->pusVSCtoVK[sc] & 0xFF) == VK__none_) {
+            return 0;
+        }
+        return _tables->pusVSCtoVK[sc];
+    }
+    for (const VSC_VK* p = prefix == 0xE0 ? _tables->pVSCtoVK_E0 : _tables->pVSCtoVK_E1; p != nullptr && p->Vsc != 0; ++p) {
+        if (p->Vsc == sc) {
+            return p->Vk;
+        }
+    }
+    return 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Get the modifier bits of a virtual key.
+//----------------------------------------------------------------------------
+
+uint16_t ReferenceTranslator::modifierBits(uint8_t vk) const
+{
+    const auto bits_of = [this](uint8_t key) {
+        uint16_t bits = 0;
+        for (const VK_TO_BIT* vb = _tables->pCharModifiers->pVkToBit; vb != nullptr && vb->Vk != 0; ++vb) {
+            if (vb->Vk == key) {
+                bits |= vb->ModBits;
+            }
+        }
+        return bits;
+    };
+
+    // Left and right keys have the bits of the generic key, unless they have their own.
+    uint16_t bits = bits_of(vk);
+    if (bits == 0 && (vk == VK_LSHIFT || vk == VK_RSHIFT)) {
+        bits = bits_of(VK_SHIFT);
+    }
+    else if (bits == 0 && (vk == VK_LCONTROL || vk == VK_RCONTROL)) {
+        bits = bits_of(VK_CONTROL);
+    }
+    else if (bits == 0 && (vk == VK_LMENU || vk == VK_RMENU)) {
+        bits = bits_of(VK_MENU);
+    }
+
+    // With AltGr, right Alt also means Ctrl.
+    if (vk == VK_RMENU && (_tables->fLocaleFlags & KLLF_ALTGR) != 0) {
+        bits |= KBDCTRL;
+    }
+    return bits;
+}
+
+
+//----------------------------------------------------------------------------
+// Check if a virtual key is a lock key.
+//----------------------------------------------------------------------------
+
+bool ReferenceTranslator::isLock(uint8_t vk) const
+{
+    if (vk == VK_CAPITAL) {
+        return modifierBits(vk) == 0;
+    }
+    if (vk == VK_KANA) {
+        for (const VK_TO_BIT* vb = _tables->pCharModifiers->pVkToBit; vb != nullptr && vb->Vk != 0; ++vb) {
+            if ((vb->ModBits & KBDKANA) != 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+//----------------------------------------------------------------------------
+// Find the first VK_TO_WCHARS entry of a virtual key.
+//----------------------------------------------------------------------------
+
+const VK_TO_WCHARS10* ReferenceTranslator::findKey(uint8_t vk, size_t& count, const VK_TO_WCHARS10*& next) const
+{
+    for (const VK_TO_WCHAR_TABLE* vtwt = _tables->pVkToWcharTable; vtwt->pVkToWchars != nullptr; ++vtwt) {
+        const char* addr = reinterpret_cast<const char*>(vtwt->pVkToWchars);
+        for (;;) {
+            const VK_TO_WCHARS10* entry = reinterpret_cast<const VK_TO_WCHARS10*>(addr);
+            if (entry->VirtualKey == 0) {
+                break;
+            }
+            addr += vtwt->cbSize;
+            if (entry->VirtualKey == vk) {
+                // As in the system, the following entry is used whatever its virtual key.
+                next = reinterpret_cast<const VK_TO_WCHARS10*>(addr);
+                if (next->VirtualKey == 0) {
+                    next = nullptr;
+                }
+                count = vtwt->nModifications;
+                return entry;
+            }
+        }
+    }
+    return nullptr;
+}
+
+
+//----------------------------------------------------------------------------
+// Find the characters of a ligature.
+//----------------------------------------------------------------------------
+
+bool ReferenceTranslator::findLigature(uint8_t vk, size_t column, WString& chars) const
+{
+    chars.clear();
+    const LIGATURE1* lig = _tables->pLigature;
+    while (lig != nullptr && _tables->cbLgEntry > 0 && lig->VirtualKey != 0) {
+        if (lig->VirtualKey == vk && size_t(lig->ModificationNumber) == column) {
+            for (size_t i = 0; i < size_t(_tables->nLgMax) && lig->wch[i] != WCH_NONE; ++i) {
+                chars.push_back(lig->wch[i]);
+            }
+            return true;
+        }
+        lig = reinterpret_cast<const LIGATURE1*>(reinterpret_cast<const char*>(lig) + _tables->cbLgEntry);
+    }
+    return false;
+}
+
+
+//----------------------------------------------------------------------------
+// Find the translation of a dead key.
+//----------------------------------------------------------------------------
+
+const DEADKEY* ReferenceTranslator::findDeadKey(wchar_t accent, wchar_t base) const
+{
+    for (const DEADKEY* dk = _tables->pDeadKey; dk != nullptr && dk->dwBoth != 0; ++dk) {
+        if (dk->dwBoth == MAKELONG(base, accent)) {
+            return dk;
+        }
+    }
+    return nullptr;
+}
+
+
+//----------------------------------------------------------------------------
+// Process one keystroke.
+//----------------------------------------------------------------------------
+
+void ReferenceTranslator::keystroke(State& state, uint8_t prefix, uint8_t sc, bool pressed, WString& out) const
+{
+    const uint8_t vk = uint8_t(virtualKey(prefix, sc) & 0xFF);
+    if (vk == 0 || vk == VK__none_) {
+        return;
+    }
+
+    // Modifier and lock keys. Locks toggle when the key goes down. A group select key
+    // which is released before any other key is pressed latches the group select.
+    if (modifierBits(vk) != 0 || isLock(vk)) {
+        if (pressed && state.pressed.insert(vk).second) {
+            if (vk == VK_CAPITAL && isLock(vk)) {
+                state.capslock = !state.capslock;
+            }
+            if (vk == VK_KANA && isLock(vk)) {
+                state.kanalock = !state.kanalock;
+            }
+            state.tap = (modifierBits(vk) & KBDGRPSELTAP) != 0 ? vk : 0;
+        }
+        else if (!pressed) {
+            if (state.tap == vk) {
+                state.grpsel = true;
+                state.tap = 0;
+            }
+            state.pressed.erase(vk);
+        }
+        // Recompute the modifier bits from all pressed keys, group select is only set on tap.
+        state.modifiers = 0;
+        for (uint8_t key : state.pressed) {
+            state.modifiers |= modifierBits(key) & ~KBDGRPSELTAP;
+        }
+        return;
+    }
+    if (!pressed) {
+        return;
+    }
+    state.tap = 0;
+    const bool grpsel = state.grpsel;
+    state.grpsel = false;
+
+    // Entry of the key. The following entry has the characters with CapsLock for SGCAPS
+    // keys, whatever its virtual key. Otherwise, a VK__none_ entry has the accents of dead keys.
+    size_t count = 0;
+    const VK_TO_WCHARS10* next = nullptr;
+    const VK_TO_WCHARS10* entry = findKey(vk, count, next);
+    if (entry == nullptr) {
+        return;
+    }
+    const bool sgcaps = (entry->Attributes & SGCAPS) != 0;
+    const VK_TO_WCHARS10* accents = !sgcaps && next != nullptr && next->VirtualKey == VK__none_ ? next : nullptr;
+
+    // Shift state: group select and Kana lock on the keys with the attributes,
+    // CapsLock on the shift state, Alt alone is ignored.
+    size_t bits = state.modifiers;
+    if (grpsel && (entry->Attributes & GRPSELTAP) != 0) {
+        bits |= KBDGRPSELTAP;
+    }
+    if (state.kanalock && (entry->Attributes & KANALOK) != 0) {
+        bits |= KBDKANA;
+    }
+    if (state.capslock) {
+        if (sgcaps && next != nullptr) {
+            entry = next;
+        }
+        else if ((entry->Attributes & CAPLOK) != 0 && (bits & (KBDCTRL | KBDALT)) == 0) {
+            bits ^= KBDSHIFT;
+        }
+        else if ((entry->Attributes & CAPLOKALTGR) != 0 && (bits & (KBDCTRL | KBDALT)) == (KBDCTRL | KBDALT)) {
+            bits ^= KBDSHIFT;
+        }
+    }
+    if ((bits & (KBDCTRL | KBDALT)) == KBDALT) {
+        bits &= ~size_t(KBDALT);
+    }
+    if (bits > _tables->pCharModifiers->wMaxModBits) {
+        return;
+    }
+    const size_t col = _tables->pCharModifiers->ModNumber[bits];
+    const wchar_t wc = col < count ? entry->wch[col] : WCH_NONE;
+
+    // Ligatures, a pending dead key is output first.
+    if (wc == WCH_LGTR) {
+        WString lig;
+        if (findLigature(entry->VirtualKey, col, lig) && !lig.empty()) {
+            if (state.dead != 0) {
+                out.push_back(state.dead);
+                state.dead = 0;
+            }
+            out.append(lig);
+        }
+        return;
+    }
+
+    // Character or dead key.
+    bool dead = false;
+    wchar_t c = wc;
+    if (wc == WCH_DEAD) {
+        if (accents == nullptr || accents->wch[col] == WCH_NONE) {
+            return;
+        }
+        c = accents->wch[col];
+        dead = true;
+    }
+    else if (wc == 0 || wc == WCH_NONE) {
+        return;
+    }
+
+    // Combine with the pending dead key.
+    if (state.dead != 0) {
+        const DEADKEY* dk = findDeadKey(state.dead, c);
+        if (dk == nullptr) {
+            out.push_back(state.dead);
+            out.push_back(c);
+            state.dead = 0;
+        }
+        else if ((dk->uFlags & DKF_DEAD) != 0) {
+            state.dead = dk->wchComposed;
+        }
+        else {
+            out.push_back(dk->wchComposed);
+            state.dead = 0;
+        }
+    }
+    else if (dead) {
+        state.dead = c;
+    }
+    else {
+        out.push_back(c);
+    }
+}
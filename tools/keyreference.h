@@ -0,0 +1,68 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Reference interpreter of the tables of a keyboard layout.
+//
+// The translation rules are the same as in KeyTranslator but the tables
+// are followed literally on each keystroke, without any precomputation:
+// scan code tables, linear scan of VK_TO_BIT, ModNumber lookup, linear
+// scan of VK_TO_WCHAR_TABLE, LIGATURE and DEADKEY. This is slow but simple
+// enough to be checked by reading. It is used to verify KeyTranslator and
+// ModifierMachine, including the CapsLock, Kana lock and group select tap.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "strutils.h"
+
+class ReferenceTranslator
+{
+public:
+    // Constructor. The tables must remain valid while the translator is used.
+    ReferenceTranslator(const KBDTABLES* tables);
+
+    // State of the keyboard for one input stream.
+    class State
+    {
+    public:
+        State();             // Constructor.
+        void reset();        // Reset the state, no key pressed.
+        bool     capslock;   // CapsLock is on.
+        bool     kanalock;   // Kana lock is on.
+        bool     grpsel;     // Group select tap is latched for the next character key.
+        uint16_t modifiers;  // Current modifier bits of the held keys.
+        wchar_t  dead;       // Accent of the pending dead key, zero if none.
+        uint8_t  tap;        // Group select virtual key being tapped, zero if none.
+        std::set<uint8_t> pressed;  // Pressed modifier and lock virtual keys.
+    };
+
+    // Get the virtual key of a scan code, including KBDEXT and other flags.
+    // Prefix is 0, 0xE0 or 0xE1. Return zero if the scan code is unused.
+    uint16_t virtualKey(uint8_t prefix, uint8_t sc) const;
+
+    // Get the modifier bits of a virtual key, zero if not a modifier.
+    uint16_t modifierBits(uint8_t vk) const;
+
+    // Check if a virtual key is a lock key: CapsLock when not a modifier, Kana when the layout uses KBDKANA.
+    bool isLock(uint8_t vk) const;
+
+    // Process one keystroke: scan code with prefix, press or release. Update the
+    // state and append the produced characters to out.
+    void keystroke(State& state, uint8_t prefix, uint8_t sc, bool pressed, WString& out) const;
+
+private:
+    const KBDTABLES* _tables;
+
+    // Find the first VK_TO_WCHARS entry of a virtual key. Return nullptr if not found.
+    // Also return the following entry, whatever its virtual key, or nullptr at end of table.
+    const VK_TO_WCHARS10* findKey(uint8_t vk, size_t& count, const VK_TO_WCHARS10*& next) const;
+
+    // Find the characters of a ligature, for a virtual key and a column. Return false if not found.
+    bool findLigature(uint8_t vk, size_t column, WString& chars) const;
+
+    // Find the translation of a dead key. Return nullptr if not found.
+    const DEADKEY* findDeadKey(wchar_t accent, wchar_t base) const;
+};
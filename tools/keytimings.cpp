@@ -0,0 +1,147 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Timing analysis of keyboard events.
+//
+//----------------------------------------------------------------------------
+
+#include "keytimings.h"
+#include "grid.h"
+#include "stats.h"
+
+// Reported percentiles.
+static const double percentiles[] = {50.0, 90.0, 99.0};
+
+
+//----------------------------------------------------------------------------
+// Constructors and reset.
+//----------------------------------------------------------------------------
+
+KeyTimings::KeyState::KeyState() :
+    down(false),
+    press_time(0),
+    vk(0),
+    presses(0),
+    repeats(0),
+    hold(),
+    interval()
+{
+}
+
+KeyTimings::KeyTimings() :
+    _keys(),
+    _last_press(0)
+{
+}
+
+void KeyTimings::clear()
+{
+    _keys.clear();
+    _last_press = 0;
+}
+
+uint32_t KeyTimings::KeyId(const KeyEvent& event)
+{
+    return uint32_t(event.scancode) |
+        ((event.flags & KeyEvent::EXTENDED) != 0 ? 0x10000 : 0) |
+        ((event.flags & KeyEvent::PREFIX_1) != 0 ? 0x20000 : 0);
+}
+
+
+//----------------------------------------------------------------------------
+// Analyze one event.
+//----------------------------------------------------------------------------
+
+void KeyTimings::add(const KeyEvent& event)
+{
+    const uint32_t id = KeyId(event);
+    auto it = _keys.find(id);
+    if (it == _keys.end()) {
+        Stats::Instance().allocate("key timings", sizeof(KeyState));
+        it = _keys.emplace(id, KeyState()).first;
+    }
+    KeyState& key(it->second);
+    if (event.vk != 0) {
+        key.vk = event.vk;
+    }
+
+    if ((event.flags & KeyEvent::KEY_UP) != 0) {
+        // Key released, ignore release without press (key was down before start).
+        if (key.down && event.time >= key.press_time) {
+            key.hold.record(event.time - key.press_time);
+        }
+        key.down = false;
+    }
+    else if (key.down) {
+        // Auto-repeat.
+        key.repeats++;
+    }
+    else {
+        // New key press.
+        key.down = true;
+        key.press_time = event.time;
+        key.presses++;
+        if (_last_press != 0 && event.time >= _last_press) {
+            key.interval.record(event.time - _last_press);
+        }
+        _last_press = event.time;
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Print percentiles of all keys.
+//----------------------------------------------------------------------------
+
+static WString Milliseconds(uint64_t nanoseconds)
+{
+    return Format(L"%.3f", double(nanoseconds) / 1000000.0);
+}
+
+static void AddHistogram(Grid::Line& line, const LatencyHistogram& hist)
+{
+    for (double pc : percentiles) {
+        line.push_back(hist.count() == 0 ? L"-" : Milliseconds(hist.percentile(pc)));
+    }
+    line.push_back(hist.count() == 0 ? L"-" : Milliseconds(hist.max()));
+}
+
+void KeyTimings::print(std::ostream& out, const char* const vk_names[]) const
+{
+    Grid grid(L"", L"  ");
+    grid.addLine({L"", L"", L"", L"", L"Hold (ms)", L"", L"", L"", L"Interval (ms)"});
+    grid.addLine({L"Key", L"VK", L"Presses", L"Repeats", L"p50", L"p90", L"p99", L"max", L"p50", L"p90", L"p99", L"max"});
+    grid.addUnderlines();
+
+    KeyState all;
+    for (const auto& it : _keys) {
+        const KeyState& key(it.second);
+        WString name((it.first & 0x20000) != 0 ? L"E1 " : ((it.first & 0x10000) != 0 ? L"E0 " : L""));
+        name += Format(L"0x%02X", it.first & 0xFFFF);
+        WString vk(Format(L"0x%02X", key.vk));
+        if (vk_names != nullptr && key.vk < 256 && vk_names[key.vk] != nullptr) {
+            vk += L" " + ToUTF16(vk_names[key.vk]);
+        }
+        Grid::Line line({name, vk, Format(L"%llu", key.presses), Format(L"%llu", key.repeats)});
+        AddHistogram(line, key.hold);
+        AddHistogram(line, key.interval);
+        grid.addLine(line);
+
+        all.presses += key.presses;
+        all.repeats += key.repeats;
+        all.hold.merge(key.hold);
+        all.interval.merge(key.interval);
+    }
+
+    Grid::Line line({L"All keys", L"", Format(L"%llu", all.presses), Format(L"%llu", all.repeats)});
+    AddHistogram(line, all.hold);
+    AddHistogram(line, all.interval);
+    grid.addUnderlines();
+    grid.addLine(line);
+
+    out << std::endl;
+    grid.print(out);
+}
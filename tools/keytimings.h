@@ -0,0 +1,57 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Timing analysis of keyboard events: press to release durations and
+// intervals between key presses, per scan code.
+//
+// Auto-repeat events (press events of a key which is already down) are
+// counted but do not restart the hold duration or the inter-key interval.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "keylog.h"
+#include "histogram.h"
+#include <map>
+
+class KeyTimings
+{
+public:
+    // Constructor.
+    KeyTimings();
+
+    // Reset all timings.
+    void clear();
+
+    // Analyze one event.
+    void add(const KeyEvent& event);
+
+    // Print percentiles of all keys, in milliseconds.
+    // The optional table provides names for the 256 virtual keys.
+    void print(std::ostream& out, const char* const vk_names[] = nullptr) const;
+
+private:
+    // Timings of one key.
+    class KeyState
+    {
+    public:
+        KeyState();
+        bool             down;
+        uint64_t         press_time;
+        uint16_t         vk;
+        uint64_t         presses;
+        uint64_t         repeats;
+        LatencyHistogram hold;
+        LatencyHistogram interval;
+    };
+
+    // Index by scan code, with E0 and E1 prefixes in high-order bits.
+    std::map<uint32_t, KeyState> _keys;
+    uint64_t _last_press;
+
+    // Build the identifier of a key from an event.
+    static uint32_t KeyId(const KeyEvent& event);
+};
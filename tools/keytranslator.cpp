@@ -0,0 +1,313 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Translation of scan code streams into characters.
+//
+//----------------------------------------------------------------------------
+
+#include "keytranslator.h"
+#include "stats.h"
+
+// Scan code bits and prefixes.
+#define SC_RELEASE 0x80
+#define SC_PREFIX0 0xE0
+#define SC_PREFIX1 0xE1
+
+
+//----------------------------------------------------------------------------
+// Keyboard state.
+//----------------------------------------------------------------------------
+
+KeyTranslator::State::State()
+{
+    reset();
+}
+
+void KeyTranslator::State::reset()
+{
+    ModifierMachine::State::reset();
+    dead = 0;
+    _prefix = 0;
+    _skip = 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Constructor and reset.
+//----------------------------------------------------------------------------
+
+KeyTranslator::KeyTranslator(Error& err) :
+    _err(err),
+    _states(0),
+    _max_output(0),
+    _modifiers(err),
+    _sc_to_vk(),
+    _rows(),
+    _cells(),
+    _ligatures(),
+    _deadkeys()
+{
+    clear();
+}
+
+void KeyTranslator::clear()
+{
+    _states = 0;
+    _max_output = 2;
+    _modifiers.clear();
+    Zero(_sc_to_vk, sizeof(_sc_to_vk));
+    for (auto& row : _rows) {
+        row.attributes = 0;
+        row.cells = -1;
+        row.sgcaps = -1;
+    }
+    _cells.clear();
+    _ligatures.clear();
+    _deadkeys.clear();
+}
+
+
+//----------------------------------------------------------------------------
+// Compile the tables of a keyboard layout.
+//----------------------------------------------------------------------------
+
+bool KeyTranslator::build(const KBDTABLES* tables)
+{
+    Stats::Timer timer("key translator");
+
+    clear();
+    if (tables == nullptr || tables->pCharModifiers == nullptr || tables->pVkToWcharTable == nullptr) {
+        _err.error(L"no character table in keyboard layout");
+        return false;
+    }
+    if (!_modifiers.build(tables)) {
+        return false;
+    }
+    const MODIFIERS* mods = tables->pCharModifiers;
+    _states = _modifiers.planes();
+
+    // Scan codes to virtual keys.
+    for (size_t sc = 0; tables->pusVSCtoVK != nullptr && sc < tables->bMaxVSCtoVK && sc < 128; ++sc) {
+        if ((tables->pusVSCtoVK[sc] & 0xFF) != VK__none_) {
+            _sc_to_vk[0][sc] = tables->pusVSCtoVK[sc];
+        }
+    }
+    for (const VSC_VK* p = tables->pVSCtoVK_E0; p != nullptr && p->Vsc != 0; ++p) {
+        if (p->Vsc < 128 && _sc_to_vk[1][p->Vsc] == 0) {
+            _sc_to_vk[1][p->Vsc] = p->Vk;
+        }
+    }
+    for (const VSC_VK* p = tables->pVSCtoVK_E1; p != nullptr && p->Vsc != 0; ++p) {
+        if (p->Vsc < 128 && _sc_to_vk[2][p->Vsc] == 0) {
+            _sc_to_vk[2][p->Vsc] = p->Vk;
+        }
+    }
+
+    // Ligatures, indexed by virtual key and column.
+    std::map<std::pair<uint8_t, size_t>, WString> ligatures;
+    const LIGATURE1* lig = tables->pLigature;
+    while (lig != nullptr && tables->cbLgEntry > 0 && lig->VirtualKey != 0) {
+        size_t len = 0;
+        while (len < size_t(tables->nLgMax) && lig->wch[len] != WCH_NONE) {
+            ++len;
+        }
+        ligatures.insert(std::make_pair(std::make_pair(lig->VirtualKey, size_t(lig->ModificationNumber)), WString(lig->wch, len)));
+        _max_output = std::max(_max_output, len + 1);
+        lig = reinterpret_cast<const LIGATURE1*>(reinterpret_cast<const char*>(lig) + tables->cbLgEntry);
+    }
+
+    // Build the cells of one row of characters, return the index of the first cell.
+    // The accents of dead keys are in the following entry, when not SGCAPS.
+    const auto add_row = [&](const VK_TO_WCHARS10* entry, const VK_TO_WCHARS10* accents, size_t count) {
+        const int32_t index = int32_t(_cells.size());
+        for (size_t bits = 0; bits < _states; ++bits) {
+            const size_t col = mods->ModNumber[bits];
+            Cell cell {WCH_NONE, CELL_NONE, 0, 0};
+            const wchar_t wc = col < count ? entry->wch[col] : WCH_NONE;
+            if (wc == WCH_DEAD) {
+                if (accents != nullptr && accents->wch[col] != WCH_NONE) {
+                    cell.wc = accents->wch[col];
+                    cell.type = CELL_DEAD;
+                }
+            }
+            else if (wc == WCH_LGTR) {
+                const auto it = ligatures.find(std::make_pair(uint8_t(entry->VirtualKey), col));
+                if (it != ligatures.end() && !it->second.empty()) {
+                    cell.wc = it->second[0];
+                    cell.type = CELL_LIGATURE;
+                    cell.length = uint8_t(it->second.size());
+                    cell.offset = uint32_t(_ligatures.size());
+                    _ligatures.insert(_ligatures.end(), it->second.begin(), it->second.end());
+                }
+            }
+            else if (wc != 0 && wc != WCH_NONE) {
+                cell.wc = wc;
+                cell.type = CELL_CHAR;
+            }
+            _cells.push_back(cell);
+        }
+        return index;
+    };
+
+    // Character rows. Only the first entry of a virtual key is used, as in the system.
+    // As in the system, the entry after an SGCAPS key is its CapsLock row, whatever its
+    // virtual key. Otherwise, a VK__none_ entry contains the dead characters of the key.
+    for (const VK_TO_WCHAR_TABLE* vtwt = tables->pVkToWcharTable; vtwt->pVkToWchars != nullptr; ++vtwt) {
+        const size_t count = vtwt->nModifications;
+        const size_t size = vtwt->cbSize;
+        const VK_TO_WCHARS10* vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(vtwt->pVkToWchars);
+        while (vtwc->VirtualKey != 0) {
+            const VK_TO_WCHARS10* next = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + size);
+            Row& row(_rows[vtwc->VirtualKey]);
+            if (vtwc->VirtualKey != VK__none_ && row.cells < 0) {
+                const bool sgcaps = (vtwc->Attributes & SGCAPS) != 0 && next->VirtualKey != 0;
+                row.attributes = vtwc->Attributes;
+                row.cells = add_row(vtwc, !sgcaps && next->VirtualKey == VK__none_ ? next : nullptr, count);
+                if (sgcaps) {
+                    row.sgcaps = add_row(next, nullptr, count);
+                }
+                else {
+                    row.attributes &= uint8_t(~SGCAPS);
+                }
+            }
+            vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + size);
+        }
+    }
+
+    // Dead keys, sorted for binary search. The first translation of a pair is used.
+    for (const DEADKEY* dk = tables->pDeadKey; dk != nullptr && dk->dwBoth != 0; ++dk) {
+        _deadkeys.push_back(*dk);
+    }
+    std::stable_sort(_deadkeys.data(), _deadkeys.data() + _deadkeys.size(), [](const DEADKEY& a, const DEADKEY& b) { return a.dwBoth < b.dwBoth; });
+
+    Stats::Instance().count("translator cells", _cells.size());
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Get the virtual key of a scan code.
+//----------------------------------------------------------------------------
+
+uint16_t KeyTranslator::virtualKey(uint8_t prefix, uint8_t sc) const
+{
+    if (sc >= 128) {
+        return 0;
+    }
+    return _sc_to_vk[prefix == SC_PREFIX0 ? 1 : (prefix == SC_PREFIX1 ? 2 : 0)][sc];
+}
+
+
+//----------------------------------------------------------------------------
+// Find the translation of a dead key.
+//----------------------------------------------------------------------------
+
+const DEADKEY* KeyTranslator::findDeadKey(wchar_t accent, wchar_t base) const
+{
+    const DWORD both = MAKELONG(base, accent);
+    const DEADKEY* end = _deadkeys.data() + _deadkeys.size();
+    const DEADKEY* dk = std::lower_bound(_deadkeys.data(), end, both, [](const DEADKEY& d, DWORD value) { return d.dwBoth < value; });
+    return dk != end && dk->dwBoth == both ? dk : nullptr;
+}
+
+
+//----------------------------------------------------------------------------
+// Process one keystroke.
+//----------------------------------------------------------------------------
+
+size_t KeyTranslator::keystroke(State& state, uint8_t prefix, uint8_t sc, bool pressed, wchar_t* out) const
+{
+    const uint8_t vk = uint8_t(virtualKey(prefix, sc) & 0xFF);
+    if (vk == 0 || vk == VK__none_) {
+        return 0;
+    }
+
+    // Modifier and lock keys.
+    if (_modifiers.update(state, vk, pressed) || !pressed) {
+        return 0;
+    }
+
+    // Select the cell from the shift state of the key.
+    const Row& row(_rows[vk]);
+    bool sgcaps = false;
+    const size_t bits = _modifiers.shiftState(state, row.attributes, sgcaps);
+    if (row.cells < 0 || bits >= _states) {
+        return 0;
+    }
+    const int32_t cells = sgcaps ? row.sgcaps : row.cells;
+    const Cell& cell(_cells[size_t(cells) + bits]);
+
+    // Combine with the pending dead key.
+    size_t count = 0;
+    switch (cell.type) {
+        case CELL_CHAR:
+        case CELL_DEAD: {
+            if (state.dead != 0) {
+                const DEADKEY* dk = findDeadKey(state.dead, cell.wc);
+                if (dk == nullptr) {
+                    out[count++] = state.dead;
+                    out[count++] = cell.wc;
+                    state.dead = 0;
+                }
+                else if ((dk->uFlags & DKF_DEAD) != 0) {
+                    state.dead = dk->wchComposed;
+                }
+                else {
+                    out[count++] = dk->wchComposed;
+                    state.dead = 0;
+                }
+            }
+            else if (cell.type == CELL_DEAD) {
+                state.dead = cell.wc;
+            }
+            else {
+                out[count++] = cell.wc;
+            }
+            break;
+        }
+        case CELL_LIGATURE: {
+            if (state.dead != 0) {
+                out[count++] = state.dead;
+                state.dead = 0;
+            }
+            for (size_t i = 0; i < cell.length; ++i) {
+                out[count++] = _ligatures[cell.offset + i];
+            }
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+    return count;
+}
+
+
+//----------------------------------------------------------------------------
+// Translate a stream of scan code bytes.
+//----------------------------------------------------------------------------
+
+size_t KeyTranslator::translate(State& state, const uint8_t* input, size_t size, wchar_t* out, size_t out_size, size_t& written) const
+{
+    size_t pos = 0;
+    written = 0;
+    while (pos < size && out_size - written >= _max_output) {
+        const uint8_t b = input[pos++];
+        if (state._skip > 0) {
+            state._skip--;
+        }
+        else if (b == SC_PREFIX0 || b == SC_PREFIX1) {
+            state._prefix = b;
+        }
+        else {
+            const uint8_t prefix = state._prefix;
+            state._prefix = 0;
+            state._skip = prefix == SC_PREFIX1 ? 1 : 0;
+            written += keystroke(state, prefix, uint8_t(b & ~SC_RELEASE), (b & SC_RELEASE) == 0, out + written);
+        }
+    }
+    return pos;
+}
@@ -0,0 +1,104 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Translation of scan code streams into characters, using the tables of
+// a keyboard layout.
+//
+// The input is a stream of set 1 scan code bytes, as sent by the keyboard:
+// bit 0x80 indicates a key release, bytes 0xE0 and 0xE1 are prefixes of
+// the next scan code. The E1 prefix covers the two next bytes, as in the
+// Pause key (E1 1D 45), and the key is identified by the first one.
+//
+// The KBDTABLES are compiled once into dense tables, indexed by scan code,
+// virtual key and modifier bits. The modifier and lock keys are handled by
+// a ModifierMachine. The translation does not allocate memory and does not
+// modify the translator. The keyboard state (pressed modifiers, locks,
+// pending dead key) is in a separate State object, one per input stream,
+// so that several threads can use the same translator.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "modifiermachine.h"
+
+class KeyTranslator
+{
+public:
+    // Constructor. Specify where to report errors.
+    KeyTranslator(Error& err);
+
+    // Compile the tables of a keyboard layout. Return false on error.
+    bool build(const KBDTABLES* tables);
+
+    // Clear the tables, nothing is translated.
+    void clear();
+
+    // Maximum number of characters which can be produced by one keystroke.
+    size_t maxOutput() const { return _max_output; }
+
+    // State of the keyboard for one input stream: modifiers and locks, see ModifierMachine::State.
+    class State : public ModifierMachine::State
+    {
+    public:
+        State();             // Constructor.
+        void reset();        // Reset the state, no key pressed.
+        wchar_t  dead;       // Accent of the pending dead key, zero if none.
+    private:
+        friend class KeyTranslator;
+        uint8_t  _prefix;    // Pending prefix byte, zero if none.
+        uint8_t  _skip;      // Number of bytes to ignore after an E1 scan code.
+    };
+
+    // Get the virtual key of a scan code, including KBDEXT and other flags.
+    // Prefix is 0, 0xE0 or 0xE1. Return zero if the scan code is unused.
+    uint16_t virtualKey(uint8_t prefix, uint8_t sc) const;
+
+    // Process one keystroke: scan code with prefix, press or release. Update the
+    // state and write the produced characters in out, at most maxOutput().
+    // Return the number of characters.
+    size_t keystroke(State& state, uint8_t prefix, uint8_t sc, bool pressed, wchar_t* out) const;
+
+    // Translate a stream of scan code bytes. Stop when the output buffer has less
+    // than maxOutput() free characters. Return the number of consumed input bytes,
+    // the number of written characters is returned in written.
+    size_t translate(State& state, const uint8_t* input, size_t size, wchar_t* out, size_t out_size, size_t& written) const;
+
+private:
+    // Type of a character cell.
+    enum : uint8_t {CELL_NONE = 0, CELL_CHAR, CELL_DEAD, CELL_LIGATURE};
+
+    // One character cell, for a virtual key and modifier bits.
+    class Cell
+    {
+    public:
+        wchar_t  wc;      // Character, accent of a dead key, first character of a ligature.
+        uint8_t  type;    // CELL_xxx.
+        uint8_t  length;  // Number of characters in a ligature.
+        uint32_t offset;  // Index of the ligature in _ligatures.
+    };
+
+    // One row of characters for a virtual key.
+    class Row
+    {
+    public:
+        uint8_t  attributes;  // CAPLOK, SGCAPS (only with a CapsLock entry), CAPLOKALTGR, KANALOK, GRPSELTAP.
+        int32_t  cells;       // Index of first cell in _cells, -1 if the key has no character.
+        int32_t  sgcaps;      // Index of first cell with CapsLock for SGCAPS, -1 if none.
+    };
+
+    Error&                _err;
+    size_t                _states;          // Number of modifier bits combinations, wMaxModBits + 1.
+    size_t                _max_output;
+    ModifierMachine       _modifiers;       // Modifier and lock keys.
+    uint16_t              _sc_to_vk[3][128];  // Scan codes without prefix, with E0, with E1.
+    Row                   _rows[256];       // Character rows, by virtual key.
+    std::vector<Cell>     _cells;           // _states cells per row.
+    std::vector<wchar_t>  _ligatures;       // Characters of all ligatures.
+    std::vector<DEADKEY>  _deadkeys;        // Dead key translations, sorted by dwBoth.
+
+    // Find the translation of a dead key. Return nullptr if not found.
+    const DEADKEY* findDeadKey(wchar_t accent, wchar_t base) const;
+};
@@ -0,0 +1,677 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Reader of Microsoft Keyboard Layout Creator (MSKLC) source files (.klc).
+//
+//----------------------------------------------------------------------------
+
+#include "klcreader.h"
+#include "winutils.h"
+#include "stats.h"
+
+const WString KlcReader::FILE_EXTENSION(L".klc");
+
+
+//----------------------------------------------------------------------------
+// Default tables, as generated by kbdtool for keyboard type 4.
+//----------------------------------------------------------------------------
+
+namespace {
+
+    // Scan code to virtual key, the LAYOUT section replaces the virtual keys, not the flags.
+    const USHORT default_sc_to_vk[] = {
+        /* 00 */ VK__none_,
+        /* 01 */ VK_ESCAPE,
+        /* 02 */ '1',
+        /* 03 */ '2',
+        /* 04 */ '3',
+        /* 05 */ '4',
+        /* 06 */ '5',
+        /* 07 */ '6',
+        /* 08 */ '7',
+        /* 09 */ '8',
+        /* 0A */ '9',
+        /* 0B */ '0',
+        /* 0C */ VK_OEM_MINUS,
+        /* 0D */ VK_OEM_PLUS,
+        /* 0E */ VK_BACK,
+        /* 0F */ VK_TAB,
+        /* 10 */ 'Q',
+        /* 11 */ 'W',
+        /* 12 */ 'E',
+        /* 13 */ 'R',
+        /* 14 */ 'T',
+        /* 15 */ 'Y',
+        /* 16 */ 'U',
+        /* 17 */ 'I',
+        /* 18 */ 'O',
+        /* 19 */ 'P',
+        /* 1A */ VK_OEM_4,
+        /* 1B */ VK_OEM_6,
+        /* 1C */ VK_RETURN,
+        /* 1D */ VK_LCONTROL,
+        /* 1E */ 'A',
+        /* 1F */ 'S',
+        /* 20 */ 'D',
+        /* 21 */ 'F',
+        /* 22 */ 'G',
+        /* 23 */ 'H',
+        /* 24 */ 'J',
+        /* 25 */ 'K',
+        /* 26 */ 'L',
+        /* 27 */ VK_OEM_1,
+        /* 28 */ VK_OEM_7,
+        /* 29 */ VK_OEM_3,
+        /* 2A */ VK_LSHIFT,
+        /* 2B */ VK_OEM_5,
+        /* 2C */ 'Z',
+        /* 2D */ 'X',
+        /* 2E */ 'C',
+        /* 2F */ 'V',
+        /* 30 */ 'B',
+        /* 31 */ 'N',
+        /* 32 */ 'M',
+        /* 33 */ VK_OEM_COMMA,
+        /* 34 */ VK_OEM_PERIOD,
+        /* 35 */ VK_OEM_2,
+        /* 36 */ VK_RSHIFT | KBDEXT,
+        /* 37 */ VK_MULTIPLY | KBDMULTIVK,
+        /* 38 */ VK_LMENU,
+        /* 39 */ VK_SPACE,
+        /* 3A */ VK_CAPITAL,
+        /* 3B */ VK_F1,
+        /* 3C */ VK_F2,
+        /* 3D */ VK_F3,
+        /* 3E */ VK_F4,
+        /* 3F */ VK_F5,
+        /* 40 */ VK_F6,
+        /* 41 */ VK_F7,
+        /* 42 */ VK_F8,
+        /* 43 */ VK_F9,
+        /* 44 */ VK_F10,
+        /* 45 */ VK_NUMLOCK | KBDEXT | KBDMULTIVK,
+        /* 46 */ VK_SCROLL | KBDMULTIVK,
+        /* 47 */ VK_HOME | KBDSPECIAL | KBDNUMPAD,
+        /* 48 */ VK_UP | KBDSPECIAL | KBDNUMPAD,
+        /* 49 */ VK_PRIOR | KBDSPECIAL | KBDNUMPAD,
+        /* 4A */ VK_SUBTRACT,
+        /* 4B */ VK_LEFT | KBDSPECIAL | KBDNUMPAD,
+        /* 4C */ VK_CLEAR | KBDSPECIAL | KBDNUMPAD,
+        /* 4D */ VK_RIGHT | KBDSPECIAL | KBDNUMPAD,
+        /* 4E */ VK_ADD,
+        /* 4F */ VK_END | KBDSPECIAL | KBDNUMPAD,
+        /* 50 */ VK_DOWN | KBDSPECIAL | KBDNUMPAD,
+        /* 51 */ VK_NEXT | KBDSPECIAL | KBDNUMPAD,
+        /* 52 */ VK_INSERT | KBDSPECIAL | KBDNUMPAD,
+        /* 53 */ VK_DELETE | KBDSPECIAL | KBDNUMPAD,
+        /* 54 */ VK_SNAPSHOT,
+        /* 55 */ VK__none_,
+        /* 56 */ VK_OEM_102,
+        /* 57 */ VK_F11,
+        /* 58 */ VK_F12,
+        /* 59 */ VK_CLEAR,
+        /* 5A */ VK_OEM_WSCTRL,
+        /* 5B */ VK_OEM_FINISH,
+        /* 5C */ VK_OEM_JUMP,
+        /* 5D */ VK_EREOF,
+        /* 5E */ VK_OEM_BACKTAB,
+        /* 5F */ VK_OEM_AUTO,
+        /* 60 */ VK__none_,
+        /* 61 */ VK__none_,
+        /* 62 */ VK_ZOOM,
+        /* 63 */ VK_HELP,
+        /* 64 */ VK_F13,
+        /* 65 */ VK_F14,
+        /* 66 */ VK_F15,
+        /* 67 */ VK_F16,
+        /* 68 */ VK_F17,
+        /* 69 */ VK_F18,
+        /* 6A */ VK_F19,
+        /* 6B */ VK_F20,
+        /* 6C */ VK_F21,
+        /* 6D */ VK_F22,
+        /* 6E */ VK_F23,
+        /* 6F */ VK_OEM_PA3,
+        /* 70 */ VK__none_,
+        /* 71 */ VK_OEM_RESET,
+        /* 72 */ VK__none_,
+        /* 73 */ 0x00C1,  // ABNT_C1
+        /* 74 */ VK__none_,
+        /* 75 */ VK__none_,
+        /* 76 */ VK_F24,
+        /* 77 */ VK__none_,
+        /* 78 */ VK__none_,
+        /* 79 */ VK__none_,
+        /* 7A */ VK__none_,
+        /* 7B */ VK_OEM_PA1,
+        /* 7C */ VK_TAB,
+        /* 7D */ VK__none_,
+        /* 7E */ 0x00C2,  // ABNT_C2
+    };
+
+    // Scan codes with E0 prefix.
+    const VSC_VK default_sc_to_vk_e0[] = {
+        {0x10, VK_MEDIA_PREV_TRACK | KBDEXT},
+        {0x19, VK_MEDIA_NEXT_TRACK | KBDEXT},
+        {0x1D, VK_RCONTROL | KBDEXT},
+        {0x20, VK_VOLUME_MUTE | KBDEXT},
+        {0x21, VK_LAUNCH_APP2 | KBDEXT},
+        {0x22, VK_MEDIA_PLAY_PAUSE | KBDEXT},
+        {0x24, VK_MEDIA_STOP | KBDEXT},
+        {0x2E, VK_VOLUME_DOWN | KBDEXT},
+        {0x30, VK_VOLUME_UP | KBDEXT},
+        {0x32, VK_BROWSER_HOME | KBDEXT},
+        {0x35, VK_DIVIDE | KBDEXT},
+        {0x37, VK_SNAPSHOT | KBDEXT},
+        {0x38, VK_RMENU | KBDEXT},
+        {0x47, VK_HOME | KBDEXT},
+        {0x48, VK_UP | KBDEXT},
+        {0x49, VK_PRIOR | KBDEXT},
+        {0x4B, VK_LEFT | KBDEXT},
+        {0x4D, VK_RIGHT | KBDEXT},
+        {0x4F, VK_END | KBDEXT},
+        {0x50, VK_DOWN | KBDEXT},
+        {0x51, VK_NEXT | KBDEXT},
+        {0x52, VK_INSERT | KBDEXT},
+        {0x53, VK_DELETE | KBDEXT},
+        {0x5B, VK_LWIN | KBDEXT},
+        {0x5C, VK_RWIN | KBDEXT},
+        {0x5D, VK_APPS | KBDEXT},
+        {0x5F, VK_SLEEP | KBDEXT},
+        {0x65, VK_BROWSER_SEARCH | KBDEXT},
+        {0x66, VK_BROWSER_FAVORITES | KBDEXT},
+        {0x67, VK_BROWSER_REFRESH | KBDEXT},
+        {0x68, VK_BROWSER_STOP | KBDEXT},
+        {0x69, VK_BROWSER_FORWARD | KBDEXT},
+        {0x6A, VK_BROWSER_BACK | KBDEXT},
+        {0x6B, VK_LAUNCH_APP1 | KBDEXT},
+        {0x6C, VK_LAUNCH_MAIL | KBDEXT},
+        {0x6D, VK_LAUNCH_MEDIA_SELECT | KBDEXT},
+        {0x1C, VK_RETURN | KBDEXT},
+        {0x46, VK_CANCEL | KBDEXT},
+    };
+
+    // Scan codes with E1 prefix.
+    const VSC_VK default_sc_to_vk_e1[] = {
+        {0x1D, VK_PAUSE},
+    };
+
+    // Keys which are always added, in base, shift and ctrl columns.
+    // The ctrl column is used only when the layout has a ctrl shift state.
+    class DefaultKey
+    {
+    public:
+        uint8_t vk;
+        wchar_t base;
+        wchar_t shift;
+        wchar_t ctrl;
+    };
+
+    const DefaultKey default_ctrl_keys[] = {
+        {VK_BACK,   0x0008, 0x0008, 0x007F},
+        {VK_ESCAPE, 0x001B, 0x001B, 0x001B},
+        {VK_RETURN, 0x000D, 0x000D, 0x000A},
+        {VK_CANCEL, 0x0003, 0x0003, 0x0003},
+    };
+
+    const DefaultKey default_keys[] = {
+        {VK_TAB,      0x0009, 0x0009, WCH_NONE},
+        {VK_ADD,      L'+',   L'+',   WCH_NONE},
+        {VK_DIVIDE,   L'/',   L'/',   WCH_NONE},
+        {VK_MULTIPLY, L'*',   L'*',   WCH_NONE},
+        {VK_SUBTRACT, L'-',   L'-',   WCH_NONE},
+    };
+}
+
+
+//----------------------------------------------------------------------------
+// Parsing helpers.
+//----------------------------------------------------------------------------
+
+namespace {
+
+    // Decode the content of a file: UTF-16 with BOM or UTF-8.
+    WString DecodeText(const std::string& content)
+    {
+        if (content.size() >= 2 && ((uint8_t(content[0]) == 0xFF && uint8_t(content[1]) == 0xFE) || (uint8_t(content[0]) == 0xFE && uint8_t(content[1]) == 0xFF))) {
+            const bool big_endian = uint8_t(content[0]) == 0xFE;
+            WString text;
+            text.reserve(content.size() / 2);
+            for (size_t i = 2; i + 1 < content.size(); i += 2) {
+                const uint8_t b0 = uint8_t(content[i]);
+                const uint8_t b1 = uint8_t(content[i + 1]);
+                text.push_back(wchar_t(big_endian ? (b0 << 8) | b1 : (b1 << 8) | b0));
+            }
+            return text;
+        }
+        return ToUTF16(content.compare(0, 3, UTF8_BOM) == 0 ? content.substr(3) : content);
+    }
+
+    // Split a line in tokens. Comments start with "//" or ';'. Quoted strings are one token, without quotes.
+    void Tokenize(const WString& line, WStringVector& tokens)
+    {
+        tokens.clear();
+        size_t i = 0;
+        while (i < line.size()) {
+            if (line[i] == L' ' || line[i] == L'\t' || line[i] == L'\r') {
+                ++i;
+            }
+            else if (line[i] == L';' || line.compare(i, 2, L"//") == 0) {
+                break;
+            }
+            else if (line[i] == L'"') {
+                const size_t end = line.find(L'"', i + 1);
+                tokens.push_back(line.substr(i + 1, end == WString::npos ? WString::npos : end - i - 1));
+                i = end == WString::npos ? line.size() : end + 1;
+            }
+            else {
+                const size_t start = i;
+                while (i < line.size() && line[i] != L' ' && line[i] != L'\t' && line[i] != L'\r') {
+                    ++i;
+                }
+                tokens.push_back(line.substr(start, i - start));
+            }
+        }
+    }
+
+    // Join the tokens from an index, with spaces.
+    WString JoinTokens(const WStringVector& tokens, size_t first)
+    {
+        WString res;
+        for (size_t i = first; i < tokens.size(); ++i) {
+            if (i > first) {
+                res.push_back(L' ');
+            }
+            res.append(tokens[i]);
+        }
+        return res;
+    }
+
+    // Parse a hexadecimal value, not empty.
+    template <typename INT_T>
+    bool ParseHexa(const WString& token, INT_T& value)
+    {
+        return !token.empty() && token.size() <= 2 * sizeof(INT_T) && FromHexa(value, token);
+    }
+
+    // Parse a character in the LAYOUT section: -1 for none, %% for ligature, hexadecimal
+    // value or single character, with a trailing '@' for dead keys.
+    bool ParseChar(const WString& token, LayoutDescription::Char& c)
+    {
+        c = LayoutDescription::Char();
+        WString tok(token);
+        if (tok.size() > 1 && tok.back() == L'@') {
+            c.dead = true;
+            tok.pop_back();
+        }
+        uint16_t value = 0;
+        if (tok == L"-1" && !c.dead) {
+            c.value = WCH_NONE;
+        }
+        else if (tok == L"%%" && !c.dead) {
+            c.value = WCH_LGTR;
+        }
+        else if (tok.size() == 1) {
+            c.value = tok[0];
+        }
+        else if (tok.size() >= 4 && ParseHexa(tok, value)) {
+            c.value = wchar_t(value);
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    // Parse a scan code: "1e", or "e01c" with prefix.
+    bool ParseScanCode(const WString& token, uint8_t& prefix, uint8_t& sc)
+    {
+        uint16_t value = 0;
+        if (!ParseHexa(token, value)) {
+            return false;
+        }
+        prefix = uint8_t(value >> 8);
+        sc = uint8_t(value);
+        return sc != 0 && (prefix == 0 || prefix == 0xE0 || prefix == 0xE1);
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Constructor.
+//----------------------------------------------------------------------------
+
+KlcReader::KlcReader(Error& err) :
+    _err(err)
+{
+}
+
+
+//----------------------------------------------------------------------------
+// Load a .klc file.
+//----------------------------------------------------------------------------
+
+bool KlcReader::load(LayoutDescription& desc, const WString& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        _err.error("cannot open " + filename);
+        return false;
+    }
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return load(desc, content, filename);
+}
+
+bool KlcReader::load(LayoutDescription& desc, const std::string& content, const WString& filename)
+{
+    Stats::Timer timer("klc file");
+    desc.clear();
+    desc.name = FileBaseName(filename);
+
+    bool success = true;
+    WString section;
+    wchar_t accent = 0;
+    std::vector<uint8_t> states;              // Shift states, in column order.
+    std::map<uint16_t, uint16_t> layout_vks;  // Scan codes (with prefix) from the LAYOUT section.
+    std::set<uint8_t> layout_keys;            // Virtual keys from the LAYOUT section.
+    WString description;                      // First entry in DESCRIPTIONS.
+
+    // Process the content line by line.
+    const WString text(DecodeText(content));
+    WStringVector tokens;
+    size_t number = 0;
+    size_t start = 0;
+    while (start < text.size() && section != L"ENDKBD") {
+        size_t end = text.find(L'\n', start);
+        if (end == WString::npos) {
+            end = text.size();
+        }
+        Tokenize(text.substr(start, end - start), tokens);
+        start = end + 1;
+        ++number;
+        if (tokens.empty()) {
+            continue;
+        }
+        const auto where = [&filename, number]() { return Format(L"%s, line %d", filename.c_str(), int(number)); };
+        const WString keyword(ToUpper(tokens[0]));
+
+        // Single line entries and section headers.
+        if (keyword == L"KBD") {
+            if (tokens.size() > 1) {
+                desc.name = StartsWith(ToLower(tokens[1]), L"kbd") ? tokens[1] : L"kbd" + tokens[1];
+            }
+            if (tokens.size() > 2) {
+                desc.text = tokens[2];
+            }
+            section.clear();
+        }
+        else if (keyword == L"LOCALEID") {
+            if (tokens.size() > 1 && tokens[1].size() >= 4) {
+                desc.lang = ToLower(tokens[1].substr(tokens[1].size() - 4));
+            }
+            section.clear();
+        }
+        else if (keyword == L"COPYRIGHT" || keyword == L"COMPANY" || keyword == L"LOCALENAME" || keyword == L"VERSION") {
+            section.clear();
+        }
+        else if (keyword == L"DEADKEY") {
+            uint16_t value = 0;
+            if (tokens.size() != 2 || !ParseHexa(tokens[1], value)) {
+                _err.error(where() + ": invalid DEADKEY");
+                success = false;
+                section = L"?";
+            }
+            else {
+                section = keyword;
+                accent = wchar_t(value);
+                desc.dead_keys.push_back(std::make_pair(accent, std::vector<LayoutDescription::DeadKey>()));
+            }
+        }
+        else if (keyword == L"ATTRIBUTES" || keyword == L"SHIFTSTATE" || keyword == L"LAYOUT" || keyword == L"LIGATURE" ||
+                 keyword == L"KEYNAME" || keyword == L"KEYNAME_EXT" || keyword == L"KEYNAME_DEAD" ||
+                 keyword == L"DESCRIPTIONS" || keyword == L"LANGUAGENAMES" || keyword == L"ENDKBD")
+        {
+            section = keyword;
+        }
+
+        // Content of sections.
+        else if (section == L"ATTRIBUTES") {
+            if (keyword == L"ALTGR") {
+                desc.locale_flags |= KLLF_ALTGR;
+            }
+            else if (keyword == L"SHIFTLOCK") {
+                desc.locale_flags |= KLLF_SHIFTLOCK;
+            }
+            else if (keyword == L"LRM_RLM") {
+                desc.locale_flags |= KLLF_LRM_RLM;
+            }
+            else {
+                _err.warning(where() + ": unsupported attribute " + tokens[0]);
+            }
+        }
+        else if (section == L"SHIFTSTATE") {
+            const int state = ToInt(tokens[0]);
+            if (state < 0 || state > (KBDSHIFT | KBDCTRL | KBDALT | KBDKANA)) {
+                _err.error(where() + ": unsupported shift state " + tokens[0]);
+                success = false;
+            }
+            else {
+                states.push_back(uint8_t(state));
+            }
+        }
+        else if (section == L"LAYOUT") {
+            // Scan code, virtual key, caps attribute, one character per shift state.
+            // A line "-1 -1 0 ..." after SGCap is the row of characters with CapsLock.
+            uint8_t prefix = 0;
+            uint8_t sc = 0;
+            uint8_t vk = 0;
+            LayoutDescription::Key key;
+            const bool sgcaps_row = tokens.size() > 1 && tokens[0] == L"-1" && tokens[1] == L"-1";
+            if (tokens.size() < 3 || tokens.size() > 3 + states.size()) {
+                _err.error(where() + ": expected 'scan-code virtual-key caps characters...'");
+                success = false;
+                continue;
+            }
+            else if (sgcaps_row) {
+                if (desc.keys.empty() || (desc.keys.back().attributes & SGCAPS) == 0) {
+                    _err.error(where() + ": caps row without SGCap");
+                    success = false;
+                    continue;
+                }
+                key.vk = desc.keys.back().vk;
+            }
+            else if (!ParseScanCode(tokens[0], prefix, sc) || !LayoutDescription::VirtualKeyFromName(tokens[1], vk)) {
+                _err.error(where() + ": invalid scan code or virtual key");
+                success = false;
+                continue;
+            }
+            else {
+                key.vk = vk;
+                layout_vks[uint16_t(prefix << 8) | sc] = vk;
+                layout_keys.insert(vk);
+                if (ToUpper(tokens[2]) == L"SGCAP") {
+                    key.attributes = SGCAPS;
+                }
+                else {
+                    key.attributes = uint8_t(ToInt(tokens[2]));
+                }
+            }
+            for (size_t i = 3; i < tokens.size(); ++i) {
+                key.chars.emplace_back();
+                if (!ParseChar(tokens[i], key.chars.back())) {
+                    _err.error(where() + ": invalid character '" + tokens[i] + "'");
+                    success = false;
+                }
+            }
+            desc.keys.push_back(key);
+        }
+        else if (section == L"DEADKEY") {
+            uint16_t base = 0;
+            uint16_t composed = 0;
+            WString comp(tokens.size() > 1 ? tokens[1] : WString());
+            const bool chained = !comp.empty() && comp.back() == L'@';
+            if (chained) {
+                comp.pop_back();
+            }
+            if (tokens.size() != 2 || !ParseHexa(tokens[0], base) || !ParseHexa(comp, composed)) {
+                _err.error(where() + ": expected 'base-char composed-char'");
+                success = false;
+            }
+            else {
+                desc.dead_keys.back().second.push_back(LayoutDescription::DeadKey{wchar_t(base), wchar_t(composed), uint16_t(chained ? DKF_DEAD : 0)});
+            }
+        }
+        else if (section == L"LIGATURE") {
+            // Virtual key, column, characters of the ligature.
+            uint8_t vk = 0;
+            const size_t column = tokens.size() > 1 ? size_t(ToInt(tokens[1])) : 0;
+            auto it = desc.keys.begin();
+            if (tokens.size() >= 3 && LayoutDescription::VirtualKeyFromName(tokens[0], vk)) {
+                it = std::find_if(desc.keys.begin(), desc.keys.end(), [vk](const LayoutDescription::Key& k) { return k.vk == vk; });
+            }
+            if (tokens.size() < 3 || it == desc.keys.end() || column >= it->chars.size()) {
+                _err.error(where() + ": expected 'virtual-key column characters...'");
+                success = false;
+                continue;
+            }
+            LayoutDescription::Char& c(it->chars[column]);
+            c.value = WCH_LGTR;
+            c.dead = false;
+            c.ligature.clear();
+            for (size_t i = 2; i < tokens.size(); ++i) {
+                uint16_t value = 0;
+                if (!ParseHexa(tokens[i], value)) {
+                    _err.error(where() + ": invalid character '" + tokens[i] + "'");
+                    success = false;
+                }
+                c.ligature.push_back(wchar_t(value));
+            }
+        }
+        else if (section == L"KEYNAME" || section == L"KEYNAME_EXT") {
+            uint8_t sc = 0;
+            if (tokens.size() < 2 || !ParseHexa(tokens[0], sc)) {
+                _err.error(where() + ": expected 'scan-code name'");
+                success = false;
+                continue;
+            }
+            desc.key_names.push_back(LayoutDescription::KeyName{uint8_t(section == L"KEYNAME" ? 0 : 0xE0), sc, JoinTokens(tokens, 1)});
+        }
+        else if (section == L"KEYNAME_DEAD") {
+            uint16_t value = 0;
+            if (tokens.size() < 2 || !ParseHexa(tokens[0], value)) {
+                _err.error(where() + ": expected 'accent name'");
+                success = false;
+                continue;
+            }
+            desc.dead_key_names.push_back(std::make_pair(wchar_t(value), JoinTokens(tokens, 1)));
+        }
+        else if (section == L"DESCRIPTIONS") {
+            if (description.empty() && tokens.size() > 1) {
+                description = JoinTokens(tokens, 1);
+            }
+        }
+        else if (section == L"LANGUAGENAMES" || section == L"?") {
+            // Ignored.
+        }
+        else {
+            _err.error(where() + ": unexpected '" + tokens[0] + "'");
+            success = false;
+        }
+    }
+    if (desc.text.empty()) {
+        desc.text = description;
+    }
+    if (states.empty()) {
+        _err.error(filename + ": no SHIFTSTATE section");
+        return false;
+    }
+
+    // Modifiers and columns of each shift state.
+    uint8_t all_bits = 0;
+    for (uint8_t bits : states) {
+        all_bits |= bits;
+    }
+    desc.modifiers.push_back(VK_TO_BIT{VK_SHIFT, KBDSHIFT});
+    desc.modifiers.push_back(VK_TO_BIT{VK_CONTROL, KBDCTRL});
+    desc.modifiers.push_back(VK_TO_BIT{VK_MENU, KBDALT});
+    if ((all_bits & KBDKANA) != 0) {
+        desc.modifiers.push_back(VK_TO_BIT{VK_KANA, KBDKANA});
+    }
+    desc.columns.assign(*std::max_element(states.begin(), states.end()) + 1, SHFT_INVALID);
+    for (size_t col = 0; col < states.size(); ++col) {
+        desc.columns[states[col]] = uint8_t(col);
+    }
+
+    // Default scan codes, with the virtual keys of the LAYOUT section. The keys of the numeric
+    // keypad keep their default virtual key, the LAYOUT section contains their NumLock virtual key.
+    const auto add_scancode = [&](uint8_t prefix, uint8_t sc, USHORT vk) {
+        const auto it = layout_vks.find(uint16_t(prefix << 8) | sc);
+        if (it != layout_vks.end()) {
+            if ((vk & KBDNUMPAD) == 0) {
+                vk = (vk & 0xFF00) | it->second;
+            }
+            layout_vks.erase(it);
+        }
+        if (vk != VK__none_) {
+            desc.scancodes.push_back(LayoutDescription::ScanCode{prefix, sc, vk});
+        }
+    };
+    for (size_t sc = 1; sc < sizeof(default_sc_to_vk) / sizeof(default_sc_to_vk[0]); ++sc) {
+        add_scancode(0, uint8_t(sc), default_sc_to_vk[sc]);
+    }
+    for (const auto& def : default_sc_to_vk_e0) {
+        add_scancode(0xE0, def.Vsc, def.Vk);
+    }
+    for (const auto& def : default_sc_to_vk_e1) {
+        add_scancode(0xE1, def.Vsc, def.Vk);
+    }
+    for (const auto& it : layout_vks) {
+        const uint8_t prefix = uint8_t(it.first >> 8);
+        desc.scancodes.push_back(LayoutDescription::ScanCode{prefix, uint8_t(it.first), uint16_t(it.second | (prefix == 0xE0 ? KBDEXT : 0))});
+    }
+
+    // Default keys. The control keys come first, the numeric keypad digits last, as with kbdtool.
+    const size_t ctrl_col = KBDCTRL < desc.columns.size() ? desc.columns[KBDCTRL] : SHFT_INVALID;
+    std::vector<LayoutDescription::Key> keys;
+    const auto add_key = [&](const DefaultKey& def, bool with_ctrl) {
+        if (layout_keys.find(def.vk) == layout_keys.end()) {
+            keys.emplace_back(def.vk, 0);
+            keys.back().chars.emplace_back(def.base);
+            keys.back().chars.emplace_back(def.shift);
+            if (with_ctrl && ctrl_col != SHFT_INVALID) {
+                keys.back().chars.resize(std::max<size_t>(ctrl_col + 1, 2));
+                keys.back().chars[ctrl_col] = LayoutDescription::Char(def.ctrl);
+            }
+        }
+    };
+    for (const auto& def : default_ctrl_keys) {
+        add_key(def, true);
+    }
+    for (const auto& key : desc.keys) {
+        keys.push_back(key);
+    }
+    for (const auto& def : default_keys) {
+        add_key(def, false);
+    }
+    for (uint8_t vk = VK_NUMPAD0; vk <= VK_NUMPAD9; ++vk) {
+        if (layout_keys.find(vk) == layout_keys.end()) {
+            keys.emplace_back(vk, 0);
+            keys.back().chars.emplace_back(wchar_t(L'0' + vk - VK_NUMPAD0));
+        }
+    }
+    desc.keys.swap(keys);
+
+    // Check that all ligatures were defined.
+    for (const auto& key : desc.keys) {
+        for (const auto& c : key.chars) {
+            if (c.value == WCH_LGTR && c.ligature.empty()) {
+                _err.error(filename + ": missing LIGATURE entry for virtual key " + Format(L"0x%02X", key.vk));
+                success = false;
+            }
+        }
+    }
+    return success;
+}
@@ -0,0 +1,42 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Reader of Microsoft Keyboard Layout Creator (MSKLC) source files (.klc).
+//
+// A .klc file is usually a UTF-16 text file with a BOM. UTF-8 is also
+// accepted. The sections KBD, LOCALEID, ATTRIBUTES, SHIFTSTATE, LAYOUT,
+// DEADKEY, LIGATURE, KEYNAME, KEYNAME_EXT, KEYNAME_DEAD and DESCRIPTIONS
+// are used. The other sections are ignored.
+//
+// The file is translated into a layout description. As with the kbdtool
+// compiler of MSKLC, the scan codes which are not in the LAYOUT section keep
+// their default virtual key for keyboard type 4, and the usual entries are
+// added for Backspace, Escape, Enter, Cancel, Tab, numeric keypad operators
+// and digits, unless the LAYOUT section redefines them.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "layoutdesc.h"
+
+class KlcReader
+{
+public:
+    // Constructor. Specify where to report errors.
+    KlcReader(Error& err);
+
+    // Default file extension of MSKLC source files.
+    static const WString FILE_EXTENSION;
+
+    // Load a .klc file into a layout description. Return false on error.
+    bool load(LayoutDescription& desc, const WString& filename);
+
+    // Same as load() with the content of the file already in memory.
+    bool load(LayoutDescription& desc, const std::string& content, const WString& filename);
+
+private:
+    Error& _err;
+};
@@ -0,0 +1,118 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// A cache of compiled keyboard layouts, with least-recently-used eviction.
+//
+//----------------------------------------------------------------------------
+
+#include "layoutcache.h"
+#include "stats.h"
+
+
+//----------------------------------------------------------------------------
+// Compiled layout constructor.
+//----------------------------------------------------------------------------
+
+CompiledLayout::CompiledLayout(const WString& filename, bool portable, const Error& err) :
+    _filename(filename),
+    _err(err),
+    _loader(_err),
+    _tables(nullptr),
+    _inverse(_err),
+    _fingerprint()
+{
+    Stats::Timer timer("layout compilation");
+    _loader.portable = portable;
+    const KBDTABLES* tables = _loader.load(filename);
+    if (tables != nullptr && _inverse.build(tables)) {
+        _fingerprint.build(*tables);
+        _tables = tables;
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Cache constructor.
+//----------------------------------------------------------------------------
+
+LayoutCache::LayoutCache(size_t capacity) :
+    portable(false),
+    _mutex(),
+    _capacity(std::max<size_t>(1, capacity)),
+    _layouts(),
+    _index(),
+    _hits(0),
+    _misses(0)
+{
+}
+
+
+//----------------------------------------------------------------------------
+// Get a compiled layout.
+//----------------------------------------------------------------------------
+
+std::shared_ptr<const CompiledLayout> LayoutCache::get(const WString& name, const Error& err)
+{
+    const WString filename(KeyboardLoader::FileName(name));
+
+    // Look in the cache first, move the layout in first position.
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const auto it = _index.find(filename);
+        if (it != _index.end()) {
+            _hits++;
+            _layouts.splice(_layouts.begin(), _layouts, it->second);
+            return it->second->second;
+        }
+        _misses++;
+    }
+
+    // Load and compile outside the lock, other requests continue meanwhile.
+    auto layout = std::make_shared<CompiledLayout>(filename, portable, err);
+    if (layout->tables() == nullptr) {
+        layout->flush(err);
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    const auto it = _index.find(filename);
+    if (it != _index.end()) {
+        // Compiled by another request in the meantime, keep the first one.
+        _layouts.splice(_layouts.begin(), _layouts, it->second);
+        return it->second->second;
+    }
+    _layouts.emplace_front(filename, layout);
+    _index[filename] = _layouts.begin();
+    while (_layouts.size() > _capacity) {
+        _index.erase(_layouts.back().first);
+        _layouts.pop_back();
+        Stats::Instance().count("evicted layouts");
+    }
+    return layout;
+}
+
+
+//----------------------------------------------------------------------------
+// Cache statistics.
+//----------------------------------------------------------------------------
+
+size_t LayoutCache::size() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _layouts.size();
+}
+
+uint64_t LayoutCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _hits;
+}
+
+uint64_t LayoutCache::misses() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _misses;
+}
@@ -0,0 +1,87 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// A cache of compiled keyboard layouts, with least-recently-used eviction.
+//
+// A compiled layout is a loaded DLL with its inverse key map and fingerprint.
+// The cache can be used from several threads. The layouts are shared: a
+// layout which is evicted while it is used remains valid until the last
+// user releases it.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "kbdloader.h"
+#include "inversekeymap.h"
+#include "fingerprint.h"
+#include "taskrunner.h"
+#include <memory>
+#include <mutex>
+
+// A keyboard layout, loaded and compiled once.
+class CompiledLayout
+{
+public:
+    // Constructor. Load and compile a layout. Check tables() for errors.
+    // The error messages are buffered, the verbose mode is inherited from err.
+    CompiledLayout(const WString& filename, bool portable, const Error& err);
+
+    // Layout DLL file name.
+    const WString& filename() const { return _filename; }
+
+    // Keyboard tables, nullptr on error.
+    const KBDTABLES* tables() const { return _tables; }
+
+    // Inverse key map and semantic fingerprint.
+    const InverseKeyMap& inverse() const { return _inverse; }
+    const LayoutFingerprint& fingerprint() const { return _fingerprint; }
+
+    // Forward the buffered error messages to another error reporter.
+    void flush(const Error& err) { _err.flush(err); }
+
+private:
+    const WString     _filename;
+    TaskError         _err;
+    KeyboardLoader    _loader;
+    const KBDTABLES*  _tables;
+    InverseKeyMap     _inverse;
+    LayoutFingerprint _fingerprint;
+
+    // Inaccessible operations.
+    CompiledLayout(const CompiledLayout&) = delete;
+    CompiledLayout& operator=(const CompiledLayout&) = delete;
+};
+
+class LayoutCache
+{
+public:
+    // Constructor. Specify the maximum number of layouts in the cache.
+    LayoutCache(size_t capacity);
+
+    // Portable loading, map the DLL's without executing them.
+    bool portable;
+
+    // Get a compiled layout, from a keyboard name or DLL file name, as in KeyboardLoader.
+    // Load and compile it if not in the cache. On error, return nullptr and report
+    // the error messages in err.
+    std::shared_ptr<const CompiledLayout> get(const WString& name, const Error& err);
+
+    // Cache statistics.
+    size_t size() const;
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    typedef std::shared_ptr<const CompiledLayout> LayoutPtr;
+    typedef std::list<std::pair<WString, LayoutPtr>> LayoutList;
+
+    mutable std::mutex                      _mutex;
+    const size_t                            _capacity;
+    LayoutList                              _layouts;  // Most recently used first.
+    std::map<WString, LayoutList::iterator> _index;    // Index of _layouts by file name.
+    uint64_t                                _hits;
+    uint64_t                                _misses;
+};
@@ -0,0 +1,1152 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Declarative description of a keyboard layout.
+//
+//----------------------------------------------------------------------------
+
+#include "layoutdesc.h"
+#include "sourcegen.h"
+#include "winutils.h"
+#include "grid.h"
+#include "stats.h"
+
+// Maximum nesting level of base descriptions.
+#define MAX_BASE_DEPTH 16
+
+const WString LayoutDescription::FILE_EXTENSION(L".kbl");
+
+
+//----------------------------------------------------------------------------
+// Names of symbols in descriptions.
+//----------------------------------------------------------------------------
+
+namespace {
+
+    // Table of names => values.
+    typedef std::map<WString, Value> NameTable;
+
+    // Build a table of names from a table of symbols. Remove a prefix and quotes, convert to lower case.
+    NameTable MakeNames(const SymbolTable& symbols, const WString& prefix, bool lower)
+    {
+        NameTable names;
+        for (const auto& sym : symbols) {
+            WString name(sym.second);
+            if (StartsWith(name, prefix)) {
+                name.erase(0, prefix.size());
+            }
+            if (name.size() == 3 && name.front() == L'\'' && name.back() == L'\'') {
+                name = name.substr(1, 1);
+            }
+            names.insert(std::make_pair(lower ? ToLower(name) : name, sym.first));
+        }
+        return names;
+    }
+
+    // Name of a value in a name table, hexadecimal if not found.
+    WString ValueName(const NameTable& names, Value value)
+    {
+        for (const auto& it : names) {
+            if (it.second == value) {
+                return it.first;
+            }
+        }
+        return Format(L"0x%02X", int(value));
+    }
+
+    // Names of a bit mask, separated with '+', "-" for zero.
+    WString BitsName(const NameTable& names, Value value)
+    {
+        WStringList list;
+        for (const auto& it : names) {
+            if (it.second != 0 && (value & it.second) == it.second) {
+                list.push_back(it.first);
+                value &= ~it.second;
+            }
+        }
+        if (value != 0) {
+            list.push_back(Format(L"0x%02X", int(value)));
+        }
+        return list.empty() ? L"-" : Join(list, L"+");
+    }
+
+    // Parse a value, by name or hexadecimal.
+    bool ParseValue(const NameTable& names, const WString& token, Value& value)
+    {
+        const auto it = names.find(token);
+        if (it != names.end()) {
+            value = it->second;
+            return true;
+        }
+        return token.size() > 2 && StartsWith(token, L"0x") && FromHexa(value, token.substr(2));
+    }
+
+    // Parse a bit mask, names separated with '+', "-" for zero.
+    bool ParseBits(const NameTable& names, const WString& token, Value& value)
+    {
+        value = 0;
+        if (token == L"-") {
+            return true;
+        }
+        size_t start = 0;
+        for (;;) {
+            const size_t end = token.find(L'+', start);
+            Value bits = 0;
+            if (!ParseValue(names, token.substr(start, end == WString::npos ? WString::npos : end - start), bits)) {
+                return false;
+            }
+            value |= bits;
+            if (end == WString::npos) {
+                return true;
+            }
+            start = end + 1;
+        }
+    }
+
+    // Virtual keys: "A", "OEM_7", "_none_".
+    const NameTable& VkNames()
+    {
+        static const NameTable names(MakeNames(vk_symbols, L"VK_", false));
+        return names;
+    }
+
+    // Flags of virtual keys in scan code tables: "ext", "numpad".
+    const NameTable& VkFlagsNames()
+    {
+        static const NameTable names(MakeNames(vk_flags_symbols, L"KBD", true));
+        return names;
+    }
+
+    // Attributes of keys: "caplok", "sgcaps".
+    const NameTable& AttributesNames()
+    {
+        static const NameTable names(MakeNames(vk_attr_symbols, L"", true));
+        return names;
+    }
+
+    // Modifier bits: "shift", "ctrl", "alt". AltGr is Ctrl+Alt.
+    const NameTable& ModifiersNames()
+    {
+        static const NameTable names(MakeNames(shift_state_symbols, L"KBD", true));
+        return names;
+    }
+
+    // Locale flags: "altgr", "shiftlock", "lrm_rlm".
+    const NameTable& LocaleFlagsNames()
+    {
+        static const NameTable names({{L"altgr", KLLF_ALTGR}, {L"shiftlock", KLLF_SHIFTLOCK}, {L"lrm_rlm", KLLF_LRM_RLM}});
+        return names;
+    }
+
+    // Name of a shift state, AltGr instead of Ctrl+Alt.
+    WString ShiftStateName(Value bits)
+    {
+        if (bits == 0) {
+            return L"base";
+        }
+        const bool altgr = (bits & (KBDCTRL | KBDALT)) == (KBDCTRL | KBDALT);
+        WString name(BitsName(ModifiersNames(), altgr ? bits & ~(KBDCTRL | KBDALT) : bits));
+        if (altgr) {
+            name = bits == (KBDCTRL | KBDALT) ? L"altgr" : name + L"+altgr";
+        }
+        return name;
+    }
+
+    // Parse a shift state.
+    bool ParseShiftState(const WString& token, Value& bits)
+    {
+        if (token == L"altgr") {
+            bits = KBDCTRL | KBDALT;
+            return true;
+        }
+        if (EndsWith(token, L"+altgr") && ParseBits(ModifiersNames(), token.substr(0, token.size() - 6), bits)) {
+            bits |= KBDCTRL | KBDALT;
+            return true;
+        }
+        return ParseBits(ModifiersNames(), token, bits);
+    }
+
+    // Characters which can be written as is. Everything else is written as U+XXXX.
+    bool IsPlainChar(wchar_t c)
+    {
+        return (c > L' ' && c < 0x7F && c != L'-' && c != L'#' && c != L'"' && c != L'@') ||
+            (c >= 0x00A1 && c <= 0x024F && c != 0x00AD) ||  // Latin-1 and Latin extended
+            (c >= 0x0386 && c <= 0x03FF) ||                  // Greek
+            (c >= 0x0400 && c <= 0x0482) ||                  // Cyrillic
+            (c >= 0x048A && c <= 0x04FF) ||
+            (c >= 0x05D0 && c <= 0x05EA) ||                  // Hebrew letters
+            (c >= 0x0621 && c <= 0x064A) ||                  // Arabic letters
+            (c >= 0x1E00 && c <= 0x1FFF) ||                  // Latin and Greek extended
+            (c >= 0x20A0 && c <= 0x20C0) ||                  // Currency symbols
+            (c >= 0x2100 && c <= 0x22FF);                    // Letterlike, arrows, maths
+    }
+
+    // Format a character.
+    WString CharToken(wchar_t c, bool dead)
+    {
+        if (c == WCH_NONE && !dead) {
+            return L"-";
+        }
+        return (IsPlainChar(c) ? WString(1, c) : Format(L"U+%04X", c)) + (dead ? L"@" : L"");
+    }
+
+    // Format a string, in double quotes.
+    WString Quoted(const WString& str)
+    {
+        WString res(1, L'"');
+        for (wchar_t c : str) {
+            if (c == L'"' || c == L'\\') {
+                res.push_back(L'\\');
+                res.push_back(c);
+            }
+            else if (c == L' ' || IsPlainChar(c) || c == L'-' || c == L'#' || c == L'@') {
+                res.push_back(c);
+            }
+            else {
+                res.append(Format(L"\\u%04X", c));
+            }
+        }
+        res.push_back(L'"');
+        return res;
+    }
+
+    // A quoted token starts with a double quote. Its value is the rest of the token.
+    bool IsString(const WString& token)
+    {
+        return !token.empty() && token.front() == L'"';
+    }
+
+    // Split a line into tokens. Return false on error.
+    bool Tokenize(const WString& line, WStringVector& tokens)
+    {
+        tokens.clear();
+        size_t i = 0;
+        for (;;) {
+            while (i < line.size() && (line[i] == L' ' || line[i] == L'\t')) {
+                ++i;
+            }
+            if (i >= line.size() || line[i] == L'#') {
+                return true;
+            }
+            WString tok;
+            if (line[i] == L'"') {
+                tok.push_back(line[i++]);
+                while (i < line.size() && line[i] != L'"') {
+                    if (line[i] != L'\\') {
+                        tok.push_back(line[i++]);
+                    }
+                    else if (i + 1 < line.size() && (line[i + 1] == L'"' || line[i + 1] == L'\\')) {
+                        tok.push_back(line[i + 1]);
+                        i += 2;
+                    }
+                    else {
+                        uint16_t c = 0;
+                        if (i + 5 >= line.size() || line[i + 1] != L'u' || !FromHexa(c, line.substr(i + 2, 4))) {
+                            return false;
+                        }
+                        tok.push_back(wchar_t(c));
+                        i += 6;
+                    }
+                }
+                if (i++ >= line.size()) {
+                    return false; // unterminated string
+                }
+            }
+            else {
+                while (i < line.size() && line[i] != L' ' && line[i] != L'\t') {
+                    tok.push_back(line[i++]);
+                }
+            }
+            tokens.push_back(tok);
+        }
+    }
+
+    // Parse a character token.
+    bool ParseChar(const WString& token, LayoutDescription::Char& c)
+    {
+        c = LayoutDescription::Char();
+        if (IsString(token)) {
+            c.value = WCH_LGTR;
+            c.ligature = token.substr(1);
+            return !c.ligature.empty();
+        }
+        WString tok(token);
+        if (tok.size() > 1 && tok.back() == L'@') {
+            c.dead = true;
+            tok.pop_back();
+        }
+        uint16_t value = 0;
+        if (tok == L"-" && !c.dead) {
+            c.value = WCH_NONE;
+        }
+        else if (tok.size() == 1) {
+            c.value = tok[0];
+        }
+        else if (tok.size() == 6 && StartsWith(tok, L"U+") && FromHexa(value, tok.substr(2))) {
+            c.value = wchar_t(value);
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    // Parse a scan code: "1E", "E0:1C", "E1:1D".
+    bool ParseScanCode(const WString& token, uint8_t& prefix, uint8_t& sc)
+    {
+        uint16_t value = 0;
+        prefix = 0;
+        if (token.size() == 5 && (StartsWith(token, L"E0:") || StartsWith(token, L"E1:"))) {
+            prefix = token[1] == L'0' ? 0xE0 : 0xE1;
+            return FromHexa(value, token.substr(3)) && (sc = uint8_t(value)) != 0;
+        }
+        return token.size() == 2 && FromHexa(value, token) && (sc = uint8_t(value)) != 0;
+    }
+
+    // Format a scan code.
+    WString ScanCodeName(uint8_t prefix, uint8_t sc)
+    {
+        return prefix == 0 ? Format(L"%02X", sc) : Format(L"%02X:%02X", prefix, sc);
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Constructor and cleanup.
+//----------------------------------------------------------------------------
+
+LayoutDescription::LayoutDescription(Error& err) :
+    name(),
+    text(),
+    lang(),
+    base(),
+    type(4),
+    subtype(0),
+    locale_flags(0),
+    version(KBD_VERSION),
+    modifiers(),
+    columns(),
+    scancodes(),
+    keys(),
+    dead_keys(),
+    key_names(),
+    dead_key_names(),
+    _err(err),
+    _tables(),
+    _depth(0),
+    _last_key(0),
+    _column_count(0),
+    _file_vks(),
+    _file_sections(),
+    _sc_to_vk(),
+    _sc_to_vk_e0(),
+    _sc_to_vk_e1(),
+    _vk_to_bits(),
+    _modifiers(),
+    _vk_to_wchars(),
+    _vk_to_wchar_table(),
+    _deadkeys(),
+    _ligatures(),
+    _strings(),
+    _names(),
+    _names_ext(),
+    _names_dead()
+{
+}
+
+void LayoutDescription::clear()
+{
+    name.clear();
+    text.clear();
+    lang.clear();
+    base.clear();
+    type = 4;
+    subtype = 0;
+    locale_flags = 0;
+    version = KBD_VERSION;
+    modifiers.clear();
+    columns.clear();
+    scancodes.clear();
+    keys.clear();
+    dead_keys.clear();
+    key_names.clear();
+    dead_key_names.clear();
+}
+
+
+//----------------------------------------------------------------------------
+// Get a virtual key from its name in descriptions.
+//----------------------------------------------------------------------------
+
+bool LayoutDescription::VirtualKeyFromName(const WString& name, uint8_t& vk)
+{
+    Value value = 0;
+    if (ParseValue(VkNames(), name, value) && value >= 0 && value <= 0xFF) {
+        vk = uint8_t(value);
+        return true;
+    }
+    return false;
+}
+
+
+//----------------------------------------------------------------------------
+// Load a description file.
+//----------------------------------------------------------------------------
+
+bool LayoutDescription::load(const WString& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        _err.error("cannot open " + filename);
+        return false;
+    }
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return load(content, filename);
+}
+
+bool LayoutDescription::load(const std::string& content, const WString& filename)
+{
+    Stats::Timer timer("layout description");
+    if (_depth == 0) {
+        clear();
+    }
+
+    // Split the content in lines of tokens.
+    class Line
+    {
+    public:
+        size_t        number;
+        WString       section;
+        WString       arg;
+        WStringVector tokens;
+    };
+    std::vector<Line> lines;
+    bool success = true;
+    WString section;
+    WString arg;
+    WStringVector tokens;
+    size_t number = 0;
+
+    // Convert the content once, the location of errors is formatted only when needed.
+    const WString wcontent(ToUTF16(content.compare(0, 3, UTF8_BOM) == 0 ? content.substr(3) : content));
+    const auto where = [&filename, &number]() { return Format(L"%s, line %d", filename.c_str(), int(number)); };
+    size_t start = 0;
+    while (start < wcontent.size()) {
+        size_t end = wcontent.find(L'\n', start);
+        if (end == WString::npos) {
+            end = wcontent.size();
+        }
+        const size_t next = end + 1;
+        if (end > start && wcontent[end - 1] == L'\r') {
+            --end;
+        }
+        const WString line_text(wcontent, start, end - start);
+        start = next;
+        ++number;
+
+        const WString trimmed(Trimmed(line_text));
+        if (!trimmed.empty() && trimmed.front() == L'[') {
+            // Section header, with an optional argument, "[deadkey ^]".
+            const size_t close = trimmed.find(L']');
+            if (close == WString::npos || !Tokenize(trimmed.substr(1, close - 1), tokens) || tokens.empty() || tokens.size() > 2) {
+                _err.error(where() + ": invalid section header");
+                success = false;
+                section = L"?";
+                continue;
+            }
+            section = tokens[0];
+            arg = tokens.size() > 1 ? tokens[1] : WString();
+            if (section != L"layout" && section != L"modifiers" && section != L"columns" && section != L"scancodes" &&
+                section != L"keys" && section != L"deadkey" && section != L"keynames" && section != L"deadkeynames")
+            {
+                _err.error(where() + ": unknown section [" + section + "]");
+                success = false;
+                section = L"?";
+            }
+            else if ((section == L"deadkey") != !arg.empty()) {
+                _err.error(where() + ": invalid section header");
+                success = false;
+                section = L"?";
+            }
+        }
+        else if (!Tokenize(line_text, tokens)) {
+            _err.error(where() + ": invalid string");
+            success = false;
+        }
+        else if (!tokens.empty() && section.empty()) {
+            _err.error(where() + ": no section");
+            success = false;
+        }
+        else if (!tokens.empty() && section != L"?") {
+            lines.push_back(Line{number, section, arg, tokens});
+        }
+    }
+
+    // Load the base description first.
+    for (const auto& line : lines) {
+        if (line.section == L"layout" && line.tokens.size() == 3 && line.tokens[0] == L"base" && line.tokens[1] == L"=") {
+            const WString& path(IsString(line.tokens[2]) ? line.tokens[2].substr(1) : line.tokens[2]);
+            const bool absolute = StartsWith(path, L"\\") || StartsWith(path, L"/") || (path.size() > 1 && path[1] == L':');
+            if (_depth >= MAX_BASE_DEPTH) {
+                _err.error(Format(L"%s, line %d: too many nested base descriptions", filename.c_str(), int(line.number)));
+                return false;
+            }
+            _depth++;
+            const bool ok = load(absolute ? path : DirName(filename) + L"\\" + path);
+            _depth--;
+            if (!ok) {
+                return false;
+            }
+        }
+    }
+
+    // The name of the layout is not inherited.
+    name = FileBaseName(filename);
+
+    // Then apply the description, on top of the base.
+    _file_vks.clear();
+    _last_key = keys.size();
+    _file_sections.clear();
+    _column_count = 0;
+    for (const auto& line : lines) {
+        if (!parseLine(line.section, line.arg, line.tokens, filename, line.number)) {
+            success = false;
+        }
+    }
+    return success;
+}
+
+
+//----------------------------------------------------------------------------
+// Parse one line in a section.
+//----------------------------------------------------------------------------
+
+bool LayoutDescription::parseLine(const WString& section, const WString& arg, const WStringVector& tokens, const WString& filename, size_t number)
+{
+    const auto where = [&filename, number]() { return Format(L"%s, line %d", filename.c_str(), int(number)); };
+
+    // Sections which are entirely replaced, cleared on first line in the file.
+    if ((section == L"modifiers" || section == L"columns") && _file_sections.insert(section).second) {
+        if (section == L"modifiers") {
+            modifiers.clear();
+        }
+        else {
+            columns.clear();
+            _column_count = 0;
+        }
+    }
+
+    Value value = 0;
+    Value flags = 0;
+    uint8_t prefix = 0;
+    uint8_t sc = 0;
+
+    if (section == L"layout") {
+        if (tokens.size() < 3 || tokens[1] != L"=") {
+            _err.error(where() + ": expected 'name = value'");
+            return false;
+        }
+        WStringList values;
+        for (size_t i = 2; i < tokens.size(); ++i) {
+            values.push_back(IsString(tokens[i]) ? tokens[i].substr(1) : tokens[i]);
+        }
+        const WString val(Join(values, L" "));
+        const WString& key(tokens[0]);
+        if (key == L"name") {
+            name = val;
+        }
+        else if (key == L"text") {
+            text = val;
+        }
+        else if (key == L"lang") {
+            lang = val;
+        }
+        else if (key == L"base") {
+            base = val;
+        }
+        else if (key == L"type") {
+            type = uint32_t(ToInt(val));
+        }
+        else if (key == L"subtype") {
+            subtype = uint32_t(ToInt(val));
+        }
+        else if (key == L"version") {
+            version = uint16_t(ToInt(val));
+        }
+        else if (key == L"flags" && ParseBits(LocaleFlagsNames(), val, value)) {
+            locale_flags = uint16_t(value);
+        }
+        else {
+            _err.error(where() + ": invalid entry '" + key + "'");
+            return false;
+        }
+    }
+    else if (section == L"modifiers") {
+        if (tokens.size() != 2 || !ParseValue(VkNames(), tokens[0], value) || !ParseShiftState(tokens[1], flags)) {
+            _err.error(where() + ": expected 'virtual-key modifier-bits'");
+            return false;
+        }
+        modifiers.push_back(VK_TO_BIT{BYTE(value), BYTE(flags)});
+    }
+    else if (section == L"columns") {
+        // One line per column, with the list of shift states which use it. "-" for an unused column.
+        const uint8_t col = uint8_t(_column_count++);
+        for (const auto& tok : tokens) {
+            if (tok == L"-" && tokens.size() == 1) {
+                break;
+            }
+            if (!ParseShiftState(tok, value) || value >= 256) {
+                _err.error(where() + ": invalid shift state '" + tok + "'");
+                return false;
+            }
+            if (columns.size() <= size_t(value)) {
+                columns.resize(size_t(value) + 1, SHFT_INVALID);
+            }
+            columns[size_t(value)] = col;
+        }
+    }
+    else if (section == L"scancodes") {
+        if (tokens.size() < 2 || !ParseScanCode(tokens[0], prefix, sc) || !ParseValue(VkNames(), tokens[1], value)) {
+            _err.error(where() + ": expected 'scan-code virtual-key [flags]'");
+            return false;
+        }
+        for (size_t i = 2; i < tokens.size(); ++i) {
+            Value f = 0;
+            if (!ParseBits(VkFlagsNames(), tokens[i], f)) {
+                _err.error(where() + ": invalid flag '" + tokens[i] + "'");
+                return false;
+            }
+            flags |= f;
+        }
+        const ScanCode entry{prefix, sc, uint16_t(value | flags)};
+        auto it = std::find_if(scancodes.begin(), scancodes.end(), [&](const ScanCode& s) { return s.prefix == prefix && s.sc == sc; });
+        if (it != scancodes.end()) {
+            *it = entry;
+        }
+        else {
+            scancodes.push_back(entry);
+        }
+    }
+    else if (section == L"keys") {
+        if (tokens.size() < 3 || tokens.size() > 12 || !ParseValue(VkNames(), tokens[0], value) || !ParseBits(AttributesNames(), tokens[1], flags)) {
+            _err.error(where() + ": expected 'virtual-key attributes characters...'");
+            return false;
+        }
+        Key key(static_cast<uint8_t>(value), static_cast<uint8_t>(flags));
+        for (size_t i = 2; i < tokens.size(); ++i) {
+            key.chars.emplace_back();
+            if (!ParseChar(tokens[i], key.chars.back())) {
+                _err.error(where() + ": invalid character '" + tokens[i] + "'");
+                return false;
+            }
+        }
+        // Position of the new key: after the previous one for the continuation of a key,
+        // in place of the same virtual key from the base description, at end otherwise.
+        size_t pos = keys.size();
+        bool replace = false;
+        if (key.vk == VK__none_) {
+            pos = std::min(_last_key + 1, keys.size());
+        }
+        else if (!_file_vks.insert(key.vk).second) {
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (keys[i].vk == key.vk) {
+                    pos = i + 1;
+                }
+            }
+        }
+        else {
+            for (size_t i = 0; !replace && i < keys.size(); ++i) {
+                if (keys[i].vk == key.vk) {
+                    pos = i;
+                    replace = true;
+                }
+            }
+        }
+        if (pos == keys.size()) {
+            keys.push_back(key);
+        }
+        else {
+            // Rebuild the list, removing the replaced virtual key.
+            std::vector<Key> updated;
+            updated.reserve(keys.size() + 1);
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (i == pos) {
+                    updated.push_back(key);
+                }
+                if (!replace || keys[i].vk != key.vk) {
+                    updated.push_back(keys[i]);
+                }
+            }
+            keys.swap(updated);
+        }
+        _last_key = pos;
+    }
+    else if (section == L"deadkey") {
+        Char accent;
+        Char base_char;
+        Char composed;
+        if (!ParseChar(arg, accent) || !accent.ligature.empty() || accent.dead ||
+            tokens.size() < 2 || tokens.size() > 3 || !ParseChar(tokens[0], base_char) || !ParseChar(tokens[1], composed) ||
+            !base_char.ligature.empty() || base_char.dead || !composed.ligature.empty() ||
+            (tokens.size() > 2 && (!StartsWith(tokens[2], L"0x") || !FromHexa(flags, tokens[2].substr(2)))))
+        {
+            _err.error(where() + ": expected 'base-char composed-char [flags]'");
+            return false;
+        }
+        const DeadKey dk{base_char.value, composed.value, uint16_t(flags | (composed.dead ? DKF_DEAD : 0))};
+        auto acc = std::find_if(dead_keys.begin(), dead_keys.end(), [&](const auto& d) { return d.first == accent.value; });
+        if (acc == dead_keys.end()) {
+            dead_keys.emplace_back(accent.value, std::vector<DeadKey>());
+            acc = dead_keys.end() - 1;
+        }
+        auto it = std::find_if(acc->second.begin(), acc->second.end(), [&](const DeadKey& d) { return d.base == dk.base; });
+        if (it != acc->second.end()) {
+            *it = dk;
+        }
+        else {
+            acc->second.push_back(dk);
+        }
+    }
+    else if (section == L"keynames") {
+        if (tokens.size() != 2 || !ParseScanCode(tokens[0], prefix, sc) || prefix == 0xE1 || !IsString(tokens[1])) {
+            _err.error(where() + ": expected 'scan-code \"name\"'");
+            return false;
+        }
+        const KeyName kn{prefix, sc, tokens[1].substr(1)};
+        auto it = std::find_if(key_names.begin(), key_names.end(), [&](const KeyName& k) { return k.prefix == prefix && k.sc == sc; });
+        if (it != key_names.end()) {
+            *it = kn;
+        }
+        else {
+            key_names.push_back(kn);
+        }
+    }
+    else if (section == L"deadkeynames") {
+        Char accent;
+        if (tokens.size() != 2 || !ParseChar(tokens[0], accent) || !accent.ligature.empty() || accent.dead || !IsString(tokens[1])) {
+            _err.error(where() + ": expected 'accent \"name\"'");
+            return false;
+        }
+        auto it = std::find_if(dead_key_names.begin(), dead_key_names.end(), [&](const auto& d) { return d.first == accent.value; });
+        if (it != dead_key_names.end()) {
+            it->second = tokens[1].substr(1);
+        }
+        else {
+            dead_key_names.emplace_back(accent.value, tokens[1].substr(1));
+        }
+    }
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Build the description of existing keyboard tables.
+//----------------------------------------------------------------------------
+
+void LayoutDescription::build(const KBDTABLES& tables)
+{
+    clear();
+    type = tables.dwType;
+    subtype = tables.dwSubType;
+    locale_flags = LOWORD(tables.fLocaleFlags);
+    version = HIWORD(tables.fLocaleFlags);
+
+    const MODIFIERS* mods = tables.pCharModifiers;
+    if (mods != nullptr) {
+        for (const VK_TO_BIT* vb = mods->pVkToBit; vb != nullptr && vb->Vk != 0; ++vb) {
+            modifiers.push_back(*vb);
+        }
+        columns.assign(mods->ModNumber, mods->ModNumber + mods->wMaxModBits + 1);
+    }
+
+    for (size_t sc = 0; tables.pusVSCtoVK != nullptr && sc < tables.bMaxVSCtoVK; ++sc) {
+        if (tables.pusVSCtoVK[sc] != VK__none_) {
+            scancodes.push_back(ScanCode{0, uint8_t(sc), tables.pusVSCtoVK[sc]});
+        }
+    }
+    for (const VSC_VK* p = tables.pVSCtoVK_E0; p != nullptr && p->Vsc != 0; ++p) {
+        scancodes.push_back(ScanCode{0xE0, p->Vsc, p->Vk});
+    }
+    for (const VSC_VK* p = tables.pVSCtoVK_E1; p != nullptr && p->Vsc != 0; ++p) {
+        scancodes.push_back(ScanCode{0xE1, p->Vsc, p->Vk});
+    }
+
+    // Ligatures, indexed by virtual key and column.
+    std::map<std::pair<uint8_t, size_t>, WString> ligatures;
+    const LIGATURE1* lig = tables.pLigature;
+    while (lig != nullptr && tables.cbLgEntry > 0 && lig->VirtualKey != 0) {
+        size_t len = 0;
+        while (len < size_t(tables.nLgMax) && lig->wch[len] != WCH_NONE) {
+            ++len;
+        }
+        ligatures.insert(std::make_pair(std::make_pair(lig->VirtualKey, size_t(lig->ModificationNumber)), WString(lig->wch, len)));
+        lig = reinterpret_cast<const LIGATURE1*>(reinterpret_cast<const char*>(lig) + tables.cbLgEntry);
+    }
+
+    // Keys. The entry after a key with dead characters is folded into the key, when it contains
+    // exactly the accents of the dead characters. Otherwise, it is kept as is.
+    for (const VK_TO_WCHAR_TABLE* vtwt = tables.pVkToWcharTable; vtwt != nullptr && vtwt->pVkToWchars != nullptr; ++vtwt) {
+        const size_t count = vtwt->nModifications;
+        const size_t size = vtwt->cbSize;
+        const VK_TO_WCHARS10* vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(vtwt->pVkToWchars);
+        bool previous_dead = false;
+        while (vtwc->VirtualKey != 0) {
+            bool folded = false;
+            if (previous_dead && vtwc->VirtualKey == VK__none_) {
+                Key& prev(keys.back());
+                folded = true;
+                for (size_t col = 0; col < count; ++col) {
+                    const bool dead = prev.chars[col].value == WCH_DEAD;
+                    if (dead != (vtwc->wch[col] != WCH_NONE)) {
+                        folded = false;
+                    }
+                }
+                for (size_t col = 0; folded && col < count; ++col) {
+                    if (prev.chars[col].value == WCH_DEAD) {
+                        prev.chars[col] = Char(vtwc->wch[col], true);
+                    }
+                }
+            }
+            previous_dead = false;
+            if (!folded) {
+                keys.emplace_back(vtwc->VirtualKey, vtwc->Attributes);
+                Key& key(keys.back());
+                for (size_t col = 0; col < count; ++col) {
+                    key.chars.emplace_back(vtwc->wch[col]);
+                    if (vtwc->wch[col] == WCH_DEAD) {
+                        previous_dead = true;
+                    }
+                    else if (vtwc->wch[col] == WCH_LGTR) {
+                        const auto it = ligatures.find(std::make_pair(vtwc->VirtualKey, col));
+                        if (it != ligatures.end() && !it->second.empty()) {
+                            key.chars.back().ligature = it->second;
+                        }
+                    }
+                }
+            }
+            vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + size);
+        }
+    }
+
+    for (const DEADKEY* dk = tables.pDeadKey; dk != nullptr && dk->dwBoth != 0; ++dk) {
+        const wchar_t accent = HIWORD(dk->dwBoth);
+        auto acc = std::find_if(dead_keys.begin(), dead_keys.end(), [accent](const auto& d) { return d.first == accent; });
+        if (acc == dead_keys.end()) {
+            dead_keys.emplace_back(accent, std::vector<DeadKey>());
+            acc = dead_keys.end() - 1;
+        }
+        acc->second.push_back(DeadKey{wchar_t(LOWORD(dk->dwBoth)), dk->wchComposed, dk->uFlags});
+    }
+
+    for (const VSC_LPWSTR* names = tables.pKeyNames; names != nullptr && names->vsc != 0; ++names) {
+        key_names.push_back(KeyName{0, names->vsc, names->pwsz == nullptr ? L"" : names->pwsz});
+    }
+    for (const VSC_LPWSTR* names = tables.pKeyNamesExt; names != nullptr && names->vsc != 0; ++names) {
+        key_names.push_back(KeyName{0xE0, names->vsc, names->pwsz == nullptr ? L"" : names->pwsz});
+    }
+    for (const DEADKEY_LPWSTR* names = tables.pKeyNamesDead; names != nullptr && *names != nullptr; ++names) {
+        if (**names != 0) {
+            dead_key_names.emplace_back(**names, *names + 1);
+        }
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Write the description.
+//----------------------------------------------------------------------------
+
+void LayoutDescription::write(std::ostream& out) const
+{
+    Grid grid;
+    grid.setSpacing(2);
+
+    out << "[layout]" << std::endl;
+    if (!name.empty()) {
+        out << "name = " << name << std::endl;
+    }
+    if (!text.empty()) {
+        out << "text = " << Quoted(text) << std::endl;
+    }
+    if (!lang.empty()) {
+        out << "lang = " << lang << std::endl;
+    }
+    if (!base.empty()) {
+        out << "base = " << base << std::endl;
+    }
+    out << "type = " << type << std::endl;
+    if (subtype != 0) {
+        out << "subtype = " << subtype << std::endl;
+    }
+    out << "flags = " << BitsName(LocaleFlagsNames(), locale_flags) << std::endl;
+    if (version != KBD_VERSION) {
+        out << "version = " << version << std::endl;
+    }
+
+    out << std::endl << "[modifiers]" << std::endl;
+    for (const auto& mod : modifiers) {
+        grid.addLine({ValueName(VkNames(), mod.Vk), ShiftStateName(mod.ModBits)});
+    }
+    grid.print(out);
+    grid.clear();
+
+    // Columns, with their shift states.
+    WStringVector headers;
+    size_t col_count = 0;
+    for (uint8_t col : columns) {
+        if (col != SHFT_INVALID) {
+            col_count = std::max<size_t>(col_count, size_t(col) + 1);
+        }
+    }
+    out << std::endl << "[columns]" << std::endl;
+    for (size_t col = 0; col < col_count; ++col) {
+        WStringList states;
+        for (size_t bits = 0; bits < columns.size(); ++bits) {
+            if (columns[bits] == col) {
+                states.push_back(ShiftStateName(Value(bits)));
+            }
+        }
+        headers.push_back(states.empty() ? L"-" : states.front());
+        out << (states.empty() ? L"-" : Join(states, L" ")) << std::endl;
+    }
+
+    out << std::endl << "[scancodes]" << std::endl;
+    for (const auto& sc : scancodes) {
+        grid.addLine({ScanCodeName(sc.prefix, sc.sc), ValueName(VkNames(), sc.vk & 0xFF)});
+        if ((sc.vk & 0xFF00) != 0) {
+            grid.addColumn(BitsName(VkFlagsNames(), sc.vk & 0xFF00));
+        }
+    }
+    grid.print(out);
+    grid.clear();
+
+    out << std::endl << "[keys]" << std::endl;
+    grid.addLine({L"#", L""});
+    for (const auto& hd : headers) {
+        grid.addColumn(hd);
+    }
+    for (const auto& key : keys) {
+        grid.addLine({ValueName(VkNames(), key.vk), BitsName(AttributesNames(), key.attributes)});
+        for (const auto& c : key.chars) {
+            grid.addColumn(c.ligature.empty() ? CharToken(c.value, c.dead) : Quoted(c.ligature));
+        }
+    }
+    grid.print(out);
+    grid.clear();
+
+    for (const auto& dk : dead_keys) {
+        out << std::endl << "[deadkey " << CharToken(dk.first, false) << "]" << std::endl;
+        for (const auto& tr : dk.second) {
+            grid.addLine({CharToken(tr.base, false), CharToken(tr.composed, (tr.flags & DKF_DEAD) != 0)});
+            if ((tr.flags & ~DKF_DEAD) != 0) {
+                grid.addColumn(Format(L"0x%04X", tr.flags & ~DKF_DEAD));
+            }
+        }
+        grid.print(out);
+        grid.clear();
+    }
+
+    if (!key_names.empty()) {
+        out << std::endl << "[keynames]" << std::endl;
+        for (const auto& kn : key_names) {
+            grid.addLine({ScanCodeName(kn.prefix, kn.sc), Quoted(kn.name)});
+        }
+        grid.print(out);
+        grid.clear();
+    }
+
+    if (!dead_key_names.empty()) {
+        out << std::endl << "[deadkeynames]" << std::endl;
+        for (const auto& dn : dead_key_names) {
+            grid.addLine({CharToken(dn.first, false), Quoted(dn.second)});
+        }
+        grid.print(out);
+        grid.clear();
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Build the keyboard tables from the description.
+//----------------------------------------------------------------------------
+
+const KBDTABLES& LayoutDescription::tables()
+{
+    Stats::Timer timer("layout tables");
+    Zero(&_tables, sizeof(_tables));
+    _tables.fLocaleFlags = MAKELONG(locale_flags, version);
+    _tables.dwType = type;
+    _tables.dwSubType = subtype;
+
+    // Modifiers. The size of ModNumber covers all modifier bits.
+    _vk_to_bits = modifiers;
+    _vk_to_bits.push_back(VK_TO_BIT{0, 0});
+    size_t max_bits = columns.empty() ? 0 : columns.size() - 1;
+    for (const auto& mod : modifiers) {
+        max_bits = std::max<size_t>(max_bits, mod.ModBits);
+    }
+    _modifiers.assign(offsetof(MODIFIERS, ModNumber) + max_bits + 1, 0);
+    MODIFIERS* mods = reinterpret_cast<MODIFIERS*>(_modifiers.data());
+    mods->pVkToBit = _vk_to_bits.data();
+    mods->wMaxModBits = WORD(max_bits);
+    for (size_t bits = 0; bits <= max_bits; ++bits) {
+        mods->ModNumber[bits] = bits < columns.size() ? columns[bits] : SHFT_INVALID;
+    }
+    _tables.pCharModifiers = mods;
+
+    // Scan codes.
+    _sc_to_vk.clear();
+    _sc_to_vk_e0.clear();
+    _sc_to_vk_e1.clear();
+    for (const auto& sc : scancodes) {
+        if (sc.prefix == 0) {
+            if (_sc_to_vk.size() <= sc.sc) {
+                _sc_to_vk.resize(size_t(sc.sc) + 1, VK__none_);
+            }
+            _sc_to_vk[sc.sc] = sc.vk;
+        }
+        else {
+            (sc.prefix == 0xE0 ? _sc_to_vk_e0 : _sc_to_vk_e1).push_back(VSC_VK{sc.sc, sc.vk});
+        }
+    }
+    _tables.pusVSCtoVK = _sc_to_vk.empty() ? nullptr : _sc_to_vk.data();
+    _tables.bMaxVSCtoVK = BYTE(_sc_to_vk.size());
+    if (!_sc_to_vk_e0.empty()) {
+        _sc_to_vk_e0.push_back(VSC_VK{0, 0});
+        _tables.pVSCtoVK_E0 = _sc_to_vk_e0.data();
+    }
+    if (!_sc_to_vk_e1.empty()) {
+        _sc_to_vk_e1.push_back(VSC_VK{0, 0});
+        _tables.pVSCtoVK_E1 = _sc_to_vk_e1.data();
+    }
+
+    // Keys and ligatures.
+    buildKeys();
+
+    // Dead keys.
+    _deadkeys.clear();
+    for (const auto& dk : dead_keys) {
+        for (const auto& tr : dk.second) {
+            _deadkeys.push_back(DEADKEY{DWORD(MAKELONG(tr.base, dk.first)), tr.composed, tr.flags});
+        }
+    }
+    if (!_deadkeys.empty()) {
+        _deadkeys.push_back(DEADKEY{0, 0, 0});
+        _tables.pDeadKey = _deadkeys.data();
+    }
+
+    // Key names.
+    _strings.clear();
+    _names.clear();
+    _names_ext.clear();
+    _names_dead.clear();
+    for (const auto& kn : key_names) {
+        _strings.push_back(kn.name);
+        (kn.prefix == 0 ? _names : _names_ext).push_back(VSC_LPWSTR{kn.sc, _strings.back().data()});
+    }
+    if (!_names.empty()) {
+        _names.push_back(VSC_LPWSTR{0, nullptr});
+        _tables.pKeyNames = _names.data();
+    }
+    if (!_names_ext.empty()) {
+        _names_ext.push_back(VSC_LPWSTR{0, nullptr});
+        _tables.pKeyNamesExt = _names_ext.data();
+    }
+    for (const auto& dn : dead_key_names) {
+        _strings.push_back(dn.first + dn.second);
+        _names_dead.push_back(_strings.back().data());
+    }
+    if (!_names_dead.empty()) {
+        _names_dead.push_back(nullptr);
+        _tables.pKeyNamesDead = _names_dead.data();
+    }
+    return _tables;
+}
+
+
+//----------------------------------------------------------------------------
+// Build the VK_TO_WCHARS tables and ligatures.
+//----------------------------------------------------------------------------
+
+void LayoutDescription::buildKeys()
+{
+    // Tables, by number of columns, in order of first appearance.
+    std::vector<size_t> counts;
+    for (const auto& key : keys) {
+        if (std::find(counts.begin(), counts.end(), key.chars.size()) == counts.end()) {
+            counts.push_back(key.chars.size());
+        }
+    }
+
+    // Ligatures: virtual key, column, characters.
+    std::vector<std::tuple<uint8_t, size_t, WString>> ligatures;
+    size_t lig_max = 0;
+
+    _vk_to_wchars.resize(counts.size());
+    _vk_to_wchar_table.clear();
+    for (size_t index = 0; index < counts.size(); ++index) {
+        const size_t count = counts[index];
+        const size_t size = offsetof(VK_TO_WCHARS1, wch) + count * sizeof(WCHAR);
+        std::vector<uint8_t>& table(_vk_to_wchars[index]);
+        table.clear();
+        const auto add = [&table, size](const VK_TO_WCHARS10& entry) {
+            const uint8_t* data = reinterpret_cast<const uint8_t*>(&entry);
+            table.insert(table.end(), data, data + size);
+        };
+        for (const auto& key : keys) {
+            if (key.chars.size() == count) {
+                VK_TO_WCHARS10 entry;
+                VK_TO_WCHARS10 accents;
+                Zero(&entry, sizeof(entry));
+                entry.VirtualKey = key.vk;
+                entry.Attributes = key.attributes;
+                accents.VirtualKey = VK__none_;
+                accents.Attributes = 0;
+                bool dead = false;
+                for (size_t col = 0; col < count; ++col) {
+                    const Char& c(key.chars[col]);
+                    entry.wch[col] = c.dead ? WCH_DEAD : (c.ligature.empty() ? c.value : WCH_LGTR);
+                    accents.wch[col] = c.dead ? c.value : WCH_NONE;
+                    dead = dead || c.dead;
+                    if (!c.ligature.empty()) {
+                        ligatures.push_back(std::make_tuple(key.vk, col, c.ligature));
+                        lig_max = std::max(lig_max, c.ligature.size());
+                    }
+                }
+                add(entry);
+                if (dead) {
+                    add(accents);
+                }
+            }
+        }
+        table.resize(table.size() + size, 0);
+        _vk_to_wchar_table.push_back(VK_TO_WCHAR_TABLE{reinterpret_cast<PVK_TO_WCHARS1>(table.data()), BYTE(count), BYTE(size)});
+    }
+    _vk_to_wchar_table.push_back(VK_TO_WCHAR_TABLE{nullptr, 0, 0});
+    _tables.pVkToWcharTable = _vk_to_wchar_table.data();
+
+    // Ligatures, all with the size of the longest one, padded with WCH_NONE.
+    _ligatures.clear();
+    if (!ligatures.empty()) {
+        const size_t size = offsetof(LIGATURE1, wch) + lig_max * sizeof(WCHAR);
+        _ligatures.resize((ligatures.size() + 1) * size, 0);
+        uint8_t* entry = _ligatures.data();
+        for (const auto& lig : ligatures) {
+            const WORD modnum = WORD(std::get<1>(lig));
+            const WString& chars(std::get<2>(lig));
+            entry[offsetof(LIGATURE1, VirtualKey)] = std::get<0>(lig);
+            std::memcpy(entry + offsetof(LIGATURE1, ModificationNumber), &modnum, sizeof(modnum));
+            for (size_t i = 0; i < lig_max; ++i) {
+                const WCHAR c = i < chars.size() ? chars[i] : WCH_NONE;
+                std::memcpy(entry + offsetof(LIGATURE1, wch) + i * sizeof(WCHAR), &c, sizeof(c));
+            }
+            entry += size;
+        }
+        _tables.nLgMax = BYTE(lig_max);
+        _tables.cbLgEntry = BYTE(size);
+        _tables.pLigature = reinterpret_cast<PLIGATURE1>(_ligatures.data());
+    }
+}
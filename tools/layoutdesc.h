@@ -0,0 +1,206 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Declarative description of a keyboard layout.
+//
+// A layout description is a UTF-8 text file, typically with extension .kbl.
+// It is made of sections, starting with a line "[name]". Empty lines are
+// ignored. A '#' at the start of a token starts a comment up to the end of
+// the line. Strings are enclosed in double quotes, with \" \\ and \uXXXX
+// escapes. Example:
+//
+//   [layout]
+//   text = "French Apple"
+//   lang = 040c
+//   base = ..\kbdfrapple\kbdfrapple.kbl
+//   type = 4
+//   flags = altgr
+//
+//   [modifiers]       # virtual key, modifier bits
+//   SHIFT   shift
+//   CONTROL ctrl
+//   MENU    alt
+//
+//   [columns]         # one line per column of characters, with its shift states
+//   base
+//   shift
+//   ctrl
+//   altgr
+//   shift+altgr
+//
+//   [scancodes]       # scan code, virtual key, flags
+//   1E      A
+//   E0:1C   RETURN  ext
+//
+//   [keys]            # virtual key, attributes, one character per column
+//   A       caplok  a  A  -  æ  Æ
+//   OEM_6   -       ^@ ¨@ -  -  -
+//
+//   [deadkey ^]       # base character, composed character
+//   a       â
+//   U+0020  ^
+//
+//   [keynames]
+//   01      "Esc"
+//   E0:1C   "Num Enter"
+//
+//   [deadkeynames]
+//   ^       "CIRCUMFLEX ACCENT"
+//
+// A character is a single character, U+XXXX, '-' for none or a quoted string
+// for a ligature. A trailing '@' means a dead key. A row of keys contains as
+// many characters as its VK_TO_WCHARS table. Rows with the same number of
+// characters are grouped in the same table, in order of first appearance.
+//
+// With "base" in section [layout], the base description is loaded first.
+// Then, each entry in the description replaces the entry with the same key
+// in the base (virtual key, scan code, accent, etc.) Sections [modifiers]
+// and [columns] are entirely replaced when present.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "error.h"
+
+class LayoutDescription
+{
+public:
+    // Constructor. Specify where to report errors.
+    LayoutDescription(Error& err);
+
+    // Default file extension of layout descriptions.
+    static const WString FILE_EXTENSION;
+
+    // One character in a column of a key.
+    class Char
+    {
+    public:
+        wchar_t value;     // Character, WCH_NONE if unused.
+        bool    dead;      // The character is the accent of a dead key.
+        WString ligature;  // Characters of a ligature, when not empty.
+
+        // Constructor.
+        Char(wchar_t v = WCH_NONE, bool d = false) : value(v), dead(d), ligature() {}
+    };
+
+    // One row in the VK_TO_WCHARS tables.
+    class Key
+    {
+    public:
+        uint8_t           vk;
+        uint8_t           attributes;
+        std::vector<Char> chars;
+
+        // Constructor.
+        Key(uint8_t v = 0, uint8_t a = 0) : vk(v), attributes(a), chars() {}
+    };
+
+    // Translation of a dead key.
+    class DeadKey
+    {
+    public:
+        wchar_t  base;
+        wchar_t  composed;
+        uint16_t flags;
+    };
+
+    // Translation of a scan code. Prefix is 0, 0xE0 or 0xE1.
+    class ScanCode
+    {
+    public:
+        uint8_t  prefix;
+        uint8_t  sc;
+        uint16_t vk;  // Including KBDEXT and other flags.
+    };
+
+    // Name of a key. Prefix is 0 or 0xE0.
+    class KeyName
+    {
+    public:
+        uint8_t prefix;
+        uint8_t sc;
+        WString name;
+    };
+
+    // General characteristics.
+    WString  name;          // Layout name, for instance "kbdfrapple".
+    WString  text;          // Description text, as in strings.h.
+    WString  lang;          // Base language, as in strings.h.
+    WString  base;          // Base description, when not empty.
+    uint32_t type;          // Keyboard type.
+    uint32_t subtype;       // Keyboard subtype.
+    uint16_t locale_flags;  // KLLF_ flags.
+    uint16_t version;       // High word of fLocaleFlags.
+
+    // Modifiers: virtual keys to modifier bits, column of each shift state.
+    std::vector<VK_TO_BIT> modifiers;
+    std::vector<uint8_t>   columns;
+
+    // Content of the tables.
+    std::vector<ScanCode> scancodes;
+    std::vector<Key>      keys;
+    std::vector<std::pair<wchar_t, std::vector<DeadKey>>> dead_keys;
+    std::vector<KeyName>  key_names;
+    std::vector<std::pair<wchar_t, WString>> dead_key_names;
+
+    // Clear the content.
+    void clear();
+
+    // Load a description file, including its base. Return false on error.
+    bool load(const WString& filename);
+
+    // Same as load() with the content of the file already in memory.
+    // The file name is used in error messages and to locate the base description.
+    bool load(const std::string& content, const WString& filename);
+
+    // Build the description of existing keyboard tables.
+    void build(const KBDTABLES&);
+
+    // Write the description.
+    void write(std::ostream&) const;
+
+    // Get a virtual key from its name in descriptions, without "VK_" prefix, for
+    // instance "A" or "OEM_7", or in hexadecimal "0xC1". Return false if unknown.
+    static bool VirtualKeyFromName(const WString& name, uint8_t& vk);
+
+    // Build the keyboard tables from the description. The tables point to internal
+    // data and remain valid until the description is modified or destroyed.
+    const KBDTABLES& tables();
+
+private:
+    Error&    _err;
+    KBDTABLES _tables;
+    int       _depth;          // Current nesting level of base descriptions.
+    size_t    _last_key;       // Index in keys of the last key from the current file.
+    size_t    _column_count;   // Number of columns in the current file.
+    std::set<uint8_t> _file_vks;       // Virtual keys from the current file.
+    std::set<WString> _file_sections;  // Sections which are replaced by the current file.
+
+    // Storage of the tables which are built by tables().
+    std::vector<USHORT>         _sc_to_vk;
+    std::vector<VSC_VK>         _sc_to_vk_e0;
+    std::vector<VSC_VK>         _sc_to_vk_e1;
+    std::vector<VK_TO_BIT>      _vk_to_bits;
+    std::vector<uint8_t>        _modifiers;     // MODIFIERS structure, variable size.
+    std::vector<std::vector<uint8_t>> _vk_to_wchars;
+    std::vector<VK_TO_WCHAR_TABLE>    _vk_to_wchar_table;
+    std::vector<DEADKEY>        _deadkeys;
+    std::vector<uint8_t>        _ligatures;
+    std::list<WString>          _strings;       // Stable addresses.
+    std::vector<VSC_LPWSTR>     _names;
+    std::vector<VSC_LPWSTR>     _names_ext;
+    std::vector<DEADKEY_LPWSTR> _names_dead;
+
+    // Parse one line in a section. The file name and line number are used in error messages.
+    bool parseLine(const WString& section, const WString& arg, const WStringVector& tokens, const WString& filename, size_t number);
+
+    // Build the VK_TO_WCHARS tables and ligatures.
+    void buildKeys();
+
+    // Inaccessible operations, the tables point to internal data.
+    LayoutDescription(const LayoutDescription&) = delete;
+    LayoutDescription& operator=(const LayoutDescription&) = delete;
+};
@@ -0,0 +1,453 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Optimization of a keyboard layout using simulated annealing.
+//
+//----------------------------------------------------------------------------
+
+#include "layoutoptim.h"
+#include "winkeymap.h"
+#include "stats.h"
+#include <random>
+#include <cwctype>
+#include <cmath>
+#include <bit>
+
+// Modifiers of the four levels of a unit pair: base, Shift, AltGr, Shift+AltGr.
+static const size_t LEVEL_MODS[4] = {0, KBDSHIFT, KBDCTRL | KBDALT, KBDSHIFT | KBDCTRL | KBDALT};
+
+// Cost of the positions.
+#define COST_ROW_DISTANCE  0.5  // Per row away from the home row.
+#define COST_PINKY         0.5  // Additional cost of a pinky.
+#define COST_RING          0.25 // Additional cost of a ring finger.
+#define COST_SAME_FINGER   2.0  // Two consecutive keys with the same finger.
+#define COST_ROW_JUMP      1.0  // Two consecutive keys, two rows apart or more.
+
+// Final temperature, relative to initial one.
+#define FINAL_TEMPERATURE 1.0e-3
+
+// Number of random moves to estimate the initial temperature.
+#define TEMPERATURE_SAMPLES 200
+
+
+//----------------------------------------------------------------------------
+// Build the model of a layout.
+//----------------------------------------------------------------------------
+
+LayoutModel::LayoutModel(Error& err) :
+    _err(err),
+    _units(),
+    _slot_costs(),
+    _pair_costs(),
+    _symbols()
+{
+}
+
+bool LayoutModel::build(const KBDTABLES* tables, const InverseKeyMap& imap, const KeyGeometry& geometry)
+{
+    Stats::Timer timer("layout model");
+
+    _units.clear();
+    _slot_costs.clear();
+    _pair_costs.clear();
+    _symbols.clear();
+
+    if (tables == nullptr || tables->pVkToWcharTable == nullptr) {
+        _err.error(L"no character table in keyboard layout");
+        return false;
+    }
+    if (!geometry.isValid()) {
+        _err.error(L"no key geometry, cannot optimize layout");
+        return false;
+    }
+
+    // Keystroke of each virtual key, preferably using a scan code without prefix.
+    WinKeyMap kmap(tables);
+    std::multimap<uint16_t, uint16_t> vk2sc;
+    kmap.buildScanCodeMap(vk2sc);
+    std::map<uint16_t, Keystroke> vkeys;
+    for (const auto& it : vk2sc) {
+        Keystroke key;
+        key.sc = uint8_t(it.second & 0xFF);
+        key.flags = (it.second & WinKeyMap::SC_E0) != 0 ? Keystroke::PREFIX_0 : ((it.second & WinKeyMap::SC_E1) != 0 ? Keystroke::PREFIX_1 : 0);
+        key.mods = 0;
+        key.vk = uint8_t(it.first);
+        const auto current = vkeys.find(it.first);
+        if (current == vkeys.end() || (current->second.flags != 0 && key.flags == 0)) {
+            vkeys[it.first] = key;
+        }
+    }
+
+    // Keystroke of each unit, to compute the costs.
+    std::vector<Keystroke> strokes;
+
+    // Index of units by (vk << 1) | pair.
+    std::map<uint32_t, uint16_t> unit_index;
+
+    // Loop on all VK_TO_WCHARS tables, one unit per pair of levels.
+    for (const VK_TO_WCHAR_TABLE* tab = tables->pVkToWcharTable; tab->pVkToWchars != nullptr; tab++) {
+        const size_t count = tab->nModifications;
+        const size_t size = tab->cbSize;
+
+        // Column of each level in this table, 0xFF if absent.
+        uint8_t level_columns[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+        for (size_t i = 0; i < count; ++i) {
+            const size_t mods = kmap.modNumberToModMask(i);
+            for (size_t lev = 0; lev < 4; ++lev) {
+                if (mods == LEVEL_MODS[lev]) {
+                    level_columns[lev] = uint8_t(i);
+                }
+            }
+        }
+
+        const VK_TO_WCHARS10* vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(tab->pVkToWchars);
+        while (vtwc->VirtualKey != 0) {
+            const auto key = vkeys.find(vtwc->VirtualKey);
+            if (vtwc->VirtualKey != VK__none_ && key != vkeys.end() && unit_index.find(uint32_t(vtwc->VirtualKey) << 1) == unit_index.end()) {
+                const KeyGeometry::Finger finger = geometry.finger(key->second);
+                const bool main_block = finger != KeyGeometry::NO_FINGER && finger != KeyGeometry::THUMB;
+                for (uint8_t pair = 0; pair < 2; ++pair) {
+                    const uint8_t col0 = level_columns[2 * pair];
+                    const uint8_t col1 = level_columns[2 * pair + 1];
+                    if (col0 == 0xFF && col1 == 0xFF) {
+                        continue;
+                    }
+                    Unit unit;
+                    unit.vk = vtwc->VirtualKey;
+                    unit.pair = pair;
+                    unit.columns[0] = col0;
+                    unit.columns[1] = col1;
+                    unit.chars[0] = col0 == 0xFF ? WCH_NONE : vtwc->wch[col0];
+                    unit.chars[1] = col1 == 0xFF ? WCH_NONE : vtwc->wch[col1];
+                    unit.movable = main_block && col0 != 0xFF && col1 != 0xFF && (vtwc->Attributes & SGCAPS) == 0;
+                    unit.letter = false;
+                    unit.empty = true;
+                    for (size_t i = 0; i < 2; ++i) {
+                        const wchar_t c = unit.chars[i];
+                        if (c != 0 && c != WCH_NONE) {
+                            unit.empty = false;
+                            unit.letter = unit.letter || std::iswalpha(wint_t(c));
+                            if (c == WCH_DEAD || c == WCH_LGTR || c <= L' ' || c == 0x7F || std::iswdigit(wint_t(c))) {
+                                unit.movable = false;
+                            }
+                        }
+                    }
+                    if (unit.letter && pair != 0) {
+                        unit.movable = false;
+                    }
+                    unit_index[(uint32_t(unit.vk) << 1) | pair] = uint16_t(_units.size());
+                    _units.push_back(unit);
+                    strokes.push_back(key->second);
+                }
+            }
+            vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + size);
+        }
+    }
+
+    if (_units.size() >= NO_SYMBOL / 2) {
+        _err.error(L"too many keys in keyboard layout");
+        return false;
+    }
+
+    // Cost of each slot and each pair of slots.
+    const size_t slots = symbolCount();
+    _slot_costs.resize(slots);
+    _pair_costs.resize(slots * slots);
+    for (size_t s1 = 0; s1 < slots; ++s1) {
+        const Keystroke& k1(strokes[s1 / 2]);
+        const KeyGeometry::Finger f1 = geometry.finger(k1);
+        const uint8_t r1 = geometry.row(k1);
+        const size_t level = 2 * _units[s1 / 2].pair + s1 % 2;
+        double cost = 1.0 + double(std::popcount(unsigned(LEVEL_MODS[level])));
+        if (r1 != KeyGeometry::NO_ROW) {
+            cost += COST_ROW_DISTANCE * std::abs(int(r1) - int(geometry.homeRow()));
+        }
+        if (f1 == KeyGeometry::LEFT_PINKY || f1 == KeyGeometry::RIGHT_PINKY) {
+            cost += COST_PINKY;
+        }
+        else if (f1 == KeyGeometry::LEFT_RING || f1 == KeyGeometry::RIGHT_RING) {
+            cost += COST_RING;
+        }
+        _slot_costs[s1] = cost;
+
+        for (size_t s2 = 0; s2 < slots; ++s2) {
+            const Keystroke& k2(strokes[s2 / 2]);
+            const KeyGeometry::Finger f2 = geometry.finger(k2);
+            const uint8_t r2 = geometry.row(k2);
+            double pcost = 0.0;
+            if (f1 < KeyGeometry::NO_FINGER && f1 != KeyGeometry::THUMB && f2 < KeyGeometry::NO_FINGER && f2 != KeyGeometry::THUMB) {
+                if (f1 == f2 && _units[s1 / 2].vk != _units[s2 / 2].vk) {
+                    pcost += COST_SAME_FINGER;
+                }
+                if (r1 != KeyGeometry::NO_ROW && r2 != KeyGeometry::NO_ROW && std::abs(int(r1) - int(r2)) >= 2) {
+                    pcost += COST_ROW_JUMP;
+                }
+            }
+            _pair_costs[s1 * slots + s2] = pcost;
+        }
+    }
+
+    // Symbols of each BMP character in the original layout.
+    _symbols.assign(0x10000, 0xFFFFFFFF);
+    imap.forEach([&](char32_t cp, const KeySequence& seq) {
+        if (cp >= _symbols.size()) {
+            return;
+        }
+        uint16_t syms[2] = {NO_SYMBOL, NO_SYMBOL};
+        for (size_t i = 0; i < seq.count; ++i) {
+            const Keystroke& k(seq.keys[i]);
+            for (size_t level = 0; level < 4; ++level) {
+                if (k.mods == LEVEL_MODS[level]) {
+                    const auto unit = unit_index.find((uint32_t(k.vk) << 1) | (level / 2));
+                    if (unit != unit_index.end()) {
+                        syms[i] = uint16_t(2 * unit->second + level % 2);
+                    }
+                }
+            }
+            if (syms[i] == NO_SYMBOL) {
+                return;
+            }
+        }
+        _symbols[cp] = uint32_t(syms[0]) | (uint32_t(syms[1]) << 16);
+    });
+
+    Stats::Instance().allocate("layout model", _units.size() * sizeof(Unit) + (_slot_costs.size() + _pair_costs.size()) * sizeof(double) + _symbols.size() * sizeof(uint32_t));
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Apply a placement to a copy of the tables.
+//----------------------------------------------------------------------------
+
+void LayoutModel::apply(const std::vector<uint16_t>& placement, KbdTablesEditor& editor) const
+{
+    for (size_t src = 0; src < placement.size() && src < _units.size(); ++src) {
+        const Unit& from(_units[src]);
+        const Unit& to(_units[placement[src]]);
+        size_t columns = 0;
+        VK_TO_WCHARS10* entry = editor.entry(to.vk, columns);
+        if (placement[src] == src || entry == nullptr) {
+            continue;
+        }
+        for (size_t i = 0; i < 2; ++i) {
+            if (to.columns[i] < columns) {
+                entry->wch[to.columns[i]] = from.chars[i];
+            }
+        }
+        // Caps lock applies to the unit when it contains a lowercase and uppercase letter.
+        const wchar_t c0 = to.columns[0] < columns ? entry->wch[to.columns[0]] : 0;
+        const wchar_t c1 = to.columns[1] < columns ? entry->wch[to.columns[1]] : 0;
+        const bool caps = std::iswalpha(wint_t(c0)) && c1 != c0 && wchar_t(std::towupper(wint_t(c0))) == c1;
+        const BYTE flag = to.pair == 0 ? CAPLOK : CAPLOKALTGR;
+        entry->Attributes = caps ? (entry->Attributes | flag) : (entry->Attributes & ~flag);
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Counts of symbols and pairs of consecutive symbols in a corpus.
+//----------------------------------------------------------------------------
+
+CorpusStats::CorpusStats(size_t count) :
+    symbol_count(count),
+    total(0),
+    unreachable(0),
+    unigrams(count, 0),
+    bigrams(count * count, 0),
+    weights(),
+    next(),
+    previous()
+{
+}
+
+void CorpusStats::count(const char32_t* text, size_t size, const LayoutModel& model)
+{
+    uint16_t previous_sym = LayoutModel::NO_SYMBOL;
+    for (size_t i = 0; i < size; ++i) {
+        if (text[i] == U'\r') {
+            continue;
+        }
+        uint16_t syms[2];
+        model.symbols(text[i], syms[0], syms[1]);
+        if (syms[0] == LayoutModel::NO_SYMBOL) {
+            // Break the chain of bigrams.
+            unreachable++;
+            previous_sym = LayoutModel::NO_SYMBOL;
+            continue;
+        }
+        for (size_t k = 0; k < 2 && syms[k] != LayoutModel::NO_SYMBOL; ++k) {
+            total++;
+            unigrams[syms[k]]++;
+            if (previous_sym != LayoutModel::NO_SYMBOL) {
+                bigrams[size_t(previous_sym) * symbol_count + syms[k]]++;
+            }
+            previous_sym = syms[k];
+        }
+    }
+}
+
+void CorpusStats::merge(const CorpusStats& other)
+{
+    total += other.total;
+    unreachable += other.unreachable;
+    for (size_t i = 0; i < unigrams.size() && i < other.unigrams.size(); ++i) {
+        unigrams[i] += other.unigrams[i];
+    }
+    for (size_t i = 0; i < bigrams.size() && i < other.bigrams.size(); ++i) {
+        bigrams[i] += other.bigrams[i];
+    }
+}
+
+void CorpusStats::finalize()
+{
+    // Normalize the counts, the costs are then expressed per keystroke.
+    const double scale = total == 0 ? 0.0 : 1.0 / double(total);
+    weights.resize(symbol_count);
+    next.assign(symbol_count, NeighborList());
+    previous.assign(symbol_count, NeighborList());
+    for (size_t s1 = 0; s1 < symbol_count; ++s1) {
+        weights[s1] = double(unigrams[s1]) * scale;
+        for (size_t s2 = 0; s2 < symbol_count; ++s2) {
+            const uint64_t count = bigrams[s1 * symbol_count + s2];
+            if (count > 0) {
+                next[s1].push_back(std::make_pair(uint16_t(s2), double(count) * scale));
+                previous[s2].push_back(std::make_pair(uint16_t(s1), double(count) * scale));
+            }
+        }
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Simulated annealing.
+//----------------------------------------------------------------------------
+
+LayoutAnnealer::LayoutAnnealer(const LayoutModel& model, const CorpusStats& stats) :
+    _model(model),
+    _stats(stats),
+    _movable(),
+    _place(),
+    _best()
+{
+    for (size_t u = 0; u < _model.units().size(); ++u) {
+        if (_model.units()[u].movable) {
+            _movable.push_back(uint16_t(u));
+        }
+    }
+}
+
+bool LayoutAnnealer::canSwap(uint16_t a, uint16_t b) const
+{
+    // Contents a and b move to the current positions of b and a.
+    const auto& units(_model.units());
+    return a != b &&
+        !(units[a].empty && units[b].empty) &&
+        !(units[a].letter && units[_place[b]].pair != 0) &&
+        !(units[b].letter && units[_place[a]].pair != 0);
+}
+
+double LayoutAnnealer::localCost(const uint16_t* syms, size_t count) const
+{
+    double cost = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        const uint16_t s = syms[i];
+        const size_t ps = slot(s);
+        cost += _stats.weights[s] * _model.slotCost(ps);
+        for (const auto& n : _stats.next[s]) {
+            cost += n.second * _model.pairCost(ps, slot(n.first));
+        }
+        for (const auto& p : _stats.previous[s]) {
+            // Pairs within the set are already counted in next.
+            if (std::find(syms, syms + count, p.first) == syms + count) {
+                cost += p.second * _model.pairCost(slot(p.first), ps);
+            }
+        }
+    }
+    return cost;
+}
+
+double LayoutAnnealer::cost(const std::vector<uint16_t>& placement) const
+{
+    double cost = 0.0;
+    const auto slot_of = [&](size_t sym) { return 2 * size_t(placement[sym / 2]) + sym % 2; };
+    for (size_t s = 0; s < _stats.symbol_count; ++s) {
+        cost += _stats.weights[s] * _model.slotCost(slot_of(s));
+        for (const auto& n : _stats.next[s]) {
+            cost += n.second * _model.pairCost(slot_of(s), slot_of(n.first));
+        }
+    }
+    return cost;
+}
+
+double LayoutAnnealer::run(uint64_t iterations, uint64_t seed)
+{
+    // Start from the original layout.
+    _place.resize(_model.units().size());
+    for (size_t u = 0; u < _place.size(); ++u) {
+        _place[u] = uint16_t(u);
+    }
+    _best = _place;
+    double current = cost(_place);
+    double best = current;
+    if (_movable.size() < 2 || iterations == 0) {
+        return best;
+    }
+
+    std::mt19937_64 rng(seed);
+    const auto pick = [&]() { return _movable[size_t(rng() % _movable.size())]; };
+
+    // Swap two contents and return the cost difference.
+    const auto swap = [&](uint16_t a, uint16_t b) {
+        const uint16_t syms[4] = {uint16_t(2 * a), uint16_t(2 * a + 1), uint16_t(2 * b), uint16_t(2 * b + 1)};
+        const double before = localCost(syms, 4);
+        std::swap(_place[a], _place[b]);
+        return localCost(syms, 4) - before;
+    };
+
+    // Initial temperature: mean cost difference of random moves.
+    double temperature = 0.0;
+    size_t samples = 0;
+    for (size_t i = 0; i < 10 * TEMPERATURE_SAMPLES && samples < TEMPERATURE_SAMPLES; ++i) {
+        const uint16_t a = pick();
+        const uint16_t b = pick();
+        if (canSwap(a, b)) {
+            temperature += std::abs(swap(a, b));
+            swap(a, b);
+            samples++;
+        }
+    }
+    temperature = samples == 0 || temperature == 0.0 ? 1.0 : temperature / double(samples);
+    const double cooling = std::pow(FINAL_TEMPERATURE, 1.0 / double(iterations));
+
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    uint64_t accepted = 0;
+    for (uint64_t i = 0; i < iterations; ++i, temperature *= cooling) {
+        const uint16_t a = pick();
+        const uint16_t b = pick();
+        if (!canSwap(a, b)) {
+            continue;
+        }
+        const double delta = swap(a, b);
+        if (delta <= 0.0 || uniform(rng) < std::exp(-delta / temperature)) {
+            accepted++;
+            current += delta;
+            if (current < best) {
+                best = current;
+                _best = _place;
+            }
+        }
+        else {
+            // Rejected, swap back.
+            std::swap(_place[a], _place[b]);
+        }
+    }
+    Stats::Instance().count("annealing moves", iterations);
+    Stats::Instance().count("annealing accepted", accepted);
+
+    // Accumulated rounding errors: evaluate the best placement again.
+    return cost(_best);
+}
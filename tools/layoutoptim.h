@@ -0,0 +1,140 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Optimization of a keyboard layout using simulated annealing.
+//
+// The layout is split into units: the base and Shift levels of a key, or
+// its AltGr and Shift+AltGr levels. The two characters of a unit move
+// together, so that lowercase and uppercase letters remain on the same key.
+// Digits, spaces, control characters, dead keys, ligatures and keys outside
+// the main block are fixed. Letters remain on the base and Shift levels.
+//
+// The corpus is reduced to counts of symbols (the characters of each level
+// of each key in the original layout) and of pairs of consecutive symbols.
+// The cost of a swap of two units is computed incrementally from the counts
+// of the four moved symbols only, without evaluating the whole corpus again.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "typingeffort.h"
+#include "kbdedit.h"
+
+// Model of a layout: units, costs of positions.
+class LayoutModel
+{
+public:
+    // Constructor. Specify where to report errors.
+    LayoutModel(Error& err);
+
+    // Symbol value when a character cannot be typed with the units of the model.
+    static constexpr uint16_t NO_SYMBOL = 0xFFFF;
+
+    // A unit: two levels of a key, moved together.
+    class Unit
+    {
+    public:
+        uint16_t vk;          // Virtual key.
+        uint8_t  pair;        // 0 for base and Shift, 1 for AltGr and Shift+AltGr.
+        uint8_t  columns[2];  // Columns of the two levels in VK_TO_WCHARS.
+        wchar_t  chars[2];    // Original characters.
+        bool     movable;     // Can be moved.
+        bool     letter;      // Contains a letter, can only move to pair 0.
+        bool     empty;       // No character.
+    };
+
+    // Build the model of a layout. Return false on error.
+    bool build(const KBDTABLES* tables, const InverseKeyMap& imap, const KeyGeometry& geometry);
+
+    // Units of the layout. Each unit contains two symbols: 2*unit and 2*unit+1.
+    const std::vector<Unit>& units() const { return _units; }
+    size_t symbolCount() const { return 2 * _units.size(); }
+
+    // Get the symbols of a code point in the original layout. When the character needs
+    // only one keystroke, sym2 is NO_SYMBOL. When it cannot be typed, sym1 is NO_SYMBOL.
+    void symbols(char32_t cp, uint16_t& sym1, uint16_t& sym2) const
+    {
+        const uint32_t syms = cp < _symbols.size() ? _symbols[cp] : 0xFFFFFFFF;
+        sym1 = uint16_t(syms & 0xFFFF);
+        sym2 = uint16_t(syms >> 16);
+    }
+
+    // Cost of a slot (same numbering as symbols) and of two consecutive slots.
+    double slotCost(size_t slot) const { return _slot_costs[slot]; }
+    double pairCost(size_t slot1, size_t slot2) const { return _pair_costs[slot1 * _slot_costs.size() + slot2]; }
+
+    // Apply a placement to a copy of the tables: placement[u] is the new position of the content of unit u.
+    void apply(const std::vector<uint16_t>& placement, KbdTablesEditor& editor) const;
+
+private:
+    Error&                _err;
+    std::vector<Unit>     _units;
+    std::vector<double>   _slot_costs;
+    std::vector<double>   _pair_costs;
+    std::vector<uint32_t> _symbols;  // Symbols of BMP code points, two 16-bit values.
+};
+
+// Counts of symbols and pairs of consecutive symbols in a corpus.
+class CorpusStats
+{
+public:
+    // Constructor.
+    CorpusStats(size_t symbol_count = 0);
+
+    // Count symbols in a text.
+    void count(const char32_t* text, size_t size, const LayoutModel& model);
+
+    // Add the counts of another instance.
+    void merge(const CorpusStats& other);
+
+    // Build the normalized weights and neighbor lists, after all counts.
+    void finalize();
+
+    // Weighted list of neighbor symbols.
+    typedef std::vector<std::pair<uint16_t, double>> NeighborList;
+
+    size_t                    symbol_count;
+    uint64_t                  total;        // Total number of symbols.
+    uint64_t                  unreachable;  // Characters which cannot be typed with the model.
+    std::vector<uint64_t>     unigrams;     // Count per symbol.
+    std::vector<uint64_t>     bigrams;      // Count per pair of symbols.
+    std::vector<double>       weights;      // Normalized unigrams.
+    std::vector<NeighborList> next;         // Normalized bigrams (s, next).
+    std::vector<NeighborList> previous;     // Normalized bigrams (previous, s).
+};
+
+// One chain of simulated annealing.
+class LayoutAnnealer
+{
+public:
+    // Constructor.
+    LayoutAnnealer(const LayoutModel& model, const CorpusStats& stats);
+
+    // Run the chain, starting from the original layout. Return the best cost.
+    double run(uint64_t iterations, uint64_t seed);
+
+    // Best placement: best()[u] is the new position of the content of unit u.
+    const std::vector<uint16_t>& best() const { return _best; }
+
+    // Full evaluation of the cost of a placement, per symbol.
+    double cost(const std::vector<uint16_t>& placement) const;
+
+private:
+    const LayoutModel&    _model;
+    const CorpusStats&    _stats;
+    std::vector<uint16_t> _movable;  // Units with movable content.
+    std::vector<uint16_t> _place;    // Current placement.
+    std::vector<uint16_t> _best;     // Best placement.
+
+    // Cost of the terms which involve a set of symbols.
+    double localCost(const uint16_t* syms, size_t count) const;
+
+    // Check if the contents of two units can be swapped.
+    bool canSwap(uint16_t a, uint16_t b) const;
+
+    // Current slot of a symbol.
+    size_t slot(size_t sym) const { return 2 * size_t(_place[sym / 2]) + sym % 2; }
+};
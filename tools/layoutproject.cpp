@@ -0,0 +1,431 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Generation of the files of a keyboard layout project.
+//
+//----------------------------------------------------------------------------
+
+#include "layoutproject.h"
+#include "fingerprint.h"
+#include "sourcegen.h"
+#include "winutils.h"
+#include <random>
+#include <tuple>
+
+// Binary model header.
+#define MODEL_MAGIC   "WKLMODEL"
+#define MODEL_VERSION 2
+
+const WString LayoutProject::MODEL_EXTENSION(L".kbm");
+
+
+//----------------------------------------------------------------------------
+// Constructor.
+//----------------------------------------------------------------------------
+
+LayoutProject::LayoutProject(Error& err) :
+    directory(),
+    name(),
+    text(),
+    lang(),
+    input(),
+    read_only(false),
+    source(true),
+    strings(true),
+    project(true),
+    model(false),
+    _err(err)
+{
+}
+
+
+//----------------------------------------------------------------------------
+// Open/close an output file, report errors.
+//----------------------------------------------------------------------------
+
+bool LayoutProject::createOutput(std::ofstream& file, const WString& filename, bool binary)
+{
+    file.open(filename, binary ? std::ios::out | std::ios::binary : std::ios::out);
+    if (!file) {
+        _err.error("cannot create " + filename);
+        return false;
+    }
+    return true;
+}
+
+bool LayoutProject::closeOutput(std::ofstream& file, const WString& filename)
+{
+    file.close();
+    if (!file) {
+        _err.error("error writing " + filename);
+        return false;
+    }
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Write the binary model of a layout.
+//----------------------------------------------------------------------------
+
+void LayoutProject::WriteModel(std::ostream& out, const KBDTABLES& tables)
+{
+    LayoutFingerprint fp;
+    fp.build(tables);
+    const std::string& canonical(fp.canonical());
+
+    std::string header(MODEL_MAGIC);
+    const auto append = [&header](uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            header.push_back(char((value >> (8 * i)) & 0xFF));
+        }
+    };
+    append(MODEL_VERSION, 4);
+    append(fp.hash(), 8);
+    append(canonical.size(), 4);
+
+    out.write(header.data(), header.size());
+    out.write(canonical.data(), canonical.size());
+}
+
+
+//----------------------------------------------------------------------------
+// Read the binary model of a layout.
+//----------------------------------------------------------------------------
+
+namespace {
+    // Little-endian integers and length-prefixed strings, as in the fingerprint.
+    class ModelData
+    {
+    public:
+        ModelData(const char* data, size_t size) : _data(data), _size(size), _pos(0), _valid(true) {}
+        bool valid() const { return _valid; }
+        bool atEnd() const { return _pos >= _size; }
+        uint32_t get(size_t bytes)
+        {
+            uint32_t value = 0;
+            if (_pos + bytes > _size) {
+                _valid = false;
+                _pos = _size;
+                return 0;
+            }
+            for (size_t i = 0; i < bytes; ++i) {
+                value |= uint32_t(uint8_t(_data[_pos + i])) << (8 * i);
+            }
+            _pos += bytes;
+            return value;
+        }
+        WString str()
+        {
+            WString s;
+            for (size_t len = get(2); len > 0 && _valid; --len) {
+                s.push_back(wchar_t(get(2)));
+            }
+            return s;
+        }
+        ModelData record()
+        {
+            const size_t size = get(2);
+            const size_t start = _pos;
+            if (_pos + size > _size) {
+                _valid = false;
+                _pos = _size;
+                return ModelData(_data, 0);
+            }
+            _pos += size;
+            return ModelData(_data + start, size);
+        }
+    private:
+        const char* _data;
+        size_t      _size;
+        size_t      _pos;
+        bool        _valid;
+    };
+
+    // One character of a key in a model record.
+    class ModelChar
+    {
+    public:
+        size_t  bits;    // Shift state.
+        wchar_t wc;      // Character.
+        wchar_t accent;  // Accent of a dead key.
+        wchar_t caps;    // Character with CapsLock, for SGCAPS keys.
+    };
+}
+
+bool LayoutProject::readModel(LayoutDescription& desc, const WString& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        _err.error("cannot open " + filename);
+        return false;
+    }
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return readModel(desc, content, filename);
+}
+
+bool LayoutProject::readModel(LayoutDescription& desc, const std::string& content, const WString& filename)
+{
+    desc.clear();
+    desc.name = FileBaseName(filename);
+
+    // Check the header.
+    const size_t magic_size = std::strlen(MODEL_MAGIC);
+    ModelData header(content.data(), content.size());
+    if (content.compare(0, magic_size, MODEL_MAGIC) != 0) {
+        _err.error(filename + " is not a binary model");
+        return false;
+    }
+    header.get(magic_size);
+    const uint32_t version = header.get(4);
+    const uint64_t hash_low = header.get(4);
+    const uint64_t hash = hash_low | (uint64_t(header.get(4)) << 32);
+    const size_t size = header.get(4);
+    const size_t start = magic_size + 16;
+    if (!header.valid() || version != MODEL_VERSION || content.size() != start + size) {
+        _err.error("invalid binary model format in " + filename);
+        return false;
+    }
+
+    // Keys, with their CapsLock flag and characters per shift state, and ligatures.
+    std::vector<std::tuple<LayoutDescription::Key, bool, std::vector<ModelChar>>> keys;
+    std::vector<std::tuple<uint8_t, size_t, WString>> ligatures;
+    std::set<size_t> states;
+
+    // Decode all sections. Unknown sections are ignored.
+    ModelData data(content.data() + start, size);
+    while (data.valid() && !data.atEnd()) {
+        const uint32_t tag = data.get(1);
+        for (uint32_t count = data.get(4); data.valid() && count > 0; --count) {
+            ModelData rec(data.record());
+            switch (tag) {
+                case 'L': {
+                    desc.type = rec.get(4);
+                    desc.subtype = rec.get(4);
+                    desc.locale_flags = uint16_t(rec.get(2));
+                    break;
+                }
+                case 'M': {
+                    const BYTE vk = BYTE(rec.get(1));
+                    const BYTE bits = BYTE(rec.get(1));
+                    desc.modifiers.push_back(VK_TO_BIT{vk, bits});
+                    break;
+                }
+                case 'S': {
+                    const uint8_t prefix = uint8_t(rec.get(1));
+                    const uint8_t sc = uint8_t(rec.get(1));
+                    desc.scancodes.push_back(LayoutDescription::ScanCode{prefix, sc, uint16_t(rec.get(2))});
+                    break;
+                }
+                case 'K': {
+                    // A flag tells if the record has the CapsLock characters of an SGCAPS key.
+                    const uint8_t vk = uint8_t(rec.get(1));
+                    const LayoutDescription::Key key(vk, uint8_t(rec.get(1)));
+                    const bool caps = rec.get(1) != 0;
+                    std::vector<ModelChar> chars;
+                    while (rec.valid() && !rec.atEnd()) {
+                        ModelChar c {rec.get(1), wchar_t(rec.get(2)), 0, WCH_NONE};
+                        if (c.wc == WCH_DEAD) {
+                            c.accent = wchar_t(rec.get(2));
+                        }
+                        if (caps) {
+                            c.caps = wchar_t(rec.get(2));
+                        }
+                        chars.push_back(c);
+                    }
+                    if (!rec.valid()) {
+                        _err.error("invalid key record in " + filename);
+                        return false;
+                    }
+                    for (const auto& c : chars) {
+                        states.insert(c.bits);
+                    }
+                    keys.emplace_back(key, caps, chars);
+                    break;
+                }
+                case 'D': {
+                    const DWORD both = rec.get(4);
+                    const wchar_t composed = wchar_t(rec.get(2));
+                    const uint16_t flags = uint16_t(rec.get(2));
+                    const wchar_t accent = HIWORD(both);
+                    auto acc = std::find_if(desc.dead_keys.begin(), desc.dead_keys.end(), [accent](const auto& d) { return d.first == accent; });
+                    if (acc == desc.dead_keys.end()) {
+                        desc.dead_keys.emplace_back(accent, std::vector<LayoutDescription::DeadKey>());
+                        acc = desc.dead_keys.end() - 1;
+                    }
+                    acc->second.push_back(LayoutDescription::DeadKey{wchar_t(LOWORD(both)), composed, flags});
+                    break;
+                }
+                case 'G': {
+                    const uint8_t vk = uint8_t(rec.get(1));
+                    const size_t bits = rec.get(1);
+                    ligatures.push_back(std::make_tuple(vk, bits, rec.str()));
+                    states.insert(bits);
+                    break;
+                }
+                case 'N': {
+                    const uint8_t prefix = uint8_t(rec.get(1));
+                    const uint8_t sc = uint8_t(rec.get(1));
+                    desc.key_names.push_back(LayoutDescription::KeyName{prefix, sc, rec.str()});
+                    break;
+                }
+                case 'A': {
+                    const WString name(rec.str());
+                    if (!name.empty()) {
+                        desc.dead_key_names.emplace_back(name[0], name.substr(1));
+                    }
+                    break;
+                }
+                default: {
+                    break;
+                }
+            }
+            if (!rec.valid()) {
+                _err.error(Format(L"invalid record in section '%c' of %s", wchar_t(tag), filename.c_str()));
+                return false;
+            }
+        }
+    }
+    if (!data.valid()) {
+        _err.error("truncated binary model " + filename);
+        return false;
+    }
+
+    // Columns: one per shift state which is used, in increasing order.
+    if (states.empty()) {
+        states.insert(0);
+    }
+    desc.columns.assign(*states.rbegin() + 1, SHFT_INVALID);
+    uint8_t column = 0;
+    for (size_t bits : states) {
+        desc.columns[bits] = column++;
+    }
+
+    // Keys. With SGCAPS, the CapsLock characters are in a separate entry after the key.
+    std::map<uint8_t, size_t> key_index;
+    for (const auto& it : keys) {
+        const std::vector<ModelChar>& chars(std::get<2>(it));
+        key_index.insert(std::make_pair(std::get<0>(it).vk, desc.keys.size()));
+        desc.keys.push_back(std::get<0>(it));
+        desc.keys.back().chars.resize(column);
+        for (const auto& c : chars) {
+            LayoutDescription::Char& ch(desc.keys.back().chars[desc.columns[c.bits]]);
+            ch = c.wc == WCH_DEAD && c.accent != 0 ? LayoutDescription::Char(c.accent, true) : LayoutDescription::Char(c.wc);
+        }
+        if (std::get<1>(it)) {
+            desc.keys.emplace_back(VK__none_, 0);
+            desc.keys.back().chars.resize(column);
+            for (const auto& c : chars) {
+                desc.keys.back().chars[desc.columns[c.bits]] = LayoutDescription::Char(c.caps);
+            }
+        }
+    }
+    for (const auto& lig : ligatures) {
+        const auto it = key_index.find(std::get<0>(lig));
+        if (it != key_index.end() && std::get<1>(lig) < desc.columns.size()) {
+            desc.keys[it->second].chars[desc.columns[std::get<1>(lig)]].ligature = std::get<2>(lig);
+        }
+    }
+
+    // The tables which are rebuilt from the description must have the same fingerprint.
+    LayoutFingerprint fp;
+    fp.build(desc.tables());
+    if (fp.hash() != hash) {
+        _err.error("inconsistent binary model " + filename + ", fingerprint " + fp.toString());
+        return false;
+    }
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Generate the project files.
+//----------------------------------------------------------------------------
+
+bool LayoutProject::generate(const KBDTABLES& tables)
+{
+    // Create the project directory.
+    if (!IsDirectory(directory) && !CreateDirectoryW(directory.c_str(), nullptr)) {
+        const DWORD err = GetLastError();
+        _err.error("cannot create " + directory + ": " + ErrorText(err));
+        return false;
+    }
+    const WString prefix(directory + L"\\" + name);
+    std::ofstream file;
+
+    // Source file. The header comment lines of an existing source file are kept.
+    if (source) {
+        const WString filename(prefix + L".c");
+        WStringList headers;
+        SourceGenerator::LoadHeaders(headers, filename);
+        if (!createOutput(file, filename)) {
+            return false;
+        }
+        SourceGenerator gen(file);
+        gen.input = input;
+        gen.comment = L"Windows Keyboards Layouts (WKL)";
+        gen.headers = headers;
+        gen.hexa_dump = false;
+        gen.read_only = read_only;
+        gen.dedup = read_only;
+        gen.generate(tables);
+        if (!closeOutput(file, filename)) {
+            return false;
+        }
+    }
+
+    // Resource strings.
+    if (strings) {
+        const WString filename(directory + L"\\strings.h");
+        if (!createOutput(file, filename)) {
+            return false;
+        }
+        file << "#define WKL_TEXT \"" << text << "\"" << std::endl;
+        file << "#define WKL_LANG \"" << lang << "\"" << std::endl;
+        if (!closeOutput(file, filename)) {
+            return false;
+        }
+    }
+
+    // Project file, with a random GUID. Never overwrite an existing project,
+    // its GUID is referenced in the solution.
+    const WString project_file(prefix + L".vcxproj");
+    if (project && !FileExists(project_file)) {
+        std::random_device rd;
+        std::mt19937_64 rng((uint64_t(rd()) << 32) | rd());
+        const uint64_t g1 = rng();
+        const uint64_t g2 = (rng() & 0x3FFFFFFFFFFFFFFF) | 0x8000000000000000;
+        const WString guid(Format(L"%08X-%04X-4%03X-%04X-%012llX", uint32_t(g1 >> 32), uint32_t(g1 >> 16) & 0xFFFF, uint32_t(g1) & 0x0FFF, uint32_t(g2 >> 48), g2 & 0xFFFFFFFFFFFF));
+        if (!createOutput(file, project_file, true)) {
+            return false;
+        }
+        file << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"
+             << "<Project DefaultTargets=\"Build\" xmlns=\"http://schemas.microsoft.com/developer/msbuild/2003\">\r\n"
+             << "  <PropertyGroup Label=\"Globals\">\r\n"
+             << "    <ProjectGuid>{" << guid << "}</ProjectGuid>\r\n"
+             << "  </PropertyGroup>\r\n"
+             << "  <ImportGroup Label=\"PropertySheets\">\r\n"
+             << "    <Import Project=\"$(SolutionDir)msbuild.props\" />\r\n"
+             << "  </ImportGroup>\r\n"
+             << "</Project>\r\n";
+        if (!closeOutput(file, project_file)) {
+            return false;
+        }
+    }
+
+    // Binary model.
+    if (model) {
+        const WString filename(prefix + MODEL_EXTENSION);
+        if (!createOutput(file, filename, true)) {
+            return false;
+        }
+        WriteModel(file, tables);
+        if (!closeOutput(file, filename)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Generation of the files of a keyboard layout project: C source file,
+// resource strings, project file and binary model.
+//
+// The binary model (extension .kbm) is the canonical semantic description
+// of the layout, as defined in fingerprint.h, with a small header:
+//
+//   8 bytes   "WKLMODEL"
+//   4 bytes   format version, little endian
+//   8 bytes   fingerprint hash, little endian
+//   4 bytes   size of canonical description, little endian
+//   n bytes   canonical description
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "layoutdesc.h"
+
+class LayoutProject
+{
+public:
+    // Constructor. Specify where to report errors.
+    LayoutProject(Error& err);
+
+    // Default file extension of binary models.
+    static const WString MODEL_EXTENSION;
+
+    // Parameters of the generation.
+    WString directory;   // Output directory of the project files.
+    WString name;        // Layout name, for instance "kbdfrapple".
+    WString text;        // Description text in strings.h.
+    WString lang;        // Base language in strings.h.
+    WString input;       // Input file, as mentioned in the source file.
+    bool    read_only;   // Generate const tables, without duplicate entries.
+    bool    source;      // Generate the C source file.
+    bool    strings;     // Generate strings.h.
+    bool    project;     // Generate the project file, when it does not exist yet.
+    bool    model;       // Generate the binary model.
+
+    // Generate the project files. Return false on error.
+    bool generate(const KBDTABLES& tables);
+
+    // Write the binary model of a layout.
+    static void WriteModel(std::ostream& out, const KBDTABLES& tables);
+
+    // Read a binary model into a layout description. Return false on error. The
+    // canonical description has no column numbers: the shift states which are used
+    // by the keys are numbered in increasing order, in one single table of keys.
+    bool readModel(LayoutDescription& desc, const WString& filename);
+
+    // Same as readModel() with the content of the file already in memory.
+    bool readModel(LayoutDescription& desc, const std::string& content, const WString& filename);
+
+private:
+    Error& _err;
+
+    // Open/close an output file, report errors.
+    bool createOutput(std::ofstream& file, const WString& filename, bool binary = false);
+    bool closeOutput(std::ofstream& file, const WString& filename);
+};
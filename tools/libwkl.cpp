@@ -0,0 +1,285 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// libwkl: C API of the layout model and translation engine.
+//
+//----------------------------------------------------------------------------
+
+#include "libwkl.h"
+#include "kbdloader.h"
+#include "keytranslator.h"
+#include "inversekeymap.h"
+#include "fingerprint.h"
+#include "winkeymap.h"
+#include "layoutdesc.h"
+#include "layoutproject.h"
+#include "klcreader.h"
+#include "taskrunner.h"
+#include <sstream>
+
+static_assert(sizeof(wkl_keystroke) == sizeof(Keystroke), "incompatible wkl_keystroke and Keystroke");
+static_assert(WKL_KEY_PREFIX_0 == Keystroke::PREFIX_0 && WKL_KEY_PREFIX_1 == Keystroke::PREFIX_1, "incompatible keystroke flags");
+static_assert(sizeof(wchar_t) == sizeof(uint16_t), "wchar_t is not UTF-16");
+
+namespace {
+    // Parent of all error reporters in the library: nothing is displayed.
+    const Error& SilentError()
+    {
+        static const Error err;
+        return err;
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Content of the handles. Everything is compiled when the layout is opened.
+// The source tables (DLL or description) are not kept after that.
+//----------------------------------------------------------------------------
+
+struct wkl_layout
+{
+    TaskError             err;
+    KeyTranslator         translator;
+    InverseKeyMap         inverse;
+    std::vector<wkl_char> chars;
+    wkl_info              info;
+
+    // Constructor.
+    wkl_layout() : err(SilentError()), translator(err), inverse(err), chars(), info() {}
+
+    // Compile the tables of the layout. Return false on error.
+    bool build(const KBDTABLES* tables);
+};
+
+struct wkl_state
+{
+    const wkl_layout*    layout;
+    KeyTranslator::State state;
+
+    // Constructor.
+    wkl_state(const wkl_layout* l) : layout(l), state() {}
+};
+
+
+//----------------------------------------------------------------------------
+// Compile the tables of a layout.
+//----------------------------------------------------------------------------
+
+bool wkl_layout::build(const KBDTABLES* tables)
+{
+    if (tables == nullptr || !translator.build(tables) || !inverse.build(tables)) {
+        return false;
+    }
+
+    // All characters, as in the character table of kbdreverse.
+    WinKeyMap map(tables);
+    for (const KeyChar& kc : map.characters()) {
+        wkl_char c {kc.sc, kc.prefix, kc.vk, kc.modifier, 0, 0, uint16_t(kc.wc)};
+        c.flags = (kc.extended ? WKL_CHAR_EXTENDED : 0) | (kc.dead ? WKL_CHAR_DEAD : 0);
+        chars.push_back(c);
+    }
+
+    LayoutFingerprint fp;
+    fp.build(*tables);
+    info.type = tables->dwType;
+    info.subtype = tables->dwSubType;
+    info.locale_flags = tables->fLocaleFlags;
+    info.char_count = uint32_t(chars.size());
+    info.max_output = uint32_t(translator.maxOutput());
+    info.reachable = uint32_t(inverse.size());
+    info.fingerprint = fp.hash();
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Version and layouts.
+//----------------------------------------------------------------------------
+
+uint32_t wkl_version(void)
+{
+    return WKL_API_VERSION;
+}
+
+wkl_layout* wkl_open(const wchar_t* name, uint32_t flags, wchar_t* error, size_t error_size)
+{
+    if (error != nullptr && error_size > 0) {
+        error[0] = 0;
+    }
+
+    // No exception can go through the C API.
+    wkl_layout* layout = nullptr;
+    bool success = false;
+    try {
+        layout = new wkl_layout;
+        if (name == nullptr || name[0] == 0) {
+            layout->err.error("no layout name");
+        }
+        else {
+            const WString filename(name);
+            const WString lower(ToLower(filename));
+            LayoutDescription desc(layout->err);
+            if (EndsWith(lower, LayoutProject::MODEL_EXTENSION)) {
+                LayoutProject project(layout->err);
+                success = project.readModel(desc, filename) && layout->build(&desc.tables());
+            }
+            else if (EndsWith(lower, LayoutDescription::FILE_EXTENSION)) {
+                success = desc.load(filename) && layout->build(&desc.tables());
+            }
+            else if (EndsWith(lower, KlcReader::FILE_EXTENSION)) {
+                KlcReader reader(layout->err);
+                success = reader.load(desc, filename) && layout->build(&desc.tables());
+            }
+            else {
+                KeyboardLoader loader(layout->err);
+                loader.portable = (flags & WKL_OPEN_PORTABLE) != 0;
+                success = layout->build(loader.load(KeyboardLoader::FileName(filename)));
+            }
+        }
+    }
+    catch (const TaskError::Abort&) {
+        success = false;
+    }
+    catch (const std::bad_alloc&) {
+        success = false;
+        if (layout != nullptr) {
+            layout->err.error("out of memory");
+        }
+    }
+    if (success) {
+        return layout;
+    }
+
+    // Return the error messages to the caller.
+    if (layout != nullptr && error != nullptr && error_size > 0) {
+        try {
+            std::ostringstream text;
+            layout->err.flush(Error(WString(), &text));
+            const WString msg(ToUTF16(text.str()));
+            const size_t size = std::min(msg.size(), error_size - 1);
+            std::copy(msg.begin(), msg.begin() + size, error);
+            error[size] = 0;
+        }
+        catch (...) {
+        }
+    }
+    delete layout;
+    return nullptr;
+}
+
+void wkl_close(wkl_layout* layout)
+{
+    delete layout;
+}
+
+int wkl_get_info(const wkl_layout* layout, wkl_info* info)
+{
+    if (layout == nullptr || info == nullptr) {
+        return 0;
+    }
+    *info = layout->info;
+    return 1;
+}
+
+size_t wkl_get_chars(const wkl_layout* layout, size_t first, wkl_char* chars, size_t count)
+{
+    if (layout == nullptr || chars == nullptr || first >= layout->chars.size()) {
+        return 0;
+    }
+    count = std::min(count, layout->chars.size() - first);
+    std::copy(layout->chars.begin() + first, layout->chars.begin() + first + count, chars);
+    return count;
+}
+
+
+//----------------------------------------------------------------------------
+// Translation of scan codes.
+//----------------------------------------------------------------------------
+
+wkl_state* wkl_state_create(const wkl_layout* layout)
+{
+    if (layout == nullptr) {
+        return nullptr;
+    }
+    try {
+        return new wkl_state(layout);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void wkl_state_destroy(wkl_state* state)
+{
+    delete state;
+}
+
+void wkl_state_reset(wkl_state* state)
+{
+    if (state != nullptr) {
+        state->state.reset();
+    }
+}
+
+size_t wkl_translate(wkl_state* state, const uint8_t* input, size_t input_size, wchar_t* output, size_t output_size, size_t* written)
+{
+    size_t count = 0;
+    size_t consumed = 0;
+    if (state != nullptr && input != nullptr && output != nullptr) {
+        consumed = state->layout->translator.translate(state->state, input, input_size, output, output_size, count);
+    }
+    if (written != nullptr) {
+        *written = count;
+    }
+    return consumed;
+}
+
+
+//----------------------------------------------------------------------------
+// Inverse lookups.
+//----------------------------------------------------------------------------
+
+size_t wkl_inverse(const wkl_layout* layout, uint32_t code_point, wkl_keystroke* keys, size_t count)
+{
+    const KeySequence* seq = layout == nullptr || keys == nullptr ? nullptr : layout->inverse.find(char32_t(code_point));
+    if (seq == nullptr || seq->count > count) {
+        return 0;
+    }
+    for (size_t i = 0; i < seq->count; ++i) {
+        const Keystroke& ks(seq->keys[i]);
+        keys[i] = wkl_keystroke {ks.sc, ks.flags, ks.mods, ks.vk};
+    }
+    return seq->count;
+}
+
+size_t wkl_inverse_text(const wkl_layout* layout, const wchar_t* text, size_t text_size, wkl_keystroke* keys, size_t count, size_t* written, size_t* unmapped)
+{
+    size_t pos = 0;
+    size_t out = 0;
+    size_t missed = 0;
+    if (layout != nullptr && text != nullptr && keys != nullptr) {
+        while (pos < text_size && count - out >= WKL_MAX_KEYSTROKES) {
+            // Decode surrogate pairs. A lone surrogate cannot be typed.
+            char32_t cp = text[pos++];
+            if (cp >= 0xD800 && cp < 0xDC00 && pos < text_size && text[pos] >= 0xDC00 && text[pos] < 0xE000) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (text[pos++] - 0xDC00);
+            }
+            // Carriage returns are ignored, newlines are typed with Enter, as in InverseKeyMap.
+            if (cp != U'\r') {
+                const size_t n = wkl_inverse(layout, uint32_t(cp), keys + out, count - out);
+                out += n;
+                missed += n == 0;
+            }
+        }
+    }
+    if (written != nullptr) {
+        *written = out;
+    }
+    if (unmapped != nullptr) {
+        *unmapped += missed;
+    }
+    return pos;
+}
@@ -0,0 +1,131 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// libwkl: C API of the layout model and translation engine, in libwkl.dll.
+//
+// A layout is opened from a keyboard layout DLL, a binary model (.kbm), a
+// layout description (.kbl) or an MSKLC source file (.klc). Everything is
+// compiled when the layout is opened. After that, the functions which
+// iterate keys, translate scan codes and find keystrokes write into buffers
+// which are provided by the caller and do not allocate memory.
+//
+// An open layout is never modified. It can be used by several threads at
+// the same time, with one translation state per input stream. A state must
+// not be used by two threads at the same time. A layout must be closed
+// after all its states.
+//
+// Strings are UTF-16 (wchar_t), as in the Windows API. Sizes of buffers
+// are in number of elements, not bytes.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Version of the API. Incremented when a function or structure is added.
+#define WKL_API_VERSION 1
+
+// Opaque handles.
+typedef struct wkl_layout wkl_layout;  // An open layout.
+typedef struct wkl_state  wkl_state;   // Keyboard state of one input stream.
+
+// Flags for wkl_open().
+#define WKL_OPEN_PORTABLE 0x0001  // Map a DLL without executing it (allows DLL's for other CPU's).
+
+// General characteristics of a layout.
+typedef struct wkl_info {
+    uint32_t type;          // Keyboard type.
+    uint32_t subtype;       // Keyboard subtype.
+    uint32_t locale_flags;  // fLocaleFlags, KLLF_ flags and version.
+    uint32_t char_count;    // Number of characters, see wkl_get_chars().
+    uint32_t max_output;    // Maximum number of characters per keystroke.
+    uint32_t reachable;     // Number of characters which can be typed.
+    uint64_t fingerprint;   // Semantic fingerprint, as in kbdreverse --fingerprint.
+} wkl_info;
+
+// One character which is produced by a key.
+typedef struct wkl_char {
+    uint8_t  sc;         // Scan code, without prefix.
+    uint8_t  prefix;     // Scan code prefix, 0, 0xE0 or 0xE1.
+    uint8_t  vk;         // Virtual key.
+    uint8_t  modifiers;  // Bitmask of KBDSHIFT, KBDCTRL, KBDALT, etc.
+    uint8_t  flags;      // Combination of WKL_CHAR_xxx.
+    uint8_t  reserved;
+    uint16_t wc;         // Unicode character, or accent of a dead key.
+} wkl_char;
+
+// Values for wkl_char.flags.
+#define WKL_CHAR_EXTENDED 0x01  // The virtual key has the KBDEXT attribute.
+#define WKL_CHAR_DEAD     0x02  // The character is a dead key.
+
+// One keystroke: a scan code and modifiers.
+typedef struct wkl_keystroke {
+    uint8_t sc;         // Scan code, without prefix.
+    uint8_t flags;      // Combination of WKL_KEY_xxx.
+    uint8_t modifiers;  // Bitmask of KBDSHIFT, KBDCTRL, KBDALT.
+    uint8_t vk;         // Virtual key.
+} wkl_keystroke;
+
+// Values for wkl_keystroke.flags.
+#define WKL_KEY_PREFIX_0 0x01  // Scan code has E0 prefix.
+#define WKL_KEY_PREFIX_1 0x02  // Scan code has E1 prefix.
+
+// Maximum number of keystrokes for one character, see wkl_inverse().
+#define WKL_MAX_KEYSTROKES 2
+
+// Get the version of the library, WKL_API_VERSION when it was built.
+uint32_t wkl_version(void);
+
+// Open a layout: keyboard name ("fr" for kbdfr.dll), DLL, .kbm, .kbl or .klc file.
+// Return null on error. When error is not null, the error messages are written
+// there, truncated and nul-terminated.
+wkl_layout* wkl_open(const wchar_t* name, uint32_t flags, wchar_t* error, size_t error_size);
+
+// Close a layout. All its states must be destroyed first.
+void wkl_close(wkl_layout* layout);
+
+// Get the general characteristics of a layout. Return zero on error.
+int wkl_get_info(const wkl_layout* layout, wkl_info* info);
+
+// Get the characters of a layout, in order of scan codes, starting at index first.
+// Return the number of characters which are written in chars, at most count.
+size_t wkl_get_chars(const wkl_layout* layout, size_t first, wkl_char* chars, size_t count);
+
+// Create a translation state, no key pressed. Return null on error.
+wkl_state* wkl_state_create(const wkl_layout* layout);
+
+// Destroy a translation state.
+void wkl_state_destroy(wkl_state* state);
+
+// Reset a translation state, no key pressed.
+void wkl_state_reset(wkl_state* state);
+
+// Translate a stream of set 1 scan code bytes into characters. The state keeps the
+// pressed modifiers, CapsLock and pending dead key across calls. The translation stops
+// when the output buffer has less than wkl_info.max_output free characters. Return the
+// number of consumed input bytes. The number of written characters is returned in
+// written, when not null.
+size_t wkl_translate(wkl_state* state, const uint8_t* input, size_t input_size, wchar_t* output, size_t output_size, size_t* written);
+
+// Get the cheapest keystrokes which type one code point, at most WKL_MAX_KEYSTROKES,
+// a dead key followed by a base key or only one key. Return the number of keystrokes,
+// zero if the character cannot be typed or if count is too small.
+size_t wkl_inverse(const wkl_layout* layout, uint32_t code_point, wkl_keystroke* keys, size_t count);
+
+// Get the keystrokes which type a UTF-16 text. Characters which cannot be typed are
+// skipped and added to unmapped, when not null. The translation stops when the output
+// buffer has less than WKL_MAX_KEYSTROKES free keystrokes. Return the number of consumed
+// characters. The number of written keystrokes is returned in written, when not null.
+size_t wkl_inverse_text(const wkl_layout* layout, const wchar_t* text, size_t text_size, wkl_keystroke* keys, size_t count, size_t* written, size_t* unmapped);
+
+#if defined(__cplusplus)
+}
+#endif
@@ -0,0 +1,103 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Read-only memory mapping of a complete file.
+//
+//----------------------------------------------------------------------------
+
+#include "mappedfile.h"
+#include "winutils.h"
+#include "stats.h"
+
+
+//----------------------------------------------------------------------------
+// Constructor and destructor.
+//----------------------------------------------------------------------------
+
+MappedFile::MappedFile(Error& err) :
+    _err(err),
+    _file(INVALID_HANDLE_VALUE),
+    _mapping(nullptr),
+    _data(nullptr),
+    _size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+
+//----------------------------------------------------------------------------
+// Map a file in memory.
+//----------------------------------------------------------------------------
+
+bool MappedFile::open(const WString& filename)
+{
+    Stats::Timer timer("file map");
+    close();
+
+    _file = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (_file == INVALID_HANDLE_VALUE) {
+        const DWORD err = GetLastError();
+        _err.error(filename + ": " + ErrorText(err));
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(_file, &size)) {
+        const DWORD err = GetLastError();
+        _err.error(filename + ": " + ErrorText(err));
+        close();
+        return false;
+    }
+    if (uint64_t(size.QuadPart) > uint64_t(SIZE_MAX)) {
+        _err.error(filename + " is too large to be mapped in memory");
+        close();
+        return false;
+    }
+    if (size.QuadPart == 0) {
+        // Empty files cannot be mapped.
+        return true;
+    }
+
+    _mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (_mapping != nullptr) {
+        _data = reinterpret_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (_data == nullptr) {
+        const DWORD err = GetLastError();
+        _err.error("cannot map " + filename + ": " + ErrorText(err));
+        close();
+        return false;
+    }
+    _size = size_t(size.QuadPart);
+    Stats::Instance().count("mapped bytes", _size);
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Unmap the file.
+//----------------------------------------------------------------------------
+
+void MappedFile::close()
+{
+    if (_data != nullptr) {
+        UnmapViewOfFile(_data);
+        _data = nullptr;
+    }
+    if (_mapping != nullptr) {
+        CloseHandle(_mapping);
+        _mapping = nullptr;
+    }
+    if (_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(_file);
+        _file = INVALID_HANDLE_VALUE;
+    }
+    _size = 0;
+}
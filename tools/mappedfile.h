@@ -0,0 +1,41 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Read-only memory mapping of a complete file.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "error.h"
+
+class MappedFile
+{
+public:
+    // Constructor. Specify where to report errors.
+    MappedFile(Error& err);
+    ~MappedFile();
+
+    // Map a file in memory. Return false on error. An empty file is valid.
+    bool open(const WString& filename);
+
+    // Unmap the file.
+    void close();
+
+    // Content of the file.
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    Error&      _err;
+    HANDLE      _file;
+    HANDLE      _mapping;
+    const char* _data;
+    size_t      _size;
+
+    // Inaccessible operations.
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
@@ -0,0 +1,219 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// State machine of the modifier and lock keys of a keyboard layout.
+//
+//----------------------------------------------------------------------------
+
+#include "modifiermachine.h"
+#include "stats.h"
+#include <bit>
+
+
+//----------------------------------------------------------------------------
+// Modifiers state.
+//----------------------------------------------------------------------------
+
+ModifierMachine::State::State()
+{
+    reset();
+}
+
+void ModifierMachine::State::reset()
+{
+    capslock = false;
+    kanalock = false;
+    grpsel = false;
+    modifiers = 0;
+    _keys = 0;
+    _tap = 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Constructor and reset.
+//----------------------------------------------------------------------------
+
+ModifierMachine::ModifierMachine(Error& err) :
+    _err(err),
+    _planes(0),
+    _index(),
+    _key_bits(),
+    _caps_keys(0),
+    _kana_keys(0),
+    _tap_keys(0),
+    _bits()
+{
+    clear();
+}
+
+void ModifierMachine::clear()
+{
+    _planes = 1;
+    std::memset(_index, 0xFF, sizeof(_index));
+    Zero(_key_bits, sizeof(_key_bits));
+    _caps_keys = 0;
+    _kana_keys = 0;
+    _tap_keys = 0;
+    _bits.assign(1, 0);
+}
+
+
+//----------------------------------------------------------------------------
+// Compile the MODIFIERS table of a keyboard layout.
+//----------------------------------------------------------------------------
+
+bool ModifierMachine::build(const KBDTABLES* tables)
+{
+    clear();
+    if (tables == nullptr || tables->pCharModifiers == nullptr) {
+        _err.error(L"no modifier table in keyboard layout");
+        return false;
+    }
+    const MODIFIERS* mods = tables->pCharModifiers;
+    _planes = size_t(mods->wMaxModBits) + 1;
+
+    // Modifier bits of all virtual keys. The tables use the generic virtual keys (VK_SHIFT)
+    // while the scan codes produce the left and right ones (VK_LSHIFT, VK_RSHIFT).
+    uint16_t vk_bits[256] {};
+    uint16_t all_bits = 0;
+    for (const VK_TO_BIT* vb = mods->pVkToBit; vb != nullptr && vb->Vk != 0; ++vb) {
+        vk_bits[vb->Vk] |= vb->ModBits;
+        all_bits |= vb->ModBits;
+    }
+    static const uint8_t sides[][3] = {
+        {VK_SHIFT,   VK_LSHIFT,   VK_RSHIFT},
+        {VK_CONTROL, VK_LCONTROL, VK_RCONTROL},
+        {VK_MENU,    VK_LMENU,    VK_RMENU},
+    };
+    for (const auto& side : sides) {
+        for (size_t i = 1; i < 3; ++i) {
+            if (vk_bits[side[i]] == 0) {
+                vk_bits[side[i]] = vk_bits[side[0]];
+            }
+        }
+    }
+    if ((tables->fLocaleFlags & KLLF_ALTGR) != 0) {
+        vk_bits[VK_RMENU] |= KBDCTRL;
+    }
+
+    // Assign an index to all modifier and lock keys.
+    size_t count = 0;
+    for (size_t vk = 1; vk < 256; ++vk) {
+        const bool caps = vk == VK_CAPITAL && vk_bits[vk] == 0;
+        const bool kana = vk == VK_KANA && (all_bits & KBDKANA) != 0;
+        if (vk_bits[vk] != 0 || caps || kana) {
+            if (count >= MAX_KEYS) {
+                _err.error(Format(L"too many modifier keys in keyboard layout, max %d", int(MAX_KEYS)));
+                clear();
+                return false;
+            }
+            const uint16_t bit = uint16_t(1u << count);
+            _index[vk] = int8_t(count);
+            _key_bits[count] = vk_bits[vk];
+            if (caps) {
+                _caps_keys |= bit;
+            }
+            if (kana) {
+                _kana_keys |= bit;
+            }
+            if ((vk_bits[vk] & KBDGRPSELTAP) != 0) {
+                _tap_keys |= bit;
+            }
+            ++count;
+        }
+    }
+
+    // Modifier bits of all combinations of pressed keys. Each mask is built from
+    // the same mask without its highest bit. Group select is only set on tap.
+    _bits.assign(size_t(1) << count, 0);
+    for (size_t mask = 1; mask < _bits.size(); ++mask) {
+        const size_t high = size_t(std::bit_width(mask)) - 1;
+        _bits[mask] = uint16_t(_bits[mask & ~(size_t(1) << high)] | (_key_bits[high] & ~KBDGRPSELTAP));
+    }
+
+    Stats::Instance().count("modifier keys", count);
+    Stats::Instance().allocate("modifier states", _bits.capacity() * sizeof(uint16_t));
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Process a press or release of a virtual key.
+//----------------------------------------------------------------------------
+
+bool ModifierMachine::update(State& state, uint8_t vk, bool pressed) const
+{
+    const int index = _index[vk];
+    if (index < 0) {
+        // Any other key press interrupts a group select tap.
+        if (pressed) {
+            state._tap = 0;
+        }
+        return false;
+    }
+
+    const uint16_t bit = uint16_t(1u << index);
+    if (pressed) {
+        // Locks are toggled when the key goes down, not on autorepeat.
+        if ((state._keys & bit) == 0) {
+            if ((_caps_keys & bit) != 0) {
+                state.capslock = !state.capslock;
+            }
+            if ((_kana_keys & bit) != 0) {
+                state.kanalock = !state.kanalock;
+            }
+            state._tap = (_tap_keys & bit) != 0 ? uint8_t(index + 1) : 0;
+        }
+        state._keys |= bit;
+    }
+    else {
+        if (state._tap == index + 1) {
+            state.grpsel = true;
+            state._tap = 0;
+        }
+        state._keys &= uint16_t(~bit);
+    }
+    state.modifiers = _bits[state._keys];
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Get the shift state of a character key press.
+//----------------------------------------------------------------------------
+
+size_t ModifierMachine::shiftState(State& state, uint8_t attributes, bool& sgcaps) const
+{
+    size_t bits = state.modifiers;
+    if (state.grpsel) {
+        state.grpsel = false;
+        if ((attributes & GRPSELTAP) != 0) {
+            bits |= KBDGRPSELTAP;
+        }
+    }
+    if (state.kanalock && (attributes & KANALOK) != 0) {
+        bits |= KBDKANA;
+    }
+
+    // CapsLock on the shift state, as in the system. Alt alone is ignored.
+    sgcaps = false;
+    if (state.capslock) {
+        if ((attributes & SGCAPS) != 0) {
+            sgcaps = true;
+        }
+        else if ((attributes & CAPLOK) != 0 && (bits & (KBDCTRL | KBDALT)) == 0) {
+            bits ^= KBDSHIFT;
+        }
+        else if ((attributes & CAPLOKALTGR) != 0 && (bits & (KBDCTRL | KBDALT)) == (KBDCTRL | KBDALT)) {
+            bits ^= KBDSHIFT;
+        }
+    }
+    if ((bits & (KBDCTRL | KBDALT)) == KBDALT) {
+        bits &= ~size_t(KBDALT);
+    }
+    return bits;
+}
@@ -0,0 +1,95 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// State machine of the modifier and lock keys of a keyboard layout.
+//
+// The MODIFIERS table of a layout (VK_TO_BIT, wMaxModBits) is compiled into
+// dense tables. Each virtual key which is a modifier or a lock is assigned a
+// bit in a mask of pressed keys and the modifier bits of all combinations of
+// pressed keys are precomputed. A key press or release updates the mask and
+// reads the new modifier bits, without any loop on the keys. All shift
+// states up to wMaxModBits are supported: KBDSHIFT, KBDCTRL, KBDALT, KBDKANA,
+// KBDROYA, KBDLOYA, KBDGRPSELTAP.
+//
+// The left and right modifier keys have the bits of the generic key, unless
+// they have their own. With KLLF_ALTGR, right Alt also means Ctrl.
+//
+// Locks and latches, toggled when the key goes down, not on autorepeat:
+// - CapsLock: VK_CAPITAL, when not a modifier. Applies to the keys with the
+//   CAPLOK, CAPLOKALTGR or SGCAPS attributes.
+// - Kana lock: VK_KANA, when the layout uses KBDKANA. Adds KBDKANA to the
+//   keys with the KANALOK attribute. A VK_KANA which is in VK_TO_BIT is also
+//   a held modifier.
+// - Group select tap: a key with KBDGRPSELTAP in VK_TO_BIT which is pressed
+//   and released without any other key in between. Adds KBDGRPSELTAP to the
+//   next character key when it has the GRPSELTAP attribute. While it is held,
+//   the key has its other modifier bits only.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "error.h"
+
+class ModifierMachine
+{
+public:
+    // Constructor. Specify where to report errors.
+    ModifierMachine(Error& err);
+
+    // Compile the MODIFIERS table of a keyboard layout. Return false on error.
+    bool build(const KBDTABLES* tables);
+
+    // Clear the tables, no modifier.
+    void clear();
+
+    // Maximum number of modifier and lock keys in a layout.
+    static constexpr size_t MAX_KEYS = 16;
+
+    // Number of shift states, wMaxModBits + 1.
+    size_t planes() const { return _planes; }
+
+    // Check if a virtual key is a modifier or a lock key.
+    bool isModifier(uint8_t vk) const { return _index[vk] >= 0; }
+
+    // Get the modifier bits of a virtual key, as in VK_TO_BIT, zero if not a modifier.
+    uint16_t keyBits(uint8_t vk) const { return _index[vk] < 0 ? 0 : _key_bits[size_t(_index[vk])]; }
+
+    // State of the modifiers and locks for one input stream.
+    class State
+    {
+    public:
+        State();             // Constructor.
+        void reset();        // Reset the state, no key pressed, no lock.
+        bool     capslock;   // CapsLock is on.
+        bool     kanalock;   // Kana lock is on.
+        bool     grpsel;     // Group select tap is latched for the next character key.
+        uint16_t modifiers;  // Current modifier bits of the held keys.
+    private:
+        friend class ModifierMachine;
+        uint16_t _keys;      // Mask of pressed modifier and lock keys.
+        uint8_t  _tap;       // Index + 1 of the group select key being tapped, zero if none.
+    };
+
+    // Process a press or release of a virtual key. Return true if the key is a
+    // modifier or a lock, false if it is a character key.
+    bool update(State& state, uint8_t vk, bool pressed) const;
+
+    // Get the shift state of a character key press, from the VK_TO_WCHARS attributes
+    // of the key. When the layout has no CapsLock entry for an SGCAPS key, the SGCAPS
+    // attribute shall be removed. Set sgcaps when the CapsLock entry shall be used.
+    // The group select latch is consumed. The returned shift state may be beyond planes().
+    size_t shiftState(State& state, uint8_t attributes, bool& sgcaps) const;
+
+private:
+    Error&                _err;
+    size_t                _planes;
+    int8_t                _index[256];          // Index of each virtual key in the pressed mask, -1 if none.
+    uint16_t              _key_bits[MAX_KEYS];  // Modifier bits of each key, by index.
+    uint16_t              _caps_keys;           // Mask of CapsLock keys.
+    uint16_t              _kana_keys;           // Mask of Kana lock keys.
+    uint16_t              _tap_keys;            // Mask of group select keys.
+    std::vector<uint16_t> _bits;                // Modifier bits, indexed by mask of pressed keys.
+};
@@ -10,6 +10,7 @@
 
 #include "options.h"
 #include "winutils.h"
+#include "stats.h"
 
 
 //----------------------------------------------------------------------------
@@ -25,8 +26,14 @@ Options::Options(int argc, wchar_t* argv[], const WString syntax) :
     _out(&std::cout),
     _prompt_on_exit(false)
 {
+    Stats::OutputFormat stats_format = Stats::NONE;
     for (int i = 1; i < argc; ++i) {
-        args.push_back(argv[i]);
+        if (Stats::FormatFromOption(stats_format, argv[i])) {
+            Stats::Instance().setFormat(stats_format);
+        }
+        else {
+            args.push_back(argv[i]);
+        }
     }
 }
 
@@ -35,11 +42,11 @@ Options::Options(int argc, wchar_t* argv[], const WString syntax) :
 // Set an output file or use std::cout.
 //----------------------------------------------------------------------------
 
-void Options::setOutput(const WString& filename)
+void Options::setOutput(const WString& filename, bool binary)
 {
     closeOutput();
     if (!filename.empty()) {
-        _outfile.open(filename);
+        _outfile.open(filename, binary ? std::ios::out | std::ios::binary : std::ios::out);
         if (!_outfile) {
             fatal("cannot create output file " + filename);
         }
@@ -50,6 +57,8 @@ void Options::setOutput(const WString& filename)
 void Options::closeOutput()
 {
     if (_out == &_outfile) {
+        Stats::Timer timer("output close");
+        Stats::Instance().count("output bytes", uint64_t(std::streamoff(_outfile.tellp())));
         _outfile.close();
         _out = &std::cout;
     }
@@ -73,6 +82,7 @@ void Options::closeOutput()
 [[noreturn]] void Options::exit(int status)
 {
     closeOutput();
+    Stats::Instance().print(std::cerr);
     if (_prompt_on_exit) {
         char c;
         std::cout << "Press return to exit: " << std::flush;
@@ -18,11 +18,15 @@ public:
     Options(int argc, wchar_t* argv[], const WString syntax);
 
     // Command name and arguments.
+    // The statistics options --stats[=text|json] are processed here and removed from args.
     const WString command;
     WStringVector args;
 
-    // Set an output file or use std::cout.
-    void setOutput(const WString& filename);
+    // Maximum number of threads which can be requested on the command line.
+    static constexpr size_t MAX_THREADS = 256;
+
+    // Set an output file or use std::cout. A binary file is written without end of line translation.
+    void setOutput(const WString& filename, bool binary = false);
     void closeOutput();
     std::ostream& out() { return *_out; }
     
@@ -30,6 +34,7 @@ public:
     void setPromptOnExit(bool on) { _prompt_on_exit = on; }
 
     // Exit process, prompt for user input if setPromptOnExit(true) was called.
+    // Statistics are printed on standard error when enabled.
     [[noreturn]] virtual void exit(int status = EXIT_SUCCESS) override;
 
     // Print help and exits.
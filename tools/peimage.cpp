@@ -0,0 +1,431 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Portable reader of PE files (DLL's), without the system loader.
+//
+//----------------------------------------------------------------------------
+
+#include "peimage.h"
+#include "stats.h"
+
+// Alignment of the image in memory, same as a memory page.
+#define PE_PAGE_SIZE 4096
+
+// Default maximum virtual size of an image.
+#define PE_DEFAULT_MAX_SIZE (16 * 1024 * 1024)
+
+// Maximum number of bytes to explore in the code of KbdLayerDescriptor().
+#define PE_MAX_CODE_SCAN 64
+
+// Maximum number of jumps to follow in the code of KbdLayerDescriptor().
+#define PE_MAX_CODE_JUMPS 4
+
+
+//----------------------------------------------------------------------------
+// Constructor and cleanup.
+//----------------------------------------------------------------------------
+
+PEImage::PEImage(Error& err) :
+    _err(err),
+    _filename(),
+    _buffer(),
+    _base(nullptr),
+    _size(0),
+    _max_size(PE_DEFAULT_MAX_SIZE),
+    _file_size(0),
+    _writable_pages(0),
+    _machine(0),
+    _is64(false),
+    _image_base(0),
+    _exports(),
+    _relocs(),
+    _tables_rva(0)
+{
+}
+
+void PEImage::clear()
+{
+    _buffer.clear();
+    _base = nullptr;
+    _size = 0;
+    _file_size = 0;
+    _writable_pages = 0;
+    _machine = 0;
+    _is64 = false;
+    _image_base = 0;
+    _exports = IMAGE_DATA_DIRECTORY();
+    _relocs = IMAGE_DATA_DIRECTORY();
+    _tables_rva = 0;
+}
+
+bool PEImage::fail(const WString& message)
+{
+    _err.error(_filename + L": " + message);
+    clear();
+    return false;
+}
+
+
+//----------------------------------------------------------------------------
+// Get the name of a machine type.
+//----------------------------------------------------------------------------
+
+WString PEImage::MachineName(WORD machine)
+{
+    switch (machine) {
+        case IMAGE_FILE_MACHINE_I386: return L"x86";
+        case IMAGE_FILE_MACHINE_AMD64: return L"x64";
+        case IMAGE_FILE_MACHINE_ARM64: return L"arm64";
+        case IMAGE_FILE_MACHINE_ARMNT: return L"arm";
+        default: return Format(L"machine 0x%04X", machine);
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Address in memory of an RVA or address range.
+//----------------------------------------------------------------------------
+
+const void* PEImage::address(uint32_t rva, size_t size) const
+{
+    return rva < _size && size <= _size - rva ? _base + rva : nullptr;
+}
+
+bool PEImage::contains(const void* addr, size_t size) const
+{
+    const uint8_t* const p = reinterpret_cast<const uint8_t*>(addr);
+    return _base != nullptr && p >= _base && p < _base + _size && size <= size_t(_base + _size - p);
+}
+
+
+//----------------------------------------------------------------------------
+// Get the RVA of a relocated pointer value of the image.
+//----------------------------------------------------------------------------
+
+uint32_t PEImage::pointerToRVA(uint64_t value) const
+{
+    // 32-bit images are relocated on the low 32 bits of the address of the image,
+    // the difference is computed on the same low 32 bits.
+    return value == 0 ? 0 : uint32_t(value - uint64_t(uintptr_t(_base)));
+}
+
+
+//----------------------------------------------------------------------------
+// Load a DLL file.
+//----------------------------------------------------------------------------
+
+bool PEImage::load(const WString& filename)
+{
+    clear();
+    _filename = filename;
+
+    // Read the complete file content.
+    std::vector<uint8_t> content;
+    {
+        Stats::Timer timer("file read");
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) {
+            return fail(L"error opening file");
+        }
+        content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    Stats::Instance().allocate("file content", content.size());
+
+    return load(content.data(), content.size(), filename);
+}
+
+bool PEImage::load(const void* file_data, size_t file_size, const WString& name)
+{
+    Stats::Timer timer("image map");
+    clear();
+    _filename = name;
+
+    const uint8_t* const data = reinterpret_cast<const uint8_t*>(file_data);
+    const size_t data_size = file_data == nullptr ? 0 : file_size;
+    _file_size = data_size;
+
+    // Locate and check file headers.
+    if (data_size < sizeof(IMAGE_DOS_HEADER) + sizeof(IMAGE_NT_HEADERS32)) {
+        return fail(L"file too short");
+    }
+    const IMAGE_DOS_HEADER* dos = reinterpret_cast<const IMAGE_DOS_HEADER*>(data);
+    if (dos->e_magic != IMAGE_DOS_SIGNATURE || dos->e_lfanew < 0 || size_t(dos->e_lfanew) > data_size - sizeof(IMAGE_NT_HEADERS32)) {
+        return fail(L"not a PE file");
+    }
+    const size_t nt_offset = size_t(dos->e_lfanew);
+    const IMAGE_NT_HEADERS32* nt32 = reinterpret_cast<const IMAGE_NT_HEADERS32*>(data + nt_offset);
+    const IMAGE_NT_HEADERS64* nt64 = reinterpret_cast<const IMAGE_NT_HEADERS64*>(data + nt_offset);
+    if (nt32->Signature != IMAGE_NT_SIGNATURE) {
+        return fail(L"invalid PE signature");
+    }
+    _machine = nt32->FileHeader.Machine;
+
+    // The optional header has a different layout in 32 and 64-bit images.
+    const IMAGE_DATA_DIRECTORY* dirs = nullptr;
+    size_t dir_count = 0;
+    size_t headers_size = 0;
+    uint32_t section_align = 0;
+    if (nt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
+        _is64 = false;
+        _image_base = nt32->OptionalHeader.ImageBase;
+        _size = nt32->OptionalHeader.SizeOfImage;
+        headers_size = nt32->OptionalHeader.SizeOfHeaders;
+        section_align = nt32->OptionalHeader.SectionAlignment;
+        dirs = nt32->OptionalHeader.DataDirectory;
+        dir_count = nt32->OptionalHeader.NumberOfRvaAndSizes;
+    }
+    else if (nt64->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC && nt_offset + sizeof(IMAGE_NT_HEADERS64) <= data_size) {
+        _is64 = true;
+        _image_base = nt64->OptionalHeader.ImageBase;
+        _size = nt64->OptionalHeader.SizeOfImage;
+        headers_size = nt64->OptionalHeader.SizeOfHeaders;
+        section_align = nt64->OptionalHeader.SectionAlignment;
+        dirs = nt64->OptionalHeader.DataDirectory;
+        dir_count = nt64->OptionalHeader.NumberOfRvaAndSizes;
+    }
+    else {
+        return fail(L"unsupported PE optional header");
+    }
+    if (_size == 0 || _size > _max_size || headers_size > _size || section_align == 0) {
+        return fail(L"invalid image size");
+    }
+    dir_count = std::min<size_t>(dir_count, IMAGE_NUMBEROF_DIRECTORY_ENTRIES);
+    if (dir_count > IMAGE_DIRECTORY_ENTRY_EXPORT) {
+        _exports = dirs[IMAGE_DIRECTORY_ENTRY_EXPORT];
+    }
+    if (dir_count > IMAGE_DIRECTORY_ENTRY_BASERELOC) {
+        _relocs = dirs[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+    }
+
+    // Allocate the image on a page boundary, as the system loader does.
+    _buffer.resize(_size + PE_PAGE_SIZE);
+    Stats::Instance().allocate("image", _buffer.size());
+    _base = _buffer.data() + (PE_PAGE_SIZE - uintptr_t(_buffer.data()) % PE_PAGE_SIZE) % PE_PAGE_SIZE;
+
+    // Map headers and sections.
+    const size_t sections_offset = nt_offset + offsetof(IMAGE_NT_HEADERS32, OptionalHeader) + nt32->FileHeader.SizeOfOptionalHeader;
+    const size_t sections_count = nt32->FileHeader.NumberOfSections;
+    if (sections_offset + sections_count * sizeof(IMAGE_SECTION_HEADER) > data_size) {
+        return fail(L"truncated section table");
+    }
+    std::memcpy(_base, data, std::min(headers_size, data_size));
+
+    const IMAGE_SECTION_HEADER* sections = reinterpret_cast<const IMAGE_SECTION_HEADER*>(data + sections_offset);
+    for (size_t i = 0; i < sections_count; ++i) {
+        const IMAGE_SECTION_HEADER& sec(sections[i]);
+        if ((sec.Characteristics & IMAGE_SCN_MEM_WRITE) != 0) {
+            const size_t vsize = std::max<size_t>(sec.SizeOfRawData, sec.Misc.VirtualSize);
+            _writable_pages += (vsize + PE_PAGE_SIZE - 1) / PE_PAGE_SIZE;
+        }
+        size_t size = sec.SizeOfRawData;
+        if (sec.Misc.VirtualSize != 0) {
+            size = std::min<size_t>(size, sec.Misc.VirtualSize);
+        }
+        if (size == 0) {
+            continue; // uninitialized data only, already zero
+        }
+        if (sec.PointerToRawData > data_size || size > data_size - sec.PointerToRawData || address(sec.VirtualAddress, size) == nullptr) {
+            return fail(Format(L"invalid section #%d", int(i)));
+        }
+        std::memcpy(_base + sec.VirtualAddress, data + sec.PointerToRawData, size);
+    }
+
+    // Locate the keyboard tables, before relocation.
+    const uint32_t entry = exportAddress(KBD_DLL_ENTRY_NAME);
+    if (entry != 0) {
+        _tables_rva = decodeReturnedAddress(entry);
+    }
+
+    // Relocate the image at its actual memory address.
+    return relocate();
+}
+
+
+//----------------------------------------------------------------------------
+// Apply base relocations to the mapped image.
+//----------------------------------------------------------------------------
+
+bool PEImage::relocate()
+{
+    const uint64_t delta = uint64_t(uintptr_t(_base)) - _image_base;
+    uint64_t rva = _relocs.VirtualAddress;
+    const uint64_t end = uint64_t(_relocs.VirtualAddress) + _relocs.Size;
+
+    while (rva < end) {
+        const IMAGE_BASE_RELOCATION* block = reinterpret_cast<const IMAGE_BASE_RELOCATION*>(address(uint32_t(rva), sizeof(IMAGE_BASE_RELOCATION)));
+        if (rva > UINT32_MAX || block == nullptr || block->SizeOfBlock < sizeof(IMAGE_BASE_RELOCATION) || address(uint32_t(rva), block->SizeOfBlock) == nullptr) {
+            return fail(L"invalid relocation table");
+        }
+        const WORD* entries = reinterpret_cast<const WORD*>(block + 1);
+        const size_t count = (block->SizeOfBlock - sizeof(IMAGE_BASE_RELOCATION)) / sizeof(WORD);
+        for (size_t i = 0; i < count; ++i) {
+            const int type = entries[i] >> 12;
+            const uint32_t target = block->VirtualAddress + (entries[i] & 0x0FFF);
+            if (type == IMAGE_REL_BASED_ABSOLUTE) {
+                continue; // padding
+            }
+            else if (type == IMAGE_REL_BASED_DIR64 && address(target, 8) != nullptr) {
+                uint64_t value = 0;
+                std::memcpy(&value, _base + target, 8);
+                value += delta;
+                std::memcpy(_base + target, &value, 8);
+            }
+            else if (type == IMAGE_REL_BASED_HIGHLOW && address(target, 4) != nullptr) {
+                // Only meaningful when the image is in the low 4 GB of the address space.
+                uint32_t value = 0;
+                std::memcpy(&value, _base + target, 4);
+                value += uint32_t(delta);
+                std::memcpy(_base + target, &value, 4);
+            }
+            else {
+                return fail(Format(L"unsupported relocation type %d at 0x%08X", type, target));
+            }
+        }
+        rva += block->SizeOfBlock;
+    }
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Get the RVA of an exported symbol.
+//----------------------------------------------------------------------------
+
+uint32_t PEImage::exportAddress(const std::string& name) const
+{
+    const IMAGE_EXPORT_DIRECTORY* exp = reinterpret_cast<const IMAGE_EXPORT_DIRECTORY*>(address(_exports.VirtualAddress, sizeof(IMAGE_EXPORT_DIRECTORY)));
+    if (_exports.Size == 0 || exp == nullptr || exp->NumberOfNames > _size / sizeof(DWORD) || exp->NumberOfFunctions > _size / sizeof(DWORD)) {
+        return 0;
+    }
+    const DWORD* names = reinterpret_cast<const DWORD*>(address(exp->AddressOfNames, exp->NumberOfNames * sizeof(DWORD)));
+    const WORD* ordinals = reinterpret_cast<const WORD*>(address(exp->AddressOfNameOrdinals, exp->NumberOfNames * sizeof(WORD)));
+    const DWORD* functions = reinterpret_cast<const DWORD*>(address(exp->AddressOfFunctions, exp->NumberOfFunctions * sizeof(DWORD)));
+    if (names == nullptr || ordinals == nullptr || functions == nullptr) {
+        return 0;
+    }
+    for (DWORD i = 0; i < exp->NumberOfNames; ++i) {
+        const char* str = reinterpret_cast<const char*>(address(names[i], name.size() + 1));
+        if (str != nullptr && name.compare(0, name.size(), str, name.size()) == 0 && str[name.size()] == '\0') {
+            return ordinals[i] < exp->NumberOfFunctions ? functions[ordinals[i]] : 0;
+        }
+    }
+    return 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Find the RVA of the address which is returned by a function.
+// A keyboard layout entry point is typically one or two instructions which
+// load the address of the KBDTABLES structure in the return register.
+//----------------------------------------------------------------------------
+
+uint32_t PEImage::decodeReturnedAddress(uint32_t func_rva) const
+{
+    for (int jumps = 0; jumps <= PE_MAX_CODE_JUMPS; ++jumps) {
+        const uint8_t* code = reinterpret_cast<const uint8_t*>(address(func_rva, PE_MAX_CODE_SCAN));
+        if (code == nullptr) {
+            return 0;
+        }
+        uint32_t next_rva = 0;
+
+        switch (_machine) {
+            case IMAGE_FILE_MACHINE_AMD64:
+            case IMAGE_FILE_MACHINE_I386: {
+                // Incremental linking thunk: jmp rel32
+                if (code[0] == 0xE9) {
+                    int32_t rel = 0;
+                    std::memcpy(&rel, code + 1, 4);
+                    next_rva = func_rva + 5 + rel;
+                    break;
+                }
+                if (_machine == IMAGE_FILE_MACHINE_I386) {
+                    // The function must start with mov eax, imm32 (absolute address, not yet relocated).
+                    // The byte B8 is not searched further: it may be part of the operands of another
+                    // instruction. Other code sequences are not decoded.
+                    if (code[0] != 0xB8) {
+                        return 0;
+                    }
+                    uint32_t value = 0;
+                    std::memcpy(&value, code + 1, 4);
+                    return uint32_t(value - _image_base);
+                }
+                for (size_t i = 0; i + 7 <= PE_MAX_CODE_SCAN; ++i) {
+                    if (code[i] == 0x48 && code[i+1] == 0x8D && code[i+2] == 0x05) {
+                        // lea rax, [rip + disp32]
+                        int32_t disp = 0;
+                        std::memcpy(&disp, code + i + 3, 4);
+                        return uint32_t(func_rva + i + 7 + disp);
+                    }
+                    if (code[i] == 0xC3) {
+                        break; // ret
+                    }
+                }
+                return 0;
+            }
+            case IMAGE_FILE_MACHINE_ARM64: {
+                // Sequence adrp x0, page / add x0, x0, offset / ret
+                uint32_t page = 0;
+                bool got_page = false;
+                for (size_t i = 0; i + 4 <= PE_MAX_CODE_SCAN; i += 4) {
+                    uint32_t insn = 0;
+                    std::memcpy(&insn, code + i, 4);
+                    const uint32_t pc = uint32_t(func_rva + i);
+                    if (i == 0 && (insn & 0xFC000000) == 0x14000000) {
+                        // b label
+                        int32_t imm26 = int32_t(insn << 6) >> 6;
+                        next_rva = pc + imm26 * 4;
+                        break;
+                    }
+                    if ((insn & 0x9F00001F) == 0x90000000) {
+                        // adrp x0, page
+                        const uint32_t immlo = (insn >> 29) & 0x03;
+                        const uint32_t immhi = (insn >> 5) & 0x7FFFF;
+                        const int32_t imm = int32_t(((immhi << 2) | immlo) << 11) >> 11;
+                        page = (pc & ~uint32_t(0x0FFF)) + uint32_t(imm * 4096);
+                        got_page = true;
+                    }
+                    else if (got_page && (insn & 0xFFC003FF) == 0x91000000) {
+                        // add x0, x0, imm12 (no shift)
+                        return page + ((insn >> 10) & 0x0FFF);
+                    }
+                    else if (insn == 0xD65F03C0) {
+                        return got_page ? page : 0; // ret
+                    }
+                }
+                if (next_rva == 0) {
+                    return 0;
+                }
+                break;
+            }
+            default:
+                return 0;
+        }
+        func_rva = next_rva;
+    }
+    return 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Get the keyboard tables.
+//----------------------------------------------------------------------------
+
+const KBDTABLES* PEImage::kbdTables() const
+{
+    if (!isLoaded()) {
+        return nullptr;
+    }
+    if (!isNativePointerSize()) {
+        _err.error(_filename + L": cannot analyze " + MachineName(_machine) + Format(L" image in a %d-bit process", int(8 * sizeof(void*))));
+        return nullptr;
+    }
+    const KBDTABLES* tables = reinterpret_cast<const KBDTABLES*>(address(_tables_rva, sizeof(KBDTABLES)));
+    if (_tables_rva == 0 || tables == nullptr) {
+        _err.error(_filename + L": cannot locate keyboard tables, " KBD_DLL_ENTRY_NAME " is missing or its " + MachineName(_machine) + L" code is not supported");
+        return nullptr;
+    }
+    return tables;
+}
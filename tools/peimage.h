@@ -0,0 +1,106 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Portable reader of PE files (DLL's), without the system loader.
+// Keyboard layout DLL's are data-only: they can be mapped and relocated
+// in private memory and analyzed without executing any code. This is also
+// possible for DLL's from another CPU architecture.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "error.h"
+
+class PEImage
+{
+public:
+    // Constructor. Specify where to report errors.
+    PEImage(Error&);
+
+    // Load a DLL file. The sections are mapped in private memory and the
+    // image is relocated at its actual address. Nothing is executed.
+    bool load(const WString& filename);
+
+    // Same as load() with the content of the file already in memory.
+    // The name is only used in error messages.
+    bool load(const void* data, size_t size, const WString& name);
+
+    // Set the maximum virtual size of images to load. Larger images are rejected.
+    // Keyboard layout DLL's are small, there is no need to allocate large images.
+    void setMaxImageSize(size_t size) { _max_size = size; }
+
+    // Clear content.
+    void clear();
+
+    // Check if an image is loaded.
+    bool isLoaded() const { return _size > 0; }
+
+    // Characteristics of the loaded image.
+    const WString& fileName() const { return _filename; }
+    WORD machine() const { return _machine; }
+    bool is64Bit() const { return _is64; }
+    uint64_t imageBase() const { return _image_base; }
+    const uint8_t* base() const { return _base; }
+    size_t size() const { return _size; }
+    size_t fileSize() const { return _file_size; }
+
+    // Number of memory pages in writable sections.
+    size_t writablePages() const { return _writable_pages; }
+
+    // Check if the pointer size of the image is the same as the current process.
+    // When not, the keyboard tables cannot be directly accessed using kbd.h structures.
+    bool isNativePointerSize() const { return _is64 == (sizeof(void*) == 8); }
+
+    // Address in memory of an RVA. Return nullptr if the range is outside the image.
+    const void* address(uint32_t rva, size_t size = 0) const;
+
+    // Check that an address range is entirely inside the image.
+    bool contains(const void* addr, size_t size = 0) const;
+
+    // Get the RVA of an exported symbol. Return zero if not found.
+    uint32_t exportAddress(const std::string& name) const;
+
+    // Get the keyboard tables, as returned by the function KbdLayerDescriptor().
+    // The code of this function is decoded, not executed. Return nullptr on error.
+    const KBDTABLES* kbdTables() const;
+
+    // Get the RVA of the keyboard tables, zero if not found. Unlike kbdTables(), this
+    // is also valid when the pointer size of the image is not the one of the process.
+    uint32_t kbdTablesRVA() const { return _tables_rva; }
+
+    // Get the RVA of a relocated pointer value of the image, 32 or 64 bits.
+    // Return zero for a null pointer. The RVA may be outside the image.
+    uint32_t pointerToRVA(uint64_t value) const;
+
+    // Get the name of a machine type, "x64" for instance.
+    static WString MachineName(WORD machine);
+
+private:
+    Error&               _err;
+    WString              _filename;
+    std::vector<uint8_t> _buffer;      // memory area containing the image
+    uint8_t*             _base;        // page-aligned image base in _buffer
+    size_t               _size;        // virtual size of image
+    size_t               _max_size;    // maximum accepted virtual size
+    size_t               _file_size;   // size of the DLL file
+    size_t               _writable_pages;
+    WORD                 _machine;
+    bool                 _is64;
+    uint64_t             _image_base;  // preferred load address
+    IMAGE_DATA_DIRECTORY _exports;
+    IMAGE_DATA_DIRECTORY _relocs;
+    uint32_t             _tables_rva;  // returned by KbdLayerDescriptor()
+
+    // Report an error, clear content and return false.
+    bool fail(const WString& message);
+
+    // Apply base relocations to the mapped image.
+    bool relocate();
+
+    // Find the RVA of the address which is returned by a function.
+    // Must be called before relocation (x86 code contains absolute addresses).
+    uint32_t decodeReturnedAddress(uint32_t func_rva) const;
+};
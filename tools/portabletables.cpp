@@ -0,0 +1,515 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Pointer-size independent copy of the tables of a keyboard layout DLL.
+//
+//----------------------------------------------------------------------------
+
+#include "portabletables.h"
+#include "stats.h"
+
+// Alignment of all copied structures.
+#define PT_ALIGN 8
+
+// Maximum number of bytes in the dump of a different entry.
+#define PT_MAX_DUMP 32
+
+
+//----------------------------------------------------------------------------
+// Structures of kbd.h which contain pointers, for a given pointer type.
+// With the natural alignment of their fields, they have the same layout
+// as the structures which are compiled for a 32-bit or 64-bit CPU.
+//----------------------------------------------------------------------------
+
+namespace {
+    template <typename PTR>
+    struct KbdTablesT {
+        PTR   pCharModifiers;
+        PTR   pVkToWcharTable;
+        PTR   pDeadKey;
+        PTR   pKeyNames;
+        PTR   pKeyNamesExt;
+        PTR   pKeyNamesDead;
+        PTR   pusVSCtoVK;
+        BYTE  bMaxVSCtoVK;
+        PTR   pVSCtoVK_E0;
+        PTR   pVSCtoVK_E1;
+        DWORD fLocaleFlags;
+        BYTE  nLgMax;
+        BYTE  cbLgEntry;
+        PTR   pLigature;
+        DWORD dwType;
+        DWORD dwSubType;
+    };
+
+    template <typename PTR>
+    struct ModifiersT {
+        PTR   pVkToBit;
+        WORD  wMaxModBits;
+        BYTE  ModNumber[1];
+    };
+
+    template <typename PTR>
+    struct VkToWcharTableT {
+        PTR   pVkToWchars;
+        BYTE  nModifications;
+        BYTE  cbSize;
+    };
+
+    template <typename PTR>
+    struct VscLpwstrT {
+        BYTE  vsc;
+        PTR   pwsz;
+    };
+}
+
+
+//----------------------------------------------------------------------------
+// A view of the memory of the current process, with the interface of PEImage
+// which is used to decode tables. Each distinct pointer which is met in the
+// tables gets its own range of RVA's, large enough for any structure.
+//----------------------------------------------------------------------------
+
+namespace {
+    class NativeImage
+    {
+    public:
+        // Size of the RVA range of one pointer, larger than any table of a layout.
+        static constexpr size_t RANGE_SIZE = 0x10000;
+
+        NativeImage(const KBDTABLES& tables) : _tables_rva(pointerToRVA(uint64_t(uintptr_t(&tables)))) {}
+
+        WORD machine() const { return 0; }
+        size_t size() const { return RANGE_SIZE; }
+        uint32_t kbdTablesRVA() const { return _tables_rva; }
+
+        // Return zero for a null pointer. When there are too many pointers, the
+        // returned RVA is outside all ranges and address() returns nullptr.
+        uint32_t pointerToRVA(uint64_t value) const
+        {
+            if (value == 0) {
+                return 0;
+            }
+            const uint8_t* ptr = reinterpret_cast<const uint8_t*>(uintptr_t(value));
+            auto it = std::find(_pointers.begin(), _pointers.end(), ptr);
+            if (it == _pointers.end()) {
+                if (_pointers.size() + 1 >= UINT32_MAX / RANGE_SIZE) {
+                    return UINT32_MAX;
+                }
+                it = _pointers.insert(_pointers.end(), ptr);
+            }
+            return uint32_t((it - _pointers.begin() + 1) * RANGE_SIZE);
+        }
+
+        const void* address(uint32_t rva, size_t size = 0) const
+        {
+            const size_t index = rva / RANGE_SIZE;
+            const size_t offset = rva % RANGE_SIZE;
+            return index == 0 || index > _pointers.size() || size > RANGE_SIZE - offset ? nullptr : _pointers[index - 1] + offset;
+        }
+
+    private:
+        mutable std::vector<const uint8_t*> _pointers {};
+        uint32_t _tables_rva = 0;
+    };
+}
+
+
+//----------------------------------------------------------------------------
+// Constructor and reset.
+//----------------------------------------------------------------------------
+
+PortableTables::PortableTables(Error& err) :
+    _err(err),
+    _filename(),
+    _buffer(),
+    _canonical(),
+    _pointers(),
+    _regions()
+{
+}
+
+void PortableTables::clear()
+{
+    _filename.clear();
+    _buffer.clear();
+    _canonical.clear();
+    _pointers.clear();
+    _regions.clear();
+}
+
+bool PortableTables::fail(const WString& name, const WString& message)
+{
+    _err.error(_filename + L": invalid keyboard tables, " + name + L": " + message);
+    return false;
+}
+
+
+//----------------------------------------------------------------------------
+// Memory area management.
+//----------------------------------------------------------------------------
+
+size_t PortableTables::allocate(size_t size, size_t entry_size, const WString& name)
+{
+    const size_t offset = (_buffer.size() + PT_ALIGN - 1) & ~size_t(PT_ALIGN - 1);
+    _buffer.resize(offset + size, 0);
+    _regions.push_back(Region{offset, size, entry_size == 0 ? size : entry_size, name});
+    return offset;
+}
+
+void PortableTables::setPointer(size_t offset, size_t target)
+{
+    // The offset is stored for now, the address is set when the area is complete.
+    const uintptr_t value = uintptr_t(target);
+    std::memcpy(_buffer.data() + offset, &value, sizeof(value));
+    _pointers.push_back(offset);
+}
+
+
+//----------------------------------------------------------------------------
+// Count the entries of an array of the image, including the last one.
+//----------------------------------------------------------------------------
+
+template <typename T, class IMAGE, class IS_LAST>
+size_t PortableTables::countEntries(const IMAGE& image, uint32_t rva, size_t entry_size, IS_LAST is_last) const
+{
+    for (size_t i = 0; entry_size > 0 && i <= image.size() / entry_size; ++i) {
+        const uint64_t entry_rva = uint64_t(rva) + i * entry_size;
+        const T* entry = entry_rva > UINT32_MAX ? nullptr : reinterpret_cast<const T*>(image.address(uint32_t(entry_rva), entry_size));
+        if (entry == nullptr) {
+            break;
+        }
+        if (is_last(entry)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Copy an array of entries without pointers.
+//----------------------------------------------------------------------------
+
+template <typename T, class IMAGE, class IS_LAST, class COPY_ENTRY>
+bool PortableTables::copyArray(const IMAGE& image, uint32_t rva, size_t entry_size, size_t slot, const WString& name, IS_LAST is_last, COPY_ENTRY copy_entry)
+{
+    if (rva == 0) {
+        return true; // null pointer
+    }
+    if (entry_size < sizeof(T)) {
+        return fail(name, Format(L"entry size %d too short", int(entry_size)));
+    }
+    const size_t count = countEntries<T>(image, rva, entry_size, is_last);
+    if (count == 0) {
+        return fail(name, L"out of range");
+    }
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(image.address(rva, count * entry_size));
+    const size_t offset = allocate(count * entry_size, entry_size, name);
+    for (size_t i = 0; i < count; ++i) {
+        copy_entry(at<T>(offset + i * entry_size), reinterpret_cast<const T*>(src + i * entry_size));
+    }
+    setPointer(slot, offset);
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Copy a nul-terminated string.
+//----------------------------------------------------------------------------
+
+template <class IMAGE>
+bool PortableTables::copyString(const IMAGE& image, uint32_t rva, size_t slot, const WString& name)
+{
+    if (rva == 0) {
+        return true; // null pointer
+    }
+    const size_t count = countEntries<WCHAR>(image, rva, sizeof(WCHAR), [](const WCHAR* c) { return *c == 0; });
+    if (count == 0) {
+        return fail(name, L"string out of range");
+    }
+    const size_t offset = allocate(count * sizeof(WCHAR), sizeof(WCHAR), name);
+    std::memcpy(_buffer.data() + offset, image.address(rva, count * sizeof(WCHAR)), count * sizeof(WCHAR));
+    setPointer(slot, offset);
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Decode the tables of an image with 32-bit or 64-bit pointers.
+//----------------------------------------------------------------------------
+
+template <typename PTR, class IMAGE>
+bool PortableTables::decode(const IMAGE& image)
+{
+    // RVA of a pointer of the image.
+    const auto rva = [&image](PTR ptr) { return image.pointerToRVA(uint64_t(ptr)); };
+
+    // Main structure, copied before any allocation.
+    const KbdTablesT<PTR>* src_tables = reinterpret_cast<const KbdTablesT<PTR>*>(image.address(image.kbdTablesRVA(), sizeof(KbdTablesT<PTR>)));
+    if (image.kbdTablesRVA() == 0 || src_tables == nullptr) {
+        _err.error(_filename + L": cannot locate keyboard tables, " KBD_DLL_ENTRY_NAME " is missing or its " + PEImage::MachineName(image.machine()) + L" code is not supported");
+        return false;
+    }
+    const KbdTablesT<PTR> kt(*src_tables);
+    const size_t tables = allocate(sizeof(KBDTABLES), 0, L"kbd_tables");
+    {
+        KBDTABLES* t = at<KBDTABLES>(tables);
+        t->bMaxVSCtoVK = kt.bMaxVSCtoVK;
+        t->fLocaleFlags = kt.fLocaleFlags;
+        t->nLgMax = kt.nLgMax;
+        t->cbLgEntry = kt.cbLgEntry;
+        t->dwType = kt.dwType;
+        t->dwSubType = kt.dwSubType;
+    }
+
+    // Modifiers and associated virtual keys.
+    if (kt.pCharModifiers != 0) {
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(image.address(rva(kt.pCharModifiers), offsetof(ModifiersT<PTR>, ModNumber)));
+        if (src == nullptr) {
+            return fail(L"char_modifiers", L"out of range");
+        }
+        const ModifiersT<PTR>* mods = reinterpret_cast<const ModifiersT<PTR>*>(src);
+        const size_t count = size_t(mods->wMaxModBits) + 1;
+        const PTR vk_to_bits = mods->pVkToBit;
+        const WORD max_bits = mods->wMaxModBits;
+        const uint8_t* numbers = reinterpret_cast<const uint8_t*>(image.address(rva(kt.pCharModifiers) + uint32_t(offsetof(ModifiersT<PTR>, ModNumber)), count));
+        if (numbers == nullptr) {
+            return fail(L"char_modifiers", L"out of range");
+        }
+        const size_t offset = allocate(offsetof(MODIFIERS, ModNumber) + count, 0, L"char_modifiers");
+        MODIFIERS* m = at<MODIFIERS>(offset);
+        m->wMaxModBits = max_bits;
+        std::memcpy(m->ModNumber, numbers, count);
+        setPointer(tables + offsetof(KBDTABLES, pCharModifiers), offset);
+        const bool ok = copyArray<VK_TO_BIT>(image, rva(vk_to_bits), sizeof(VK_TO_BIT), offset + offsetof(MODIFIERS, pVkToBit), L"vk_to_bits",
+            [](const VK_TO_BIT* e) { return e->Vk == 0; },
+            [](VK_TO_BIT* dst, const VK_TO_BIT* e) { dst->Vk = e->Vk; dst->ModBits = e->ModBits; });
+        if (!ok) {
+            return false;
+        }
+    }
+
+    // Virtual keys to characters, one sub-table per number of shift states.
+    if (kt.pVkToWcharTable != 0) {
+        const uint32_t vtwt = rva(kt.pVkToWcharTable);
+        const size_t count = countEntries<VkToWcharTableT<PTR>>(image, vtwt, sizeof(VkToWcharTableT<PTR>), [](const VkToWcharTableT<PTR>* e) { return e->pVkToWchars == 0; });
+        if (count == 0) {
+            return fail(L"vk_to_wchar", L"out of range");
+        }
+        const size_t offset = allocate(count * sizeof(VK_TO_WCHAR_TABLE), sizeof(VK_TO_WCHAR_TABLE), L"vk_to_wchar");
+        setPointer(tables + offsetof(KBDTABLES, pVkToWcharTable), offset);
+        for (size_t i = 0; i + 1 < count; ++i) {
+            const VkToWcharTableT<PTR> e(*reinterpret_cast<const VkToWcharTableT<PTR>*>(image.address(uint32_t(vtwt + i * sizeof(VkToWcharTableT<PTR>)), sizeof(VkToWcharTableT<PTR>))));
+            const WString name(Format(L"vk_to_wchar%d (#%d)", e.nModifications, int(i)));
+            const size_t used = offsetof(VK_TO_WCHARS1, wch) + e.nModifications * sizeof(WCHAR);
+            if (e.cbSize < used) {
+                return fail(name, Format(L"entry size %d too short", e.cbSize));
+            }
+            const size_t entry = offset + i * sizeof(VK_TO_WCHAR_TABLE);
+            at<VK_TO_WCHAR_TABLE>(entry)->nModifications = e.nModifications;
+            at<VK_TO_WCHAR_TABLE>(entry)->cbSize = e.cbSize;
+            const bool ok = copyArray<VK_TO_WCHARS1>(image, rva(e.pVkToWchars), e.cbSize, entry + offsetof(VK_TO_WCHAR_TABLE, pVkToWchars), name,
+                [](const VK_TO_WCHARS1* v) { return v->VirtualKey == 0; },
+                [used](VK_TO_WCHARS1* dst, const VK_TO_WCHARS1* v) { std::memcpy(dst, v, used); });
+            if (!ok) {
+                return false;
+            }
+        }
+    }
+
+    // Dead keys.
+    bool ok = copyArray<DEADKEY>(image, rva(kt.pDeadKey), sizeof(DEADKEY), tables + offsetof(KBDTABLES, pDeadKey), L"dead_keys",
+        [](const DEADKEY* e) { return e->dwBoth == 0; },
+        [](DEADKEY* dst, const DEADKEY* e) { dst->dwBoth = e->dwBoth; dst->wchComposed = e->wchComposed; dst->uFlags = e->uFlags; });
+    if (!ok) {
+        return false;
+    }
+
+    // Scan codes to key names.
+    for (const bool ext : {false, true}) {
+        const WString name(ext ? L"key_names_ext" : L"key_names");
+        const PTR ptr = ext ? kt.pKeyNamesExt : kt.pKeyNames;
+        if (ptr != 0) {
+            const uint32_t names = rva(ptr);
+            const size_t count = countEntries<VscLpwstrT<PTR>>(image, names, sizeof(VscLpwstrT<PTR>), [](const VscLpwstrT<PTR>* e) { return e->vsc == 0; });
+            if (count == 0) {
+                return fail(name, L"out of range");
+            }
+            const size_t offset = allocate(count * sizeof(VSC_LPWSTR), sizeof(VSC_LPWSTR), name);
+            setPointer(tables + (ext ? offsetof(KBDTABLES, pKeyNamesExt) : offsetof(KBDTABLES, pKeyNames)), offset);
+            for (size_t i = 0; i < count; ++i) {
+                const VscLpwstrT<PTR> e(*reinterpret_cast<const VscLpwstrT<PTR>*>(image.address(uint32_t(names + i * sizeof(VscLpwstrT<PTR>)), sizeof(VscLpwstrT<PTR>))));
+                const size_t entry = offset + i * sizeof(VSC_LPWSTR);
+                at<VSC_LPWSTR>(entry)->vsc = e.vsc;
+                if (!copyString(image, rva(e.pwsz), entry + offsetof(VSC_LPWSTR, pwsz), name)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Names of dead keys.
+    if (kt.pKeyNamesDead != 0) {
+        const uint32_t names = rva(kt.pKeyNamesDead);
+        const size_t count = countEntries<PTR>(image, names, sizeof(PTR), [](const PTR* e) { return *e == 0; });
+        if (count == 0) {
+            return fail(L"key_names_dead", L"out of range");
+        }
+        const size_t offset = allocate(count * sizeof(DEADKEY_LPWSTR), sizeof(DEADKEY_LPWSTR), L"key_names_dead");
+        setPointer(tables + offsetof(KBDTABLES, pKeyNamesDead), offset);
+        for (size_t i = 0; i + 1 < count; ++i) {
+            const PTR str = *reinterpret_cast<const PTR*>(image.address(uint32_t(names + i * sizeof(PTR)), sizeof(PTR)));
+            if (!copyString(image, rva(str), offset + i * sizeof(DEADKEY_LPWSTR), L"key_names_dead")) {
+                return false;
+            }
+        }
+    }
+
+    // Scan codes to virtual keys, fixed size without terminator.
+    if (kt.pusVSCtoVK != 0) {
+        const size_t size = size_t(kt.bMaxVSCtoVK) * sizeof(USHORT);
+        const void* src = image.address(rva(kt.pusVSCtoVK), size);
+        if (src == nullptr) {
+            return fail(L"scancode_to_vk", L"out of range");
+        }
+        const size_t offset = allocate(size, sizeof(USHORT), L"scancode_to_vk");
+        std::memcpy(_buffer.data() + offset, src, size);
+        setPointer(tables + offsetof(KBDTABLES, pusVSCtoVK), offset);
+    }
+    const auto last_vsc_vk = [](const VSC_VK* e) { return e->Vsc == 0; };
+    const auto copy_vsc_vk = [](VSC_VK* dst, const VSC_VK* e) { dst->Vsc = e->Vsc; dst->Vk = e->Vk; };
+    ok = copyArray<VSC_VK>(image, rva(kt.pVSCtoVK_E0), sizeof(VSC_VK), tables + offsetof(KBDTABLES, pVSCtoVK_E0), L"scancode_to_vk_e0", last_vsc_vk, copy_vsc_vk) &&
+         copyArray<VSC_VK>(image, rva(kt.pVSCtoVK_E1), sizeof(VSC_VK), tables + offsetof(KBDTABLES, pVSCtoVK_E1), L"scancode_to_vk_e1", last_vsc_vk, copy_vsc_vk);
+    if (!ok) {
+        return false;
+    }
+
+    // Ligatures, variable-size entries.
+    if (kt.pLigature != 0) {
+        const size_t chars = kt.nLgMax;
+        if (kt.cbLgEntry < offsetof(LIGATURE1, wch) + chars * sizeof(WCHAR)) {
+            return fail(L"ligatures", Format(L"entry size %d too short", kt.cbLgEntry));
+        }
+        ok = copyArray<LIGATURE1>(image, rva(kt.pLigature), kt.cbLgEntry, tables + offsetof(KBDTABLES, pLigature), L"ligatures",
+            [](const LIGATURE1* e) { return e->VirtualKey == 0; },
+            [chars](LIGATURE1* dst, const LIGATURE1* e) {
+                dst->VirtualKey = e->VirtualKey;
+                dst->ModificationNumber = e->ModificationNumber;
+                std::memcpy(dst->wch, e->wch, chars * sizeof(WCHAR));
+            });
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Copy the keyboard tables of a loaded image.
+//----------------------------------------------------------------------------
+
+const KBDTABLES* PortableTables::build(const PEImage& image)
+{
+    Stats::Timer timer("portable tables");
+
+    clear();
+    _filename = image.fileName();
+    if (!image.isLoaded() || !(image.is64Bit() ? decode<uint64_t>(image) : decode<uint32_t>(image))) {
+        clear();
+        return nullptr;
+    }
+    return complete();
+}
+
+const KBDTABLES* PortableTables::build(const KBDTABLES& tables, const WString& name)
+{
+    Stats::Timer timer("portable tables");
+
+    clear();
+    _filename = name;
+    if (!decode<uintptr_t>(NativeImage(tables))) {
+        clear();
+        return nullptr;
+    }
+    return complete();
+}
+
+const KBDTABLES* PortableTables::complete()
+{
+    // Keep the canonical content, then replace the offsets with the actual addresses.
+    _canonical = _buffer;
+    for (size_t offset : _pointers) {
+        uintptr_t value = 0;
+        std::memcpy(&value, _buffer.data() + offset, sizeof(value));
+        value += uintptr_t(_buffer.data());
+        std::memcpy(_buffer.data() + offset, &value, sizeof(value));
+    }
+    Stats::Instance().allocate("portable tables", 2 * _buffer.capacity());
+    return tables();
+}
+
+
+//----------------------------------------------------------------------------
+// Compare with other tables.
+//----------------------------------------------------------------------------
+
+bool PortableTables::compare(const PortableTables& other, WString& difference) const
+{
+    difference.clear();
+
+    // Same structures, in the same order, with the same sizes.
+    const size_t count = std::max(_regions.size(), other._regions.size());
+    for (size_t i = 0; i < count; ++i) {
+        if (i >= _regions.size() || i >= other._regions.size()) {
+            const Region& reg(i < _regions.size() ? _regions[i] : other._regions[i]);
+            difference = reg.name + L": missing in " + (i < _regions.size() ? other._filename : _filename);
+            return false;
+        }
+        const Region& reg1(_regions[i]);
+        const Region& reg2(other._regions[i]);
+        if (reg1.name != reg2.name) {
+            difference = L"different structures, " + reg1.name + L" / " + reg2.name;
+            return false;
+        }
+        if (reg1.size != reg2.size || reg1.entry_size != reg2.entry_size) {
+            difference = Format(L"%s: %llu entries of %llu bytes / %llu entries of %llu bytes", reg1.name.c_str(),
+                                uint64_t(reg1.size / reg1.entry_size), uint64_t(reg1.entry_size),
+                                uint64_t(reg2.size / reg2.entry_size), uint64_t(reg2.entry_size));
+            return false;
+        }
+    }
+
+    // Same content. The pointers are compared as offsets.
+    const auto diff = std::mismatch(_canonical.begin(), _canonical.end(), other._canonical.begin(), other._canonical.end());
+    if (diff.first == _canonical.end()) {
+        return true;
+    }
+    const size_t offset = size_t(diff.first - _canonical.begin());
+    const auto reg = std::upper_bound(_regions.begin(), _regions.end(), offset, [](size_t value, const Region& r) { return value < r.offset; });
+    if (reg == _regions.begin()) {
+        difference = Format(L"padding at offset %llu", uint64_t(offset));
+        return false;
+    }
+    const Region& r(*(reg - 1));
+    const size_t index = (offset - r.offset) / r.entry_size;
+    const size_t start = r.offset + index * r.entry_size;
+    const size_t size = std::min<size_t>(r.entry_size, PT_MAX_DUMP);
+    const auto dump = [start, size](const std::vector<uint8_t>& data) {
+        WString str;
+        for (size_t i = 0; i < size; ++i) {
+            AppendFormat(str, L"%s%02X", i == 0 ? L"" : L" ", data[start + i]);
+        }
+        return str;
+    };
+    difference = r.name;
+    if (r.entry_size < r.size) {
+        AppendFormat(difference, L", entry #%llu", uint64_t(index));
+    }
+    AppendFormat(difference, L", byte %llu: %s / %s", uint64_t(offset - start), dump(_canonical).c_str(), dump(other._canonical).c_str());
+    return false;
+}
@@ -0,0 +1,110 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Pointer-size independent copy of the tables of a keyboard layout DLL.
+//
+// The KBDTABLES of a DLL contain 32 or 64-bit pointers, depending on the CPU
+// architecture, relocated at the address of the image. The same layout which
+// is built for x86, x64 and arm64 has three different binary images. Here,
+// the tables of an image of any pointer size are decoded and copied in one
+// private memory area, using the structures of the current process.
+//
+// Each structure is copied every time it is referenced, in a fixed order,
+// field by field, with cleared padding. Copies of identical tables are
+// consequently byte-identical, except the pointers, which are compared as
+// offsets in the memory area.
+//
+// The tables of the current process, for instance the tables which are built
+// from a layout description, can be copied the same way and compared with
+// the tables of a DLL, without building a new DLL.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "peimage.h"
+
+class PortableTables
+{
+public:
+    // Constructor. Specify where to report errors.
+    PortableTables(Error& err);
+
+    // Copy the keyboard tables of a loaded image, 32 or 64-bit. The source tables are
+    // checked while they are decoded. Return nullptr on error. The returned tables
+    // are valid until the next build() or clear() and do not reference the image.
+    const KBDTABLES* build(const PEImage& image);
+
+    // Copy keyboard tables of the current process. The name is only used in error
+    // messages. Same as build() with an image.
+    const KBDTABLES* build(const KBDTABLES& tables, const WString& name);
+
+    // Clear content.
+    void clear();
+
+    // Get the copied tables, nullptr if none.
+    const KBDTABLES* tables() const { return _buffer.empty() ? nullptr : reinterpret_cast<const KBDTABLES*>(_buffer.data()); }
+
+    // Memory area which contains all copied structures.
+    const void* base() const { return _buffer.data(); }
+    size_t size() const { return _buffer.size(); }
+
+    // Compare with other tables. Return true if identical. Otherwise, return false
+    // and a description of the first difference.
+    bool compare(const PortableTables& other, WString& difference) const;
+
+private:
+    // One copied structure or array in the memory area.
+    class Region
+    {
+    public:
+        size_t  offset;      // Offset in the memory area.
+        size_t  size;        // Total size in bytes.
+        size_t  entry_size;  // Size of one entry in arrays, same as size for structures.
+        WString name;        // Name of the structure, as in generated source files.
+    };
+
+    Error&               _err;
+    WString              _filename;   // Source image, for error messages.
+    std::vector<uint8_t> _buffer;     // Copied tables, with pointers in _buffer.
+    std::vector<uint8_t> _canonical;  // Same content, with pointers replaced by their offsets.
+    std::vector<size_t>  _pointers;   // Offsets of non-null pointers in _buffer.
+    std::vector<Region>  _regions;    // All copied structures, in order of copy.
+
+    // Report an error in a named structure and return false.
+    bool fail(const WString& name, const WString& message);
+
+    // Allocate a cleared region, return its offset. Invalidates all previous addresses.
+    size_t allocate(size_t size, size_t entry_size, const WString& name);
+
+    // Address of a structure in the memory area, valid until the next allocate().
+    template <typename T>
+    T* at(size_t offset) { return reinterpret_cast<T*>(_buffer.data() + offset); }
+
+    // Set the pointer at some offset in the memory area to another offset.
+    void setPointer(size_t offset, size_t target);
+
+    // Count the entries of an array of the image, including the last one.
+    // IS_LAST is a predicate on one entry. Return zero if out of the image.
+    // IMAGE is PEImage or a view of the memory of the current process.
+    template <typename T, class IMAGE, class IS_LAST>
+    size_t countEntries(const IMAGE& image, uint32_t rva, size_t entry_size, IS_LAST is_last) const;
+
+    // Copy an array of entries without pointers, up to the last one, and set the pointer
+    // at slot to the copy. COPY_ENTRY copies the fields of one entry into a cleared entry.
+    template <typename T, class IMAGE, class IS_LAST, class COPY_ENTRY>
+    bool copyArray(const IMAGE& image, uint32_t rva, size_t entry_size, size_t slot, const WString& name, IS_LAST is_last, COPY_ENTRY copy_entry);
+
+    // Copy a nul-terminated string and set the pointer at slot to the copy.
+    template <class IMAGE>
+    bool copyString(const IMAGE& image, uint32_t rva, size_t slot, const WString& name);
+
+    // Decode the tables of an image with 32-bit or 64-bit pointers.
+    template <typename PTR, class IMAGE>
+    bool decode(const IMAGE& image);
+
+    // Complete a decoded copy: keep the canonical content, set the pointers.
+    const KBDTABLES* complete();
+};
@@ -10,6 +10,7 @@
 
 #include "registry.h"
 #include "winutils.h"
+#include "stats.h"
 
 
 //-----------------------------------------------------------------------------
@@ -80,6 +81,8 @@ bool Registry::splitKey(const WString& key, HKEY& root_key, WString& midkey, WSt
 
 bool Registry::valueExists(const WString& key, const WString& value_name)
 {
+    Stats::Timer timer("registry read");
+
     HKEY root;
     WString subkey;
 
@@ -129,6 +132,8 @@ bool Registry::openKey(HKEY root, const WString& key, REGSAM sam, HKEY& handle)
 
 WString Registry::getValuePrivate(const WString& key, const WString& value_name, const WString& default_value, bool ignore_errors, bool expand)
 {
+    Stats::Timer timer("registry read");
+
     // Split name
     HKEY root;
     WString subkey;
@@ -216,6 +221,8 @@ WString Registry::getValuePrivate(const WString& key, const WString& value_name,
 
 DWORD Registry::getIntValue(const WString& key, const WString& value_name, DWORD default_value)
 {
+    Stats::Timer timer("registry read");
+
     // Split the key without error reporting.
     HKEY root;
     WString subkey;
@@ -237,6 +244,8 @@ DWORD Registry::getIntValue(const WString& key, const WString& value_name, DWORD
 
 DWORD Registry::getIntValue(const WString& key, const WString& value_name)
 {
+    Stats::Timer timer("registry read");
+
     // Split name
     HKEY root;
     WString subkey;
@@ -262,6 +271,8 @@ DWORD Registry::getIntValue(const WString& key, const WString& value_name)
 
 bool Registry::getValueNames(const WString& key, WStringList& names)
 {
+    Stats::Timer timer("registry read");
+
     names.clear();
 
     // Split name
@@ -299,6 +310,8 @@ bool Registry::getValueNames(const WString& key, WStringList& names)
 
 bool Registry::getSubKeys(const WString& key, WStringList& subkeys)
 {
+    Stats::Timer timer("registry read");
+
     subkeys.clear();
 
     // Split name
@@ -336,6 +349,8 @@ bool Registry::getSubKeys(const WString& key, WStringList& subkeys)
 
 bool Registry::setValue(const WString& key, const WString& value_name, const WString& value, bool expandable)
 {
+    Stats::Timer timer("registry write");
+
     // Split name
     HKEY root;
     WString subkey;
@@ -362,6 +377,8 @@ bool Registry::setValue(const WString& key, const WString& value_name, const WSt
 
 bool Registry::setValue(const WString& key, const WString& value_name, DWORD value)
 {
+    Stats::Timer timer("registry write");
+
     HKEY root;
     WString subkey;
     if (!splitKey(key, root, subkey)) {
@@ -384,6 +401,8 @@ bool Registry::setValue(const WString& key, const WString& value_name, DWORD val
 
 bool Registry::deleteValue(const WString& key, const WString& value_name)
 {
+    Stats::Timer timer("registry write");
+
     // Split name
     HKEY root, hkey;
     WString subkey;
@@ -408,6 +427,8 @@ bool Registry::deleteValue(const WString& key, const WString& value_name)
 
 bool Registry::createKey(const WString& key, bool is_volatile)
 {
+    Stats::Timer timer("registry write");
+
     // Split name
     HKEY root, hkey;
     WString midkey, newkey;
@@ -438,6 +459,8 @@ bool Registry::createKey(const WString& key, bool is_volatile)
 
 bool Registry::deleteKey(const WString& key)
 {
+    Stats::Timer timer("registry write");
+
     // Split name
     HKEY root, hkey;
     WString midkey, endkey;
@@ -9,9 +9,20 @@
 //
 //---------------------------------------------------------------------------
 
-#define _CRT_SECURE_NO_WARNINGS 1 // don't complain about string rtl.
-#include <windows.h>
-#include <iostream>
+#include "options.h"
+#include "winutils.h"
+#include "inputsource.h"
+#include "keytimings.h"
+#include "spscring.h"
+#include "stats.h"
+#include <thread>
+#include <iomanip>
+
+// Size of the buffer between the capture and display threads, in events.
+#define EVENT_RING_SIZE 4096
+
+// Configure the terminal console on init, restore on exit.
+ConsoleState state;
 
 
 //---------------------------------------------------------------------------
@@ -249,7 +260,7 @@ static const char* const vk_names[256] = {
     /*E3*/ nullptr,
     /*E4*/ nullptr,
     /*E5*/ "PROCESSKEY",
-    /*E6*/ "OEM_E6"
+    /*E6*/ "OEM_E6",
     /*E7*/ "PACKET",
     /*E8*/ nullptr,
     /*E9*/ nullptr,
@@ -279,24 +290,153 @@ static const char* const vk_names[256] = {
 
 
 //---------------------------------------------------------------------------
-// Display one key message.
+// Command line options.
+//---------------------------------------------------------------------------
+
+class ScanCodesOptions : public Options
+{
+public:
+    // Constructor.
+    ScanCodesOptions(int argc, wchar_t* argv[]);
+
+    // Command line options.
+    WString replay;
+    WString log;
+    bool    measure;
+    bool    raw_input;
+    bool    realtime;
+    bool    quiet;
+};
+
+ScanCodesOptions::ScanCodesOptions(int argc, wchar_t* argv[]) :
+    Options(argc, argv,
+        L"[options]\n"
+        L"\n"
+        L"Options:\n"
+        L"\n"
+        L"  -h : display this help text\n"
+        L"  -l file : record all key events in a binary log file\n"
+        L"  -m : measure key timings, display hold durations and inter-key intervals on exit\n"
+        L"  -q : quiet, do not display key events\n"
+        L"  -r : use raw input, capture all keyboards, even when the application is in background\n"
+        L"  -R file : replay a binary log file instead of capturing the keyboard\n"
+        L"  -t : with -R, replay the events with their original timing\n"
+        L"  --stats[=text|json] : display performance statistics on standard error"),
+    replay(),
+    log(),
+    measure(false),
+    raw_input(false),
+    realtime(false),
+    quiet(false)
+{
+    // Parse arguments.
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == L"--help" || args[i] == L"-h") {
+            usage();
+        }
+        else if (args[i] == L"-q") {
+            quiet = true;
+        }
+        else if (args[i] == L"-m") {
+            measure = true;
+        }
+        else if (args[i] == L"-r") {
+            raw_input = true;
+        }
+        else if (args[i] == L"-t") {
+            realtime = true;
+        }
+        else if (args[i] == L"-l" && i + 1 < args.size()) {
+            log = args[++i];
+        }
+        else if (args[i] == L"-R" && i + 1 < args.size()) {
+            replay = args[++i];
+        }
+        else {
+            fatal("invalid option '" + args[i] + "', try --help");
+        }
+    }
+    if (raw_input && !replay.empty()) {
+        fatal(L"-r and -R are mutually exclusive");
+    }
+}
+
+
+//---------------------------------------------------------------------------
+// Capture and display are decoupled: the capture thread never waits for
+// the console, the display thread flushes the output only when idle.
+//---------------------------------------------------------------------------
+
+static SpscRing<KeyEvent, EVENT_RING_SIZE> events;
+static std::unique_ptr<InputSource> source;
+static std::atomic<bool> finished(false);
+
+// Capture thread. Live events are dropped when the ring is full, the capture
+// cannot be delayed. Replayed events are never dropped, the replay waits.
+static void CaptureEvents(std::atomic<uint64_t>& dropped, bool live)
+{
+    if (source->open()) {
+        KeyEvent event;
+        while (source->read(event)) {
+            while (!events.push(event)) {
+                if (live) {
+                    dropped++;
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+        source->close();
+    }
+    events.close();
+}
+
+// Stop the capture on Ctrl+C or when the console is closed.
+static BOOL WINAPI ConsoleHandler(DWORD type)
+{
+    if (source != nullptr) {
+        source->stop();
+    }
+    if (type == CTRL_CLOSE_EVENT) {
+        // The process is terminated when the handler returns, let the display thread complete.
+        for (int i = 0; i < 30 && !finished; ++i) {
+            Sleep(100);
+        }
+    }
+    return TRUE;
+}
+
+
+//---------------------------------------------------------------------------
+// Display one key event.
 //---------------------------------------------------------------------------
 
-static void print_key(const std::string& name, WPARAM wParam, LPARAM lParam)
+static void PutHexa(std::ostream& out, uint32_t value, int width)
 {
-    const int vk = int(wParam);
-    const int scancode = int((lParam >> 16) & 0xFF);
-    const int ext = int((lParam >> 24) & 0x01);
-    const int alt = int((lParam >> 29) & 0x01);
+    char buffer[8];
+    for (int i = std::min(width, 8) - 1; i >= 0; --i) {
+        buffer[i] = "0123456789ABCDEF"[value & 0x0F];
+        value >>= 4;
+    }
+    out.write(buffer, std::min(width, 8));
+}
 
-    char buffer[1024];
-    _snprintf(buffer, sizeof(buffer), "Scan code: 0x%02X, Ext: %d, Alt: %d, VK: 0x%04X", scancode, ext, alt, vk);
+static void PrintEvent(std::ostream& out, const KeyEvent& event, uint64_t origin)
+{
+    const char* name = (event.flags & KeyEvent::KEY_UP) != 0 ?
+        ((event.flags & KeyEvent::SYSKEY) != 0 ? "SYSKEYUP  " : "KEYUP     ") :
+        ((event.flags & KeyEvent::SYSKEY) != 0 ? "SYSKEYDOWN" : "KEYDOWN   ");
+    const char* ext = (event.flags & KeyEvent::PREFIX_1) != 0 ? "E1" : ((event.flags & KeyEvent::EXTENDED) != 0 ? "1" : "0");
 
-    std::cout << name << std::string(name.length() < 10 ? 10 - name.length() : 0, ' ') << "  " << buffer;
-    if (vk < 256 && vk_names[vk] != nullptr) {
-        std::cout << " (" << vk_names[vk] << ")";
+    out << std::setw(10) << std::fixed << std::setprecision(3) << double(event.time - origin) / 1000000.0 << " ms  "
+        << name << "  Scan code: 0x";
+    PutHexa(out, event.scancode, 2);
+    out << ", Ext: " << ext << ", Alt: " << ((event.flags & KeyEvent::ALT) != 0 ? 1 : 0) << ", VK: 0x";
+    PutHexa(out, event.vk, 4);
+    if (event.vk < 256 && vk_names[event.vk] != nullptr) {
+        out << " (" << vk_names[event.vk] << ")";
     }
-    std::cout << std::endl << std::flush;
+    out << '\n';
 }
 
 
@@ -304,46 +444,71 @@ static void print_key(const std::string& name, WPARAM wParam, LPARAM lParam)
 // Application entry point.
 //---------------------------------------------------------------------------
 
-int main(int argc, char* argv[])
+int wmain(int argc, wchar_t* argv[])
 {
-    WNDCLASSA wclass;
-    memset(&wclass, 0, sizeof(wclass));
-    wclass.style = CS_HREDRAW | CS_VREDRAW | CS_OWNDC;
-    wclass.lpfnWndProc = DefWindowProcA;
-    wclass.lpszClassName = "ScanCodesClass";
-    wclass.hCursor = LoadCursorA(0, IDC_ARROW);
-    wclass.cbWndExtra = 0;
-    RegisterClassA(&wclass);
+    // Parse command line options.
+    ScanCodesOptions opt(argc, argv);
+
+    // Create the binary log file before starting the capture.
+    KeyLogWriter log(opt);
+    if (!opt.log.empty() && !log.open(opt.log)) {
+        opt.exit(EXIT_FAILURE);
+    }
 
-    HWND window = CreateWindowExA(0, "ScanCodesClass", "ScanCodes", WS_OVERLAPPEDWINDOW, 0, 0, 200, 200, 0, 0, 0, 0);
-    ShowWindow(window, SW_SHOW);
+    // Select the source of events.
+    if (!opt.replay.empty()) {
+        source.reset(new ReplayInputSource(opt, opt.replay, opt.realtime));
+    }
+    else if (opt.raw_input) {
+        source.reset(new RawInputSource(opt));
+        std::cerr << "Press keys in any application to see their scan codes." << std::endl
+                  << "Press Ctrl+C in this shell window to stop the application." << std::endl;
+    }
+    else {
+        source.reset(new WindowInputSource(opt));
+        std::cerr << "Click on the small window and press keys to see their scan codes." << std::endl
+                  << "Close the small window or this shell window to stop the application." << std::endl;
+    }
+    SetConsoleCtrlHandler(ConsoleHandler, TRUE);
 
-    std::cout << "Click on the small window and press keys to see their scan codes." << std::endl
-              << "Close this shell window to stop the application." << std::endl;
+    // The capture runs in a separate thread, which owns the capture window.
+    std::atomic<uint64_t> dropped(0);
+    std::thread capture(CaptureEvents, std::ref(dropped), opt.replay.empty());
 
-    MSG msg;
-    while (GetMessageA(&msg, window, 0, 0) > 0) {
-        switch (msg.message) {
-            case WM_SYSKEYDOWN:
-                print_key("SYSKEYDOWN", msg.wParam, msg.lParam);
-                break;
-            case WM_SYSKEYUP:
-                print_key("SYSKEYUP", msg.wParam, msg.lParam);
-                break;
-            case WM_KEYDOWN:
-                print_key("KEYDOWN", msg.wParam, msg.lParam);
-                break;
-            case WM_KEYUP:
-                print_key("KEYUP", msg.wParam, msg.lParam);
-                break;
-            case WM_PAINT: {
-                // Make sure the window stops complaining about paint.
-                PAINTSTRUCT ps;
-                HDC hdc = BeginPaint(msg.hwnd, &ps);
-                EndPaint(msg.hwnd, &ps);
-                break;
+    // Display and log events as they come.
+    uint64_t origin = 0;
+    KeyTimings timings;
+    KeyEvent event;
+    while (events.wait()) {
+        while (events.pop(event)) {
+            Stats::Timer timer("event display");
+            Stats::Instance().count("events");
+            if (origin == 0) {
+                origin = event.time;
+            }
+            if (opt.measure) {
+                timings.add(event);
+            }
+            if (log.isOpen()) {
+                log.write(event);
+            }
+            if (!opt.quiet) {
+                PrintEvent(std::cout, event, origin);
             }
         }
+        // Flush only when there is no pending event.
+        std::cout << std::flush;
+    }
+
+    capture.join();
+    log.close();
+    if (opt.measure) {
+        timings.print(std::cout, vk_names);
+    }
+    Stats::Instance().count("dropped events", dropped);
+    if (dropped > 0) {
+        opt.warning(Format(L"%llu events dropped", uint64_t(dropped)));
     }
-    return EXIT_SUCCESS;
+    finished = true;
+    opt.exit(EXIT_SUCCESS);
 }
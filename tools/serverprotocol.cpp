@@ -0,0 +1,175 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Binary protocol of kbdserver, over a named pipe.
+//
+//----------------------------------------------------------------------------
+
+#include "serverprotocol.h"
+
+const WString ServerMessage::DEFAULT_PIPE(L"\\\\.\\pipe\\wkl-kbdserver");
+
+
+//----------------------------------------------------------------------------
+// Constructor and header.
+//----------------------------------------------------------------------------
+
+ServerMessage::ServerMessage() :
+    type(0),
+    status(REPLY_OK),
+    id(0),
+    _data(HEADER_SIZE, '\0')
+{
+}
+
+void ServerMessage::reset(uint16_t t, uint32_t i, uint16_t s)
+{
+    type = t;
+    id = i;
+    status = s;
+    _data.resize(HEADER_SIZE);
+}
+
+
+//----------------------------------------------------------------------------
+// Append data to the payload.
+//----------------------------------------------------------------------------
+
+void ServerMessage::putUInt8(uint8_t value)
+{
+    _data.push_back(char(value));
+}
+
+void ServerMessage::putUInt16(uint16_t value)
+{
+    _data.push_back(char(value));
+    _data.push_back(char(value >> 8));
+}
+
+void ServerMessage::putUInt32(uint32_t value)
+{
+    putUInt16(uint16_t(value));
+    putUInt16(uint16_t(value >> 16));
+}
+
+void ServerMessage::putString(const std::string& value)
+{
+    const size_t size = std::min<size_t>(value.size(), 0xFFFF);
+    putUInt16(uint16_t(size));
+    _data.append(value, 0, size);
+}
+
+void ServerMessage::putBytes(const void* data, size_t size)
+{
+    _data.append(reinterpret_cast<const char*>(data), size);
+}
+
+
+//----------------------------------------------------------------------------
+// Read data from the payload.
+//----------------------------------------------------------------------------
+
+bool ServerMessage::getUInt8(size_t& pos, uint8_t& value) const
+{
+    if (pos + 1 > payloadSize()) {
+        return false;
+    }
+    value = uint8_t(payload()[pos++]);
+    return true;
+}
+
+bool ServerMessage::getUInt16(size_t& pos, uint16_t& value) const
+{
+    uint8_t b0 = 0, b1 = 0;
+    if (!getUInt8(pos, b0) || !getUInt8(pos, b1)) {
+        return false;
+    }
+    value = uint16_t(b0 | (b1 << 8));
+    return true;
+}
+
+bool ServerMessage::getUInt32(size_t& pos, uint32_t& value) const
+{
+    uint16_t w0 = 0, w1 = 0;
+    if (!getUInt16(pos, w0) || !getUInt16(pos, w1)) {
+        return false;
+    }
+    value = uint32_t(w0) | (uint32_t(w1) << 16);
+    return true;
+}
+
+bool ServerMessage::getString(size_t& pos, std::string& value) const
+{
+    uint16_t size = 0;
+    if (!getUInt16(pos, size) || pos + size > payloadSize()) {
+        return false;
+    }
+    value.assign(payload() + pos, size);
+    pos += size;
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Read or write a complete message on a pipe.
+//----------------------------------------------------------------------------
+
+bool ServerMessage::read(HANDLE pipe, DWORD& error)
+{
+    // Read exactly 'size' bytes at 'offset' in _data.
+    const auto read_all = [pipe, &error, this](size_t offset, size_t size) {
+        while (size > 0) {
+            DWORD count = 0;
+            if (!ReadFile(pipe, &_data[offset], DWORD(size), &count, nullptr) || count == 0) {
+                error = GetLastError();
+                return false;
+            }
+            offset += count;
+            size -= count;
+        }
+        return true;
+    };
+
+    _data.resize(HEADER_SIZE);
+    if (!read_all(0, HEADER_SIZE)) {
+        return false;
+    }
+    const uint8_t* h = reinterpret_cast<const uint8_t*>(_data.data());
+    const uint32_t size = uint32_t(h[0]) | (uint32_t(h[1]) << 8) | (uint32_t(h[2]) << 16) | (uint32_t(h[3]) << 24);
+    type = uint16_t(h[4] | (h[5] << 8));
+    status = uint16_t(h[6] | (h[7] << 8));
+    id = uint32_t(h[8]) | (uint32_t(h[9]) << 8) | (uint32_t(h[10]) << 16) | (uint32_t(h[11]) << 24);
+    if (size > MAX_PAYLOAD) {
+        error = ERROR_INVALID_DATA;
+        return false;
+    }
+    _data.resize(HEADER_SIZE + size);
+    return read_all(HEADER_SIZE, size);
+}
+
+bool ServerMessage::write(HANDLE pipe, DWORD& error)
+{
+    // Build the header in place, then write header and payload at once.
+    const uint32_t size = uint32_t(payloadSize());
+    const uint8_t header[HEADER_SIZE] = {
+        uint8_t(size), uint8_t(size >> 8), uint8_t(size >> 16), uint8_t(size >> 24),
+        uint8_t(type), uint8_t(type >> 8),
+        uint8_t(status), uint8_t(status >> 8),
+        uint8_t(id), uint8_t(id >> 8), uint8_t(id >> 16), uint8_t(id >> 24),
+    };
+    _data.replace(0, HEADER_SIZE, reinterpret_cast<const char*>(header), HEADER_SIZE);
+
+    size_t offset = 0;
+    while (offset < _data.size()) {
+        DWORD count = 0;
+        if (!WriteFile(pipe, _data.data() + offset, DWORD(_data.size() - offset), &count, nullptr)) {
+            error = GetLastError();
+            return false;
+        }
+        offset += count;
+    }
+    return true;
+}
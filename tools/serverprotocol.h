@@ -0,0 +1,108 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Binary protocol of kbdserver, over a named pipe.
+//
+// All messages, requests and responses, start with a 12-byte header which
+// is followed by a payload. All integers are little-endian.
+//
+//   uint32 size    Size of the payload in bytes.
+//   uint16 type    Request type, the same in the response.
+//   uint16 status  Zero in requests. In responses, zero on success, one on error.
+//   uint32 id      Request identifier, set by the client, copied in the response.
+//
+// A string is a uint16 length, followed by that number of UTF-8 bytes. The
+// payloads of the requests and responses are:
+//
+//   TRANSLATE  Request: string layout, UTF-8 text until the end of the payload.
+//              Response: uint32 number of unmapped characters, 4 bytes per
+//              keystroke, as in kbdtype -b.
+//   INVERSE    Request: string layout, uint32 code points until the end.
+//              Response: for each code point, uint8 number of keystrokes (zero
+//              when unreachable), uint8 cost, 4 bytes per keystroke.
+//   REVERSE    Request: string layout, uint8 format (0: C source, 1: JSON).
+//              Response: the generated text.
+//   DIFF       Request: string layout1, string layout2.
+//              Response: uint8 1 when the layouts are identical, 0 otherwise,
+//              then one text line per character which is typed differently:
+//              code point and keystrokes in each layout ("-" if unreachable).
+//   STATUS     Request: empty. Response: statistics of the server, as text.
+//
+// On error, the payload of the response is the UTF-8 error message.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "strutils.h"
+
+class ServerMessage
+{
+public:
+    // Constructor.
+    ServerMessage();
+
+    // Request types.
+    enum Type : uint16_t {
+        REQ_TRANSLATE = 1,
+        REQ_INVERSE   = 2,
+        REQ_REVERSE   = 3,
+        REQ_DIFF      = 4,
+        REQ_STATUS    = 5,
+    };
+
+    // Response status.
+    enum Status : uint16_t {
+        REPLY_OK    = 0,
+        REPLY_ERROR = 1,
+    };
+
+    // Formats of REQ_REVERSE.
+    enum Format : uint8_t {
+        FORMAT_SOURCE = 0,
+        FORMAT_JSON   = 1,
+    };
+
+    // Size of the header and maximum size of the payload.
+    static constexpr size_t HEADER_SIZE = 12;
+    static constexpr size_t MAX_PAYLOAD = 64 * 1024 * 1024;
+
+    // Default name of the pipe.
+    static const WString DEFAULT_PIPE;
+
+    // Message header.
+    uint16_t type;
+    uint16_t status;
+    uint32_t id;
+
+    // Clear the payload and set the header of a new message.
+    void reset(uint16_t type, uint32_t id, uint16_t status = REPLY_OK);
+
+    // Access the payload.
+    const char* payload() const { return _data.data() + HEADER_SIZE; }
+    size_t payloadSize() const { return _data.size() - HEADER_SIZE; }
+
+    // Append data to the payload.
+    void putUInt8(uint8_t value);
+    void putUInt16(uint16_t value);
+    void putUInt32(uint32_t value);
+    void putString(const std::string& value);
+    void putBytes(const void* data, size_t size);
+
+    // Read data from the payload at a given position, which is updated.
+    // Return false if the payload is too short.
+    bool getUInt8(size_t& pos, uint8_t& value) const;
+    bool getUInt16(size_t& pos, uint16_t& value) const;
+    bool getUInt32(size_t& pos, uint32_t& value) const;
+    bool getString(size_t& pos, std::string& value) const;
+
+    // Read or write a complete message on a pipe. Return false on error or
+    // disconnection, with the Windows error code in 'error'.
+    bool read(HANDLE pipe, DWORD& error);
+    bool write(HANDLE pipe, DWORD& error);
+
+private:
+    std::string _data;  // Header and payload.
+};
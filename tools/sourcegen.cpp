@@ -0,0 +1,1225 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Generate a C source file for a keyboard layout from its KBDTABLES.
+//
+//----------------------------------------------------------------------------
+
+#include "sourcegen.h"
+#include "stats.h"
+#include "winutils.h"
+#include "grid.h"
+#include "unicode.h"
+
+#define SYM(e) {e, L#e}
+
+// So-called "ligatures" can generate up to 16 characters.
+// In "kbd.h", typedef's are predefined up to 5 characters.
+// Longer typedef's must be explicitly defined.
+#define LIG_MAX_PREDEFINED 5
+#define LIG_MAX            16
+TYPEDEF_LIGATURE(16)
+typedef LIGATURE16 LIGATURE_MAX;
+
+
+//---------------------------------------------------------------------------
+// Common symbol tables.
+//---------------------------------------------------------------------------
+
+// Full description of a modifier state, for use in comments in MODIFIERS structure.
+const WStringVector modifiers_comments {
+    L"000 = <none>",
+    L"001 = Shift",
+    L"010 = Control",
+    L"011 = Shift Control",
+    L"100 = Alt",
+    L"101 = Shift Alt",
+    L"110 = Control Alt (AltGr)",
+    L"111 = Shift Control Alt (Shift AltGr)"
+};
+
+// Top of columns of VK_TO_WCHARSx structures.
+const WStringVector modifiers_headers {
+    L"Base",
+    L"Shift",
+    L"Ctrl",
+    L"Shift/Ctrl",
+    L"Alt",
+    L"Shift/Alt",
+    L"AltGr",       // AltGr = Ctrl/Alt
+    L"Shift/AltGr"  // Shift/Ctrl/Alt
+};
+
+const SymbolTable shift_state_symbols {
+    SYM(KBDBASE),
+    SYM(KBDSHIFT),
+    SYM(KBDCTRL),
+    SYM(KBDALT),
+    SYM(KBDKANA),
+    SYM(KBDROYA),
+    SYM(KBDLOYA),
+    SYM(KBDGRPSELTAP)
+};
+
+const SymbolTable vk_symbols {
+    SYM(VK_LBUTTON),
+    SYM(VK_RBUTTON),
+    SYM(VK_CANCEL),
+    SYM(VK_MBUTTON),
+    SYM(VK_XBUTTON1),
+    SYM(VK_XBUTTON2),
+    SYM(VK_BACK),
+    SYM(VK_TAB),
+    SYM(VK_CLEAR),
+    SYM(VK_RETURN),
+    SYM(VK_SHIFT),
+    SYM(VK_CONTROL),
+    SYM(VK_MENU),
+    SYM(VK_PAUSE),
+    SYM(VK_CAPITAL),
+    SYM(VK_KANA),
+    SYM(VK_IME_ON),
+    SYM(VK_JUNJA),
+    SYM(VK_FINAL),
+    SYM(VK_HANJA),
+    SYM(VK_KANJI),
+    SYM(VK_IME_OFF),
+    SYM(VK_ESCAPE),
+    SYM(VK_CONVERT),
+    SYM(VK_NONCONVERT),
+    SYM(VK_ACCEPT),
+    SYM(VK_MODECHANGE),
+    SYM(VK_SPACE),
+    SYM(VK_PRIOR),
+    SYM(VK_NEXT),
+    SYM(VK_END),
+    SYM(VK_HOME),
+    SYM(VK_LEFT),
+    SYM(VK_UP),
+    SYM(VK_RIGHT),
+    SYM(VK_DOWN),
+    SYM(VK_SELECT),
+    SYM(VK_PRINT),
+    SYM(VK_EXECUTE),
+    SYM(VK_SNAPSHOT),
+    SYM(VK_INSERT),
+    SYM(VK_DELETE),
+    SYM(VK_HELP),
+    SYM('0'),
+    SYM('1'),
+    SYM('2'),
+    SYM('3'),
+    SYM('4'),
+    SYM('5'),
+    SYM('6'),
+    SYM('7'),
+    SYM('8'),
+    SYM('9'),
+    SYM('A'),
+    SYM('B'),
+    SYM('C'),
+    SYM('D'),
+    SYM('E'),
+    SYM('F'),
+    SYM('G'),
+    SYM('H'),
+    SYM('I'),
+    SYM('J'),
+    SYM('K'),
+    SYM('L'),
+    SYM('M'),
+    SYM('N'),
+    SYM('O'),
+    SYM('P'),
+    SYM('Q'),
+    SYM('R'),
+    SYM('S'),
+    SYM('T'),
+    SYM('U'),
+    SYM('V'),
+    SYM('W'),
+    SYM('X'),
+    SYM('Y'),
+    SYM('Z'),
+    SYM(VK_LWIN),
+    SYM(VK_RWIN),
+    SYM(VK_APPS),
+    SYM(VK_SLEEP),
+    SYM(VK_NUMPAD0),
+    SYM(VK_NUMPAD1),
+    SYM(VK_NUMPAD2),
+    SYM(VK_NUMPAD3),
+    SYM(VK_NUMPAD4),
+    SYM(VK_NUMPAD5),
+    SYM(VK_NUMPAD6),
+    SYM(VK_NUMPAD7),
+    SYM(VK_NUMPAD8),
+    SYM(VK_NUMPAD9),
+    SYM(VK_MULTIPLY),
+    SYM(VK_ADD),
+    SYM(VK_SEPARATOR),
+    SYM(VK_SUBTRACT),
+    SYM(VK_DECIMAL),
+    SYM(VK_DIVIDE),
+    SYM(VK_F1),
+    SYM(VK_F2),
+    SYM(VK_F3),
+    SYM(VK_F4),
+    SYM(VK_F5),
+    SYM(VK_F6),
+    SYM(VK_F7),
+    SYM(VK_F8),
+    SYM(VK_F9),
+    SYM(VK_F10),
+    SYM(VK_F11),
+    SYM(VK_F12),
+    SYM(VK_F13),
+    SYM(VK_F14),
+    SYM(VK_F15),
+    SYM(VK_F16),
+    SYM(VK_F17),
+    SYM(VK_F18),
+    SYM(VK_F19),
+    SYM(VK_F20),
+    SYM(VK_F21),
+    SYM(VK_F22),
+    SYM(VK_F23),
+    SYM(VK_F24),
+    SYM(VK_NAVIGATION_VIEW),
+    SYM(VK_NAVIGATION_MENU),
+    SYM(VK_NAVIGATION_UP),
+    SYM(VK_NAVIGATION_DOWN),
+    SYM(VK_NAVIGATION_LEFT),
+    SYM(VK_NAVIGATION_RIGHT),
+    SYM(VK_NAVIGATION_ACCEPT),
+    SYM(VK_NAVIGATION_CANCEL),
+    SYM(VK_NUMLOCK),
+    SYM(VK_SCROLL),
+    SYM(VK_OEM_NEC_EQUAL),
+    SYM(VK_OEM_FJ_JISHO),
+    SYM(VK_OEM_FJ_MASSHOU),
+    SYM(VK_OEM_FJ_TOUROKU),
+    SYM(VK_OEM_FJ_LOYA),
+    SYM(VK_OEM_FJ_ROYA),
+    SYM(VK_LSHIFT),
+    SYM(VK_RSHIFT),
+    SYM(VK_LCONTROL),
+    SYM(VK_RCONTROL),
+    SYM(VK_LMENU),
+    SYM(VK_RMENU),
+    SYM(VK_BROWSER_BACK),
+    SYM(VK_BROWSER_FORWARD),
+    SYM(VK_BROWSER_REFRESH),
+    SYM(VK_BROWSER_STOP),
+    SYM(VK_BROWSER_SEARCH),
+    SYM(VK_BROWSER_FAVORITES),
+    SYM(VK_BROWSER_HOME),
+    SYM(VK_VOLUME_MUTE),
+    SYM(VK_VOLUME_DOWN),
+    SYM(VK_VOLUME_UP),
+    SYM(VK_MEDIA_NEXT_TRACK),
+    SYM(VK_MEDIA_PREV_TRACK),
+    SYM(VK_MEDIA_STOP),
+    SYM(VK_MEDIA_PLAY_PAUSE),
+    SYM(VK_LAUNCH_MAIL),
+    SYM(VK_LAUNCH_MEDIA_SELECT),
+    SYM(VK_LAUNCH_APP1),
+    SYM(VK_LAUNCH_APP2),
+    SYM(VK_OEM_1),
+    SYM(VK_OEM_PLUS),
+    SYM(VK_OEM_COMMA),
+    SYM(VK_OEM_MINUS),
+    SYM(VK_OEM_PERIOD),
+    SYM(VK_OEM_2),
+    SYM(VK_OEM_3),
+    SYM(VK_GAMEPAD_A),
+    SYM(VK_GAMEPAD_B),
+    SYM(VK_GAMEPAD_X),
+    SYM(VK_GAMEPAD_Y),
+    SYM(VK_GAMEPAD_RIGHT_SHOULDER),
+    SYM(VK_GAMEPAD_LEFT_SHOULDER),
+    SYM(VK_GAMEPAD_LEFT_TRIGGER),
+    SYM(VK_GAMEPAD_RIGHT_TRIGGER),
+    SYM(VK_GAMEPAD_DPAD_UP),
+    SYM(VK_GAMEPAD_DPAD_DOWN),
+    SYM(VK_GAMEPAD_DPAD_LEFT),
+    SYM(VK_GAMEPAD_DPAD_RIGHT),
+    SYM(VK_GAMEPAD_MENU),
+    SYM(VK_GAMEPAD_VIEW),
+    SYM(VK_GAMEPAD_LEFT_THUMBSTICK_BUTTON),
+    SYM(VK_GAMEPAD_RIGHT_THUMBSTICK_BUTTON),
+    SYM(VK_GAMEPAD_LEFT_THUMBSTICK_UP),
+    SYM(VK_GAMEPAD_LEFT_THUMBSTICK_DOWN),
+    SYM(VK_GAMEPAD_LEFT_THUMBSTICK_RIGHT),
+    SYM(VK_GAMEPAD_LEFT_THUMBSTICK_LEFT),
+    SYM(VK_GAMEPAD_RIGHT_THUMBSTICK_UP),
+    SYM(VK_GAMEPAD_RIGHT_THUMBSTICK_DOWN),
+    SYM(VK_GAMEPAD_RIGHT_THUMBSTICK_RIGHT),
+    SYM(VK_GAMEPAD_RIGHT_THUMBSTICK_LEFT),
+    SYM(VK_OEM_4),
+    SYM(VK_OEM_5),
+    SYM(VK_OEM_6),
+    SYM(VK_OEM_7),
+    SYM(VK_OEM_8),
+    SYM(VK_OEM_AX),
+    SYM(VK_OEM_102),
+    SYM(VK_ICO_HELP),
+    SYM(VK_ICO_00),
+    SYM(VK_PROCESSKEY),
+    SYM(VK_ICO_CLEAR),
+    SYM(VK_PACKET),
+    SYM(VK_OEM_RESET),
+    SYM(VK_OEM_JUMP),
+    SYM(VK_OEM_PA1),
+    SYM(VK_OEM_PA2),
+    SYM(VK_OEM_PA3),
+    SYM(VK_OEM_WSCTRL),
+    SYM(VK_OEM_CUSEL),
+    SYM(VK_OEM_ATTN),
+    SYM(VK_OEM_FINISH),
+    SYM(VK_OEM_COPY),
+    SYM(VK_OEM_AUTO),
+    SYM(VK_OEM_ENLW),
+    SYM(VK_OEM_BACKTAB),
+    SYM(VK_ATTN),
+    SYM(VK_CRSEL),
+    SYM(VK_EXSEL),
+    SYM(VK_EREOF),
+    SYM(VK_PLAY),
+    SYM(VK_ZOOM),
+    SYM(VK_NONAME),
+    SYM(VK_PA1),
+    SYM(VK_OEM_CLEAR),
+    SYM(VK__none_)
+};
+
+const SymbolTable vk_flags_symbols {
+    SYM(KBDEXT),
+    SYM(KBDMULTIVK),
+    SYM(KBDSPECIAL),
+    SYM(KBDNUMPAD),
+    SYM(KBDUNICODE),
+    SYM(KBDINJECTEDVK),
+    SYM(KBDMAPPEDVK),
+    SYM(KBDBREAK)
+};
+
+const SymbolTable vk_attr_symbols {
+    SYM(CAPLOK),
+    SYM(SGCAPS),
+    SYM(CAPLOKALTGR),
+    SYM(KANALOK),
+    SYM(GRPSELTAP)
+};
+
+// Complete symbol for a WCHAR (a character literal).
+const SymbolTable wchar_symbols {
+    {'\t', L"L'\\t'"},
+    {'\n', L"L'\\n'"},
+    {'\r', L"L'\\r'"},
+    {'\'', L"L'\\\''"},
+    {'\\', L"L'\\\\'"},
+    SYM(WCH_NONE),
+    SYM(WCH_DEAD),
+    SYM(WCH_LGTR),
+    // Automatically generated file (using a Python script)
+    #include "unicode_syms.h"
+};
+
+// Local symbol tables, with a few values only.
+static const SymbolTable shift_invalid_symbols {SYM(SHFT_INVALID)};
+static const SymbolTable dead_flags_symbols {SYM(DKF_DEAD)};
+static const SymbolTable locale_flags_symbols {SYM(KLLF_ALTGR), SYM(KLLF_SHIFTLOCK), SYM(KLLF_LRM_RLM)};
+static const SymbolTable kbd_version_symbols {SYM(KBD_VERSION)};
+
+
+//---------------------------------------------------------------------------
+// Description of one data structure.
+//---------------------------------------------------------------------------
+
+void DataStructure::dump(std::ostream& out) const
+{
+    const WString header(name + Format(L" (%d bytes)", int(size)));
+    out << "//" << std::endl
+        << "// " << header << std::endl
+        << "// " << std::string(header.length(), '-') << std::endl;
+    PrintHexa(out, address, size, L"// ", true);
+}
+
+
+//---------------------------------------------------------------------------
+// Generate various parts of the source file.
+//---------------------------------------------------------------------------
+
+SourceGenerator::SourceGenerator(std::ostream& out) :
+    input(),
+    comment(L"Windows Keyboards Layouts (WKL)"),
+    headers(),
+    kbd_type(0),
+    num_only(false),
+    hexa_dump(false),
+    read_only(false),
+    dedup(false),
+    model(false),
+    _ou(out),
+    _dashed(75, L'-'),
+    _alldata(),
+    _arena(),
+    _cell()
+{
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::LoadHeaders(WStringList& headers, const WString& filename)
+{
+    std::string line;
+    std::ifstream prev(filename);
+    while (std::getline(prev, line)) {
+        // Remove leading (optional BOM) and trailing control characters.
+        while (!line.empty() && line.back() < 0x20) {
+            line.pop_back();
+        }
+        while (!line.empty() && line[0] > 0xB0) {
+            line.erase(0, 1);
+        }
+        if (line.length() >= 2 && line[0] == '/' && line[1] == '/') {
+            headers.push_back(ToUTF16(line));
+        }
+        else {
+            break;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::integer(WString& str, Value value, int hex_digits)
+{
+    if (hex_digits <= 0) {
+        AppendFormat(str, L"%lld", value);
+    }
+    else {
+        AppendFormat(str, L"0x%0*llX", hex_digits, value);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::symbol(WString& str, const SymbolTable& symbols, Value value, int hex_digits)
+{
+    if (!num_only) {
+        const auto it = symbols.find(value);
+        if (it != symbols.end()) {
+            str.append(it->second);
+            return;
+        }
+    }
+    integer(str, value, hex_digits);
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::bitMask(WString& str, const SymbolTable& symbols, Value value, int hex_digits)
+{
+    if (!num_only) {
+        const size_t start = str.size();
+        Value bits = 0;
+        for (const auto& sym : symbols) {
+            if (sym.first == 0 && value == 0) {
+                // Specific symbol for zero (no flag)
+                str.append(sym.second);
+                return;
+            }
+            if (sym.first != 0 && (value & sym.first) == sym.first) {
+                // Found one flag.
+                if (str.size() > start) {
+                    str.append(L" | ");
+                }
+                str.append(sym.second);
+                bits |= sym.first;
+            }
+        }
+        if (bits != 0) {
+            // Found at least some bits, add remaining bits.
+            if ((value & ~bits) != 0) {
+                if (str.size() > start) {
+                    str.append(L" | ");
+                }
+                AppendFormat(str, L"0x%0*lld", hex_digits, value & ~bits);
+            }
+            return;
+        }
+    }
+    integer(str, value, hex_digits);
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::attributes(WString& str, const SymbolTable& symbols, const SymbolTable& attributes, Value value, int hex_digits)
+{
+    if (!num_only) {
+        // Compute mask of all possible attributes.
+        Value all_attributes = 0;
+        for (const auto& sym : attributes) {
+            all_attributes |= sym.first;
+        }
+        // Base value.
+        symbol(str, symbols, value & ~all_attributes, hex_digits);
+        // Add attributes.
+        if ((value & all_attributes) != 0) {
+            str.append(L" | ");
+            bitMask(str, attributes, value & all_attributes, hex_digits);
+        }
+        return;
+    }
+    integer(str, value, hex_digits);
+}
+
+//---------------------------------------------------------------------------
+
+WString SourceGenerator::localeFlags(const DWORD flags)
+{
+    if (num_only) {
+        return Format(L"0x%08X", flags);
+    }
+    else {
+        WString str(L"MAKELONG(");
+        bitMask(str, locale_flags_symbols, LOWORD(flags), 4);
+        str.append(L", ");
+        symbol(str, kbd_version_symbols, HIWORD(flags), 4);
+        str.append(L")");
+        return str;
+    }
+}
+
+//---------------------------------------------------------------------------
+
+WString SourceGenerator::pointer(const void* value, const WString& name)
+{
+    return value == nullptr ? L"NULL" : name;
+}
+
+//---------------------------------------------------------------------------
+
+WString SourceGenerator::declare(const WString& type) const
+{
+    return (model ? L"constexpr " : (read_only ? L"static const " : L"static ")) + type;
+}
+
+WString SourceGenerator::reference(const WString& pointer_type, const WString& value) const
+{
+    return read_only && !model && value != L"NULL" ? L"(" + pointer_type + L")" + value : value;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::wchar(WString& str, wchar_t value)
+{
+    // Format a WCHAR. Add description in descs if one exists.
+    if (!num_only) {
+        const auto sym = wchar_symbols.find(value);
+        if (sym != wchar_symbols.end()) {
+            str.append(sym->second);
+            return;
+        }
+    }
+    if (value == L'\'' || value == L'\\') {
+        str.append(L"L'\\");
+        str.push_back(value);
+        str.push_back(L'\'');
+    }
+    else if (value >= L' ' && value < 0x007F) {
+        str.append(L"L'");
+        str.push_back(value);
+        str.push_back(L'\'');
+    }
+    else {
+        AppendFormat(str, L"0x%04X", value);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::addCell(Grid& grid, const wchar_t* suffix)
+{
+    _cell.append(suffix);
+    grid.addColumn(_cell);
+    _cell.clear();
+}
+
+//---------------------------------------------------------------------------
+
+void SortDataStructures(std::list<DataStructure>& alldata)
+{
+    if (alldata.empty()) {
+        return;
+    }
+
+    // Sort all data structures by address.
+    alldata.sort();
+
+    // Merge adjacent data structures with same names (typically "Strings in ...").
+    auto current = alldata.begin();
+    auto previous = current++;
+    while (current != alldata.end()) {
+        const bool inter_zero = IsZero(previous->end(), current->address);
+        // Merge if the two data structures have the same name and are adjacent or
+        // only separated by zeroes (typpically padding).
+        if (previous->name == current->name && (previous->end() == current->address || inter_zero)) {
+            // Merge previous and current structure.
+            previous->size = uintptr_t(current->end()) - uintptr_t(previous->address);
+            current = alldata.erase(current);
+        }
+        else {
+            // If there is empty space between the two structures, create a structure for it.
+            if (previous->end() < current->address) {
+                DataStructure inter(inter_zero ? L"Padding" : L"Unreferenced", previous->end(), current->address);
+                current = alldata.insert(current, inter);
+            }
+            // Move to next pair of structures.
+            previous = current;
+            ++current;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genVkToBits(const VK_TO_BIT* vtb, const WString& name)
+{
+    DataStructure ds(name, vtb);
+
+    Grid grid(L"", L" ", &_arena);
+    for (; vtb->Vk != 0; vtb++) {
+        grid.newLine();
+        _cell.push_back(L'{');
+        symbol(_cell, vk_symbols, vtb->Vk, 2);
+        addCell(grid, L",");
+        bitMask(_cell, shift_state_symbols, vtb->ModBits, 4);
+        addCell(grid, L"},");
+    }
+    grid.addLine({L"{0,", L"0}"});
+    vtb++;
+
+    ds.setEnd(vtb);
+    _alldata.push_back(ds);
+
+    _ou << "//" << _dashed << std::endl
+        << "// Associate a virtual key with a modifier bitmask" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << declare(L"VK_TO_BIT") << " " << name << "[] = {" << std::endl;
+    grid.setMargin(4);
+    grid.print(_ou);
+    _ou << "};" << std::endl << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genCharModifiers(const MODIFIERS& mods, const WString& name)
+{
+    const wchar_t* vk_to_bits_name = L"vk_to_bits";
+    if (mods.pVkToBit != nullptr) {
+        genVkToBits(mods.pVkToBit, vk_to_bits_name);
+    }
+
+    Grid grid(L"", L" ", &_arena);
+    // Note: wMaxModBits is the "max value", ie. size = wMaxModBits + 1
+    for (WORD i = 0; i <= mods.wMaxModBits; ++i) {
+        grid.newLine();
+        symbol(_cell, shift_invalid_symbols, mods.ModNumber[i]);
+        addCell(grid, L",");
+        if (!num_only && i < modifiers_comments.size()) {
+            grid.addColumn(L"// " + modifiers_comments[i]);
+        }
+    }
+
+    DataStructure ds(name, &mods);
+    ds.setEnd(&mods.ModNumber[0] + mods.wMaxModBits + 1);
+    _alldata.push_back(ds);
+
+    _ou << "//" << _dashed << std::endl
+        << "// Map character modifier bits to modification number" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << declare(model ? Format(L"KbdModifiers<%d>", int(mods.wMaxModBits) + 1) : L"MODIFIERS") << " " << name << " = {" << std::endl
+        << "    .pVkToBit    = " << reference(L"PVK_TO_BIT", mods.pVkToBit != nullptr ? vk_to_bits_name : L"NULL") << "," << std::endl
+        << "    .wMaxModBits = " << mods.wMaxModBits << "," << std::endl
+        << "    .ModNumber   = {" << std::endl;
+    grid.setMargin(8);
+    grid.print(_ou);
+    _ou << "    }" << std::endl
+        << "};" << std::endl
+        << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genSubVkToWchar(const VK_TO_WCHARS10* vtwc, size_t count, size_t size, const WString& name, const MODIFIERS* mods)
+{
+    DataStructure ds(name, vtwc);
+    Grid grid(L"", L" ", &_arena);
+
+    // Add header lines of comments to indicate the type of modifier on top of each column.
+    if (mods != nullptr && !num_only) {
+        Grid::Line headers(2 + count);
+        headers[0] = L"//";
+        bool not_empty = false;
+        for (size_t i = 0; i <= mods->wMaxModBits && i < modifiers_headers.size(); ++i) {
+            const size_t index = mods->ModNumber[i];
+            if (2 + index < headers.size()) {
+                headers[2 + index] = modifiers_headers[i];
+                not_empty = not_empty || !modifiers_headers[i].empty();
+            }
+        }
+        if (not_empty) {
+            grid.addLine(headers);
+            grid.addUnderlines({ L"//" });
+        }
+    }
+
+    while (vtwc->VirtualKey != 0) {
+        grid.newLine();
+        _cell.push_back(L'{');
+        symbol(_cell, vk_symbols, vtwc->VirtualKey, 2);
+        addCell(grid, L",");
+        bitMask(_cell, vk_attr_symbols, vtwc->Attributes, 2);
+        addCell(grid, L",");
+        for (size_t i = 0; i < count; ++i) {
+            if (i == 0) {
+                _cell.push_back(L'{');
+            }
+            wchar(_cell, vtwc->wch[i]);
+            addCell(grid, i == count - 1 ? L"}}," : L",");
+        }
+
+        // Move to next structure (variable size).
+        vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + size);
+    }
+
+    // Last null element.
+    Grid::Line line({L"{0,"});
+    line.resize(count + 1, L"0,");
+    line.push_back(L"0}");
+    grid.addLine(line);
+    vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + size);
+
+    ds.setEnd(vtwc);
+    _alldata.push_back(ds);
+
+    _ou << "//" << _dashed << std::endl
+        << "// Virtual Key to WCHAR translations for " << count << " shift states" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << declare(Format(L"VK_TO_WCHARS%d", int(count))) << " " << name << "[] = {" << std::endl;
+    grid.setMargin(4);
+    grid.print(_ou);
+    _ou << "};" << std::endl << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genVkToWchar(const VK_TO_WCHAR_TABLE* vtwc, const WString& name, const::MODIFIERS* mods)
+{
+    DataStructure ds(name, vtwc);
+
+    Grid grid(L"", L" ", &_arena);
+    for (; vtwc->pVkToWchars != nullptr; vtwc++) {
+        const WString sub_name(Format(L"vk_to_wchar%d", vtwc->nModifications));
+        genSubVkToWchar(reinterpret_cast<PVK_TO_WCHARS10>(vtwc->pVkToWchars), vtwc->nModifications, vtwc->cbSize, sub_name, mods);
+        grid.addLine({
+            L"{(PVK_TO_WCHARS1)" + sub_name + L",",
+            Format(L"%d,", vtwc->nModifications),
+            L"sizeof(" + sub_name + L"[0])},"
+        });
+    }
+    grid.addLine({L"{NULL,", L"0,", L"0}"});
+    vtwc++;
+
+    ds.setEnd(vtwc);
+    _alldata.push_back(ds);
+
+    // In model mode, the VK_TO_WCHARS tables are directly passed to the model.
+    if (model) {
+        return;
+    }
+
+    _ou << "//" << _dashed << std::endl
+        << "// Virtual Key to WCHAR translations with shift states" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << declare(L"VK_TO_WCHAR_TABLE") << " " << name << "[] = {" << std::endl;
+    grid.setMargin(4);
+    grid.print(_ou);
+    _ou << "};" << std::endl << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genLgToWchar(const LIGATURE1* ligatures, size_t count, size_t size, const WString& name, const MODIFIERS* mods)
+{
+    DataStructure ds(name, ligatures);
+    const LIGATURE_MAX* lg = reinterpret_cast<const LIGATURE_MAX*>(ligatures);
+
+    Grid grid(L"", L" ", &_arena);
+    std::pmr::set<std::pair<BYTE, WORD>> keys(&_arena);
+    for (; lg->VirtualKey != 0; lg = reinterpret_cast<const LIGATURE_MAX*>(reinterpret_cast<const char*>(lg) + size)) {
+        if (dedup && !keys.insert(std::make_pair(lg->VirtualKey, lg->ModificationNumber)).second) {
+            continue; // hidden by a previous ligature of the same key and shift state
+        }
+        // Start of entry: virtual key and modification number.
+        grid.newLine();
+        _cell.push_back(L'{');
+        symbol(_cell, vk_symbols, lg->VirtualKey, 2);
+        addCell(grid, L",");
+        AppendFormat(_cell, L"%d,", lg->ModificationNumber);
+        addCell(grid);
+        // Search a description for the modification number.
+        const WString* comment = nullptr;
+        if (mods != nullptr && !num_only) {
+            for (size_t i = 0; i <= mods->wMaxModBits && i < modifiers_headers.size(); ++i) {
+                if (lg->ModificationNumber == mods->ModNumber[i] && !modifiers_headers[i].empty()) {
+                    comment = &modifiers_headers[i];
+                    break;
+                }
+            }
+        }
+        // List of generated characters for that ligature.
+        for (size_t i = 0; i < count; ++i) {
+            if (i == 0) {
+                _cell.push_back(L'{');
+            }
+            wchar(_cell, lg->wch[i]);
+            addCell(grid, i == count - 1 ? L"}}," : L",");
+        }
+        // Add any interesting comment.
+        if (comment != nullptr) {
+            _cell.append(L"// ");
+            _cell.append(*comment);
+            addCell(grid);
+        }
+    }
+
+    // Last null element.
+    Grid::Line line({L"{0,", L"0,"});
+    switch (count) {
+        case 0:
+            line.push_back(L"}");
+            break;
+        case 1:
+            line.push_back(L"{0}}");
+            break;
+        default:
+            line.push_back(L"{0, ");
+            line.resize(count + 1, L"0,");
+            line.push_back(L"0}}");
+    }
+    grid.addLine(line);
+    lg = reinterpret_cast<const LIGATURE_MAX*>(reinterpret_cast<const char*>(lg) + size);
+
+    ds.setEnd(lg);
+    _alldata.push_back(ds);
+
+    _ou << "//" << _dashed << std::endl
+        << "// Ligatures to WCHAR translations" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl;
+    if (count > LIG_MAX_PREDEFINED) {
+        _ou << "TYPEDEF_LIGATURE(" << count << ")" << std::endl
+            << std::endl;
+    }
+    _ou << declare(Format(L"LIGATURE%d", int(count))) << " " << name << "[] = {" << std::endl;
+    grid.setMargin(4);
+    grid.print(_ou);
+    _ou << "};" << std::endl << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genDeadKeys(const DEADKEY* dk, const WString& name)
+{
+    DataStructure ds(name, dk);
+
+    Grid grid(L"", L" ", &_arena);
+    grid.addLine({L"//", L"Accent", L"Composed", L"Flags"});
+    grid.addUnderlines({L"//"});
+    std::pmr::set<DWORD> keys(&_arena);
+    for (; dk->dwBoth != 0; dk++) {
+        if (dedup && !keys.insert(dk->dwBoth).second) {
+            continue; // hidden by a previous translation of the same sequence
+        }
+        grid.newLine();
+        _cell.append(L"DEADTRANS(");
+        wchar(_cell, LOWORD(dk->dwBoth));
+        addCell(grid, L",");
+        wchar(_cell, HIWORD(dk->dwBoth));
+        addCell(grid, L",");
+        wchar(_cell, dk->wchComposed);
+        addCell(grid, L",");
+        bitMask(_cell, dead_flags_symbols, dk->uFlags, 4);
+        addCell(grid, L"),");
+    }
+    dk++; // last null element
+
+    ds.setEnd(dk);
+    _alldata.push_back(ds);
+
+    _ou << "//" << _dashed << std::endl
+        << "// Dead keys sequences translations" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << declare(L"DEADKEY") << " " << name << "[] = {" << std::endl;
+    grid.setMargin(4);
+    grid.print(_ou);
+    _ou << "    {0, 0, 0}" << std::endl
+        << "};" << std::endl
+        << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genVscToString(const VSC_LPWSTR* vts, const WString& name, const WString& comment)
+{
+    DataStructure ds(name, vts);
+
+    Grid grid(L"", L" ", &_arena);
+    std::pmr::set<BYTE> keys(&_arena);
+    const WString strings_name(L"Strings in " + name);
+    for (; vts->vsc != 0; vts++) {
+        if (dedup && !keys.insert(vts->vsc).second) {
+            continue; // hidden by a previous name of the same scan code
+        }
+        grid.newLine();
+        AppendFormat(_cell, L"{0x%02X,", vts->vsc);
+        addCell(grid);
+        AppendWStringLiteral(_cell, vts->pwsz);
+        addCell(grid, L"},");
+        if (hexa_dump) {
+            _alldata.push_back(DataStructure(strings_name, vts->pwsz, WStringSize(vts->pwsz)));
+        }
+    }
+    grid.addLine({L"{0x00,", L"NULL}"});
+    vts++;
+
+    ds.setEnd(vts);
+    _alldata.push_back(ds);
+
+    _ou << "//" << _dashed << std::endl
+        << "// Scan codes to key names" << comment << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << declare(L"VSC_LPWSTR") << " " << name << "[] = {" << std::endl;
+    grid.setMargin(4);
+    grid.print(_ou);
+    _ou << "};" << std::endl << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genKeyNames(const DEADKEY_LPWSTR* names, const WString& name)
+{
+    DataStructure ds(name, names);
+
+    Grid grid(L"", L" ", &_arena);
+    std::pmr::set<WCHAR> keys(&_arena);
+    const WString strings_name(L"Strings in " + name);
+    for (; *names != nullptr; ++names) {
+        if (**names != 0 && (!dedup || keys.insert(**names).second)) {
+            WCHAR prefix[2]{ **names, L'\0' };
+            grid.newLine();
+            AppendWStringLiteral(_cell, prefix);
+            addCell(grid);
+            AppendWStringLiteral(_cell, *names + 1);
+            addCell(grid, L",");
+            if (hexa_dump) {
+                _alldata.push_back(DataStructure(strings_name, *names, WStringSize(*names)));
+            }
+        }
+    }
+    ++names; // skip last null pointer
+
+    ds.setEnd(names);
+    _alldata.push_back(ds);
+
+    _ou << "//" << _dashed << std::endl
+        << "// Names of dead keys" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << declare(L"DEADKEY_LPWSTR") << " " << name << "[] = {" << std::endl;
+    grid.setMargin(4);
+    grid.print(_ou);
+    _ou << "    NULL" << std::endl << "};" << std::endl << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genScanToVk(const USHORT* vk, size_t vk_count, const WString& name)
+{
+    DataStructure ds(name, vk, vk_count * sizeof(*vk));
+    _alldata.push_back(ds);
+
+    _ou << "//" << _dashed << std::endl
+        << "// Scan code to virtual key conversion table" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << declare(L"USHORT") << " " << name << "[] = {" << std::endl;
+ 
+    for (size_t i = 0; i < vk_count; ++i) {
+        AppendFormat(_cell, L"    /* %02X */ ", int(i));
+        attributes(_cell, vk_symbols, vk_flags_symbols, vk[i], 4);
+        _cell.append(L",\n");
+        _ou << _cell;
+        _cell.clear();
+    }
+
+    _ou << "};" << std::endl << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genVscToVk(const VSC_VK* vtvk, const WString& name, const WString& comment)
+{
+    DataStructure ds(name, vtvk);
+
+    Grid grid(L"", L" ", &_arena);
+    std::pmr::set<BYTE> keys(&_arena);
+    for (; vtvk->Vsc != 0; vtvk++) {
+        if (dedup && !keys.insert(vtvk->Vsc).second) {
+            continue; // hidden by a previous entry of the same scan code
+        }
+        grid.newLine();
+        AppendFormat(_cell, L"{0x%02X,", vtvk->Vsc);
+        addCell(grid);
+        attributes(_cell, vk_symbols, vk_flags_symbols, vtvk->Vk, 4);
+        addCell(grid, L"},");
+    }
+    grid.addLine({L"{0x00,", L"0x0000}"});
+    vtvk++;
+
+    ds.setEnd(vtvk);
+    _alldata.push_back(ds);
+
+    _ou << "//" << _dashed << std::endl
+        << "// Scan code to virtual key conversion table" << comment << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << declare(L"VSC_VK") << " " << name << "[] = {" << std::endl;
+    grid.setMargin(4);
+    grid.print(_ou);
+    _ou << "};" << std::endl << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::generate(const KBDTABLES& tables)
+{
+    Stats::Timer timer("source generation");
+
+    // Keyboard type are typically lower than 42. The field dwType was not used in older
+    // versions and may contain crap. Try to guess a realistic value for keyboard type.
+    // The last default keyord type is 4 (classical 101/102-key keyboard).
+    const int type = kbd_type > 0 ? kbd_type : (tables.dwType > 0 && tables.dwType < 48 ? tables.dwType : 4);
+
+    // File header.
+    if (headers.empty()) {
+        _ou << "//" << _dashed << std::endl
+            << "// " << comment << std::endl
+            << "// Automatically generated from " << FileName(input) << std::endl
+            << "//" << _dashed << std::endl;
+    }
+    else {
+        for (const auto& line : headers) {
+            _ou << line << std::endl;
+        }
+    }
+    if (model) {
+        _ou << std::endl
+            << "#pragma once" << std::endl
+            << "#include \"kbdmodel.h\"" << std::endl;
+    }
+    else {
+        _ou << std::endl
+            << "#define KBD_TYPE " << type << std::endl
+            << std::endl
+            << "#include <windows.h>" << std::endl
+            << "#include <kbd.h>" << std::endl
+            << "#include <dontuse.h>" << std::endl;
+    }
+    if (!num_only) {
+        _ou << "#include \"unicode.h\"" << std::endl;
+    }
+    _ou << std::endl;
+
+    // The key names are not part of the model: string literals cannot initialize LPWSTR in C++.
+    const WString key_names_name(L"key_names");
+    if (tables.pKeyNames != nullptr && !model) {
+        genVscToString(tables.pKeyNames, key_names_name);
+    }
+
+    const WString key_names_ext_name(L"key_names_ext");
+    if (tables.pKeyNamesExt != nullptr && !model) {
+        genVscToString(tables.pKeyNamesExt, key_names_ext_name, L" (extended keypad)");
+    }
+
+    const WString key_names_dead_name(L"key_names_dead");
+    if (tables.pKeyNamesDead != nullptr && !model) {
+        genKeyNames(tables.pKeyNamesDead, key_names_dead_name);
+    }
+
+    const WString scancode_to_vk_name(L"scancode_to_vk");
+    if (tables.pusVSCtoVK != nullptr) {
+        genScanToVk(tables.pusVSCtoVK, tables.bMaxVSCtoVK, scancode_to_vk_name);
+    }
+
+    const WString scancode_to_vk_e0_name(L"scancode_to_vk_e0");
+    if (tables.pVSCtoVK_E0 != nullptr) {
+        genVscToVk(tables.pVSCtoVK_E0, scancode_to_vk_e0_name, L" (scancodes with E0 prefix)");
+    }
+
+    const WString scancode_to_vk_e1_name(L"scancode_to_vk_e1");
+    if (tables.pVSCtoVK_E1 != nullptr) {
+        genVscToVk(tables.pVSCtoVK_E1, scancode_to_vk_e1_name, L" (scancodes with E1 prefix)");
+    }
+
+    const WString char_modifiers_name(L"char_modifiers");
+    if (tables.pCharModifiers != nullptr) {
+        genCharModifiers(*tables.pCharModifiers, char_modifiers_name);
+    }
+
+    const WString vk_to_wchar_name(L"vk_to_wchar");
+    if (tables.pVkToWcharTable != nullptr) {
+        genVkToWchar(tables.pVkToWcharTable, vk_to_wchar_name, tables.pCharModifiers);
+    }
+
+    const WString dead_keys_name(L"dead_keys");
+    if (tables.pDeadKey != nullptr) {
+        genDeadKeys(tables.pDeadKey, dead_keys_name);
+    }
+
+    const WString ligatures_name(L"ligatures");
+    if (tables.pLigature != nullptr) {
+        genLgToWchar(tables.pLigature, tables.nLgMax, tables.cbLgEntry, ligatures_name, tables.pCharModifiers);
+    }
+
+    // In model mode, generate the model instead of the main table.
+    if (model) {
+        genModel(tables, scancode_to_vk_name, scancode_to_vk_e0_name, scancode_to_vk_e1_name, char_modifiers_name, dead_keys_name);
+        return;
+    }
+
+    // Generate main table.
+    const WString kbd_table_name(L"kbd_tables");
+    _alldata.push_back(DataStructure(kbd_table_name, &tables, sizeof(tables)));
+    _ou << "//" << _dashed << std::endl
+        << "// Main keyboard layout structure, point to all tables" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << declare(L"KBDTABLES") << " " << kbd_table_name << " = {" << std::endl
+        << "    .pCharModifiers  = " << reference(L"PMODIFIERS", pointer(tables.pCharModifiers, L"&" + char_modifiers_name)) << "," << std::endl
+        << "    .pVkToWcharTable = " << reference(L"PVK_TO_WCHAR_TABLE", pointer(tables.pVkToWcharTable, vk_to_wchar_name)) << "," << std::endl
+        << "    .pDeadKey        = " << reference(L"PDEADKEY", pointer(tables.pDeadKey, dead_keys_name)) << "," << std::endl
+        << "    .pKeyNames       = " << reference(L"PVSC_LPWSTR", pointer(tables.pKeyNames, key_names_name)) << "," << std::endl
+        << "    .pKeyNamesExt    = " << reference(L"PVSC_LPWSTR", pointer(tables.pKeyNamesExt, key_names_ext_name)) << "," << std::endl
+        << "    .pKeyNamesDead   = " << reference(L"DEADKEY_LPWSTR*", pointer(tables.pKeyNamesDead, key_names_dead_name)) << "," << std::endl
+        << "    .pusVSCtoVK      = " << reference(L"USHORT*", pointer(tables.pusVSCtoVK, scancode_to_vk_name)) << "," << std::endl
+        << "    .bMaxVSCtoVK     = " << (tables.pusVSCtoVK == nullptr ? L"0," : "ARRAYSIZE(" + scancode_to_vk_name + "),") << std::endl
+        << "    .pVSCtoVK_E0     = " << reference(L"PVSC_VK", pointer(tables.pVSCtoVK_E0, scancode_to_vk_e0_name)) << "," << std::endl
+        << "    .pVSCtoVK_E1     = " << reference(L"PVSC_VK", pointer(tables.pVSCtoVK_E1, scancode_to_vk_e1_name)) << "," << std::endl
+        << "    .fLocaleFlags    = " << localeFlags(tables.fLocaleFlags) << "," << std::endl
+        << "    .nLgMax          = " << int(tables.nLgMax) << "," << std::endl
+        << "    .cbLgEntry       = " << (tables.pLigature == nullptr ? L"0," : "sizeof(" + ligatures_name + "[0]),") << std::endl
+        << "    .pLigature       = " << pointer(tables.pLigature, L"(PLIGATURE1)" + ligatures_name) << "," << std::endl
+        << "    .dwType          = " << tables.dwType << "," << std::endl
+        << "    .dwSubType       = " << tables.dwSubType << "," << std::endl
+        << "};" << std::endl
+        << std::endl
+        << "//" << _dashed << std::endl
+        << "// Keyboard layout entry point" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << "__declspec(dllexport) PKBDTABLES " KBD_DLL_ENTRY_NAME "(void)" << std::endl
+        << "{" << std::endl
+        << "    return " << reference(L"PKBDTABLES", L"&" + kbd_table_name) << ";" << std::endl
+        << "}" << std::endl;
+
+    // Dump file content.
+    if (hexa_dump) {
+        genHexaDump();
+    }
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genModel(const KBDTABLES& tables, const WString& scancode_to_vk_name, const WString& scancode_to_vk_e0_name, const WString& scancode_to_vk_e1_name, const WString& char_modifiers_name, const WString& dead_keys_name)
+{
+    // The model needs the modifiers and at least one VK_TO_WCHARS table.
+    if (tables.pCharModifiers == nullptr || tables.pVkToWcharTable == nullptr || tables.pVkToWcharTable->pVkToWchars == nullptr) {
+        return;
+    }
+
+    // Same names as in genVkToWchar().
+    WString wchar_tables;
+    for (const VK_TO_WCHAR_TABLE* vtwc = tables.pVkToWcharTable; vtwc->pVkToWchars != nullptr; vtwc++) {
+        AppendFormat(wchar_tables, L"%svk_to_wchar%d", wchar_tables.empty() ? L"" : L", ", vtwc->nModifications);
+    }
+
+    _ou << "//" << _dashed << std::endl
+        << "// Compile-time model of the keyboard layout" << std::endl
+        << "//" << _dashed << std::endl
+        << std::endl
+        << "KBD_MODEL(kbd_model," << std::endl
+        << "          " << (tables.pusVSCtoVK == nullptr ? L"nullptr" : scancode_to_vk_name)
+        << ", " << (tables.pVSCtoVK_E0 == nullptr ? L"nullptr" : scancode_to_vk_e0_name)
+        << ", " << (tables.pVSCtoVK_E1 == nullptr ? L"nullptr" : scancode_to_vk_e1_name)
+        << ", " << char_modifiers_name
+        << ", " << (tables.pDeadKey == nullptr ? L"nullptr" : dead_keys_name) << "," << std::endl
+        << "          " << wchar_tables << ");" << std::endl;
+}
+
+//---------------------------------------------------------------------------
+
+void SourceGenerator::genHexaDump()
+{
+    // Rearrange, merge, describe inter-structure spaces, etc.
+    SortDataStructures(_alldata);
+
+    // Get system page size.
+    SYSTEM_INFO sysinfo;
+    GetSystemInfo(&sysinfo);
+    const size_t page_size = size_t(sysinfo.dwPageSize);
+
+    const uintptr_t first_address = uintptr_t(_alldata.front().address);
+    const uintptr_t last_address = uintptr_t(_alldata.back().end());
+    const uintptr_t first_page = first_address - first_address % page_size;
+    const uintptr_t last_page = last_address + (page_size - last_address % page_size) % page_size;
+
+    _ou << std::endl
+        << "//" << _dashed << std::endl
+        << "// Data structures dump" << std::endl
+        << "//" << _dashed << std::endl
+        << "//" << std::endl
+        << "// Total size: " << (last_page - first_page) << " bytes (" << ((last_page - first_page) / page_size) << " pages)" << std::endl
+        << Format(L"// Base: 0x%08llX", size_t(first_page)) << std::endl
+        << Format(L"// End:  0x%08llX", size_t(last_page)) << std::endl;
+
+    // Dump start of memory page, before the first data structure.
+    if (first_page < first_address) {
+        const DataStructure ds(L"Start of memory page before first data structure", first_page, first_address - first_page);
+        ds.dump(_ou);
+    }
+
+    // Dump all data structures.
+    for (const auto& data : _alldata) {
+        data.dump(_ou);
+    }
+
+    // Dump end of memory page after last structure.
+    if (last_address < last_page) {
+        const DataStructure ds(L"End of memory page after last data structure", last_address, last_page - last_address);
+        ds.dump(_ou);
+    }
+}
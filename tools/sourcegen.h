@@ -0,0 +1,150 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Generate a C source file for a keyboard layout from its KBDTABLES.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "strutils.h"
+#include <memory_resource>
+
+class Grid;
+
+// Tables of values => symbols
+typedef __int64 Value;
+typedef std::map<Value, WString> SymbolTable;
+
+// Full description of a modifier state, for use in comments in MODIFIERS structure.
+extern const WStringVector modifiers_comments;
+
+// Top of columns of VK_TO_WCHARSx structures.
+extern const WStringVector modifiers_headers;
+
+// Common symbol tables.
+extern const SymbolTable shift_state_symbols;
+extern const SymbolTable vk_symbols;
+extern const SymbolTable vk_flags_symbols;
+extern const SymbolTable vk_attr_symbols;
+extern const SymbolTable wchar_symbols;
+
+// Description of one data structure.
+class DataStructure
+{
+public:
+    WString name;
+    const void*  address;
+    size_t       size;
+
+    // Constructors with address or integer.
+    DataStructure(const WString& n = L"", const void* a = nullptr, size_t s = 0)
+        : name(n), address(a), size(s) {}
+    DataStructure(const WString& n, const void* a, const void* end)
+        : name(n), address(a), size(uintptr_t(end) - uintptr_t(a)) {}
+    DataStructure(const WString& n, uintptr_t a, size_t s = 0)
+        : name(n), address(reinterpret_cast<const void*>(a)), size(s) {}
+
+    // Get/set address after last byte.
+    const void* end() const { return reinterpret_cast<const uint8_t*>(address) + size; }
+    void setEnd(const void* e) { size = uintptr_t(e) - uintptr_t(address); }
+
+    // Sort operator.
+    bool operator<(const DataStructure& s) const { return address < s.address; }
+
+    // Hexa dump of the structure.
+    void dump(std::ostream&) const;
+};
+
+// Sort a list of data structures by address, merge adjacent data structures with same names
+// (typically "Strings in ...") and describe the space between them ("Padding" or "Unreferenced").
+void SortDataStructures(std::list<DataStructure>&);
+
+// Generate the various parts of the source file.
+class SourceGenerator
+{
+public:
+    // Constructor. Specify the output stream.
+    SourceGenerator(std::ostream& out);
+
+    // Generation options, to be set before generate().
+    WString     input;      // Input file name, in the header comment.
+    WString     comment;    // Comment string in the header.
+    WStringList headers;    // When not empty, replace the default header comment lines.
+    int         kbd_type;   // Keyboard type, zero means from dwType in tables.
+    bool        num_only;   // Numerical output only, no source macro.
+    bool        hexa_dump;  // Add hexa dump of data structures in final comments.
+    bool        read_only;  // Declare all tables as const.
+    bool        dedup;      // Remove entries which are hidden by a previous entry with the same key.
+    bool        model;      // Generate a C++ header with the constexpr tables and model, see kbdmodel.h.
+
+    // Generate the source file.
+    void generate(const KBDTABLES&);
+
+    // Load the leading comment lines of an existing source file, to be used as headers.
+    // Nothing is loaded if the file does not exist.
+    static void LoadHeaders(WStringList& headers, const WString& filename);
+
+private:
+    std::ostream&            _ou;
+    const WString            _dashed;
+    std::list<DataStructure> _alldata;
+
+    // All tables of a source file are built in this arena (grids, dedup sets).
+    // The cells of the tables are formatted in the same reused buffer.
+    std::pmr::monotonic_buffer_resource _arena;
+    WString                             _cell;
+
+    // The following functions append their result to a string, typically _cell,
+    // without intermediate string.
+
+    // Format an integer as a decimal or hexadecimal string.
+    // If hex_digits is zero, format in decimal.
+    void integer(WString& str, Value value, int hex_digits = 0);
+
+    // Format an integer as a string, using a table of symbols.
+    // If no symbol found or option -n, return a number.
+    // If hex_digits is zero, format in decimal.
+    void symbol(WString& str, const SymbolTable& symbols, Value value, int hex_digits = 0);
+
+    // Format a bit mask of symbols, same principle as symbol().
+    void bitMask(WString& str, const SymbolTable& symbols, Value value, int hex_digits = 0);
+
+    // Format a symbol and a bit mask of attributes, same principle as Symbol().
+    void attributes(WString& str, const SymbolTable& symbols, const SymbolTable& attributes, Value value, int hex_digits = 0);
+
+    // Format a WCHAR. Add description in descs if one exists.
+    void wchar(WString& str, wchar_t value);
+
+    // Add the content of _cell as a new column in a grid, followed by a suffix.
+    void addCell(Grid& grid, const wchar_t* suffix = L"");
+
+    // Format locale flags according to symbols.
+    WString localeFlags(DWORD flags);
+
+    // Format a Pointer
+    WString pointer(const void* value, const WString& name);
+
+    // Declaration of a static table of a given type, const in read-only mode, constexpr in model mode.
+    WString declare(const WString& type) const;
+
+    // Reference to a table from another one. In read-only mode, the constness must be cast away:
+    // the structures of kbd.h contain non-const pointers. In model mode, no cast is possible in a constexpr.
+    WString reference(const WString& pointer_type, const WString& value) const;
+
+    // Generate the various data structures.
+    void genVkToBits(const VK_TO_BIT*, const WString& name);
+    void genCharModifiers(const MODIFIERS&, const WString& name);
+    void genSubVkToWchar(const VK_TO_WCHARS10*, size_t count, size_t size, const WString& name, const MODIFIERS*);
+    void genVkToWchar(const VK_TO_WCHAR_TABLE*, const WString& name, const::MODIFIERS*);
+    void genModel(const KBDTABLES&, const WString& scancode_to_vk_name, const WString& scancode_to_vk_e0_name, const WString& scancode_to_vk_e1_name, const WString& char_modifiers_name, const WString& dead_keys_name);
+    void genLgToWchar(const LIGATURE1*, size_t count, size_t size, const WString& name, const MODIFIERS*);
+    void genDeadKeys(const DEADKEY*, const WString& name);
+    void genVscToString(const VSC_LPWSTR*, const WString& name, const WString& comment = L"");
+    void genKeyNames(const DEADKEY_LPWSTR*, const WString& name);
+    void genScanToVk(const USHORT* vk, size_t vk_count, const WString& name);
+    void genVscToVk(const VSC_VK*, const WString& name, const WString& comment = L"");
+    void genHexaDump();
+};
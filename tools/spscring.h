@@ -0,0 +1,91 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Lock-free ring buffer with one producer thread and one consumer thread.
+//
+// The producer never blocks: when the ring is full, push() fails and the
+// caller decides what to do. The consumer can wait for new elements.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include <atomic>
+#include <array>
+
+template <typename T, size_t SIZE>
+class SpscRing
+{
+    static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "ring size must be a power of 2");
+
+public:
+    // Constructor.
+    SpscRing() : _items(), _head(0), _tail(0), _signal(0), _closed(false) {}
+
+    // Producer side: push one element. Return false if the ring is full.
+    bool push(const T& item)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) >= SIZE) {
+            return false;
+        }
+        _items[head & (SIZE - 1)] = item;
+        _head.store(head + 1, std::memory_order_release);
+        wakeUp();
+        return true;
+    }
+
+    // Producer side: no more element will be pushed.
+    void close()
+    {
+        _closed.store(true, std::memory_order_release);
+        wakeUp();
+    }
+
+    // Consumer side: pop one element. Return false if the ring is empty.
+    bool pop(T& item)
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = _items[tail & (SIZE - 1)];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: wait until the ring is not empty or closed.
+    // Return false if the ring is closed and empty.
+    bool wait()
+    {
+        for (;;) {
+            const uint32_t signal = _signal.load(std::memory_order_acquire);
+            if (_tail.load(std::memory_order_relaxed) != _head.load(std::memory_order_acquire)) {
+                return true;
+            }
+            if (_closed.load(std::memory_order_acquire)) {
+                return false;
+            }
+            _signal.wait(signal, std::memory_order_acquire);
+        }
+    }
+
+    // Number of elements in the ring, approximate when called by the producer.
+    size_t size() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+
+private:
+    std::array<T, SIZE> _items;
+    alignas(64) std::atomic<size_t> _head;      // Next index to write, owned by producer.
+    alignas(64) std::atomic<size_t> _tail;      // Next index to read, owned by consumer.
+    alignas(64) std::atomic<uint32_t> _signal;  // Incremented on each push or close, to wake up the consumer.
+    std::atomic<bool> _closed;
+
+    void wakeUp()
+    {
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_one();
+    }
+};
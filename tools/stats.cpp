@@ -0,0 +1,242 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Lightweight instrumentation: phase timers, counters, allocation tallies.
+//
+//----------------------------------------------------------------------------
+
+#include "stats.h"
+#include "grid.h"
+
+
+//----------------------------------------------------------------------------
+// Process-wide instance.
+//----------------------------------------------------------------------------
+
+Stats::Stats() :
+    _mutex(),
+    _format(NONE),
+    _timers(),
+    _counters(),
+    _allocs()
+{
+}
+
+Stats& Stats::Instance()
+{
+    static Stats instance;
+    return instance;
+}
+
+
+//----------------------------------------------------------------------------
+// Get the format from a command line option.
+//----------------------------------------------------------------------------
+
+bool Stats::FormatFromOption(OutputFormat& format, const WString& option)
+{
+    if (option == L"--stats" || option == L"--stats=text") {
+        format = TEXT;
+    }
+    else if (option == L"--stats=json") {
+        format = JSON;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+WString Stats::option() const
+{
+    switch (_format) {
+        case TEXT: return L"--stats";
+        case JSON: return L"--stats=json";
+        case NONE:
+        default: return WString();
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Collect statistics.
+//----------------------------------------------------------------------------
+
+void Stats::addTime(const std::string& name, std::chrono::nanoseconds duration)
+{
+    if (enabled()) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        TimeStat& ts(_timers[name]);
+        ts.count++;
+        ts.total += duration;
+        ts.max = std::max(ts.max, duration);
+    }
+}
+
+void Stats::count(const std::string& name, uint64_t increment)
+{
+    if (enabled()) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _counters[name] += increment;
+    }
+}
+
+void Stats::allocate(const std::string& name, size_t bytes)
+{
+    if (enabled()) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        AllocStat& as(_allocs[name]);
+        as.count++;
+        as.bytes += bytes;
+        as.max = std::max<uint64_t>(as.max, bytes);
+    }
+}
+
+void Stats::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _timers.clear();
+    _counters.clear();
+    _allocs.clear();
+}
+
+
+//----------------------------------------------------------------------------
+// Scoped timer.
+//----------------------------------------------------------------------------
+
+Stats::Timer::Timer(const char* name) :
+    _name(name),
+    _enabled(Stats::Instance().enabled()),
+    _start(_enabled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point())
+{
+}
+
+Stats::Timer::~Timer()
+{
+    if (_enabled) {
+        Stats::Instance().addTime(_name, std::chrono::steady_clock::now() - _start);
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Print the statistics.
+//----------------------------------------------------------------------------
+
+void Stats::print(std::ostream& out) const
+{
+    switch (_format) {
+        case TEXT:
+            printText(out);
+            break;
+        case JSON:
+            printJSON(out);
+            break;
+        case NONE:
+        default:
+            break;
+    }
+}
+
+// Format a duration in milliseconds.
+static WString Milliseconds(std::chrono::nanoseconds duration)
+{
+    return Format(L"%.3f", double(duration.count()) / 1000000.0);
+}
+
+// Write a name as a JSON string. Names are free-form UTF-8 strings, the quotes,
+// backslashes and control characters are escaped, as in JsonGenerator.
+static void WriteJSONString(std::ostream& out, const std::string& str)
+{
+    static const char hexdigits[] = "0123456789abcdef";
+    out.put('"');
+    for (const char ch : str) {
+        const uint8_t c = uint8_t(ch);
+        if (c == '"' || c == '\\') {
+            out.put('\\');
+            out.put(ch);
+        }
+        else if (c < 0x20) {
+            out << "\\u00" << hexdigits[c >> 4] << hexdigits[c & 0x0F];
+        }
+        else {
+            out.put(ch);
+        }
+    }
+    out.put('"');
+}
+
+void Stats::printText(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    Grid grid(L"", L"  ");
+
+    if (!_timers.empty()) {
+        grid.addLine({L"Phase", L"Calls", L"Total ms", L"Average ms", L"Max ms"});
+        grid.addUnderlines();
+        for (const auto& it : _timers) {
+            const TimeStat& ts(it.second);
+            grid.addLine({ToUTF16(it.first), Format(L"%llu", ts.count), Milliseconds(ts.total), Milliseconds(ts.total / ts.count), Milliseconds(ts.max)});
+        }
+        grid.addLine({});
+    }
+    if (!_allocs.empty()) {
+        grid.addLine({L"Allocation", L"Count", L"Total bytes", L"Average bytes", L"Max bytes"});
+        grid.addUnderlines();
+        for (const auto& it : _allocs) {
+            const AllocStat& as(it.second);
+            grid.addLine({ToUTF16(it.first), Format(L"%llu", as.count), Format(L"%llu", as.bytes), Format(L"%llu", as.bytes / as.count), Format(L"%llu", as.max)});
+        }
+        grid.addLine({});
+    }
+    if (!_counters.empty()) {
+        grid.addLine({L"Counter", L"Value"});
+        grid.addUnderlines();
+        for (const auto& it : _counters) {
+            grid.addLine({ToUTF16(it.first), Format(L"%llu", it.second)});
+        }
+    }
+    out << std::endl;
+    grid.print(out);
+}
+
+void Stats::printJSON(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    const char* sep = "";
+
+    out << "{\"timers\": {";
+    for (const auto& it : _timers) {
+        const TimeStat& ts(it.second);
+        out << sep;
+        WriteJSONString(out, it.first);
+        out << ": {\"count\": " << ts.count
+            << ", \"total_ms\": " << Milliseconds(ts.total)
+            << ", \"max_ms\": " << Milliseconds(ts.max) << "}";
+        sep = ", ";
+    }
+    sep = "";
+    out << "}, \"allocations\": {";
+    for (const auto& it : _allocs) {
+        const AllocStat& as(it.second);
+        out << sep;
+        WriteJSONString(out, it.first);
+        out << ": {\"count\": " << as.count
+            << ", \"bytes\": " << as.bytes
+            << ", \"max_bytes\": " << as.max << "}";
+        sep = ", ";
+    }
+    sep = "";
+    out << "}, \"counters\": {";
+    for (const auto& it : _counters) {
+        out << sep;
+        WriteJSONString(out, it.first);
+        out << ": " << it.second;
+        sep = ", ";
+    }
+    out << "}}" << std::endl;
+}
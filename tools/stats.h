@@ -0,0 +1,101 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Lightweight instrumentation: phase timers, counters, allocation tallies.
+//
+// Statistics are collected only when enabled, typically using option
+// --stats in command line tools. When disabled, each probe costs a test.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "strutils.h"
+#include <chrono>
+#include <mutex>
+
+class Stats
+{
+public:
+    // Get the process-wide instance.
+    static Stats& Instance();
+
+    // Output format of the statistics. NONE means disabled.
+    enum OutputFormat {NONE, TEXT, JSON};
+
+    // Get the format from a command line option: --stats, --stats=text, --stats=json.
+    // Return false if this is not a statistics option.
+    static bool FormatFromOption(OutputFormat& format, const WString& option);
+
+    // Get the command line option which selects the current format, empty if disabled.
+    // Useful to propagate the option to a child process.
+    WString option() const;
+
+    // Enable or disable statistics.
+    void setFormat(OutputFormat format) { _format = format; }
+    OutputFormat format() const { return _format; }
+    bool enabled() const { return _format != NONE; }
+
+    // Record the duration of one execution of a named phase.
+    void addTime(const std::string& name, std::chrono::nanoseconds duration);
+
+    // Increment a named counter.
+    void count(const std::string& name, uint64_t increment = 1);
+
+    // Record an allocation of a named object.
+    void allocate(const std::string& name, size_t bytes);
+
+    // Clear all statistics.
+    void clear();
+
+    // Print the statistics in the selected format.
+    void print(std::ostream& out) const;
+
+    // A scoped timer, record the duration of a phase in its destructor.
+    class Timer
+    {
+    public:
+        Timer(const char* name);
+        ~Timer();
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+    private:
+        const char* _name;
+        bool        _enabled;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+private:
+    // Statistics on a timer.
+    class TimeStat
+    {
+    public:
+        uint64_t                 count = 0;
+        std::chrono::nanoseconds total = std::chrono::nanoseconds::zero();
+        std::chrono::nanoseconds max = std::chrono::nanoseconds::zero();
+    };
+
+    // Statistics on an allocated object.
+    class AllocStat
+    {
+    public:
+        uint64_t count = 0;
+        uint64_t bytes = 0;
+        uint64_t max = 0;
+    };
+
+    Stats();
+    Stats(const Stats&) = delete;
+    Stats& operator=(const Stats&) = delete;
+
+    mutable std::mutex               _mutex;
+    OutputFormat                     _format;
+    std::map<std::string, TimeStat>  _timers;
+    std::map<std::string, uint64_t>  _counters;
+    std::map<std::string, AllocStat> _allocs;
+
+    void printText(std::ostream& out) const;
+    void printJSON(std::ostream& out) const;
+};
@@ -17,27 +17,39 @@
 // Format a C++ string in a printf-way.
 //---------------------------------------------------------------------------
 
+static void AppendFormatList(WString& str, const wchar_t* fmt, va_list ap)
+{
+    // Get required output size.
+    va_list ap2;
+    va_copy(ap2, ap);
+    int len = _vsnwprintf(nullptr, 0, fmt, ap2);
+    va_end(ap2);
+
+    if (len > 0) {
+        // Actual formatting, directly at end of string.
+        const size_t start = str.size();
+        str.resize(start + len + 1);
+        len = _vsnwprintf(&str[start], len + 1, fmt, ap);
+        str.resize(start + std::max(0, len));
+    }
+}
+
 WString Format(const wchar_t* fmt, ...)
 {
+    WString buf;
     va_list ap;
-
-    // Get required output size.
     va_start(ap, fmt);
-    int len = _vsnwprintf(nullptr, 0, fmt, ap);
+    AppendFormatList(buf, fmt, ap);
     va_end(ap);
+    return buf;
+}
 
-    if (len < 0) {
-        return WString(); // error
-    }
-
-    // Actual formatting.
-    WString buf(len + 1, '\0');
+void AppendFormat(WString& str, const wchar_t* fmt, ...)
+{
+    va_list ap;
     va_start(ap, fmt);
-    len = _vsnwprintf(&buf[0], buf.size(), fmt, ap);
+    AppendFormatList(str, fmt, ap);
     va_end(ap);
-
-    buf.resize(std::min<size_t>(buf.size(), std::max(0, len)));
-    return buf;
 }
 
 
@@ -147,12 +159,19 @@ namespace {
 }
 
 WString WStringLiteral(const wchar_t* value)
+{
+    WString str;
+    AppendWStringLiteral(str, value);
+    return str;
+}
+
+void AppendWStringLiteral(WString& str, const wchar_t* value)
 {
     if (value == nullptr) {
-        return L"NULL";
+        str.append(L"NULL");
     }
     else {
-        WString str(L"L\"");
+        str.append(L"L\"");
         for (; *value != 0; ++value) {
             const auto it = wchar_literals.find(*value);
             if (it != wchar_literals.end()) {
@@ -162,11 +181,10 @@ WString WStringLiteral(const wchar_t* value)
                 str.push_back(*value);
             }
             else {
-                str.append(Format(L"\\x%04x", *value));
+                AppendFormat(str, L"\\x%04x", *value);
             }
         }
         str.push_back(L'"');
-        return str;
     }
 }
 
@@ -177,32 +195,98 @@ WString WStringLiteral(const wchar_t* value)
 
 WString ToUTF16(const std::string& str)
 {
-    if (str.empty()) {
-        return WString();
+    WString out;
+    AppendUTF16(out, str.data(), str.size());
+    return out;
+}
+
+std::string ToUTF8(const WString& str)
+{
+    std::string out;
+    AppendUTF8(out, str.data(), str.size());
+    return out;
+}
+
+void AppendUTF16(WString& out, const char* str, size_t size)
+{
+    // Most strings are ASCII only, copy the ASCII prefix without conversion.
+    size_t ascii = 0;
+    while (ascii < size && (str[ascii] & 0x80) == 0) {
+        ascii++;
     }
-    else {
+    out.append(str, str + ascii);
+    if (ascii < size) {
         // The UTF-16 string cannot have more characters than the UTF-8 one.
-        WString out(str.size(), 0);
-        const size_t size = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), int(str.size()), &out[0], int(out.size()));
-        out.resize(std::min(size, out.size()));
-        return out;
+        const size_t start = out.size();
+        out.resize(start + size - ascii);
+        const size_t len = MultiByteToWideChar(CP_UTF8, 0, str + ascii, int(size - ascii), &out[start], int(size - ascii));
+        out.resize(start + std::min(len, size - ascii));
     }
 }
 
-std::string ToUTF8(const WString& str)
+void AppendUTF8(std::string& out, const wchar_t* str, size_t size)
 {
-    if (str.empty()) {
-        return std::string();
+    size_t ascii = 0;
+    while (ascii < size && str[ascii] < 0x80) {
+        ascii++;
     }
-    else {
+    const size_t start = out.size();
+    out.resize(start + ascii);
+    for (size_t i = 0; i < ascii; ++i) {
+        out[start + i] = char(str[i]);
+    }
+    if (ascii < size) {
         // There is at most 4 bytes per Unicode character.
-        std::string out(4 * str.size(), 0);
-        const size_t size = WideCharToMultiByte(CP_UTF8, 0, str.c_str(), int(str.size()), &out[0], int(out.size()), nullptr, nullptr);
-        out.resize(std::min(size, out.size()));
-        return out;
+        const size_t max = 4 * (size - ascii);
+        out.resize(start + ascii + max);
+        const size_t len = WideCharToMultiByte(CP_UTF8, 0, str + ascii, int(size - ascii), &out[start + ascii], int(max), nullptr, nullptr);
+        out.resize(start + ascii + std::min(len, max));
     }
 }
 
+std::ostream& WriteUTF8(std::ostream& stream, const wchar_t* str, size_t size)
+{
+    // Convert by chunks in a local buffer. Never split a surrogate pair.
+    constexpr size_t CHUNK = 128;
+    char buffer[4 * CHUNK];
+    while (size > 0) {
+        size_t count = std::min(size, CHUNK);
+        if (count < size && count > 1 && str[count - 1] >= 0xD800 && str[count - 1] < 0xDC00) {
+            count--;
+        }
+        size_t len = 0;
+        while (len < count && str[len] < 0x80) {
+            buffer[len] = char(str[len]);
+            len++;
+        }
+        if (len < count) {
+            len += WideCharToMultiByte(CP_UTF8, 0, str + len, int(count - len), buffer + len, int(sizeof(buffer) - len), nullptr, nullptr);
+        }
+        stream.write(buffer, len);
+        str += count;
+        size -= count;
+    }
+    return stream;
+}
+
+WString Concat(const char* s1, size_t size1, const wchar_t* s2, size_t size2)
+{
+    WString out;
+    out.reserve(size1 + size2);
+    AppendUTF16(out, s1, size1);
+    out.append(s2, size2);
+    return out;
+}
+
+WString Concat(const wchar_t* s1, size_t size1, const char* s2, size_t size2)
+{
+    WString out;
+    out.reserve(size1 + size2);
+    out.append(s1, size1);
+    AppendUTF16(out, s2, size2);
+    return out;
+}
+
 
 //---------------------------------------------------------------------------
 // Check if a memory area is not empty and full of zeroes.
@@ -18,6 +18,9 @@ typedef std::wstring WString;
 // Use "%s" for wchar_t* arguments and "%S" for char* arguments.
 WString Format(const wchar_t* fmt, ...);
 
+// Same as Format() but append to an existing string, without intermediate string.
+void AppendFormat(WString& str, const wchar_t* fmt, ...);
+
 // Length of a string. Size in bytes of it (including trailing null).
 size_t WStringLength(const wchar_t*);
 size_t WStringSize(const wchar_t*);
@@ -40,9 +43,14 @@ bool EndsWith(const WString&, const WString& suffix);
 // Format a WString literal, as used in a C/C++ source file.
 WString WStringLiteral(const wchar_t*);
 inline WString WStringLiteral(const WString& s) { return WStringLiteral(s.c_str()); }
+void AppendWStringLiteral(WString& str, const wchar_t* value);
 
 // Decode a string as an integer. Return 0 on error.
 inline int ToInt(const WString& str) { return _wtoi(str.c_str()); }
+inline int64_t ToInt64(const WString& str) { return _wtoi64(str.c_str()); }
+
+// Check if a string is a non-empty sequence of decimal digits.
+inline bool IsDecimal(const WString& str) { return !str.empty() && str.find_first_not_of(L"0123456789") == WString::npos; }
 
 // Decode an hexa value with error checking.
 template <typename INT_T, typename std::enable_if<std::is_integral<INT_T>::value, int>::type = 0>
@@ -68,14 +76,26 @@ bool IsZero(const void* base, const void* end);
 WString ToUTF16(const std::string&);
 std::string ToUTF8(const WString&);
 
-inline std::ostream& operator<<(std::ostream& stream, const WString& s) { return stream << ToUTF8(s); }
-inline std::ostream& operator<<(std::ostream& stream, const wchar_t* s) { return stream << ToUTF8(s); }
-inline WString operator+(const std::string& s1, const WString& s2) { return ToUTF16(s1) + s2; }
-inline WString operator+(const WString& s1, const std::string& s2) { return s1 + ToUTF16(s2); }
-inline WString operator+(const char* s1, const WString& s2) { return ToUTF16(s1) + s2; }
-inline WString operator+(const WString& s1, const char* s2) { return s1 + ToUTF16(s2); }
-inline WString operator+(const std::string& s1, const wchar_t* s2) { return ToUTF16(s1) + s2; }
-inline WString operator+(const wchar_t* s1, const std::string& s2) { return s1 + ToUTF16(s2); }
+// Append UTF-8 / UTF-16 conversions to an existing string, without intermediate string.
+// ASCII characters are directly copied.
+void AppendUTF16(WString& out, const char* str, size_t size);
+void AppendUTF8(std::string& out, const wchar_t* str, size_t size);
+
+// Concatenation of 8-bit and 16-bit strings, one single allocation.
+WString Concat(const char* s1, size_t size1, const wchar_t* s2, size_t size2);
+WString Concat(const wchar_t* s1, size_t size1, const char* s2, size_t size2);
+
+// Write a UTF-16 string in UTF-8 on a stream, without intermediate string.
+std::ostream& WriteUTF8(std::ostream& stream, const wchar_t* str, size_t size);
+
+inline std::ostream& operator<<(std::ostream& stream, const WString& s) { return WriteUTF8(stream, s.data(), s.size()); }
+inline std::ostream& operator<<(std::ostream& stream, const wchar_t* s) { return WriteUTF8(stream, s, WStringLength(s)); }
+inline WString operator+(const std::string& s1, const WString& s2) { return Concat(s1.data(), s1.size(), s2.data(), s2.size()); }
+inline WString operator+(const WString& s1, const std::string& s2) { return Concat(s1.data(), s1.size(), s2.data(), s2.size()); }
+inline WString operator+(const char* s1, const WString& s2) { return Concat(s1, strlen(s1), s2.data(), s2.size()); }
+inline WString operator+(const WString& s1, const char* s2) { return Concat(s1.data(), s1.size(), s2, strlen(s2)); }
+inline WString operator+(const std::string& s1, const wchar_t* s2) { return Concat(s1.data(), s1.size(), s2, wcslen(s2)); }
+inline WString operator+(const wchar_t* s1, const std::string& s2) { return Concat(s1, wcslen(s1), s2.data(), s2.size()); }
 
 // String container types.
 typedef std::vector<WString> WStringVector;
@@ -0,0 +1,239 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Concurrent execution of independent tasks, typically one per input file.
+//
+//----------------------------------------------------------------------------
+
+#include "taskrunner.h"
+#include "stats.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+
+//----------------------------------------------------------------------------
+// Task error reporter constructor.
+//----------------------------------------------------------------------------
+
+TaskError::TaskError(const Error& parent) :
+    Error(),
+    _messages(),
+    _errors(0),
+    _warnings(0),
+    _muted(false)
+{
+    setVerbose(parent.verbose());
+}
+
+
+//----------------------------------------------------------------------------
+// Buffer messages.
+//----------------------------------------------------------------------------
+
+void TaskError::add(Severity severity, const std::string& text) const
+{
+    if (!_muted) {
+        _messages.push_back({severity, text});
+        if (severity == MSG_ERROR) {
+            _errors++;
+        }
+        else if (severity == MSG_WARNING) {
+            _warnings++;
+        }
+    }
+}
+
+void TaskError::error(const std::string& msg) const
+{
+    add(MSG_ERROR, msg);
+}
+
+void TaskError::error(const WString& msg) const
+{
+    add(MSG_ERROR, ToUTF8(msg));
+}
+
+void TaskError::warning(const std::string& msg) const
+{
+    add(MSG_WARNING, msg);
+}
+
+void TaskError::warning(const WString& msg) const
+{
+    add(MSG_WARNING, ToUTF8(msg));
+}
+
+void TaskError::info(const std::string& msg) const
+{
+    add(MSG_INFO, msg);
+}
+
+void TaskError::info(const WString& msg) const
+{
+    add(MSG_INFO, ToUTF8(msg));
+}
+
+void TaskError::verbose(const std::string& msg) const
+{
+    if (verbose()) {
+        add(MSG_VERBOSE, msg);
+    }
+}
+
+void TaskError::verbose(const WString& msg) const
+{
+    if (verbose()) {
+        add(MSG_VERBOSE, ToUTF8(msg));
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Abort the task.
+//----------------------------------------------------------------------------
+
+[[noreturn]] void TaskError::fatal(const WString& message)
+{
+    error(message);
+    throw Abort(EXIT_FAILURE);
+}
+
+[[noreturn]] void TaskError::exit(int status)
+{
+    throw Abort(status);
+}
+
+
+//----------------------------------------------------------------------------
+// Forward all buffered messages to another error reporter.
+//----------------------------------------------------------------------------
+
+void TaskError::flush(const Error& err)
+{
+    for (const auto& msg : _messages) {
+        switch (msg.severity) {
+            case MSG_ERROR:
+                err.error(msg.text);
+                break;
+            case MSG_WARNING:
+                err.warning(msg.text);
+                break;
+            case MSG_INFO:
+                err.info(msg.text);
+                break;
+            case MSG_VERBOSE:
+                err.verbose(msg.text);
+                break;
+        }
+    }
+    _messages.clear();
+}
+
+
+//----------------------------------------------------------------------------
+// Task runner constructor.
+//----------------------------------------------------------------------------
+
+TaskRunner::TaskRunner(Error& err) :
+    threads(std::max<size_t>(1, std::thread::hardware_concurrency())),
+    _err(err),
+    _tasks(0),
+    _failed(0),
+    _errors(0),
+    _warnings(0)
+{
+}
+
+
+//----------------------------------------------------------------------------
+// Run tasks.
+//----------------------------------------------------------------------------
+
+bool TaskRunner::run(size_t count, const Task& task, const Completion& completion)
+{
+    Stats::Timer timer("tasks");
+    Stats::Instance().count("tasks", count);
+
+    _tasks = count;
+    _failed = _errors = _warnings = 0;
+
+    // Completed tasks, waiting for all previous tasks to complete.
+    std::vector<std::unique_ptr<TaskError>> reports(count);
+    std::vector<bool> success(count, false);
+    size_t next_report = 0;
+    std::mutex mutex;
+
+    std::atomic<size_t> next_task(0);
+    const auto worker = [&]() {
+        for (size_t index; (index = next_task++) < count; ) {
+            auto report = std::make_unique<TaskError>(_err);
+            bool ok = false;
+            try {
+                ok = task(index, *report);
+            }
+            catch (const TaskError::Abort& abort) {
+                ok = abort.status == EXIT_SUCCESS;
+            }
+            catch (const std::exception& e) {
+                report->error("unexpected exception: " + std::string(e.what()));
+                ok = false;
+            }
+            catch (...) {
+                // Never let an exception escape from a thread, this would terminate the process.
+                report->error("unexpected exception");
+                ok = false;
+            }
+
+            // Report all consecutive completed tasks, in order.
+            std::lock_guard<std::mutex> lock(mutex);
+            reports[index] = std::move(report);
+            success[index] = ok;
+            while (next_report < count && reports[next_report] != nullptr) {
+                TaskError& done(*reports[next_report]);
+                done.flush(_err);
+                _errors += done.errorCount();
+                _warnings += done.warningCount();
+                if (!success[next_report]) {
+                    _failed++;
+                }
+                if (completion != nullptr) {
+                    completion(next_report, success[next_report]);
+                }
+                reports[next_report].reset();
+                next_report++;
+            }
+        }
+    };
+
+    // With one thread, run in the current thread.
+    const size_t thread_count = std::min(std::max<size_t>(1, threads), count);
+    if (thread_count <= 1) {
+        worker();
+    }
+    else {
+        std::vector<std::thread> pool;
+        for (size_t i = 0; i < thread_count; ++i) {
+            pool.emplace_back(worker);
+        }
+        for (auto& thread : pool) {
+            thread.join();
+        }
+    }
+    Stats::Instance().count("failed tasks", _failed);
+    return _failed == 0;
+}
+
+
+//----------------------------------------------------------------------------
+// Report a summary of the last run().
+//----------------------------------------------------------------------------
+
+void TaskRunner::summary(const WString& what) const
+{
+    _err.info(Format(L"%llu %s, %llu failed, %llu errors, %llu warnings", uint64_t(_tasks), what.c_str(), uint64_t(_failed), uint64_t(_errors), uint64_t(_warnings)));
+}
@@ -0,0 +1,117 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Concurrent execution of independent tasks, typically one per input file.
+//
+// Each task reports its messages through its own TaskError, a buffer which
+// is owned by the worker thread and never locked. When a task completes,
+// its messages are forwarded to the main error reporter, in task order,
+// after the messages of all previous tasks. The output is consequently the
+// same as a sequential execution, whatever the number of threads.
+//
+// A fatal error in a task aborts this task only, the other tasks continue.
+// A call to exit() in a task ends this task only, as a success if the status
+// is EXIT_SUCCESS. Any other exception from a task is reported as an error
+// of this task.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "error.h"
+#include <functional>
+
+class TaskError : public Error
+{
+public:
+    // Constructor. The verbose mode is inherited from the parent.
+    TaskError(const Error& parent);
+
+    // Exception which is thrown by fatal() and exit() to abort the task.
+    class Abort
+    {
+    public:
+        int status;  // Exit status, EXIT_FAILURE after fatal().
+
+        // Constructor.
+        Abort(int s = EXIT_FAILURE) : status(s) {}
+    };
+
+    // Report a message, buffered until flush().
+    using Error::verbose;
+    virtual void error(const std::string& msg) const override;
+    virtual void error(const WString& msg) const override;
+    virtual void warning(const std::string& msg) const override;
+    virtual void warning(const WString& msg) const override;
+    virtual void info(const std::string& msg) const override;
+    virtual void info(const WString& msg) const override;
+    virtual void verbose(const std::string& msg) const override;
+    virtual void verbose(const WString& msg) const override;
+
+    // Temporary mute errors.
+    virtual void muteErrors() override { _muted = true; }
+    virtual void restoreErrors() override { _muted = false; }
+
+    // Report a fatal error and abort the task, not the process.
+    [[noreturn]] virtual void fatal(const WString& message) override;
+    [[noreturn]] virtual void exit(int status = EXIT_SUCCESS) override;
+
+    // Number of reported errors and warnings.
+    size_t errorCount() const { return _errors; }
+    size_t warningCount() const { return _warnings; }
+
+    // Forward all buffered messages to another error reporter and clear the buffer.
+    void flush(const Error& err);
+
+private:
+    enum Severity {MSG_ERROR, MSG_WARNING, MSG_INFO, MSG_VERBOSE};
+    struct Message {
+        Severity    severity;
+        std::string text;
+    };
+    mutable std::vector<Message> _messages;
+    mutable size_t _errors;
+    mutable size_t _warnings;
+    bool           _muted;
+
+    // Buffer a message.
+    void add(Severity severity, const std::string& text) const;
+};
+
+class TaskRunner
+{
+public:
+    // Constructor. Specify where to report the messages of all tasks.
+    TaskRunner(Error& err);
+
+    // Number of worker threads, default is the number of processors.
+    size_t threads;
+
+    // A task receives its index and its error reporter. It returns false on error.
+    using Task = std::function<bool(size_t index, TaskError& err)>;
+
+    // Function which is called in task order when a task is completed, after
+    // its messages are reported. It is never called concurrently.
+    using Completion = std::function<void(size_t index, bool success)>;
+
+    // Run tasks, from index 0 to count-1. Return false if at least one task failed.
+    bool run(size_t count, const Task& task, const Completion& completion = nullptr);
+
+    // Statistics of the last run().
+    size_t tasks() const { return _tasks; }
+    size_t failed() const { return _failed; }
+    size_t errors() const { return _errors; }
+    size_t warnings() const { return _warnings; }
+
+    // Report a summary of the last run(), "what" is the name of the tasks.
+    void summary(const WString& what = L"tasks") const;
+
+private:
+    Error& _err;
+    size_t _tasks;
+    size_t _failed;
+    size_t _errors;
+    size_t _warnings;
+};
@@ -0,0 +1,237 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Typing effort metrics of a text on a keyboard layout.
+//
+//----------------------------------------------------------------------------
+
+#include "typingeffort.h"
+#include <bit>
+
+// Scan codes of the home row keys, left pinky to right pinky, and their fingers.
+static const struct {
+    uint16_t            sc;
+    KeyGeometry::Finger finger;
+} home_keys[] = {
+    {0x1E, KeyGeometry::LEFT_PINKY},
+    {0x1F, KeyGeometry::LEFT_RING},
+    {0x20, KeyGeometry::LEFT_MIDDLE},
+    {0x21, KeyGeometry::LEFT_INDEX},
+    {0x22, KeyGeometry::LEFT_INDEX},
+    {0x23, KeyGeometry::RIGHT_INDEX},
+    {0x24, KeyGeometry::RIGHT_INDEX},
+    {0x25, KeyGeometry::RIGHT_MIDDLE},
+    {0x26, KeyGeometry::RIGHT_RING},
+    {0x27, KeyGeometry::RIGHT_PINKY},
+};
+
+// Keys which define the right edge of the main block: Backspace, Enter, backslash, right Shift.
+static const uint16_t right_edge_keys[] = {0x0E, 0x1C, 0x2B, 0x36};
+
+// Scan code of the space bar.
+#define SC_SPACE 0x39
+
+
+//----------------------------------------------------------------------------
+// Key geometry.
+//----------------------------------------------------------------------------
+
+KeyGeometry::KeyGeometry() :
+    _valid(false),
+    _home_row(NO_ROW),
+    _fingers(),
+    _rows()
+{
+    _fingers.fill(NO_FINGER);
+    _rows.fill(NO_ROW);
+}
+
+bool KeyGeometry::build(const KeyboardMap& map)
+{
+    _valid = false;
+    _home_row = NO_ROW;
+    _fingers.fill(NO_FINGER);
+    _rows.fill(NO_ROW);
+
+    // Locate the home row keys and the right edge of the main block. Columns are doubled to keep cell centers exact.
+    std::array<size_t, std::size(home_keys)> home_centers;
+    home_centers.fill(SIZE_MAX);
+    size_t right_edge = 0;
+    uint8_t row = 0;
+    for (const auto& line : map.lines()) {
+        for (const auto& cell : line.cells) {
+            if (!cell.extended) {
+                for (size_t i = 0; i < std::size(home_keys); ++i) {
+                    if (cell.scancode == home_keys[i].sc) {
+                        home_centers[i] = 2 * cell.column + cell.width;
+                        _home_row = row;
+                    }
+                }
+                for (uint16_t sc : right_edge_keys) {
+                    if (cell.scancode == sc) {
+                        right_edge = std::max(right_edge, cell.column + cell.width);
+                    }
+                }
+            }
+        }
+        if (!line.cells.empty()) {
+            row++;
+        }
+    }
+    if (_home_row == NO_ROW || std::find(home_centers.begin(), home_centers.end(), SIZE_MAX) != home_centers.end()) {
+        return false;
+    }
+
+    // Assign a row and a finger to all keys in the main block.
+    row = 0;
+    for (const auto& line : map.lines()) {
+        for (const auto& cell : line.cells) {
+            const size_t index = (cell.scancode & 0xFF) | (cell.extended ? 0x100 : 0);
+            if (cell.column + cell.width <= right_edge) {
+                _rows[index] = row;
+                if (cell.scancode == SC_SPACE && !cell.extended) {
+                    _fingers[index] = THUMB;
+                }
+                else {
+                    const size_t center = 2 * cell.column + cell.width;
+                    size_t best = 0;
+                    for (size_t i = 1; i < std::size(home_keys); ++i) {
+                        const size_t dist = center > home_centers[i] ? center - home_centers[i] : home_centers[i] - center;
+                        const size_t best_dist = center > home_centers[best] ? center - home_centers[best] : home_centers[best] - center;
+                        if (dist < best_dist) {
+                            best = i;
+                        }
+                    }
+                    _fingers[index] = home_keys[best].finger;
+                }
+            }
+        }
+        if (!line.cells.empty()) {
+            row++;
+        }
+    }
+    _valid = true;
+    return true;
+}
+
+
+//----------------------------------------------------------------------------
+// Typing effort counters.
+//----------------------------------------------------------------------------
+
+TypingEffort::TypingEffort() :
+    characters(0),
+    unreachable(0),
+    keystrokes(0),
+    modifiers(0),
+    shifted(0),
+    altgr(0),
+    dead_keys(0),
+    home_row(0),
+    bigrams(0),
+    same_finger(0),
+    row_jumps(0),
+    alternations(0),
+    fingers()
+{
+}
+
+void TypingEffort::merge(const TypingEffort& other)
+{
+    characters += other.characters;
+    unreachable += other.unreachable;
+    keystrokes += other.keystrokes;
+    modifiers += other.modifiers;
+    shifted += other.shifted;
+    altgr += other.altgr;
+    dead_keys += other.dead_keys;
+    home_row += other.home_row;
+    bigrams += other.bigrams;
+    same_finger += other.same_finger;
+    row_jumps += other.row_jumps;
+    alternations += other.alternations;
+    for (size_t i = 0; i < fingers.size(); ++i) {
+        fingers[i] += other.fingers[i];
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// Analyze the typing effort of a text.
+//----------------------------------------------------------------------------
+
+EffortAnalyzer::EffortAnalyzer(const InverseKeyMap& imap, const KeyGeometry& geometry) :
+    _imap(imap),
+    _geometry(geometry)
+{
+}
+
+void EffortAnalyzer::analyze(const char32_t* text, size_t count, TypingEffort& effort) const
+{
+    const bool geometry = _geometry.isValid();
+    Keystroke previous;
+    bool has_previous = false;
+
+    for (size_t ci = 0; ci < count; ++ci) {
+        // Carriage returns are ignored, as in InverseKeyMap::translate().
+        if (text[ci] == U'\r') {
+            continue;
+        }
+        effort.characters++;
+        const KeySequence* seq = _imap.find(text[ci]);
+        if (seq == nullptr) {
+            effort.unreachable++;
+            has_previous = false;
+            continue;
+        }
+        if (seq->count > 1) {
+            effort.dead_keys++;
+        }
+
+        for (size_t ki = 0; ki < seq->count; ++ki) {
+            const Keystroke& key(seq->keys[ki]);
+            effort.keystrokes++;
+            effort.modifiers += size_t(std::popcount(unsigned(key.mods & (KBDSHIFT | KBDCTRL | KBDALT))));
+            if ((key.mods & KBDSHIFT) != 0) {
+                effort.shifted++;
+            }
+            if ((key.mods & (KBDCTRL | KBDALT)) == (KBDCTRL | KBDALT)) {
+                effort.altgr++;
+            }
+            if (!geometry) {
+                continue;
+            }
+
+            const KeyGeometry::Finger finger = _geometry.finger(key);
+            const uint8_t row = _geometry.row(key);
+            if (row == _geometry.homeRow()) {
+                effort.home_row++;
+            }
+            if (finger == KeyGeometry::NO_FINGER) {
+                has_previous = false;
+                continue;
+            }
+            effort.fingers[finger]++;
+
+            if (has_previous) {
+                const KeyGeometry::Finger pfinger = _geometry.finger(previous);
+                const uint8_t prow = _geometry.row(previous);
+                effort.bigrams++;
+                if (finger == pfinger && finger != KeyGeometry::THUMB && (key.sc != previous.sc || key.flags != previous.flags)) {
+                    effort.same_finger++;
+                }
+                if ((row > prow ? row - prow : prow - row) >= 2) {
+                    effort.row_jumps++;
+                }
+                if (finger != KeyGeometry::THUMB && pfinger != KeyGeometry::THUMB && (finger < KeyGeometry::THUMB) != (pfinger < KeyGeometry::THUMB)) {
+                    effort.alternations++;
+                }
+            }
+            previous = key;
+            has_previous = true;
+        }
+    }
+}
@@ -0,0 +1,96 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Typing effort metrics of a text on a keyboard layout.
+//
+// The finger and row of each key are deduced from a keyboard map template.
+// Rows are the template lines which contain keys. In the main block of keys
+// (up to the right edge of Backspace, Enter and right Shift), each key is
+// assigned to the finger of the nearest home row key (1E to 27, touch typing
+// positions), the space bar to the thumbs. Other keys have no finger.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "kbdmap.h"
+#include "inversekeymap.h"
+
+// Finger and row of each key.
+class KeyGeometry
+{
+public:
+    // Constructor.
+    KeyGeometry();
+
+    // Fingers, left to right.
+    enum Finger : uint8_t {
+        LEFT_PINKY, LEFT_RING, LEFT_MIDDLE, LEFT_INDEX, THUMB,
+        RIGHT_INDEX, RIGHT_MIDDLE, RIGHT_RING, RIGHT_PINKY, NO_FINGER
+    };
+    static constexpr size_t FINGER_COUNT = NO_FINGER;
+    static constexpr uint8_t NO_ROW = 0xFF;
+
+    // Build the geometry from a compiled keyboard map template. Return false if the home row is not found.
+    bool build(const KeyboardMap& map);
+
+    // Check if a geometry is available.
+    bool isValid() const { return _valid; }
+
+    // Home row index.
+    uint8_t homeRow() const { return _home_row; }
+
+    // Finger and row of a keystroke.
+    Finger finger(const Keystroke& key) const { return Finger(_fingers[Index(key)]); }
+    uint8_t row(const Keystroke& key) const { return _rows[Index(key)]; }
+
+private:
+    bool                     _valid;
+    uint8_t                  _home_row;
+    std::array<uint8_t, 512> _fingers;  // Indexed by scan code, +256 with E0 prefix.
+    std::array<uint8_t, 512> _rows;
+
+    static size_t Index(const Keystroke& key) { return key.sc | ((key.flags & Keystroke::PREFIX_0) != 0 ? 0x100 : 0); }
+};
+
+// Typing effort counters. Bigrams are pairs of consecutive keystrokes on keys with a finger.
+class TypingEffort
+{
+public:
+    // Constructor.
+    TypingEffort();
+
+    uint64_t characters;    // Characters in text, excluding carriage returns.
+    uint64_t unreachable;   // Characters which cannot be typed.
+    uint64_t keystrokes;    // Keystrokes, excluding modifiers.
+    uint64_t modifiers;     // Modifier keys pressed with keystrokes.
+    uint64_t shifted;       // Keystrokes with Shift.
+    uint64_t altgr;         // Keystrokes with AltGr (Ctrl+Alt).
+    uint64_t dead_keys;     // Characters typed using a dead key.
+    uint64_t home_row;      // Keystrokes on the home row.
+    uint64_t bigrams;       // Pairs of consecutive keystrokes, with a finger.
+    uint64_t same_finger;   // Bigrams on two different keys with the same finger.
+    uint64_t row_jumps;     // Bigrams on rows which are two rows apart or more.
+    uint64_t alternations;  // Bigrams using the two hands.
+    std::array<uint64_t, KeyGeometry::FINGER_COUNT> fingers;  // Keystrokes per finger.
+
+    // Add the counters of another instance.
+    void merge(const TypingEffort& other);
+};
+
+// Analyze the typing effort of texts on one layout.
+class EffortAnalyzer
+{
+public:
+    // Constructor. The geometry may be invalid, the finger and row metrics are then not computed.
+    EffortAnalyzer(const InverseKeyMap& imap, const KeyGeometry& geometry);
+
+    // Analyze a sequence of code points and accumulate the metrics.
+    void analyze(const char32_t* text, size_t count, TypingEffort& effort) const;
+
+private:
+    const InverseKeyMap& _imap;
+    const KeyGeometry&   _geometry;
+};
@@ -0,0 +1,99 @@
+//----------------------------------------------------------------------------
+//
+// Windows Keyboards Layouts (WKL)
+// Copyright (c) 2023, Thierry Lelegard
+// BSD-2-Clause license, see the LICENSE file.
+//
+// Fast inline UTF-8 decoder, for large text streams.
+//
+//----------------------------------------------------------------------------
+
+#pragma once
+#include "platform.h"
+
+// Status of DecodeUTF8().
+enum UTF8Status {UTF8_OK, UTF8_INVALID, UTF8_TRUNCATED};
+
+// Decode one UTF-8 sequence and advance cur after it.
+// On invalid sequence, skip one byte. On truncated sequence, cur is unchanged.
+// A sequence is truncated only when all its bytes before the end are valid.
+inline UTF8Status DecodeUTF8(const uint8_t*& cur, const uint8_t* end, char32_t& cp)
+{
+    cp = *cur;
+    if (cp < 0x80) {
+        cur++;
+        return UTF8_OK;
+    }
+    size_t len = 0;
+    if (cp >= 0xC2 && cp < 0xE0) {
+        len = 2;
+        cp &= 0x1F;
+    }
+    else if (cp >= 0xE0 && cp < 0xF0) {
+        len = 3;
+        cp &= 0x0F;
+    }
+    else if (cp >= 0xF0 && cp < 0xF5) {
+        len = 4;
+        cp &= 0x07;
+    }
+    else {
+        cur++;
+        return UTF8_INVALID;
+    }
+    // Validate the available bytes first: an invalid sequence is never reported as truncated.
+    // The second byte also excludes overlong sequences, surrogates and values out of range.
+    const size_t avail = std::min(len, size_t(end - cur));
+    for (size_t i = 1; i < avail; ++i) {
+        if ((cur[i] & 0xC0) != 0x80) {
+            cur++;
+            return UTF8_INVALID;
+        }
+    }
+    if (avail > 1 && ((cur[0] == 0xE0 && cur[1] < 0xA0) || (cur[0] == 0xED && cur[1] >= 0xA0) ||
+                      (cur[0] == 0xF0 && cur[1] < 0x90) || (cur[0] == 0xF4 && cur[1] >= 0x90))) {
+        cur++;
+        return UTF8_INVALID;
+    }
+    if (avail < len) {
+        return UTF8_TRUNCATED;
+    }
+    for (size_t i = 1; i < len; ++i) {
+        cp = (cp << 6) | (cur[i] & 0x3F);
+    }
+    // Reject overlong sequences, surrogates and values out of the Unicode range.
+    if ((len == 3 && (cp < 0x800 || (cp >= 0xD800 && cp < 0xE000))) || (len == 4 && (cp < 0x10000 || cp >= 0x110000))) {
+        cur++;
+        return UTF8_INVALID;
+    }
+    cur += len;
+    return UTF8_OK;
+}
+
+// Check if a byte starts a UTF-8 sequence (is not a continuation byte).
+inline bool IsUTF8Start(uint8_t c)
+{
+    return (c & 0xC0) != 0x80;
+}
+
+// A range of UTF-8 text, starting and ending on sequence boundaries.
+class TextChunk
+{
+public:
+    const char* data;
+    size_t      size;
+};
+
+// Split UTF-8 text in chunks of approximately the same size, on sequence boundaries.
+// The chunks are appended to a vector.
+inline void SplitUTF8(std::vector<TextChunk>& chunks, const char* data, size_t size, size_t chunk_size)
+{
+    for (size_t start = 0; start < size; ) {
+        size_t end = std::min(size, start + std::max<size_t>(1, chunk_size));
+        while (end < size && !IsUTF8Start(uint8_t(data[end]))) {
+            end++;
+        }
+        chunks.push_back({data + start, end - start});
+        start = end;
+    }
+}
@@ -9,6 +9,7 @@
 //----------------------------------------------------------------------------
 
 #include "winkeymap.h"
+#include "stats.h"
 
 
 //----------------------------------------------------------------------------
@@ -30,13 +31,23 @@ WinKey::WinKey() :
 
 WinKeyMap::WinKeyMap(const KBDTABLES* tables) :
     _tables(tables),
-    _mods(8, SHFT_INVALID)
+    _planes(8),
+    _mods()
 {
     // Build the conversion table from "modifier number" to modifier masks.
+    // All shift states are used, not only KBDSHIFT, KBDCTRL, KBDALT.
     if (_tables != nullptr && _tables->pCharModifiers != nullptr) {
-        for (size_t i = 0; i <= _tables->pCharModifiers->wMaxModBits; ++i) {
-            if (_tables->pCharModifiers->ModNumber[i] < _mods.size()) {
-                _mods[_tables->pCharModifiers->ModNumber[i]] = i;
+        const MODIFIERS* mods = _tables->pCharModifiers;
+        _planes = std::max<size_t>(_planes, size_t(mods->wMaxModBits) + 1);
+        for (size_t i = 0; i <= mods->wMaxModBits; ++i) {
+            const size_t col = mods->ModNumber[i];
+            if (col != SHFT_INVALID) {
+                if (col >= _mods.size()) {
+                    _mods.resize(col + 1, NO_MODMASK);
+                }
+                if (_mods[col] == NO_MODMASK) {
+                    _mods[col] = i;
+                }
             }
         }
     }
@@ -47,26 +58,23 @@ WinKeyMap::WinKeyMap(const KBDTABLES* tables) :
 // Convert a "modifier number" (index in wch[] of VK_TO_WCHARS)
 //----------------------------------------------------------------------------
 
-size_t WinKeyMap::modNumberToModMask(size_t modnum)
+size_t WinKeyMap::modNumberToModMask(size_t modnum) const
 {
-    return modnum < _mods.size() ? _mods[modnum] : SHFT_INVALID;
+    return modnum < _mods.size() ? _mods[modnum] : NO_MODMASK;
 }
 
 
 //----------------------------------------------------------------------------
-// Get a map of all scan codes in a keymap.
+// Get a multimap of virtual key => scan code.
 //----------------------------------------------------------------------------
 
-void WinKeyMap::buildKeyMap(WinKeyVector& keys)
+void WinKeyMap::buildScanCodeMap(std::multimap<uint16_t, uint16_t>& vk2sc)
 {
-    keys.clear();
-    if (_tables == nullptr || _tables->pVkToWcharTable == nullptr) {
+    // The scan code can have attributes KBDEXT.
+    vk2sc.clear();
+    if (_tables == nullptr) {
         return;
     }
-
-    // Build a multimap of virtual key => scan code.
-    // The scan code can have attributes KBDEXT.
-    std::multimap<uint16_t, uint16_t> vk2sc;
     if (_tables->pusVSCtoVK != nullptr) {
         for (uint16_t i = 0; i < _tables->bMaxVSCtoVK; ++i) {
             if ((_tables->pusVSCtoVK[i] & 0xFF) != VK__none_) {
@@ -76,14 +84,33 @@ void WinKeyMap::buildKeyMap(WinKeyVector& keys)
     }
     if (_tables->pVSCtoVK_E0 != nullptr) {
         for (const VSC_VK* p = _tables->pVSCtoVK_E0; p->Vsc != 0; ++p) {
-            vk2sc.insert(std::make_pair(p->Vk & 0xFF, p->Vsc | (p->Vk & KBDEXT)));
+            vk2sc.insert(std::make_pair(p->Vk & 0xFF, p->Vsc | (p->Vk & KBDEXT) | SC_E0));
         }
     }
     if (_tables->pVSCtoVK_E1 != nullptr) {
         for (const VSC_VK* p = _tables->pVSCtoVK_E1; p->Vsc != 0; ++p) {
-            vk2sc.insert(std::make_pair(p->Vk & 0xFF, p->Vsc | (p->Vk & KBDEXT)));
+            vk2sc.insert(std::make_pair(p->Vk & 0xFF, p->Vsc | (p->Vk & KBDEXT) | SC_E1));
         }
     }
+}
+
+
+//----------------------------------------------------------------------------
+// Get a map of all scan codes in a keymap.
+//----------------------------------------------------------------------------
+
+void WinKeyMap::buildKeyMap(WinKeyVector& keys)
+{
+    Stats::Timer timer("table walk");
+
+    keys.clear();
+    if (_tables == nullptr || _tables->pVkToWcharTable == nullptr) {
+        return;
+    }
+
+    // Build a multimap of virtual key => scan code.
+    std::multimap<uint16_t, uint16_t> vk2sc;
+    buildScanCodeMap(vk2sc);
 
     // Loop on all VK_TO_WCHARS tables.
     for (const VK_TO_WCHAR_TABLE* tab = _tables->pVkToWcharTable; tab->pVkToWchars != nullptr; tab++) {
@@ -112,6 +139,9 @@ void WinKeyMap::buildKeyMap(WinKeyVector& keys)
                     // The virtual key description to update.
                     VirtualKey& vkd(extended ? keys[sc].evk : keys[sc].vk);
                     vkd.vk = vk;
+                    if (vkd.wc.size() < _planes) {
+                        vkd.wc.resize(_planes, L'\0');
+                    }
 
                     // Loop on all modified characters.
                     for (size_t i = 0; i < wch_count; ++i) {
@@ -128,4 +158,135 @@ void WinKeyMap::buildKeyMap(WinKeyVector& keys)
             vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + tab_entry_size);
         }
     }
+    Stats::Instance().allocate("key map", keys.capacity() * sizeof(WinKey));
+    Stats::Instance().count("scan codes", keys.size());
+}
+
+
+//----------------------------------------------------------------------------
+// Iterator over the characters of a keymap.
+//----------------------------------------------------------------------------
+
+WinKeyMap::CharFilter::CharFilter() :
+    modifiers(0xFFFFFFFF),
+    sc_min(0x00),
+    sc_max(0xFF),
+    prefixed(true)
+{
+}
+
+WinKeyMap::CharIterator::CharIterator(const WinKeyMap& map, const CharFilter& filter) :
+    _map(map),
+    _filter(filter),
+    _sc(filter.sc_min),
+    _source(0),
+    _ext(nullptr),
+    _entry(nullptr),
+    _dead(nullptr),
+    _count(0),
+    _col(0),
+    _done(false),
+    _current()
+{
+    if (_map._tables == nullptr || _map._tables->pVkToWcharTable == nullptr) {
+        _done = true;
+    }
+    else {
+        next();
+    }
+}
+
+// Move to next character.
+void WinKeyMap::CharIterator::next()
+{
+    while (!_done) {
+        // Next character of the current virtual key.
+        while (_entry != nullptr && _col < _count) {
+            const size_t col = _col++;
+            const size_t mod = _map.modNumberToModMask(col);
+            if (mod >= 32 || (_filter.modifiers & (uint32_t(1) << mod)) == 0) {
+                continue;
+            }
+            wchar_t wc = _entry->wch[col];
+            const bool dead = wc == WCH_DEAD;
+            if (dead) {
+                // The actual dead key is in the following entry.
+                wc = _dead != nullptr ? _dead->wch[col] : WCH_NONE;
+            }
+            if (wc != 0 && wc != WCH_NONE && wc != WCH_DEAD && wc != WCH_LGTR) {
+                _current.modifier = uint8_t(mod);
+                _current.dead = dead;
+                _current.wc = wc;
+                return;
+            }
+        }
+        // Move to next key.
+        _entry = nullptr;
+        _done = !nextKey();
+    }
+}
+
+// Move to next scan code which has characters. Return false at end of table.
+bool WinKeyMap::CharIterator::nextKey()
+{
+    const KBDTABLES* tables = _map._tables;
+    while (_sc <= _filter.sc_max) {
+        if (_source == 0) {
+            // Scan code without prefix, then scan codes with E0 prefix.
+            _source = 1;
+            _ext = _filter.prefixed ? tables->pVSCtoVK_E0 : nullptr;
+            if (tables->pusVSCtoVK != nullptr && _sc < tables->bMaxVSCtoVK && setKey(tables->pusVSCtoVK[_sc], 0)) {
+                return true;
+            }
+        }
+        else {
+            // Search the next entry with the same scan code in the E0 or E1 table.
+            while (_ext != nullptr && _ext->Vsc != 0 && _ext->Vsc != _sc) {
+                _ext++;
+            }
+            if (_ext != nullptr && _ext->Vsc != 0) {
+                const VSC_VK* entry = _ext++;
+                if (setKey(entry->Vk, _source == 1 ? 0xE0 : 0xE1)) {
+                    return true;
+                }
+            }
+            else if (_source == 1) {
+                _source = 2;
+                _ext = _filter.prefixed ? tables->pVSCtoVK_E1 : nullptr;
+            }
+            else {
+                _source = 0;
+                _sc++;
+            }
+        }
+    }
+    return false;
+}
+
+// Set the current key from its virtual key. Return false if the key has no character.
+bool WinKeyMap::CharIterator::setKey(uint16_t vk, uint8_t prefix)
+{
+    const uint8_t vkey = uint8_t(vk & 0xFF);
+    if (vkey == 0 || vkey == VK__none_) {
+        return false;
+    }
+    // Search the first entry of the virtual key in all VK_TO_WCHARS tables.
+    for (const VK_TO_WCHAR_TABLE* tab = _map._tables->pVkToWcharTable; tab->pVkToWchars != nullptr; tab++) {
+        const VK_TO_WCHARS10* vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(tab->pVkToWchars);
+        for (; vtwc->VirtualKey != 0; vtwc = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + tab->cbSize)) {
+            if (vtwc->VirtualKey == vkey) {
+                const VK_TO_WCHARS10* following = reinterpret_cast<const VK_TO_WCHARS10*>(reinterpret_cast<const char*>(vtwc) + tab->cbSize);
+                _entry = vtwc;
+                _dead = following->VirtualKey == VK__none_ ? following : nullptr;
+                _count = tab->nModifications;
+                _col = 0;
+                _current.sc = uint8_t(_sc);
+                _current.prefix = prefix;
+                _current.extended = (vk & KBDEXT) != 0;
+                _current.vk = vkey;
+                return true;
+            }
+        }
+    }
+    return false;
 }
@@ -17,7 +17,7 @@ class VirtualKey
 public:
     VirtualKey();    // Constructor.
     uint16_t vk;     // Virtual key, without modifier. Zero means unused.
-    WString  wc;     // Unicode characters. Index in string is a bitmask of KBDSHIFT, KBDCTRL, KBDALT. Zero means unused.
+    WString  wc;     // Unicode characters. Index in string is a bitmask of KBDSHIFT, KBDCTRL, KBDALT, KBDKANA, etc. Zero means unused.
 };
 
 // Description of one key
@@ -33,6 +33,19 @@ public:
 // A vector of WinKey. Index in the vector is a scan code.
 typedef std::vector<WinKey> WinKeyVector;
 
+// One character which is produced by a key, see WinKeyMap::characters().
+class KeyChar
+{
+public:
+    uint8_t sc;        // Scan code, without prefix.
+    uint8_t prefix;    // Scan code prefix, 0, 0xE0 or 0xE1.
+    bool    extended;  // The virtual key has the KBDEXT attribute.
+    uint8_t vk;        // Virtual key, without attributes.
+    uint8_t modifier;  // Bitmask of KBDSHIFT, KBDCTRL, KBDALT, etc.
+    bool    dead;      // The character is a dead key.
+    wchar_t wc;        // Unicode character.
+};
+
 // Description of a complete keyboard.
 class WinKeyMap
 {
@@ -40,15 +53,99 @@ public:
     // Constructor.
     WinKeyMap(const KBDTABLES*);
 
-    // Convert a "modifier number" (index in wch[] of VK_TO_WCHARS)
-    // into a bitmak of KBDSHIFT, KBDCTRL, KBDALT (0 to 7).
-    // Return SHFT_INVALID (>7) if the nodifier number is invalid.
-    size_t modNumberToModMask(size_t modnum);
+    // Convert a "modifier number" (index in wch[] of VK_TO_WCHARS) into a bitmask
+    // of KBDSHIFT, KBDCTRL, KBDALT, KBDKANA, etc. (0 to wMaxModBits). When several
+    // bitmasks use the same modifier number, the lowest one is returned.
+    // Return NO_MODMASK (>wMaxModBits) if the modifier number is invalid.
+    static constexpr size_t NO_MODMASK = 0x10000;
+    size_t modNumberToModMask(size_t modnum) const;
+
+    // Number of shift states, wMaxModBits + 1, at least 8. This is the size of VirtualKey::wc in buildKeyMap().
+    size_t planes() const { return _planes; }
 
     // Get a map of all scan codes in a keymap.
     void buildKeyMap(WinKeyVector&);
 
+    // Filter of characters in characters().
+    class CharFilter
+    {
+    public:
+        CharFilter();        // Constructor, select all characters.
+        uint32_t modifiers;  // Bitmask of selected modifier masks, bit N for modifier mask N.
+        uint8_t  sc_min;     // First scan code.
+        uint8_t  sc_max;     // Last scan code.
+        bool     prefixed;   // Include scan codes with E0 or E1 prefix.
+    };
+
+    // Iterator over the characters of a keymap, in order of scan codes.
+    // Nothing is allocated, the characters are read from the KBDTABLES.
+    class CharIterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = KeyChar;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const KeyChar*;
+        using reference = const KeyChar&;
+
+        // End of iteration.
+        class End {};
+
+        const KeyChar& operator*() const { return _current; }
+        const KeyChar* operator->() const { return &_current; }
+        CharIterator& operator++() { next(); return *this; }
+        bool operator==(End) const { return _done; }
+        bool operator!=(End) const { return !_done; }
+
+    private:
+        friend class WinKeyMap;
+        CharIterator(const WinKeyMap& map, const CharFilter& filter);
+
+        const WinKeyMap&      _map;
+        const CharFilter      _filter;
+        unsigned int          _sc;     // Current scan code.
+        int                   _source; // 0: base scan codes, 1: E0 prefix, 2: E1 prefix.
+        const VSC_VK*         _ext;    // Next entry with E0 or E1 prefix.
+        const VK_TO_WCHARS10* _entry;  // Characters of the current virtual key.
+        const VK_TO_WCHARS10* _dead;   // Following entry with dead keys.
+        size_t                _count;  // Number of characters in _entry.
+        size_t                _col;    // Next character in _entry.
+        bool                  _done;
+        KeyChar               _current;
+
+        void next();
+        bool nextKey();
+        bool setKey(uint16_t vk, uint8_t prefix);
+    };
+
+    // A range of characters, for use in range-based for loops.
+    class CharRange
+    {
+    public:
+        CharIterator begin() const { return CharIterator(_map, _filter); }
+        CharIterator::End end() const { return CharIterator::End(); }
+    private:
+        friend class WinKeyMap;
+        CharRange(const WinKeyMap& map, const CharFilter& filter) : _map(map), _filter(filter) {}
+        const WinKeyMap& _map;
+        const CharFilter _filter;
+    };
+
+    // Get all characters of a keymap, in order of scan codes, without building a key map.
+    // Invalid characters (WCH_NONE, WCH_LGTR) are skipped. Dead keys are returned with
+    // their actual character. When a virtual key appears several times in the tables,
+    // only the first one is used, as Windows does.
+    CharRange characters(const CharFilter& filter = CharFilter()) const { return CharRange(*this, filter); }
+
+    // Get a multimap of virtual key => scan code. The scan code value is ored with
+    // the KBDEXT attribute of the virtual key, and SC_E0 or SC_E1 when the scan code
+    // has an E0 or E1 prefix.
+    static constexpr uint16_t SC_E0 = 0x4000;
+    static constexpr uint16_t SC_E1 = 0x8000;
+    void buildScanCodeMap(std::multimap<uint16_t, uint16_t>&);
+
 private:
     const KBDTABLES*    _tables;
+    size_t              _planes; // Number of shift states.
     std::vector<size_t> _mods;   // Modifier masks, indexed by "modifier number".
 };